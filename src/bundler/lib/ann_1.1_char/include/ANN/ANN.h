@@ -702,6 +702,31 @@ const int ANN_N_SHRINK_RULES	= 4;	// number of shrink rules
 //
 //----------------------------------------------------------------------
 
+//----------------------------------------------------------------------
+//	Search context
+//		An ANNsearchContext holds the per-call state of a kd-tree or
+//		bd-tree search: the limit on the number of points to visit
+//		and the number of points actually visited.  A search that is
+//		given its own context uses no global state, so several threads
+//		may search the same tree at once, each with its own context.
+//
+//		The searches that take no context use the limit set by
+//		annMaxPtsVisit() and leave the count in ANNptsVisited.
+//----------------------------------------------------------------------
+
+class DLL_API ANNsearchContext {
+public:
+	ANNsearchContext(					// constructor
+		int				maxPts = 0)		// max. pts to visit (0 = no limit)
+		{
+			maxPtsVisited	= maxPts;
+			ptsVisited		= 0;
+		}
+
+	int				maxPtsVisited;		// max. pts to visit in search
+	int				ptsVisited;			// pts visited in last search
+};
+
 //----------------------------------------------------------------------
 // Some types and objects used by kd-tree functions
 // See src/kd_tree.h and src/kd_tree.cpp for definitions
@@ -759,6 +784,22 @@ public:
 		ANNdistArray	dd,				// dist to near neighbors (modified)
 		double			eps=0.0);		// error bound
 
+	void annkSearch(					// reentrant k near neighbor search
+		ANNpoint		q,				// query point
+		int				k,				// number of near neighbors to return
+		ANNidxArray		nn_idx,			// nearest neighbor array (modified)
+		ANNdistArray	dd,				// dist to near neighbors (modified)
+		double			eps,			// error bound
+		ANNsearchContext &ctx);			// search context (modified)
+
+	void annkPriSearch( 				// reentrant priority search
+		ANNpoint		q,				// query point
+		int				k,				// number of near neighbors to return
+		ANNidxArray		nn_idx,			// nearest neighbor array (modified)
+		ANNdistArray	dd,				// dist to near neighbors (modified)
+		double			eps,			// error bound
+		ANNsearchContext &ctx);			// search context (modified)
+
 	int annkFRSearch(					// approx fixed-radius kNN search
 		ANNpoint		q,				// the query point
 		ANNdist			sqRad,			// squared radius of query ball
@@ -57,10 +57,19 @@ enum ANNerr {ANNwarn = 0, ANNabort = 1};
 //	number of points visited exceeds some threshold.  If the
 //	threshold is 0 (its default)  this means there is no limit
 //	and the algorithm applies its normal termination condition.
+//
+//	These are kept per thread.  They are only used by the searches that
+//	are not given an ANNsearchContext (see ANN.h).
 //----------------------------------------------------------------------
 
-extern int		ANNmaxPtsVisited;	// maximum number of pts visited
-extern int		ANNptsVisited;		// number of pts visited in search
+#if defined(_MSC_VER)
+#define ANN_THREAD_LOCAL __declspec(thread)
+#else
+#define ANN_THREAD_LOCAL __thread
+#endif
+
+extern ANN_THREAD_LOCAL int	ANNmaxPtsVisited;	// maximum number of pts visited
+extern ANN_THREAD_LOCAL int	ANNptsVisited;		// number of pts visited in search
 
 //----------------------------------------------------------------------
 //	Global function declarations
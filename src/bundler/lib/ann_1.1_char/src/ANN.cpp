@@ -188,8 +188,8 @@ void ann_1_1_char::annError(char *msg, ANNerr level)
 //		on the running time of the algorithm.
 //----------------------------------------------------------------------
 
-int	ann_1_1_char::ANNmaxPtsVisited = 0;	// maximum number of pts visited
-int	ann_1_1_char::ANNptsVisited;			// number of pts visited in search
+ANN_THREAD_LOCAL int	ann_1_1_char::ANNmaxPtsVisited = 0;	// maximum number of pts visited
+ANN_THREAD_LOCAL int	ann_1_1_char::ANNptsVisited;		// number of pts visited in search
 
 //----------------------------------------------------------------------
 //	Global function declarations
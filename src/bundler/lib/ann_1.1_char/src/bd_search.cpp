@@ -39,25 +39,26 @@ using namespace ann_1_1_char;
 //	bd_shrink::ann_search - search a shrinking node
 //----------------------------------------------------------------------
 
-void ANNbd_shrink::ann_search(ANNdist box_dist)
+void ANNbd_shrink::ann_search(ANNdist box_dist, ANNkdSearchState &st)
 {
 												// check dist calc term cond.
-	if (ANNmaxPtsVisited != 0 && ANNptsVisited > ANNmaxPtsVisited) return;
+	if (st.ctx->maxPtsVisited != 0 &&
+		st.ctx->ptsVisited > st.ctx->maxPtsVisited) return;
 
 	ANNdist inner_dist = 0;						// distance to inner box
 	for (int i = 0; i < n_bnds; i++) {			// is query point in the box?
-		if (bnds[i].out(ANNkdQ)) {				// outside this bounding side?
+		if (bnds[i].out(st.q)) {				// outside this bounding side?
 												// add to inner distance
-			inner_dist = (ANNdist) ANN_SUM(inner_dist, bnds[i].dist(ANNkdQ));
+			inner_dist = (ANNdist) ANN_SUM(inner_dist, bnds[i].dist(st.q));
 		}
 	}
 	if (inner_dist <= box_dist) {				// if inner box is closer
-		child[ANN_IN]->ann_search(inner_dist);	// search inner child first
-		child[ANN_OUT]->ann_search(box_dist);	// ...then outer child
+		child[ANN_IN]->ann_search(inner_dist, st);	// search inner child first
+		child[ANN_OUT]->ann_search(box_dist, st);	// ...then outer child
 	}
 	else {										// if outer box is closer
-		child[ANN_OUT]->ann_search(box_dist);	// search outer child first
-		child[ANN_IN]->ann_search(inner_dist);	// ...then outer child
+		child[ANN_OUT]->ann_search(box_dist, st);	// search outer child first
+		child[ANN_IN]->ann_search(inner_dist, st);	// ...then outer child
 	}
 	ANN_FLOP(3*n_bnds)							// increment floating ops
 	ANN_SHR(1)									// one more shrinking node
@@ -69,19 +69,12 @@ using namespace ann_1_1_char;
 //----------------------------------------------------------------------
 
 //----------------------------------------------------------------------
-//		To keep argument lists short, a number of global variables
-//		are maintained which are common to all the recursive calls.
-//		These are given below.
+//		To keep argument lists short, the data which are common to all
+//		the recursive calls are kept in an ANNprSearchState, which lives
+//		on the stack of annkPriSearch().  The limit on the number of
+//		points visited comes from the caller's ANNsearchContext.
 //----------------------------------------------------------------------
 
-double			ann_1_1_char::ANNprEps;				// the error bound
-int				ann_1_1_char::ANNprDim;				// dimension of space
-ANNpoint		ann_1_1_char::ANNprQ;					// query point
-double			ann_1_1_char::ANNprMaxErr;			// max tolerable squared error
-ANNpointArray	ann_1_1_char::ANNprPts;				// the points
-ANNpr_queue		*ann_1_1_char::ANNprBoxPQ;			// priority queue for boxes
-ANNmin_k		*ann_1_1_char::ANNprPointMK;			// set of k closest points
-
 //----------------------------------------------------------------------
 //	annkPriSearch - priority search for k nearest neighbors
 //----------------------------------------------------------------------
@@ -91,61 +84,80 @@ void ANNkd_tree::annkPriSearch(
 	int					k,				// number of near neighbors to return
 	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
 	ANNdistArray		dd,				// dist to near neighbors (returned)
-	double				eps)			// error bound (ignored)
+	double				eps,			// error bound (ignored)
+	ANNsearchContext	&ctx)			// search context
 {
+	ANNprSearchState st;
 										// max tolerable squared error
-	ANNprMaxErr = ANN_POW(1.0 + eps);
+	st.maxErr = ANN_POW(1.0 + eps);
 	ANN_FLOP(2)							// increment floating ops
 
-	ANNprDim = dim;						// copy arguments to static equivs
-	ANNprQ = q;
-	ANNprPts = pts;
-	ANNptsVisited = 0;					// initialize count of points visited
+	st.dim = dim;						// copy arguments to search state
+	st.q = q;
+	st.pts = pts;
+	st.ctx = &ctx;
+	ctx.ptsVisited = 0;					// initialize count of points visited
 
-	ANNprPointMK = new ANNmin_k(k);		// create set for closest k points
+	ANNmin_k pointMK(k);				// create set for closest k points
+	st.pointMK = &pointMK;
 
 										// distance to root box
 	ANNdist box_dist = annBoxDistance(q,
 				bnd_box_lo, bnd_box_hi, dim);
 
-	ANNprBoxPQ = new ANNpr_queue(n_pts);// create priority queue for boxes
-	ANNprBoxPQ->insert(box_dist, root); // insert root in priority queue
+	ANNpr_queue boxPQ(n_pts);			// create priority queue for boxes
+	st.boxPQ = &boxPQ;
+	boxPQ.insert(box_dist, root);		// insert root in priority queue
 
-	while (ANNprBoxPQ->non_empty() &&
-		(!(ANNmaxPtsVisited != 0 && ANNptsVisited > ANNmaxPtsVisited))) {
+	while (boxPQ.non_empty() &&
+		(!(ctx.maxPtsVisited != 0 && ctx.ptsVisited > ctx.maxPtsVisited))) {
 		ANNkd_ptr np;					// next box from prior queue
 
 										// extract closest box from queue
-		ANNprBoxPQ->extr_min(box_dist, (void *&) np);
+		boxPQ.extr_min(box_dist, (void *&) np);
 
 		ANN_FLOP(2)						// increment floating ops
-		if (box_dist*ANNprMaxErr >= ANNprPointMK->max_key())
+		if (box_dist*st.maxErr >= pointMK.max_key())
 			break;
 
-		np->ann_pri_search(box_dist);	// search this subtree.
+		np->ann_pri_search(box_dist, st);	// search this subtree.
 	}
 
 	for (int i = 0; i < k; i++) {		// extract the k-th closest points
-		dd[i] = ANNprPointMK->ith_smallest_key(i);
-		nn_idx[i] = ANNprPointMK->ith_smallest_info(i);
+		dd[i] = pointMK.ith_smallest_key(i);
+		nn_idx[i] = pointMK.ith_smallest_info(i);
 	}
+}
+
+//----------------------------------------------------------------------
+//	annkPriSearch - search using the limit set by annMaxPtsVisit()
+//----------------------------------------------------------------------
+
+void ANNkd_tree::annkPriSearch(
+	ANNpoint			q,				// query point
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
+	ANNdistArray		dd,				// dist to near neighbors (returned)
+	double				eps)			// error bound (ignored)
+{
+	ANNsearchContext ctx(ANNmaxPtsVisited);
 
-	delete ANNprPointMK;				// deallocate closest point set
-	delete ANNprBoxPQ;					// deallocate priority queue
+	annkPriSearch(q, k, nn_idx, dd, eps, ctx);
+	ANNptsVisited = ctx.ptsVisited;
 }
 
 //----------------------------------------------------------------------
 //	kd_split::ann_pri_search - search a splitting node
 //----------------------------------------------------------------------
 
-void ANNkd_split::ann_pri_search(ANNdist box_dist)
+void ANNkd_split::ann_pri_search(ANNdist box_dist, ANNprSearchState &st)
 {
 	ANNdist new_dist;					// distance to child visited later
 										// distance to cutting plane
-	ANNdist cut_diff = (ANNdist) ANNprQ[cut_dim] - (ANNdist) cut_val;
+	ANNdist cut_diff = (ANNdist) st.q[cut_dim] - (ANNdist) cut_val;
 
 	if (cut_diff < 0) {					// left of cutting plane
-            ANNdist box_diff = (ANNdist) cd_bnds[ANN_LO] - (ANNdist) ANNprQ[cut_dim];
+            ANNdist box_diff = (ANNdist) cd_bnds[ANN_LO] - (ANNdist) st.q[cut_dim];
 		if (box_diff < 0)				// within bounds - ignore
 			box_diff = 0;
 										// distance to further box
@@ -153,12 +165,12 @@ void ANNkd_split::ann_pri_search(ANNdist box_dist)
 				ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
 
 		if (child[ANN_HI] != KD_TRIVIAL)// enqueue if not trivial
-			ANNprBoxPQ->insert(new_dist, child[ANN_HI]);
+			st.boxPQ->insert(new_dist, child[ANN_HI]);
 										// continue with closer child
-		child[ANN_LO]->ann_pri_search(box_dist);
+		child[ANN_LO]->ann_pri_search(box_dist, st);
 	}
 	else {								// right of cutting plane
-            ANNdist box_diff = (ANNdist) ANNprQ[cut_dim] - (ANNdist) cd_bnds[ANN_HI];
+            ANNdist box_diff = (ANNdist) st.q[cut_dim] - (ANNdist) cd_bnds[ANN_HI];
 		if (box_diff < 0)				// within bounds - ignore
 			box_diff = 0;
 										// distance to further box
@@ -166,9 +178,9 @@ void ANNkd_split::ann_pri_search(ANNdist box_dist)
 				ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
 
 		if (child[ANN_LO] != KD_TRIVIAL)// enqueue if not trivial
-			ANNprBoxPQ->insert(new_dist, child[ANN_LO]);
+			st.boxPQ->insert(new_dist, child[ANN_LO]);
 										// continue with closer child
-		child[ANN_HI]->ann_pri_search(box_dist);
+		child[ANN_HI]->ann_pri_search(box_dist, st);
 	}
 	ANN_SPL(1)							// one more splitting node visited
 	ANN_FLOP(8)							// increment floating ops
@@ -180,7 +192,7 @@ void ANNkd_split::ann_pri_search(ANNdist box_dist)
 //		This is virtually identical to the ann_search for standard search.
 //----------------------------------------------------------------------
 
-void ANNkd_leaf::ann_pri_search(ANNdist box_dist)
+void ANNkd_leaf::ann_pri_search(ANNdist box_dist, ANNprSearchState &st)
 {
 	register ANNdist dist;				// distance to data point
 	register ANNcoord* pp;				// data coordinate pointer
@@ -189,15 +201,15 @@ void ANNkd_leaf::ann_pri_search(ANNdist box_dist)
 	register ANNdist t;
 	register int d;
 
-	min_dist = ANNprPointMK->max_key(); // k-th smallest distance so far
+	min_dist = st.pointMK->max_key(); // k-th smallest distance so far
 
 	for (int i = 0; i < n_pts; i++) {	// check points in bucket
 
-		pp = ANNprPts[bkt[i]];			// first coord of next data point
-		qq = ANNprQ;					// first coord of query point
+		pp = st.pts[bkt[i]];			// first coord of next data point
+		qq = st.q;					// first coord of query point
 		dist = 0;
 
-		for(d = 0; d < ANNprDim; d++) {
+		for(d = 0; d < st.dim; d++) {
 			ANN_COORD(1)				// one more coordinate hit
 			ANN_FLOP(4)					// increment floating ops
 
@@ -208,14 +220,14 @@ void ANNkd_leaf::ann_pri_search(ANNdist box_dist)
 			}
 		}
 
-		if (d >= ANNprDim &&					// among the k best?
+		if (d >= st.dim &&					// among the k best?
 		   (ANN_ALLOW_SELF_MATCH || dist!=0)) { // and no self-match problem
 												// add it to the list
-			ANNprPointMK->insert(dist, bkt[i]);
-			min_dist = ANNprPointMK->max_key();
+			st.pointMK->insert(dist, bkt[i]);
+			min_dist = st.pointMK->max_key();
 		}
 	}
 	ANN_LEAF(1)							// one more leaf node visited
 	ANN_PTS(n_pts)						// increment points visited
-	ANNptsVisited += n_pts;				// increment number of points visited
+	st.ctx->ptsVisited += n_pts;		// increment number of points visited
 }
@@ -36,18 +36,20 @@ namespace ann_1_1_char
 {
 
 //----------------------------------------------------------------------
-//	Global variables
-//		Active for the life of each call to Appx_Near_Neigh() or
-//		Appx_k_Near_Neigh().
+//	Search state
+//		Active for the life of each call to annkPriSearch().  It is
+//		local to the call, so concurrent searches do not interfere.
 //----------------------------------------------------------------------
 
-extern double			ANNprEps;		// the error bound
-extern int				ANNprDim;		// dimension of space
-extern ANNpoint			ANNprQ;			// query point
-extern double			ANNprMaxErr;	// max tolerable squared error
-extern ANNpointArray	ANNprPts;		// the points
-extern ANNpr_queue		*ANNprBoxPQ;	// priority queue for boxes
-extern ANNmin_k			*ANNprPointMK;	// set of k closest points
+struct ANNprSearchState {
+	int					dim;			// dimension of space
+	ANNpoint			q;				// query point
+	double				maxErr;			// max tolerable squared error
+	ANNpointArray		pts;			// the points
+	ANNpr_queue			*boxPQ;			// priority queue for boxes
+	ANNmin_k			*pointMK;		// set of k closest points
+	ANNsearchContext	*ctx;			// caller's search context
+};
     
 }
 
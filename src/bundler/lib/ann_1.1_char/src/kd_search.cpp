@@ -73,17 +73,12 @@ using namespace ann_1_1_char;
 //----------------------------------------------------------------------
 
 //----------------------------------------------------------------------
-//		To keep argument lists short, a number of global variables
-//		are maintained which are common to all the recursive calls.
-//		These are given below.
+//		To keep argument lists short, the data which are common to all
+//		the recursive calls are kept in an ANNkdSearchState, which lives
+//		on the stack of annkSearch().  The limit on the number of points
+//		visited comes from the caller's ANNsearchContext.
 //----------------------------------------------------------------------
 
-int				ann_1_1_char::ANNkdDim;				// dimension of space
-ANNpoint		ann_1_1_char::ANNkdQ;					// query point
-double			ann_1_1_char::ANNkdMaxErr;			// max tolerable squared error
-ANNpointArray	ann_1_1_char::ANNkdPts;				// the points
-ANNmin_k		*ann_1_1_char::ANNkdPointMK;			// set of k closest points
-
 //----------------------------------------------------------------------
 //	annkSearch - search for the k nearest neighbors
 //----------------------------------------------------------------------
@@ -93,48 +88,69 @@ void ANNkd_tree::annkSearch(
 	int					k,				// number of near neighbors to return
 	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
 	ANNdistArray		dd,				// the approximate nearest neighbor
-	double				eps)			// the error bound
+	double				eps,			// the error bound
+	ANNsearchContext	&ctx)			// search context
 {
+	ANNkdSearchState st;
 
-	ANNkdDim = dim;						// copy arguments to static equivs
-	ANNkdQ = q;
-	ANNkdPts = pts;
-	ANNptsVisited = 0;					// initialize count of points visited
+	st.dim = dim;						// copy arguments to search state
+	st.q = q;
+	st.pts = pts;
+	st.ctx = &ctx;
+	ctx.ptsVisited = 0;					// initialize count of points visited
 
 	if (k > n_pts) {					// too many near neighbors?
 		annError("Requesting more near neighbors than data points", ANNabort);
 	}
 
-	ANNkdMaxErr = ANN_POW(1.0 + eps);
+	st.maxErr = ANN_POW(1.0 + eps);
 	ANN_FLOP(2)							// increment floating op count
 
-	ANNkdPointMK = new ANNmin_k(k);		// create set for closest k points
+	ANNmin_k pointMK(k);				// create set for closest k points
+	st.pointMK = &pointMK;
 										// search starting at the root
-	root->ann_search(annBoxDistance(q, bnd_box_lo, bnd_box_hi, dim));
+	root->ann_search(annBoxDistance(q, bnd_box_lo, bnd_box_hi, dim), st);
 
 	for (int i = 0; i < k; i++) {		// extract the k-th closest points
-		dd[i] = ANNkdPointMK->ith_smallest_key(i);
-		nn_idx[i] = ANNkdPointMK->ith_smallest_info(i);
+		dd[i] = pointMK.ith_smallest_key(i);
+		nn_idx[i] = pointMK.ith_smallest_info(i);
 	}
-	delete ANNkdPointMK;				// deallocate closest point set
+}
+
+//----------------------------------------------------------------------
+//	annkSearch - search using the limit set by annMaxPtsVisit()
+//----------------------------------------------------------------------
+
+void ANNkd_tree::annkSearch(
+	ANNpoint			q,				// the query point
+	int					k,				// number of near neighbors to return
+	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
+	ANNdistArray		dd,				// the approximate nearest neighbor
+	double				eps)			// the error bound
+{
+	ANNsearchContext ctx(ANNmaxPtsVisited);
+
+	annkSearch(q, k, nn_idx, dd, eps, ctx);
+	ANNptsVisited = ctx.ptsVisited;
 }
 
 //----------------------------------------------------------------------
 //	kd_split::ann_search - search a splitting node
 //----------------------------------------------------------------------
 
-void ANNkd_split::ann_search(ANNdist box_dist)
+void ANNkd_split::ann_search(ANNdist box_dist, ANNkdSearchState &st)
 {
 										// check dist calc term condition
-	if (ANNmaxPtsVisited != 0 && ANNptsVisited > ANNmaxPtsVisited) return;
+	if (st.ctx->maxPtsVisited != 0 &&
+		st.ctx->ptsVisited > st.ctx->maxPtsVisited) return;
 
 										// distance to cutting plane
-	ANNdist cut_diff = (ANNdist) ANNkdQ[cut_dim] - (ANNdist) cut_val;
+	ANNdist cut_diff = (ANNdist) st.q[cut_dim] - (ANNdist) cut_val;
 
 	if (cut_diff < 0) {					// left of cutting plane
-		child[ANN_LO]->ann_search(box_dist);// visit closer child first
+		child[ANN_LO]->ann_search(box_dist, st);// visit closer child first
 
-		ANNdist box_diff = (ANNdist) cd_bnds[ANN_LO] - (ANNdist) ANNkdQ[cut_dim];
+		ANNdist box_diff = (ANNdist) cd_bnds[ANN_LO] - (ANNdist) st.q[cut_dim];
 		if (box_diff < 0)				// within bounds - ignore
 			box_diff = 0;
 										// distance to further box
@@ -142,14 +158,14 @@ void ANNkd_split::ann_search(ANNdist box_dist)
 				ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
 
 										// visit further child if close enough
-		if (box_dist * ANNkdMaxErr < ANNkdPointMK->max_key())
-			child[ANN_HI]->ann_search(box_dist);
+		if (box_dist * st.maxErr < st.pointMK->max_key())
+			child[ANN_HI]->ann_search(box_dist, st);
 
 	}
 	else {								// right of cutting plane
-		child[ANN_HI]->ann_search(box_dist);// visit closer child first
+		child[ANN_HI]->ann_search(box_dist, st);// visit closer child first
 
-		ANNdist box_diff = (ANNdist) ANNkdQ[cut_dim] - (ANNdist) cd_bnds[ANN_HI];
+		ANNdist box_diff = (ANNdist) st.q[cut_dim] - (ANNdist) cd_bnds[ANN_HI];
 		if (box_diff < 0)				// within bounds - ignore
 			box_diff = 0;
 										// distance to further box
@@ -157,8 +173,8 @@ void ANNkd_split::ann_search(ANNdist box_dist)
 				ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
 
 										// visit further child if close enough
-		if (box_dist * ANNkdMaxErr < ANNkdPointMK->max_key())
-			child[ANN_LO]->ann_search(box_dist);
+		if (box_dist * st.maxErr < st.pointMK->max_key())
+			child[ANN_LO]->ann_search(box_dist, st);
 
 	}
 	ANN_FLOP(10)						// increment floating ops
@@ -171,7 +187,7 @@ void ANNkd_split::ann_search(ANNdist box_dist)
 //		some fine tuning to replace indexing by pointer operations.
 //----------------------------------------------------------------------
 
-void ANNkd_leaf::ann_search(ANNdist box_dist)
+void ANNkd_leaf::ann_search(ANNdist box_dist, ANNkdSearchState &st)
 {
 	register ANNdist dist;				// distance to data point
 	register ANNcoord* pp;				// data coordinate pointer
@@ -180,15 +196,15 @@ void ANNkd_leaf::ann_search(ANNdist box_dist)
 	register ANNdist t;
 	register int d;
 
-	min_dist = ANNkdPointMK->max_key(); // k-th smallest distance so far
+	min_dist = st.pointMK->max_key(); // k-th smallest distance so far
 
 	for (int i = 0; i < n_pts; i++) {	// check points in bucket
 
-		pp = ANNkdPts[bkt[i]];			// first coord of next data point
-		qq = ANNkdQ;					// first coord of query point
+		pp = st.pts[bkt[i]];			// first coord of next data point
+		qq = st.q;					// first coord of query point
 		dist = 0;
 
-		for(d = 0; d < ANNkdDim; d++) {
+		for(d = 0; d < st.dim; d++) {
 			ANN_COORD(1)				// one more coordinate hit
 			ANN_FLOP(4)					// increment floating ops
 
@@ -199,14 +215,14 @@ void ANNkd_leaf::ann_search(ANNdist box_dist)
 			}
 		}
 
-		if (d >= ANNkdDim &&					// among the k best?
+		if (d >= st.dim &&					// among the k best?
 		   (ANN_ALLOW_SELF_MATCH || dist!=0)) { // and no self-match problem
 												// add it to the list
-			ANNkdPointMK->insert(dist, bkt[i]);
-			min_dist = ANNkdPointMK->max_key();
+			st.pointMK->insert(dist, bkt[i]);
+			min_dist = st.pointMK->max_key();
 		}
 	}
 	ANN_LEAF(1)							// one more leaf node visited
 	ANN_PTS(n_pts)						// increment points visited
-	ANNptsVisited += n_pts;				// increment number of points visited
+	st.ctx->ptsVisited += n_pts;		// increment number of points visited
 }
@@ -32,21 +32,24 @@
 #include <ANN/ANNperf.h>				// performance evaluation
 
 //----------------------------------------------------------------------
-//	More global variables
-//		These are active for the life of each call to annkSearch(). They
-//		are set to save the number of variables that need to be passed
-//		among the various search procedures.
+//	Search state
+//		This is active for the life of each call to annkSearch().  It
+//		is passed down the recursive search procedures to save the
+//		number of arguments they need, and is local to the call, so
+//		concurrent searches do not interfere.
 //----------------------------------------------------------------------
 
 namespace ann_1_1_char
 {    
 
-extern int				ANNkdDim;		// dimension of space (static copy)
-extern ANNpoint			ANNkdQ;			// query point (static copy)
-extern double			ANNkdMaxErr;	// max tolerable squared error
-extern ANNpointArray	ANNkdPts;		// the points (static copy)
-extern ANNmin_k			*ANNkdPointMK;	// set of k closest points
-extern int				ANNptsVisited;	// number of points visited
+struct ANNkdSearchState {
+	int					dim;			// dimension of space
+	ANNpoint			q;				// query point
+	double				maxErr;			// max tolerable squared error
+	ANNpointArray		pts;			// the points
+	ANNmin_k			*pointMK;		// set of k closest points
+	ANNsearchContext	*ctx;			// caller's search context
+};
     
 }
 
@@ -33,6 +33,9 @@ using namespace std;					// make std:: available
 
 namespace ann_1_1_char {
 
+struct ANNkdSearchState;				// state of a standard search
+struct ANNprSearchState;				// state of a priority search
+
 //----------------------------------------------------------------------
 //	Generic kd-tree node
 //
@@ -49,8 +52,10 @@ class ANNkd_node{						// generic kd-tree node (empty shell)
 public:
 	virtual ~ANNkd_node() {}					// virtual distroyer
 
-	virtual void ann_search(ANNdist) = 0;		// tree search
-	virtual void ann_pri_search(ANNdist) = 0;	// priority search
+	virtual void ann_search(					// tree search
+				ANNdist, ANNkdSearchState &) = 0;
+	virtual void ann_pri_search(				// priority search
+				ANNdist, ANNprSearchState &) = 0;
 	virtual void ann_FR_search(ANNdist) = 0;	// fixed-radius search
 
 	virtual void getStats(						// get tree statistics
@@ -112,8 +117,10 @@ public:
 	virtual void print(int level, ostream &out);// print node
 	virtual void dump(ostream &out);			// dump node
 
-	virtual void ann_search(ANNdist);			// standard search
-	virtual void ann_pri_search(ANNdist);		// priority search
+	virtual void ann_search(					// standard search
+				ANNdist, ANNkdSearchState &);
+	virtual void ann_pri_search(				// priority search
+				ANNdist, ANNprSearchState &);
 	virtual void ann_FR_search(ANNdist);		// fixed-radius search
 };
 
@@ -178,8 +185,10 @@ public:
 	virtual void print(int level, ostream &out);// print node
 	virtual void dump(ostream &out);			// dump node
 
-	virtual void ann_search(ANNdist);			// standard search
-	virtual void ann_pri_search(ANNdist);		// priority search
+	virtual void ann_search(					// standard search
+				ANNdist, ANNkdSearchState &);
+	virtual void ann_pri_search(				// priority search
+				ANNdist, ANNprSearchState &);
 	virtual void ann_FR_search(ANNdist);		// fixed-radius search
 };
 
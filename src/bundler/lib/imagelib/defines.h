@@ -39,6 +39,16 @@
 
 #define SGN(x) ((x) < 0 ? (-1) : (1))
 
+/* Storage class of file-scope state that each thread needs its own
+ * copy of, such as the data read by minimization callbacks */
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__) || defined(__INTEL_COMPILER)
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
 #ifdef WIN32
 #ifndef M_PI
 #define M_PI 3.14159265358979323846f
@@ -22,12 +22,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "defines.h"
 #include "matrix.h"
 #include "triangulate.h"
 #include "vector.h"
 
-static v2_t global_p, global_q;
-static double *global_R0, *global_t0, *global_R1, *global_t1;
+/* The data of the minimization callbacks below is kept per thread, so
+ * that different threads can triangulate points and estimate poses */
+static THREAD_LOCAL v2_t global_p, global_q;
+static THREAD_LOCAL double *global_R0, *global_t0, *global_R1, *global_t1;
 
 void quick_svd(double *E, double *U, double *S, double *VT) {
     double e1[3] = { E[0], E[3], E[6] };
@@ -106,10 +109,10 @@ void triangulation_residual(const int *m, const int *n, double *x,
     fvec[3] = Vy(global_q) - Vy(q);
 }
 
-static int global_num_points;
-static double *global_Rs = NULL;
-static double *global_ts = NULL;
-static v2_t *global_ps;
+static THREAD_LOCAL int global_num_points;
+static THREAD_LOCAL double *global_Rs = NULL;
+static THREAD_LOCAL double *global_ts = NULL;
+static THREAD_LOCAL v2_t *global_ps;
 
 void triangulate_n_residual(const int *m, const int *n, 
 			    double *x, double *fvec, double *iflag) 
@@ -858,9 +861,9 @@ int find_projection_3x4(int num_pts, v3_t *points, v2_t *projs, double *P) {
     }
 }
 
-static int global_num_pts;
-static v3_t *global_points;
-static v2_t *global_projs;
+static THREAD_LOCAL int global_num_pts;
+static THREAD_LOCAL v3_t *global_points;
+static THREAD_LOCAL v2_t *global_projs;
 
 static void projection_residual(const int *m, const int *n, double *x, 
 				double *fvec, double *iflag) 
@@ -920,11 +923,36 @@ int find_projection_3x4_nonlinear(int num_pts, v3_t *points, v2_t *projs,
 }
 
 
+/* Draw a random number in [0, 2^30) from the generator state *seed */
+static int rand_seed(unsigned int *seed) 
+{
+    unsigned int hi, lo;
+
+    *seed = *seed * 1103515245u + 12345u;
+    hi = (*seed >> 16) & 0x7fff;
+    *seed = *seed * 1103515245u + 12345u;
+    lo = (*seed >> 16) & 0x7fff;
+
+    return (int) ((hi << 15) | lo);
+}
+
 /* Solve for a 3x4 projection matrix using RANSAC, given a set of 3D
  * points and 2D projections */
 int find_projection_3x4_ransac(int num_pts, v3_t *points, v2_t *projs, 
 			       double *P, 
 			       int ransac_rounds, double ransac_threshold) 
+{
+    return find_projection_3x4_ransac_r(num_pts, points, projs, P, 
+                                        ransac_rounds, ransac_threshold, 
+                                        NULL);
+}
+
+/* Same as above, but if seed is not NULL the samples are drawn from
+ * the generator state *seed instead of rand() */
+int find_projection_3x4_ransac_r(int num_pts, v3_t *points, v2_t *projs, 
+                                 double *P, 
+                                 int ransac_rounds, double ransac_threshold,
+                                 unsigned int *seed) 
 {
     if (num_pts < 6) {
 	printf("[find_projection_3x4_ransac] Error: need at least 6 points!\n");
@@ -969,7 +997,7 @@ int find_projection_3x4_ransac(int num_pts, v3_t *points, v2_t *projs,
                         return -1;
                     }
 
-		    idx = rand() % num_pts;
+		    idx = (seed != NULL ? rand_seed(seed) : rand()) % num_pts;
 		    
 		    redo = 0;
 		    for (j = 0; j < i; j++) {
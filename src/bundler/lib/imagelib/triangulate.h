@@ -64,6 +64,14 @@ int find_projection_3x4(int num_pts, v3_t *points, v2_t *projs, double *P);
 int find_projection_3x4_ransac(int num_pts, v3_t *points, v2_t *projs, 
 			       double *P,
 			       int ransac_rounds, double ransac_threshold);
+
+/* Same as above, but if seed is not NULL the samples are drawn from
+ * the generator state *seed instead of rand().  With its own seed,
+ * each thread gets the same result whatever the others do */
+int find_projection_3x4_ransac_r(int num_pts, v3_t *points, v2_t *projs, 
+                                 double *P,
+                                 int ransac_rounds, double ransac_threshold,
+                                 unsigned int *seed);
     
 #ifdef __cplusplus
 }
@@ -39,4 +39,17 @@
 #define SBA_FINITE finite // other than MSVC, ICC, GCC, let's hope this will work
 #endif 
 
+/* thread local storage for the work buffers that the LAPACK wrappers retain
+ * between calls, so that different threads can run bundle adjustments
+ */
+#ifdef _MSC_VER
+#define SBA_THREAD_LOCAL __declspec(thread) // MSVC
+#define SBA_HAVE_THREAD_LOCAL
+#elif defined(__ICC) || defined(__INTEL_COMPILER) || defined(__GNUC__)
+#define SBA_THREAD_LOCAL __thread // ICC, GCC
+#define SBA_HAVE_THREAD_LOCAL
+#else
+#define SBA_THREAD_LOCAL // other than MSVC, ICC, GCC: buffers are shared by all threads
+#endif
+
 #endif /* _COMPILER_H_ */
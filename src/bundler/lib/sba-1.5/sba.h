@@ -43,6 +43,20 @@
 /*#define SBA_DESTROY_COVS */
 
 
+/* the reduced camera system of sba_motstr_levmar_x() is solved as a block sparse
+ * matrix (see sba_schur.c) if its Cholesky factor has at most this fraction of the
+ * blocks of a dense one; denser systems are solved with LAPACK
+ */
+#define SBA_SCHUR_MAX_FILL 0.5
+
+
+/* define the following to solve the block sparse reduced camera system with
+ * block Jacobi preconditioned conjugate gradients instead of a sparse Cholesky
+ * factorization. CG needs no memory for fill-in, but its solutions are approximate
+ */
+/*#define SBA_SCHUR_PCG */
+
+
 /********* End of configuration options, no changes necessary beyond this point *********/
 
 #ifdef __cplusplus
@@ -77,6 +91,33 @@ struct sba_crsm{
                    */
 };
 
+/* Block sparse storage of the reduced camera matrix S of sba_motstr_levmar_x(),
+ * which is also used for its Cholesky factor. Blocks are cnp x cnp, row major.
+ * See sba_schur.c
+ */
+struct sba_schur{
+    int nb;       /* number of block rows & columns, i.e. cameras that are not fixed */
+    int bsz;      /* block size, i.e. cnp */
+    int mcon;     /* number of fixed cameras; camera j is block j-mcon of S */
+    int nnzb;     /* number of nonzero blocks in the lower triangle */
+    int *perm;    /* position of each camera block in the factor. size: nb */
+    int *colptr;  /* blocks of column c are colptr[c]...colptr[c+1]-1, the diagonal
+                   * one first. size: nb+1 */
+    int *rowidx;  /* block row of each block, increasing within a column. size: nnzb */
+    double *val;  /* the blocks. size: nnzb*bsz*bsz */
+    int *sptr, *sidx, *sblk; /* the upper triangle of S in camera order: the blocks S_jk, k>=j,
+                   * are sidx[sptr[j]...sptr[j+1]-1] and stored in blocks sblk[] of val, */
+    char *strans; /* as S_kj if strans[] is set */
+    int *cptr, *cpts, *cvis; /* the points seen by camera j are cpts[cptr[j]...cptr[j+1]-1]
+                   * in increasing order; cvis[] are their indices in the visibility matrix */
+    int pnp;      /* number of point parameters */
+    int nthreads; /* number of threads building S */
+    int maxpts;   /* max. number of points seen by a camera */
+    int *map;     /* work arrays of the threads, size nthreads*nb */
+    double *Yj;   /* work arrays of the threads for the Y_ij of a camera, size nthreads*maxpts*bsz*pnp */
+    double *work; /* work array for the solvers */
+};
+
 typedef struct {
     char *constrained;
     double *constraints;
@@ -93,7 +134,7 @@ typedef struct {
 
 /* simple drivers */
 extern int
-sba_motstr_levmar(const int n, const int m, const int mcon, char *vmask, 
+sba_motstr_levmar(const int n, const int m, const int mcon, struct sba_crsm *vis, 
                   double *p, const int cnp, const int pnp, 
                   double *x, double *covx, const int mnp,
                   void (*proj)(int j, int i, double *aj, double *bi, 
@@ -105,17 +146,18 @@ sba_motstr_levmar(const int n, const int m, const int mcon, char *vmask,
                   int use_constraints, camera_constraints_t *constraints, 
                   int use_point_constraints, 
                   point_constraints_t *point_constraints, 
-                  double *Vout, double *Sout, double *Uout, double *Wout);
+                  double *Vout, double *Sout, double *Uout, double *Wout,
+                  const int nthreads);
 
 extern int
-sba_mot_levmar(const int n, const int m, const int mcon, char *vmask, double *p, const int cnp,
+sba_mot_levmar(const int n, const int m, const int mcon, struct sba_crsm *vis, double *p, const int cnp,
            double *x, double *covx, const int mnp,
            void (*proj)(int j, int i, double *aj, double *xij, void *adata),
            void (*projac)(int j, int i, double *aj, double *Aij, void *adata),
                void *adata, const int itmax, const int verbose, const double opts[SBA_OPTSSZ], double info[SBA_INFOSZ], int use_constraints, camera_constraints_t *constraints  /* Constraints on camera parameters */);
 
 extern int
-sba_str_levmar(const int n, const int m, char *vmask, double *p, const int pnp,
+sba_str_levmar(const int n, const int m, struct sba_crsm *vis, double *p, const int pnp,
            double *x, double *covx, const int mnp,
            void (*proj)(int j, int i, double *bi, double *xij, void *adata),
            void (*projac)(int j, int i, double *bi, double *Bij, void *adata),
@@ -124,7 +166,7 @@ sba_str_levmar(const int n, const int m, char *vmask, double *p, const int pnp,
 
 /* expert drivers */
 extern int
-sba_motstr_levmar_x(const int n, const int m, const int mcon, char *vmask, double *p, const int cnp, const int pnp,
+sba_motstr_levmar_x(const int n, const int m, const int mcon, struct sba_crsm *vis, double *p, const int cnp, const int pnp,
            double *x, double *covx, const int mnp,
            void (*func)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *hx, void *adata),
            void (*fjac)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *jac, void *adata),
@@ -135,17 +177,18 @@ sba_motstr_levmar_x(const int n, const int m, const int mcon, char *vmask, doubl
 		    point_constraints_t *point_constraints
 		    /* Constraints on camera parameters */,
                     double *Vout, double *Sout /* size cnp * cnp * m*m */,
-                    double *Uout, double *Wout /* size pnp * cnp * m*n */);
+                    double *Uout, double *Wout /* size pnp * cnp * m*n */,
+                    const int nthreads);
 
 extern int
-sba_mot_levmar_x(const int n, const int m, const int mcon, char *vmask, double *p, const int cnp,
+sba_mot_levmar_x(const int n, const int m, const int mcon, struct sba_crsm *vis, double *p, const int cnp,
            double *x, double *covx, const int mnp,
            void (*func)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *hx, void *adata),
            void (*fjac)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *jac, void *adata),
                  void *adata, const int itmax, const int verbose, const double opts[SBA_OPTSSZ], double info[SBA_INFOSZ], int use_constraints, camera_constraints_t *constraints  /* Constraints on camera parameters */);
 
 extern int
-sba_str_levmar_x(const int n, const int m, char *vmask, double *p, const int pnp,
+sba_str_levmar_x(const int n, const int m, struct sba_crsm *vis, double *p, const int pnp,
            double *x, double *covx, const int mnp,
            void (*func)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *hx, void *adata),
            void (*fjac)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *jac, void *adata),
@@ -172,8 +215,23 @@ extern int sba_crsm_elmidx(struct sba_crsm *sm, int i, int j);
 extern int sba_crsm_elmidxp(struct sba_crsm *sm, int i, int j, int jp, int jpidx);
 extern int sba_crsm_row_elmidxs(struct sba_crsm *sm, int i, int *vidxs, int *jidxs);
 extern int sba_crsm_col_elmidxs(struct sba_crsm *sm, int j, int *vidxs, int *iidxs);
+extern void sba_vmask2crsm(char *vmask, int n, int m, struct sba_crsm *vis);
 /* extern int sba_crsm_common_row(struct sba_crsm *sm, int j, int k); */
 
+/* block sparse reduced camera system */
+extern int sba_schur_alloc(struct sba_schur *sc, struct sba_crsm *idxij, int mcon, int cnp, int pnp,
+                           int nthreads);
+extern void sba_schur_free(struct sba_schur *sc);
+extern void sba_schur_build(struct sba_schur *sc, struct sba_crsm *idxij,
+                            double *U, double *V, double *W, double *ea, double *eb, double *E);
+extern int sba_schur_solve(struct sba_schur *sc, double *E, double *da);
+
+/* parallel loops */
+extern void sba_parallel_for(int nthreads, int n, int chunk,
+                             void (*body)(int first, int last, int thread, void *data), void *data);
+extern int sba_pool_start(int nthreads);
+extern void sba_pool_stop(void);
+
 #ifdef __cplusplus
 }
 #endif
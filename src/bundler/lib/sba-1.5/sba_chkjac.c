@@ -228,12 +228,12 @@ void sba_str_chkjac_x(
   sba_motstr_chkjac_x(func, jacf, p, idxij, rcidxs, rcsubs, 0, 0, pnp, mnp, func_adata, jac_adata);
 }
 
-#if 0
-/* Routines for directly checking the jacobians supplied to the simple drivers.
- * They shouldn't be necessary since these jacobians can be verified indirectly
+/* Routines for directly checking the jacobians supplied to the simple drivers,
+ * one projection at a time. The jacobians can also be verified indirectly
  * through the expert sba_XXX_chkjac_x() routines.
  */
 
+#if 0
 /*****************************************************************************************/
 // Sample code for using sba_motstr_chkjac():
 
@@ -246,6 +246,7 @@ void sba_str_chkjac_x(
 
 
 /*****************************************************************************************/
+#endif /* 0 */
 
 
 /* union used for passing pointers to the user-supplied functions for the motstr/mot/str simple drivers */
@@ -270,7 +271,8 @@ union proj_projac{
 /* 
  * Check the jacobian of a projection function in cnp+pnp variables
  * evaluated at a point p, for consistency with the function itself.
- * Simple version of the above, NOT to be called directly
+ * Simple version of the above, NOT to be called directly.
+ * Returns the number of suspicious gradients
  *
  * Based on fortran77 subroutine CHKDER by
  * Burton S. Garbow, Kenneth E. Hillstrom, Jorge J. More
@@ -311,7 +313,7 @@ union proj_projac{
  *     other value which may cause loss of significance."
  */
 
-static void sba_chkjac(
+static int sba_chkjac(
     union proj_projac *funcs, double *aj, double *bi, int jj, int ii, int cnp, int pnp, int mnp, void *func_adata, void *jac_adata)
 {
 const double factor=100.0, one=1.0, zero=0.0;
@@ -416,10 +418,10 @@ int fvec_sz, ajp_sz, bip_sz, fvecp_sz, err_sz, numerr=0;
   free(fjac);
   free(buf);
 
-  return;
+  return numerr;
 }
 
-void sba_motstr_chkjac(
+int sba_motstr_chkjac(
     void (*proj)(int jj, int ii, double *aj, double *bi, double *xij, void *adata),
     void (*projac)(int jj, int ii, double *aj, double *bi, double *Aij, double *Bij, void *adata),
     double *aj, double *bi, int jj, int ii, int cnp, int pnp, int mnp, void *func_adata, void *jac_adata)
@@ -429,10 +431,10 @@ union proj_projac funcs;
   funcs.motstr.proj=proj;
   funcs.motstr.projac=projac;
 
-  sba_chkjac(&funcs, aj, bi, jj, ii, cnp, pnp, mnp, func_adata, jac_adata);
+  return sba_chkjac(&funcs, aj, bi, jj, ii, cnp, pnp, mnp, func_adata, jac_adata);
 }
 
-void sba_mot_chkjac(
+int sba_mot_chkjac(
     void (*proj)(int jj, int ii, double *aj, double *xij, void *adata),
     void (*projac)(int jj, int ii, double *aj, double *Aij, void *adata),
     double *aj, double *bi, int jj, int ii, int cnp, int pnp, int mnp, void *func_adata, void *jac_adata)
@@ -442,10 +444,10 @@ union proj_projac funcs;
   funcs.mot.proj=proj;
   funcs.mot.projac=projac;
 
-  sba_chkjac(&funcs, aj, NULL, jj, ii, cnp, 0, mnp, func_adata, jac_adata);
+  return sba_chkjac(&funcs, aj, NULL, jj, ii, cnp, 0, mnp, func_adata, jac_adata);
 }
 
-void sba_str_chkjac(
+int sba_str_chkjac(
     void (*proj)(int jj, int ii, double *bi, double *xij, void *adata),
     void (*projac)(int jj, int ii, double *bi, double *Bij, void *adata),
     double *aj, double *bi, int jj, int ii, int cnp, int pnp, int mnp, void *func_adata, void *jac_adata)
@@ -455,6 +457,5 @@ union proj_projac funcs;
   funcs.str.proj=proj;
   funcs.str.projac=projac;
 
-  sba_chkjac(&funcs, NULL, bi, jj, ii, 0, pnp, mnp, func_adata, jac_adata);
+  return sba_chkjac(&funcs, NULL, bi, jj, ii, 0, pnp, mnp, func_adata, jac_adata);
 }
-#endif /* 0 */
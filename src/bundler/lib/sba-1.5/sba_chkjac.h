@@ -25,23 +25,21 @@
 extern "C" {
 #endif
 
-#if 0
 /* simple driver jacobians */
-extern void sba_motstr_chkjac(
+extern int sba_motstr_chkjac(
       void (*proj)(int jj, int ii, double *aj, double *bi, double *xij, void *adata),
       void (*projac)(int jj, int ii, double *aj, double *bi, double *Aij, double *Bij, void *adata),
       double *aj, double *bi, int jj, int ii, int cnp, int pnp, int mnp, void *func_adata, void *jac_adata);
 
-extern void sba_mot_chkjac(
+extern int sba_mot_chkjac(
       void (*proj)(int jj, int ii, double *aj, double *xij, void *adata),
       void (*projac)(int jj, int ii, double *aj, double *Aij, void *adata),
       double *aj, double *bi, int jj, int ii, int cnp, int pnp, int mnp, void *func_adata, void *jac_adata);
 
-extern void sba_str_chkjac(
+extern int sba_str_chkjac(
       void (*proj)(int jj, int ii, double *bi, double *xij, void *adata),
       void (*projac)(int jj, int ii, double *bi, double *Bij, void *adata),
       double *aj, double *bi, int jj, int ii, int cnp, int pnp, int mnp, void *func_adata, void *jac_adata);
-#endif /* 0 */
 
 /* expert driver jacobians */
 extern void sba_motstr_chkjac_x(
@@ -51,6 +51,30 @@ void sba_crsm_free(struct sba_crsm *sm)
   sm->val=sm->colidx=sm->rowptr=NULL;
 }
 
+/* build the sparse visibility structure expected by the sba_XXX_levmar routines
+ * from a dense nxm visibility mask, for callers that still keep one around
+ */
+void sba_vmask2crsm(char *vmask, int n, int m, struct sba_crsm *vis)
+{
+int nnz;
+register int i, j, k;
+
+  for(i=nnz=0; i<n*m; ++i)
+    nnz+=(vmask[i]!=0);
+
+  sba_crsm_alloc(vis, n, m, nnz);
+
+  for(i=k=0; i<n; ++i){
+    vis->rowptr[i]=k;
+    for(j=0; j<m; ++j)
+      if(vmask[i*m+j]){
+        vis->val[k]=k;
+        vis->colidx[k++]=j;
+      }
+  }
+  vis->rowptr[n]=nnz;
+}
+
 static void sba_crsm_print(struct sba_crsm *sm, FILE *fp)
 {
 register int i;
@@ -92,8 +92,8 @@ extern int F77_FUNC(dsytri)(char *uplo, int *n, double *a, int *lda, int *ipiv,
  */
 int sba_Axb_QR(double *A, double *B, double *x, int m, int iscolmaj)
 {
-static double *buf=NULL;
-static int buf_sz=0, nb=0;
+static SBA_THREAD_LOCAL double *buf=NULL;
+static SBA_THREAD_LOCAL int buf_sz=0, nb=0;
 
 double *a, *qtb, *r, *tau, *work;
 int a_sz, qtb_sz, r_sz, tau_sz, tot_sz;
@@ -234,8 +234,8 @@ register double sum;
  */
 int sba_Axb_QRnoQ(double *A, double *B, double *x, int m, int iscolmaj)
 {
-static double *buf=NULL;
-static int buf_sz=0, nb=0;
+static SBA_THREAD_LOCAL double *buf=NULL;
+static SBA_THREAD_LOCAL int buf_sz=0, nb=0;
 
 double *a, *atb, *tau, *work;
 int a_sz, atb_sz, tau_sz, tot_sz;
@@ -373,8 +373,8 @@ register double sum;
  */
 int sba_Axb_Chol(double *A, double *B, double *x, int m, int iscolmaj)
 {
-static double *buf=NULL;
-static int buf_sz=0;
+static SBA_THREAD_LOCAL double *buf=NULL;
+static SBA_THREAD_LOCAL int buf_sz=0;
 
 double *a, *b;
 int a_sz, b_sz, tot_sz;
@@ -506,8 +506,8 @@ int info, nrhs=1;
  */
 int sba_Axb_LU(double *A, double *B, double *x, int m, int iscolmaj)
 {
-static double *buf=NULL;
-static int buf_sz=0;
+static SBA_THREAD_LOCAL double *buf=NULL;
+static SBA_THREAD_LOCAL int buf_sz=0;
 
 int a_sz, ipiv_sz, b_sz, tot_sz;
 register int i, j;
@@ -612,9 +612,9 @@ double *a, *b;
  */
 int sba_Axb_SVD(double *A, double *B, double *x, int m, int iscolmaj)
 {
-static double *buf=NULL;
-static int buf_sz=0;
-static double eps=-1.0;
+static SBA_THREAD_LOCAL double *buf=NULL;
+static SBA_THREAD_LOCAL int buf_sz=0;
+static SBA_THREAD_LOCAL double eps=-1.0;
 
 register int i, j;
 double *a, *u, *s, *vt, *work;
@@ -747,8 +747,8 @@ int info, rank, worksz, *iwork, iworksz;
  */
 int sba_Axb_BK(double *A, double *B, double *x, int m, int iscolmaj)
 {
-static double *buf=NULL;
-static int buf_sz=0, nb=0;
+static SBA_THREAD_LOCAL double *buf=NULL;
+static SBA_THREAD_LOCAL int buf_sz=0, nb=0;
 
 int a_sz, ipiv_sz, b_sz, work_sz, tot_sz;
 register int i, j;
@@ -862,8 +862,8 @@ double *a, *b, *work;
  */
 int sba_symat_invert_LU(double *A, int m)
 {
-static double *buf=NULL;
-static int buf_sz=0, nb=0;
+static SBA_THREAD_LOCAL double *buf=NULL;
+static SBA_THREAD_LOCAL int buf_sz=0, nb=0;
 
 int a_sz, ipiv_sz, work_sz, tot_sz;
 register int i, j;
@@ -964,8 +964,8 @@ double *a, *work;
  */
 int sba_symat_invert_Chol(double *A, int m)
 {
-static double *buf=NULL;
-static int buf_sz=0;
+static SBA_THREAD_LOCAL double *buf=NULL;
+static SBA_THREAD_LOCAL int buf_sz=0;
 
 int a_sz, tot_sz;
 register int i, j;
@@ -1052,8 +1052,8 @@ double *a;
  */
 int sba_symat_invert_BK(double *A, int m)
 {
-static double *buf=NULL;
-static int buf_sz=0, nb=0;
+static SBA_THREAD_LOCAL double *buf=NULL;
+static SBA_THREAD_LOCAL int buf_sz=0, nb=0;
 
 int a_sz, ipiv_sz, work_sz, tot_sz;
 register int i, j;
@@ -1269,8 +1269,8 @@ int blockn;
  */
 int sba_Axb_CG(double *A, double *B, double *x, int m, int niter, double eps, int prec, int iscolmaj)
 {
-static double *buf=NULL;
-static int buf_sz=0;
+static SBA_THREAD_LOCAL double *buf=NULL;
+static SBA_THREAD_LOCAL int buf_sz=0;
 
 register int i, j;
 register double *aim;
@@ -1504,8 +1504,8 @@ int rec_res;
 #if 0
 int sba_mat_cholinv(double *A, double *B, int m)
 {
-static double *buf=NULL;
-static int buf_sz=0, nb=0;
+static SBA_THREAD_LOCAL double *buf=NULL;
+static SBA_THREAD_LOCAL int buf_sz=0, nb=0;
 
 int a_sz, ipiv_sz, work_sz, tot_sz;
 register int i, j;
@@ -446,6 +446,268 @@ static void sba_fdjac_x(
     free(tmpd);
 }
 
+/* The loops of sba_motstr_levmar_x() over cameras and points are run in parallel
+ * by sba_parallel_for(). Every U_j, ea_j, V_i, eb_i, W_ij and db_i is computed by a
+ * single thread in the same order as in a serial loop and the partial sums of ||e||^2
+ * are over fixed chunks of e, thus the results do not depend on the number of threads
+ */
+#define SBA_PTS_CHUNK     256  /* points per chunk */
+#define SBA_NRM_CHUNK     8192 /* elements of e per chunk */
+
+/* variables of sba_motstr_levmar_x() used by its parallel loops */
+struct motstr_pfor_ {
+    struct sba_crsm *idxij;
+    int n, m, mcon, cnp, pnp, mnp, nvis;
+    double *p, *jac, *e, *U, *V, *W, *ea, *eb, *dpa, *dpb;
+    int use_constraints, use_point_constraints;
+    camera_constraints_t *constraints;
+    point_constraints_t *point_constraints;
+    int maxCPvis, *rcidxs, *rcsubs; /* rcidxs, rcsubs of thread t start at t*maxCPvis */
+    double *Wtda; /* Wtda of thread t starts at t*pnp */
+};
+
+/* compute U_j = \sum_i A_ij^T A_ij and ea_j = \sum_i A_ij^T e_ij for j=mcon+first...mcon+last-1 */
+static void sba_motstr_U_cams(int first, int last, int thread, void *data)
+{
+    struct motstr_pfor_ *pf=(struct motstr_pfor_ *)data;
+    const int cnp=pf->cnp, pnp=pf->pnp, mnp=pf->mnp;
+    const int Usz=cnp*cnp, easz=cnp, esz=mnp, ABsz=mnp*(cnp+pnp);
+    register int i, j, ii, jj, k;
+    register double *ptr1, *ptr2, *ptr3, *ptr4, sum;
+    int nnz, *rcidxs, *rcsubs;
+
+    rcidxs=pf->rcidxs + thread*pf->maxCPvis;
+    rcsubs=pf->rcsubs + thread*pf->maxCPvis;
+
+    for(j=pf->mcon+first; j<pf->mcon+last; ++j){
+        ptr1=pf->U + j*Usz; // set ptr1 to point to U_j
+        ptr2=pf->ea + j*easz; // set ptr2 to point to ea_j
+
+        nnz=sba_crsm_col_elmidxs(pf->idxij, j, rcidxs, rcsubs); /* find nonzero A_ij, i=0...n-1 */
+        for(i=0; i<nnz; ++i){
+            /* set ptr3 to point to A_ij, actual row number in rcsubs[i] */
+            ptr3=pf->jac + pf->idxij->val[rcidxs[i]]*ABsz;
+
+            /* compute the UPPER TRIANGULAR PART of A_ij^T A_ij and add it to U_j */
+            for(ii=0; ii<cnp; ++ii){
+                for(jj=ii; jj<cnp; ++jj){
+                    for(k=0, sum=0.0; k<mnp; ++k)
+                        sum+=ptr3[k*cnp+ii]*ptr3[k*cnp+jj];
+                    ptr1[ii*cnp+jj]+=sum;
+                }
+
+                /* copy the LOWER TRIANGULAR PART of U_j from the upper one */
+                for(jj=0; jj<ii; ++jj)
+                    ptr1[ii*cnp+jj]=ptr1[jj*cnp+ii];
+            }
+
+            ptr4=pf->e + pf->idxij->val[rcidxs[i]]*esz; /* set ptr4 to point to e_ij */
+            /* compute A_ij^T e_ij and add it to ea_j */
+            for(ii=0; ii<cnp; ++ii){
+                for(jj=0, sum=0.0; jj<mnp; ++jj)
+                    sum+=ptr3[jj*cnp+ii]*ptr4[jj];
+                ptr2[ii]+=sum;
+            }
+        }
+
+        /* Add in the camera constraints */
+        if (pf->use_constraints) {
+            camera_constraints_t *constraints=pf->constraints;
+
+            for (jj=0; jj < cnp; jj++) {
+                if (constraints[j].constrained[jj]) {
+                    double diff = 
+                        constraints[j].constraints[jj] - pf->p[j * cnp + jj];
+                    /* Add to the U matrix */
+                    ptr1[jj*cnp+jj] += /*nnz **/ constraints[j].weights[jj];
+                    ptr2[jj] += /*nnz **/ constraints[j].weights[jj] * diff;
+                }
+            }
+        }
+    }
+}
+
+/* compute V_i = \sum_j B_ij^T B_ij, eb_i = \sum_j B_ij^T e_ij and W_ij = A_ij^T B_ij
+ * for i=first...last-1
+ */
+static void sba_motstr_VW_pts(int first, int last, int thread, void *data)
+{
+    struct motstr_pfor_ *pf=(struct motstr_pfor_ *)data;
+    const int cnp=pf->cnp, pnp=pf->pnp, mnp=pf->mnp;
+    const int Vsz=pnp*pnp, ebsz=pnp, Wsz=cnp*pnp, esz=mnp, Asz=mnp*cnp, ABsz=mnp*(cnp+pnp);
+    register int i, j, ii, jj, k;
+    register double *ptr1, *ptr2, *ptr3, *ptr4, sum;
+    int nnz, *rcidxs, *rcsubs;
+
+    rcidxs=pf->rcidxs + thread*pf->maxCPvis;
+    rcsubs=pf->rcsubs + thread*pf->maxCPvis;
+
+    for(i=first; i<last; ++i){
+        ptr1=pf->V + i*Vsz; // set ptr1 to point to V_i
+        ptr2=pf->eb + i*ebsz; // set ptr2 to point to eb_i
+
+        nnz=sba_crsm_row_elmidxs(pf->idxij, i, rcidxs, rcsubs); /* find nonzero B_ij, j=0...m-1 */
+        for(j=0; j<nnz; ++j){
+            /* set ptr3 to point to B_ij, actual column number in rcsubs[j] */
+            ptr3=pf->jac + pf->idxij->val[rcidxs[j]]*ABsz + Asz;
+      
+            /* compute the UPPER TRIANGULAR PART of B_ij^T B_ij and add it to V_i */
+            for(ii=0; ii<pnp; ++ii){
+                for(jj=ii; jj<pnp; ++jj){
+                    for(k=0, sum=0.0; k<mnp; ++k)
+                        sum+=ptr3[k*pnp+ii]*ptr3[k*pnp+jj];
+                    ptr1[ii*pnp+jj]+=sum;
+                }
+            }
+
+            ptr4=pf->e + pf->idxij->val[rcidxs[j]]*esz; /* set ptr4 to point to e_ij */
+            /* compute B_ij^T e_ij and add it to eb_i */
+            for(ii=0; ii<pnp; ++ii){
+                for(jj=0, sum=0.0; jj<mnp; ++jj)
+                    sum+=ptr3[jj*pnp+ii]*ptr4[jj];
+                ptr2[ii]+=sum;
+            }
+        }
+
+        /* Add in the constraints */
+        if (pf->use_point_constraints && pf->point_constraints[i].constrained) {
+            point_constraints_t *point_constraints=pf->point_constraints;
+
+            for (ii=0; ii < pnp; ii++) {
+                double diff = 
+                    point_constraints[i].constraints[ii] - 
+                    pf->p[pf->m * cnp + i * pnp + ii];
+                    
+                /* Add to the U matrix */
+                ptr1[ii*pnp+ii] += pf->nvis * point_constraints[i].weight;
+                ptr2[ii] += pf->nvis * point_constraints[i].weight * diff;
+            }
+        }
+
+        /* compute W_ij =  A_ij^T B_ij */
+        /* Recall that A_ij is mnp x cnp and B_ij is mnp x pnp
+         */
+        for(j=0; j<nnz; ++j){
+            /* set ptr1 to point to W_ij, actual column number in rcsubs[j] */
+            ptr1=pf->W + pf->idxij->val[rcidxs[j]]*Wsz;
+
+            if(rcsubs[j]<pf->mcon){ /* A_ij is zero */
+                _dblzero(ptr1, Wsz); /* clear W_ij */
+                continue;
+            }
+
+            /* set ptr2 & ptr3 to point to A_ij & B_ij resp. */
+            ptr2=pf->jac  + pf->idxij->val[rcidxs[j]]*ABsz;
+            ptr3=ptr2 + Asz;
+            /* compute A_ij^T B_ij and store it in W_ij
+             * Recall that storage for A_ij, B_ij does not overlap with that for W_ij,
+             * see the comments related to the initialization of jac in sba_motstr_levmar_x().
+             * W_ij may overwrite A_ik, B_ik of earlier points, thus jac shares memory with W
+             * only if the points are processed in order by a single thread
+             */
+            for(ii=0; ii<cnp; ++ii)
+                for(jj=0; jj<pnp; ++jj){
+                    for(k=0, sum=0.0; k<mnp; ++k)
+                        sum+=ptr2[k*cnp+ii]*ptr3[k*pnp+jj];
+                    ptr1[ii*pnp+jj]=sum;
+                }
+        }
+    }
+}
+
+/* compute db_i = (V*_i)^-1 (eb_i - \sum_j W_ij^T da_j) for i=first...last-1 */
+static void sba_motstr_db_pts(int first, int last, int thread, void *data)
+{
+    struct motstr_pfor_ *pf=(struct motstr_pfor_ *)data;
+    const int cnp=pf->cnp, pnp=pf->pnp;
+    const int Vsz=pnp*pnp, ebsz=pnp, Wsz=cnp*pnp;
+    register int i, j, ii, jj;
+    register double *ptr1, *ptr2, *ptr3, *ptr4, sum;
+    int nnz, *rcidxs, *rcsubs;
+    double *Wtda;
+
+    rcidxs=pf->rcidxs + thread*pf->maxCPvis;
+    rcsubs=pf->rcsubs + thread*pf->maxCPvis;
+    Wtda=pf->Wtda + thread*pnp;
+
+    for(i=first; i<last; ++i){
+        ptr1=pf->dpb + i*ebsz; // set ptr1 to point to db_i
+
+        /* compute \sum_j W_ij^T da_j */
+        /* Recall that W_ij is cnp x pnp and da_j is cnp x 1 */
+        _dblzero(Wtda, pnp); /* clear Wtda */
+        nnz=sba_crsm_row_elmidxs(pf->idxij, i, rcidxs, rcsubs); /* find nonzero W_ij, j=0...m-1 */
+        for(j=0; j<nnz; ++j){
+            /* set ptr2 to point to W_ij, actual column number in rcsubs[j] */
+            if(rcsubs[j]<pf->mcon) continue; /* W_ij is zero */
+
+            ptr2=pf->W + pf->idxij->val[rcidxs[j]]*Wsz;
+
+            /* set ptr3 to point to da_j */
+            ptr3=pf->dpa + rcsubs[j]*cnp;
+
+            for(ii=0; ii<pnp; ++ii){
+                ptr4=ptr2+ii;
+                for(jj=0, sum=0.0; jj<cnp; ++jj)
+                    sum+=ptr4[jj*pnp]*ptr3[jj]; //ptr2[jj*pnp+ii]*ptr3[jj];
+                Wtda[ii]+=sum;
+            }
+        }
+
+        /* compute eb_i - \sum_j W_ij^T da_j = eb_i - Wtda in Wtda */
+        ptr2=pf->eb + i*ebsz; // set ptr2 to point to eb_i
+        for(ii=0; ii<pnp; ++ii)
+            Wtda[ii]=ptr2[ii] - Wtda[ii];
+
+        /* compute the product (V*_i)^-1 Wtda = (V*_i)^-1 (eb_i - \sum_j W_ij^T da_j).
+         * Recall that only the lower triangle of (V*_i)^-1 is stored
+         */
+        ptr2=pf->V + i*Vsz; // set ptr2 to point to (V*_i)^-1
+        for(ii=0; ii<pnp; ++ii){
+            for(jj=0, sum=0.0; jj<=ii; ++jj)
+                sum+=ptr2[ii*pnp+jj]*Wtda[jj];
+            for( ; jj<pnp; ++jj)
+                sum+=ptr2[jj*pnp+ii]*Wtda[jj];
+            ptr1[ii]=sum;
+        }
+    }
+}
+
+/* arguments of nrmL2xmy_chunks() */
+struct nrm_pfor_ {
+    double *e;
+    const double *x, *y;
+    double *sums;
+};
+
+static void nrmL2xmy_chunks(int first, int last, int thread, void *data)
+{
+    struct nrm_pfor_ *nf=(struct nrm_pfor_ *)data;
+
+    nf->sums[first/SBA_NRM_CHUNK]=nrmL2xmy(nf->e+first, nf->x+first, nf->y+first, last-first);
+}
+
+/* nrmL2xmy() on nthreads threads. The result does not depend on nthreads */
+static double nrmL2xmy_mt(double *const e, const double *const x, const double *const y, const int n,
+                          const int nthreads)
+{
+    struct nrm_pfor_ nf;
+    int i, nchunks;
+    double sum;
+
+    if(n<=SBA_NRM_CHUNK) return nrmL2xmy(e, x, y, n);
+
+    nchunks=(n-1)/SBA_NRM_CHUNK + 1;
+    nf.e=e; nf.x=x; nf.y=y;
+    nf.sums=(double *)emalloc(nchunks*sizeof(double));
+    sba_parallel_for(nthreads, n, SBA_NRM_CHUNK, nrmL2xmy_chunks, &nf);
+    for(i=0, sum=0.0; i<nchunks; ++i)
+        sum+=nf.sums[i];
+    free(nf.sums);
+
+    return sum;
+}
+
 typedef int (*PLS)(double *A, double *B, double *x, int m, int iscolmaj);
 
 /* Bundle adjustment on camera and structure parameters 
@@ -460,7 +722,10 @@ int sba_motstr_levmar_x(
                         const int mcon,/* number of images (starting from the 1st) whose parameters should not be modified.
                                         * All A_ij (see below) with j<mcon are assumed to be zero
                                         */
-                        char *vmask,  /* visibility mask: vmask[i, j]=1 if point i visible in image j, 0 otherwise. nxm */
+                        struct sba_crsm *vis, /* visibility: nxm sparse matrix with a nonzero (i, j) element iff point i is
+                                     * visible in image j. Column indices must be increasing within each row;
+                                     * only rowptr & colidx are used, val is ignored
+                                     */
                         double *p,    /* initial parameter vector p0: (a1, ..., am, b1, ..., bn).
                                        * aj are the image j parameters, bi are the i-th point parameters,
                                        * size m*cnp + n*pnp
@@ -470,13 +735,13 @@ int sba_motstr_levmar_x(
                         double *x,    /* measurements vector: (x_11^T, .. x_1m^T, ..., x_n1^T, .. x_nm^T)^T where
                                        * x_ij is the projection of the i-th point on the j-th image.
                                        * NOTE: some of the x_ij might be missing, if point i is not visible in image j;
-                                       * see vmask[i, j], max. size n*m*mnp
+                                       * see vis(i, j), max. size n*m*mnp
                                        */
                         double *covx, /* measurements covariance matrices: (Sigma_x_11, .. Sigma_x_1m, ..., Sigma_x_n1, .. Sigma_x_nm),
                                        * where Sigma_x_ij is the mnp x mnp covariance of x_ij stored row-by-row. Set to NULL if no
                                        * covariance estimates are available (identity matrices are implicitly used in this case).
                                        * NOTE: a certain Sigma_x_ij is missing if the corresponding x_ij is also missing;
-                                       * see vmask[i, j], max. size n*m*mnp*mnp
+                                       * see vis(i, j), max. size n*m*mnp*mnp
                                        */
                         const int mnp,/* number of parameters for EACH measurement; usually 2 */
                         void (*func)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *hx, void *adata),
@@ -527,11 +792,12 @@ int sba_motstr_levmar_x(
                          */
                         int use_constraints, camera_constraints_t *constraints,  /* Constraints on camera parameters */
                         int use_point_constraints, point_constraints_t *point_constraints,
-                        double *Vout, double *Sout, double *Uout, double *Wout
+                        double *Vout, double *Sout, double *Uout, double *Wout,
+                        const int nthreads /* I: number of threads for the loops over cameras & points */
                         )
 {
     register int i, j, ii, jj, k, l;
-    int nvis, nnz, retval;
+    int nvis, nnz, retval, pooled;
 
     /* The following are work arrays that are dynamically allocated by sba_motstr_levmar_x() */
     double *jac;  /* work array for storing the jacobian, max. size n*m*(mnp*cnp + mnp*pnp) */
@@ -556,7 +822,11 @@ int sba_motstr_levmar_x(
     double *Yj;   /* work array for storing the Y_ij for a *fixed* j in the order Y_1j, Y_nj,
                      max. size n*cnp*pnp */
     double *YWt;  /* work array for storing \sum_i Y_ij W_ik^T, size cnp*cnp */
-    double *S;    /* work array for storing the block array S_jk, size m*m*cnp*cnp */
+    double *S;    /* work array for storing the block array S_jk, size m*m*cnp*cnp.
+                   * Only allocated if S is solved as a dense matrix or requested by the caller
+                   */
+    struct sba_schur schur; /* S as a block sparse matrix, see sba_schur.c */
+    int sparseS;  /* nonzero if S is stored in schur rather than S */
     double *dp;   /* work array for storing the parameter vector updates da_1, ..., da_m, db_1, ..., db_n, size m*cnp + n*pnp */
     double *Wtda; /* work array for storing \sum_j W_ij^T da_j, size pnp */
     double *wght= /* work array for storing the weights computed from the covariance inverses, max. size n*m*mnp*mnp */
@@ -617,6 +887,8 @@ int sba_motstr_levmar_x(
 
     struct fdj_data_x_ fdj_data;
     void *jac_adata;
+    struct motstr_pfor_ pf; /* state of the parallel loops */
+    const int nthr=(nthreads>1)? nthreads : 1;
 
     /* Initialization */
 
@@ -639,8 +911,7 @@ int sba_motstr_levmar_x(
     covsz=mnp * mnp;
 
     /* count total number of visible image points */
-    for(i=nvis=0, jj=n*m; i<jj; ++i)
-        nvis+=(vmask[i]!=0);
+    nvis=vis->rowptr[n];
 
     nobs=nvis*mnp;
     nvars=m*cnp + n*pnp;
@@ -649,29 +920,31 @@ int sba_motstr_levmar_x(
         return SBA_ERROR;
     }
 
+    /* keep the worker threads of the parallel loops until the minimization is over */
+    pooled=(nthr>1)? sba_pool_start(nthr) : 0;
+
     /* allocate & fill up the idxij structure */
     sba_crsm_alloc(&idxij, n, m, nvis);
-    for(i=k=0; i<n; ++i){
-        idxij.rowptr[i]=k;
-        ii=i*m;
-        for(j=0; j<m; ++j)
-            if(vmask[ii+j]){
-                idxij.val[k]=k;
-                idxij.colidx[k++]=j;
-            }
+    for(i=0; i<=n; ++i)
+        idxij.rowptr[i]=vis->rowptr[i];
+    for(k=0; k<nvis; ++k){
+        idxij.val[k]=k;
+        idxij.colidx[k]=vis->colidx[k];
     }
-    idxij.rowptr[n]=nvis;
 
     /* find the maximum number (for all cameras) of visible image projections coming from a single 3D point */
     for(i=maxCvis=0; i<n; ++i)
         if((k=idxij.rowptr[i+1]-idxij.rowptr[i])>maxCvis) maxCvis=k;
 
     /* find the maximum number (for all points) of visible image projections in any single camera */
-    for(j=maxPvis=0; j<m; ++j){
-        for(i=ii=0; i<n; ++i)
-            if(vmask[i*m+j]) ++ii;
-        if(ii>maxPvis) maxPvis=ii;
-    }
+    rcsubs=(int *)emalloc(m*sizeof(int)); /* temporary per camera counts */
+    for(j=0; j<m; ++j)
+        rcsubs[j]=0;
+    for(k=0; k<nvis; ++k)
+        ++rcsubs[idxij.colidx[k]];
+    for(j=maxPvis=0; j<m; ++j)
+        if(rcsubs[j]>maxPvis) maxPvis=rcsubs[j];
+    free(rcsubs);
     maxCPvis=(maxCvis>=maxPvis)? maxCvis : maxPvis;
 
 #if 0
@@ -684,9 +957,19 @@ int sba_motstr_levmar_x(
     printf("\nS density: %.5g\n", ((double)ii)/(mmcon*mmcon)); fflush(stdout);
 #endif
 
+    /* store S as a block sparse matrix unless its factor is too dense */
+    sparseS=sba_schur_alloc(&schur, &idxij, mcon, cnp, pnp, nthr);
+
     /* allocate work arrays */
-    /* W is big enough to hold both jac & W. Note also the extra Wsz, see the initialization of jac below for explanation */
-    W=(double *)emalloc((nvis*((Wsz>=ABsz)? Wsz : ABsz) + Wsz)*sizeof(double));
+    if(nthr==1){
+        /* W is big enough to hold both jac & W. Note also the extra Wsz, see the initialization of jac below for explanation */
+        W=(double *)emalloc((nvis*((Wsz>=ABsz)? Wsz : ABsz) + Wsz)*sizeof(double));
+        jac=NULL;
+    }
+    else{ /* the W_ij are computed in parallel, see sba_motstr_VW_pts() */
+        W=(double *)emalloc(nvis*Wsz*sizeof(double));
+        jac=(double *)emalloc(nvis*ABsz*sizeof(double));
+    }
     U=(double *)emalloc(m*Usz*sizeof(double));
     V=(double *)emalloc(n*Vsz*sizeof(double));
     e=(double *)emalloc(nobs*sizeof(double));
@@ -694,11 +977,11 @@ int sba_motstr_levmar_x(
     E=(double *)emalloc(m*cnp*sizeof(double));
     Yj=(double *)emalloc(maxPvis*Ysz*sizeof(double));
     YWt=(double *)emalloc(YWtsz*sizeof(double));
-    S=(double *)emalloc(m*m*Sblsz*sizeof(double));
+    S=(!sparseS || Sout!=NULL)? (double *)emalloc(m*m*Sblsz*sizeof(double)) : NULL;
     dp=(double *)emalloc(nvars*sizeof(double));
-    Wtda=(double *)emalloc(pnp*sizeof(double));
-    rcidxs=(int *)emalloc(maxCPvis*sizeof(int));
-    rcsubs=(int *)emalloc(maxCPvis*sizeof(int));
+    Wtda=(double *)emalloc(nthr*Wtdasz*sizeof(double));
+    rcidxs=(int *)emalloc(nthr*maxCPvis*sizeof(int));
+    rcsubs=(int *)emalloc(nthr*maxCPvis*sizeof(int));
 #ifndef SBA_DESTROY_COVS
     if(covx!=NULL) wght=(double *)emalloc(nvis*covsz*sizeof(double));
 #else
@@ -737,13 +1020,24 @@ int sba_motstr_levmar_x(
      * W_ij is guaranteed not to overlap with that allocated to their corresponding
      * A_ij, B_ij pairs
      */
-    jac=W + Wsz + ((Wsz>ABsz)? nvis*(Wsz-ABsz) : 0);
+    if(jac==NULL) jac=W + Wsz + ((Wsz>ABsz)? nvis*(Wsz-ABsz) : 0);
 
     /* set up auxiliary pointers */
     pa=p; pb=p+m*cnp;
     ea=eab; eb=eab+m*cnp;
     dpa=dp; dpb=dp+m*cnp;
 
+    pf.idxij=&idxij;
+    pf.n=n; pf.m=m; pf.mcon=mcon;
+    pf.cnp=cnp; pf.pnp=pnp; pf.mnp=mnp; pf.nvis=nvis;
+    pf.p=p; pf.jac=jac; pf.e=e;
+    pf.U=U; pf.V=V; pf.W=W;
+    pf.ea=ea; pf.eb=eb; pf.dpa=dpa; pf.dpb=dpb;
+    pf.use_constraints=use_constraints; pf.constraints=constraints;
+    pf.use_point_constraints=use_point_constraints; pf.point_constraints=point_constraints;
+    pf.maxCPvis=maxCPvis; pf.rcidxs=rcidxs; pf.rcsubs=rcsubs;
+    pf.Wtda=Wtda;
+
     diagU=diagUV; diagV=diagUV + m*cnp;
 
     /* if no jacobian function is supplied, prepare to compute jacobian with finite difference */
@@ -801,19 +1095,13 @@ int sba_motstr_levmar_x(
     (*func)(p, &idxij, rcidxs, rcsubs, hx, adata); nfev=1;
     /* ### compute e=x - f(p) [e=w*(x - f(p)] and its L2 norm */
     if(covx==NULL)
-        p_eL2=nrmL2xmy(e, x, hx, nobs); /* e=x-hx, p_eL2=||e|| */
+        p_eL2=nrmL2xmy_mt(e, x, hx, nobs, nthr); /* e=x-hx, p_eL2=||e|| */
     else
         p_eL2=nrmCxmy(e, x, hx, wght, mnp, nvis); /* e=wght*(x-hx), p_eL2=||e||=||x-hx||_Sigma^-1 */
 
     /* Add in the camera constraints */
     if (use_constraints) {
         for (j = 0; j < m; j++) {
-            /* Find number of points projecting into this camera */
-            int nnz = 0;
-
-            for(i = 0; i < n; i++)
-                nnz += vmask[i * m + j];
-
             for (jj = 0; jj < cnp; jj++) {
                 if (constraints[j].constrained[jj]) {
                     double diff = 
@@ -918,50 +1206,7 @@ int sba_motstr_levmar_x(
 
         _dblzero(U, m*Usz); /* clear all U_j */
         _dblzero(ea, m*easz); /* clear all ea_j */
-        for(j=mcon; j<m; ++j){
-            ptr1=U + j*Usz; // set ptr1 to point to U_j
-            ptr2=ea + j*easz; // set ptr2 to point to ea_j
-
-            nnz=sba_crsm_col_elmidxs(&idxij, j, rcidxs, rcsubs); /* find nonzero A_ij, i=0...n-1 */
-            for(i=0; i<nnz; ++i){
-                /* set ptr3 to point to A_ij, actual row number in rcsubs[i] */
-                ptr3=jac + idxij.val[rcidxs[i]]*ABsz;
-
-                /* compute the UPPER TRIANGULAR PART of A_ij^T A_ij and add it to U_j */
-                for(ii=0; ii<cnp; ++ii){
-                    for(jj=ii; jj<cnp; ++jj){
-                        for(k=0, sum=0.0; k<mnp; ++k)
-                            sum+=ptr3[k*cnp+ii]*ptr3[k*cnp+jj];
-                        ptr1[ii*cnp+jj]+=sum;
-                    }
-
-                    /* copy the LOWER TRIANGULAR PART of U_j from the upper one */
-                    for(jj=0; jj<ii; ++jj)
-                        ptr1[ii*cnp+jj]=ptr1[jj*cnp+ii];
-                }
-
-                ptr4=e + idxij.val[rcidxs[i]]*esz; /* set ptr4 to point to e_ij */
-                /* compute A_ij^T e_ij and add it to ea_j */
-                for(ii=0; ii<cnp; ++ii){
-                    for(jj=0, sum=0.0; jj<mnp; ++jj)
-                        sum+=ptr3[jj*cnp+ii]*ptr4[jj];
-                    ptr2[ii]+=sum;
-                }
-            }
-
-            /* Add in the camera constraints */
-            if (use_constraints) {
-                for (jj=0; jj < cnp; jj++) {
-                    if (constraints[j].constrained[jj]) {
-                        double diff = 
-                            constraints[j].constraints[jj] - p[j * cnp + jj];
-                        /* Add to the U matrix */
-                        ptr1[jj*cnp+jj] += /*nnz **/ constraints[j].weights[jj];
-                        ptr2[jj] += /*nnz **/ constraints[j].weights[jj] * diff;
-                    }
-                }
-            }
-        }
+        sba_parallel_for(nthr, mmcon, 1, sba_motstr_U_cams, &pf);
         
 #ifdef TIMINGS
         end = clock();
@@ -986,48 +1231,8 @@ int sba_motstr_levmar_x(
 
         _dblzero(V, n*Vsz); /* clear all V_i */
         _dblzero(eb, n*ebsz); /* clear all eb_i */
-        for(i=0; i<n; ++i){
-            ptr1=V + i*Vsz; // set ptr1 to point to V_i
-            ptr2=eb + i*ebsz; // set ptr2 to point to eb_i
-
-            nnz=sba_crsm_row_elmidxs(&idxij, i, rcidxs, rcsubs); /* find nonzero B_ij, j=0...m-1 */
-            for(j=0; j<nnz; ++j){
-                /* set ptr3 to point to B_ij, actual column number in rcsubs[j] */
-                ptr3=jac + idxij.val[rcidxs[j]]*ABsz + Asz;
-      
-                /* compute the UPPER TRIANGULAR PART of B_ij^T B_ij and add it to V_i */
-                for(ii=0; ii<pnp; ++ii){
-                    for(jj=ii; jj<pnp; ++jj){
-                        for(k=0, sum=0.0; k<mnp; ++k)
-                            sum+=ptr3[k*pnp+ii]*ptr3[k*pnp+jj];
-                        ptr1[ii*pnp+jj]+=sum;
-                    }
-                }
-
-                ptr4=e + idxij.val[rcidxs[j]]*esz; /* set ptr4 to point to e_ij */
-                /* compute B_ij^T e_ij and add it to eb_i */
-                for(ii=0; ii<pnp; ++ii){
-                    for(jj=0, sum=0.0; jj<mnp; ++jj)
-                        sum+=ptr3[jj*pnp+ii]*ptr4[jj];
-                    ptr2[ii]+=sum;
-                }
-            }
-
-            /* Add in the constraints */
-            if (use_point_constraints && point_constraints[i].constrained) {
-                for (ii=0; ii < pnp; ii++) {
-                    double diff = 
-                        point_constraints[i].constraints[ii] - 
-                        p[m * cnp + i * pnp + ii];
-                    
-                    // printf("  p[%d][%d] diff: %0.3f\n", i, ii, diff);
-                    
-                    /* Add to the U matrix */
-                    ptr1[ii*pnp+ii] += nvis * point_constraints[i].weight;
-                    ptr2[ii] += nvis * point_constraints[i].weight * diff;
-                }
-            }
-        }
+        /* W_ij = A_ij^T B_ij are computed along */
+        sba_parallel_for(nthr, n, SBA_PTS_CHUNK, sba_motstr_VW_pts, &pf);
         
 #ifdef TIMINGS
         end = clock();
@@ -1050,37 +1255,6 @@ int sba_motstr_levmar_x(
             }            
         }
         
-        /* compute W_ij =  A_ij^T B_ij */ // \Sigma here!
-        /* Recall that A_ij is mnp x cnp and B_ij is mnp x pnp
-         */
-        for(i=0; i<n; ++i){
-            nnz=sba_crsm_row_elmidxs(&idxij, i, rcidxs, rcsubs); /* find nonzero W_ij, j=0...m-1 */
-            for(j=0; j<nnz; ++j){
-                /* set ptr1 to point to W_ij, actual column number in rcsubs[j] */
-                ptr1=W + idxij.val[rcidxs[j]]*Wsz;
-
-                if(rcsubs[j]<mcon){ /* A_ij is zero */
-                    _dblzero(ptr1, Wsz); /* clear W_ij */
-                    continue;
-                }
-
-                /* set ptr2 & ptr3 to point to A_ij & B_ij resp. */
-                ptr2=jac  + idxij.val[rcidxs[j]]*ABsz;
-                ptr3=ptr2 + Asz;
-                /* compute A_ij^T B_ij and store it in W_ij
-                 * Recall that storage for A_ij, B_ij does not overlap with that for W_ij,
-                 * see the comments related to the initialization of jac above
-                 */
-                /* assert(ptr2-ptr1>=Wsz); */
-                for(ii=0; ii<cnp; ++ii)
-                    for(jj=0; jj<pnp; ++jj){
-                        for(k=0, sum=0.0; k<mnp; ++k)
-                            sum+=ptr2[k*cnp+ii]*ptr3[k*pnp+jj];
-                        ptr1[ii*pnp+jj]=sum;
-                    }
-            }
-        }
-
         /* Compute ||J^T e||_inf and ||p||^2 */
         for(i=0, p_L2=eab_inf=0.0; i<nvars; ++i){
             if(eab_inf < (tmp=FABS(eab[i]))) eab_inf=tmp;
@@ -1179,163 +1353,167 @@ int sba_motstr_levmar_x(
             start = clock();
 #endif
 
-            for(j=mcon; j<m; ++j){
-                int mmconxUsz=mmcon*Usz;
-
-                nnz=sba_crsm_col_elmidxs(&idxij, j, rcidxs, rcsubs); /* find nonzero Y_ij, i=0...n-1 */
-
-                /* compute all Y_ij = W_ij (V*_i)^-1 for a *fixed* j.
-                 * To save memory, the block matrix consisting of the Y_ij
-                 * is not stored. Instead, only a block column of this matrix
-                 * is computed & used at each time: For each j, all nonzero
-                 * Y_ij are computed in Yj and then used in the calculations
-                 * involving S_jk and e_j.
-                 * Recall that W_ij is cnp x pnp and (V*_i) is pnp x pnp
-                 */
-                for(i=0; i<nnz; ++i){
-                    /* set ptr3 to point to (V*_i)^-1, actual row number in rcsubs[i] */
-                    ptr3=V + rcsubs[i]*Vsz;
-
-                    /* set ptr1 to point to Y_ij, actual row number in rcsubs[i] */
-                    ptr1=Yj + i*Ysz;
-                    /* set ptr2 to point to W_ij resp. */
-                    ptr2=W + idxij.val[rcidxs[i]]*Wsz;
-                    /* compute W_ij (V*_i)^-1 and store it in Y_ij.
-                     * Recall that only the lower triangle of (V*_i)^-1 is stored
-                     */
-                    for(ii=0; ii<cnp; ++ii){
-                        ptr4=ptr2+ii*pnp;
-                        for(jj=0; jj<pnp; ++jj){
-                            for(k=0, sum=0.0; k<=jj; ++k)
-                                sum+=ptr4[k]*ptr3[jj*pnp+k]; //ptr2[ii*pnp+k]*ptr3[jj*pnp+k];
-                            for( ; k<pnp; ++k)
-                                sum+=ptr4[k]*ptr3[k*pnp+jj]; //ptr2[ii*pnp+k]*ptr3[k*pnp+jj];
-                            ptr1[ii*pnp+jj]=sum;
-                        }
-                    }
-                }
-
-                /* compute the UPPER TRIANGULAR PART of S */
-                for(k=j; k<m; ++k){ // j>=mcon
-                    /* compute \sum_i Y_ij W_ik^T in YWt. Note that
-                     * for an off-diagonal block defined by j, k YWt
-                     * (and thus S_jk) is nonzero only if there exists
-                     * a point that is visible in both the j-th and
-                     * k-th images
+            if(sparseS)
+                sba_schur_build(&schur, &idxij, U, V, W, ea, eb, E);
+            else{
+                for(j=mcon; j<m; ++j){
+                    int mmconxUsz=mmcon*Usz;
+
+                    nnz=sba_crsm_col_elmidxs(&idxij, j, rcidxs, rcsubs); /* find nonzero Y_ij, i=0...n-1 */
+
+                    /* compute all Y_ij = W_ij (V*_i)^-1 for a *fixed* j.
+                     * To save memory, the block matrix consisting of the Y_ij
+                     * is not stored. Instead, only a block column of this matrix
+                     * is computed & used at each time: For each j, all nonzero
+                     * Y_ij are computed in Yj and then used in the calculations
+                     * involving S_jk and e_j.
+                     * Recall that W_ij is cnp x pnp and (V*_i) is pnp x pnp
                      */
-          
-                    /* Recall that Y_ij is cnp x pnp and W_ik is 
-                     * cnp x pnp */ 
-                    _dblzero(YWt, YWtsz); /* clear YWt */
-
                     for(i=0; i<nnz; ++i){
-                        register double *pYWt;
+                        /* set ptr3 to point to (V*_i)^-1, actual row number in rcsubs[i] */
+                        ptr3=V + rcsubs[i]*Vsz;
 
-                        /* find the min and max column indices of the elements in row i (actually rcsubs[i])
-                         * and make sure that k falls within them. This test handles W_ik's which are
-                         * certain to be zero without bothering to call sba_crsm_elmidx()
-                         */
-                        ii=idxij.colidx[idxij.rowptr[rcsubs[i]]];
-                        jj=idxij.colidx[idxij.rowptr[rcsubs[i]+1]-1];
-                        if(k<ii || k>jj) continue; /* W_ik == 0 */
-
-                        /* set ptr2 to point to W_ik */
-                        l=sba_crsm_elmidxp(&idxij, rcsubs[i], k, j, rcidxs[i]);
-                        //l=sba_crsm_elmidx(&idxij, rcsubs[i], k);
-                        if(l==-1) continue; /* W_ik == 0 */
-
-                        ptr2=W + idxij.val[l]*Wsz;
                         /* set ptr1 to point to Y_ij, actual row number in rcsubs[i] */
                         ptr1=Yj + i*Ysz;
+                        /* set ptr2 to point to W_ij resp. */
+                        ptr2=W + idxij.val[rcidxs[i]]*Wsz;
+                        /* compute W_ij (V*_i)^-1 and store it in Y_ij.
+                         * Recall that only the lower triangle of (V*_i)^-1 is stored
+                         */
+                        for(ii=0; ii<cnp; ++ii){
+                            ptr4=ptr2+ii*pnp;
+                            for(jj=0; jj<pnp; ++jj){
+                                for(k=0, sum=0.0; k<=jj; ++k)
+                                    sum+=ptr4[k]*ptr3[jj*pnp+k]; //ptr2[ii*pnp+k]*ptr3[jj*pnp+k];
+                                for( ; k<pnp; ++k)
+                                    sum+=ptr4[k]*ptr3[k*pnp+jj]; //ptr2[ii*pnp+k]*ptr3[k*pnp+jj];
+                                ptr1[ii*pnp+jj]=sum;
+                            }
+                        }
+                    }
+
+                    /* compute the UPPER TRIANGULAR PART of S */
+                    for(k=j; k<m; ++k){ // j>=mcon
+                        /* compute \sum_i Y_ij W_ik^T in YWt. Note that
+                         * for an off-diagonal block defined by j, k YWt
+                         * (and thus S_jk) is nonzero only if there exists
+                         * a point that is visible in both the j-th and
+                         * k-th images
+                         */
+          
+                        /* Recall that Y_ij is cnp x pnp and W_ik is 
+                         * cnp x pnp */ 
+                        _dblzero(YWt, YWtsz); /* clear YWt */
+
+                        for(i=0; i<nnz; ++i){
+                            register double *pYWt;
+
+                            /* find the min and max column indices of the elements in row i (actually rcsubs[i])
+                             * and make sure that k falls within them. This test handles W_ik's which are
+                             * certain to be zero without bothering to call sba_crsm_elmidx()
+                             */
+                            ii=idxij.colidx[idxij.rowptr[rcsubs[i]]];
+                            jj=idxij.colidx[idxij.rowptr[rcsubs[i]+1]-1];
+                            if(k<ii || k>jj) continue; /* W_ik == 0 */
+
+                            /* set ptr2 to point to W_ik */
+                            l=sba_crsm_elmidxp(&idxij, rcsubs[i], k, j, rcidxs[i]);
+                            //l=sba_crsm_elmidx(&idxij, rcsubs[i], k);
+                            if(l==-1) continue; /* W_ik == 0 */
+
+                            ptr2=W + idxij.val[l]*Wsz;
+                            /* set ptr1 to point to Y_ij, actual row number in rcsubs[i] */
+                            ptr1=Yj + i*Ysz;
 
 #if 0
-                        matrix_product_ipp(cnp, cnp, pnp, ptr1, ptr2, YWt);
+                            matrix_product_ipp(cnp, cnp, pnp, ptr1, ptr2, YWt);
 #else
-                        for(ii=0; ii<cnp; ++ii){
-                            ptr3=ptr1+ii*pnp;
-                            pYWt=YWt+ii*cnp;
-
-                            ptr4=ptr2;
-                            for(jj=0; jj<cnp; ++jj){
-                                //ptr4=ptr2+jj*pnp;
-                                for(l=0, sum=0.0; l<pnp; ++l)
-                                    sum+=ptr3[l]*ptr4[l]; //ptr1[ii*pnp+l]*ptr2[jj*pnp+l];
-                                pYWt[jj]+=sum; //YWt[ii*cnp+jj]+=sum;
-                                ptr4+=pnp;
+                            for(ii=0; ii<cnp; ++ii){
+                                ptr3=ptr1+ii*pnp;
+                                pYWt=YWt+ii*cnp;
+
+                                ptr4=ptr2;
+                                for(jj=0; jj<cnp; ++jj){
+                                    //ptr4=ptr2+jj*pnp;
+                                    for(l=0, sum=0.0; l<pnp; ++l)
+                                        sum+=ptr3[l]*ptr4[l]; //ptr1[ii*pnp+l]*ptr2[jj*pnp+l];
+                                    pYWt[jj]+=sum; //YWt[ii*cnp+jj]+=sum;
+                                    ptr4+=pnp;
+                                }
                             }
-                        }
 #endif
-                    }
+                        }
 		  
-                    /* since the linear system involving S is solved with lapack,
-                     * it is preferable to store S in column major (i.e. fortran)
-                     * order, so as to avoid unecessary transposing/copying.
-                     */
+                        /* since the linear system involving S is solved with lapack,
+                         * it is preferable to store S in column major (i.e. fortran)
+                         * order, so as to avoid unecessary transposing/copying.
+                         */
 #if MAT_STORAGE==COLUMN_MAJOR
-                    ptr2=S + (k-mcon)*mmconxUsz + (j-mcon)*cnp; // set ptr2 to point to the beginning of block j,k in S
+                        ptr2=S + (k-mcon)*mmconxUsz + (j-mcon)*cnp; // set ptr2 to point to the beginning of block j,k in S
 #else
-                    ptr2=S + (j-mcon)*mmconxUsz + (k-mcon)*cnp; // set ptr2 to point to the beginning of block j,k in S
+                        ptr2=S + (j-mcon)*mmconxUsz + (k-mcon)*cnp; // set ptr2 to point to the beginning of block j,k in S
 #endif
 		  
-                    if(j!=k){ /* Kronecker */
-                        for(ii=0; ii<cnp; ++ii, ptr2+=Sdim)
-                            for(jj=0; jj<cnp; ++jj)
-                                ptr2[jj]=
+                        if(j!=k){ /* Kronecker */
+                            for(ii=0; ii<cnp; ++ii, ptr2+=Sdim)
+                                for(jj=0; jj<cnp; ++jj)
+                                    ptr2[jj]=
 #if MAT_STORAGE==COLUMN_MAJOR
-                                    -YWt[jj*cnp+ii];
+                                        -YWt[jj*cnp+ii];
 #else
-                        -YWt[ii*cnp+jj];
+                            -YWt[ii*cnp+jj];
 #endif
-                    }
-                    else{
-                        ptr1=U + j*Usz; // set ptr1 to point to U_j
+                        }
+                        else{
+                            ptr1=U + j*Usz; // set ptr1 to point to U_j
 
-                        for(ii=0; ii<cnp; ++ii, ptr2+=Sdim)
-                            for(jj=0; jj<cnp; ++jj)
-                                ptr2[jj]=
+                            for(ii=0; ii<cnp; ++ii, ptr2+=Sdim)
+                                for(jj=0; jj<cnp; ++jj)
+                                    ptr2[jj]=
 #if MAT_STORAGE==COLUMN_MAJOR
-                                    ptr1[jj*cnp+ii] - YWt[jj*cnp+ii];
+                                        ptr1[jj*cnp+ii] - YWt[jj*cnp+ii];
 #else
-                        ptr1[ii*cnp+jj] - YWt[ii*cnp+jj];
+                            ptr1[ii*cnp+jj] - YWt[ii*cnp+jj];
 #endif
+                        }
                     }
-                }
 
-                /* copy the LOWER TRIANGULAR PART of S from the upper one */
-                for(k=mcon; k<j; ++k){
+                    /* copy the LOWER TRIANGULAR PART of S from the upper one */
+                    for(k=mcon; k<j; ++k){
 #if MAT_STORAGE==COLUMN_MAJOR
-                    ptr1=S + (k-mcon)*mmconxUsz + (j-mcon)*cnp; // set ptr1 to point to the beginning of block j,k in S
-                    ptr2=S + (j-mcon)*mmconxUsz + (k-mcon)*cnp; // set ptr2 to point to the beginning of block k,j in S
+                        ptr1=S + (k-mcon)*mmconxUsz + (j-mcon)*cnp; // set ptr1 to point to the beginning of block j,k in S
+                        ptr2=S + (j-mcon)*mmconxUsz + (k-mcon)*cnp; // set ptr2 to point to the beginning of block k,j in S
 #else
-                    ptr1=S + (j-mcon)*mmconxUsz + (k-mcon)*cnp; // set ptr1 to point to the beginning of block j,k in S
-                    ptr2=S + (k-mcon)*mmconxUsz + (j-mcon)*cnp; // set ptr2 to point to the beginning of block k,j in S
+                        ptr1=S + (j-mcon)*mmconxUsz + (k-mcon)*cnp; // set ptr1 to point to the beginning of block j,k in S
+                        ptr2=S + (k-mcon)*mmconxUsz + (j-mcon)*cnp; // set ptr2 to point to the beginning of block k,j in S
 #endif
-                    for(ii=0; ii<cnp; ++ii, ptr1+=Sdim)
-                        for(jj=0, ptr3=ptr2+ii; jj<cnp; ++jj, ptr3+=Sdim)
-                            ptr1[jj]=*ptr3;
-                }
+                        for(ii=0; ii<cnp; ++ii, ptr1+=Sdim)
+                            for(jj=0, ptr3=ptr2+ii; jj<cnp; ++jj, ptr3+=Sdim)
+                                ptr1[jj]=*ptr3;
+                    }
 
-                /* compute e_j=ea_j - \sum_i Y_ij eb_i */
-                /* Recall that Y_ij is cnp x pnp and eb_i is pnp x 1 */
-                ptr1=E + j*easz; // set ptr1 to point to e_j
+                    /* compute e_j=ea_j - \sum_i Y_ij eb_i */
+                    /* Recall that Y_ij is cnp x pnp and eb_i is pnp x 1 */
+                    ptr1=E + j*easz; // set ptr1 to point to e_j
 
-                for(i=0; i<nnz; ++i){
-                    /* set ptr2 to point to Y_ij, actual row number in rcsubs[i] */
-                    ptr2=Yj + i*Ysz;
+                    for(i=0; i<nnz; ++i){
+                        /* set ptr2 to point to Y_ij, actual row number in rcsubs[i] */
+                        ptr2=Yj + i*Ysz;
 
-                    /* set ptr3 to point to eb_i */
-                    ptr3=eb + rcsubs[i]*ebsz;
-                    for(ii=0; ii<cnp; ++ii){
-                        ptr4=ptr2+ii*pnp;
-                        for(jj=0, sum=0.0; jj<pnp; ++jj)
-                            sum+=ptr4[jj]*ptr3[jj]; //ptr2[ii*pnp+jj]*ptr3[jj];
-                        ptr1[ii]+=sum;
+                        /* set ptr3 to point to eb_i */
+                        ptr3=eb + rcsubs[i]*ebsz;
+                        for(ii=0; ii<cnp; ++ii){
+                            ptr4=ptr2+ii*pnp;
+                            for(jj=0, sum=0.0; jj<pnp; ++jj)
+                                sum+=ptr4[jj]*ptr3[jj]; //ptr2[ii*pnp+jj]*ptr3[jj];
+                            ptr1[ii]+=sum;
+                        }
                     }
-                }
 
-                ptr2=ea + j*easz; // set ptr2 to point to ea_j
-                for(i=0; i<easz; ++i)
-                    ptr1[i]=ptr2[i] - ptr1[i];
+                    ptr2=ea + j*easz; // set ptr2 to point to ea_j
+                    for(i=0; i<easz; ++i)
+                        ptr1[i]=ptr2[i] - ptr1[i];
+                }
             }
 
 
@@ -1364,13 +1542,17 @@ int sba_motstr_levmar_x(
             start = clock();
 #endif
 
-	    //issolved=sba_Axb_LU(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_LU;
-            issolved=sba_Axb_Chol(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_Chol;
-            //issolved=sba_Axb_BK(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_BK;
-            //issolved=sba_Axb_QRnoQ(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_QRnoQ;
-            //issolved=sba_Axb_QR(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_QR;
-	    //issolved=sba_Axb_SVD(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_SVD;
-	    //issolved=sba_Axb_CG(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, (3*Sdim)/2, 1E-10, SBA_CG_JACOBI, MAT_STORAGE); linsolver=(PLS)sba_Axb_CG;
+            if(sparseS)
+                issolved=sba_schur_solve(&schur, E+mcon*cnp, dpa+mcon*cnp);
+            else{
+                //issolved=sba_Axb_LU(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_LU;
+                issolved=sba_Axb_Chol(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_Chol;
+                //issolved=sba_Axb_BK(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_BK;
+                //issolved=sba_Axb_QRnoQ(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_QRnoQ;
+                //issolved=sba_Axb_QR(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_QR;
+                //issolved=sba_Axb_SVD(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, MAT_STORAGE); linsolver=sba_Axb_SVD;
+                //issolved=sba_Axb_CG(S, E+mcon*cnp, dpa+mcon*cnp, Sdim, (3*Sdim)/2, 1E-10, SBA_CG_JACOBI, MAT_STORAGE); linsolver=(PLS)sba_Axb_CG;
+            }
 
             ++nlss;
 
@@ -1390,47 +1572,7 @@ int sba_motstr_levmar_x(
                 start = clock();
 #endif
 
-                for(i=0; i<n; ++i){
-                    ptr1=dpb + i*ebsz; // set ptr1 to point to db_i
-
-                    /* compute \sum_j W_ij^T da_j */
-                    /* Recall that W_ij is cnp x pnp and da_j is cnp x 1 */
-                    _dblzero(Wtda, Wtdasz); /* clear Wtda */
-                    nnz=sba_crsm_row_elmidxs(&idxij, i, rcidxs, rcsubs); /* find nonzero W_ij, j=0...m-1 */
-                    for(j=0; j<nnz; ++j){
-                        /* set ptr2 to point to W_ij, actual column number in rcsubs[j] */
-                        if(rcsubs[j]<mcon) continue; /* W_ij is zero */
-
-                        ptr2=W + idxij.val[rcidxs[j]]*Wsz;
-
-                        /* set ptr3 to point to da_j */
-                        ptr3=dpa + rcsubs[j]*cnp;
-
-                        for(ii=0; ii<pnp; ++ii){
-                            ptr4=ptr2+ii;
-                            for(jj=0, sum=0.0; jj<cnp; ++jj)
-                                sum+=ptr4[jj*pnp]*ptr3[jj]; //ptr2[jj*pnp+ii]*ptr3[jj];
-                            Wtda[ii]+=sum;
-                        }
-                    }
-
-                    /* compute eb_i - \sum_j W_ij^T da_j = eb_i - Wtda in Wtda */
-                    ptr2=eb + i*ebsz; // set ptr2 to point to eb_i
-                    for(ii=0; ii<pnp; ++ii)
-                        Wtda[ii]=ptr2[ii] - Wtda[ii];
-
-                    /* compute the product (V*_i)^-1 Wtda = (V*_i)^-1 (eb_i - \sum_j W_ij^T da_j).
-                     * Recall that only the lower triangle of (V*_i)^-1 is stored
-                     */
-                    ptr2=V + i*Vsz; // set ptr2 to point to (V*_i)^-1
-                    for(ii=0; ii<pnp; ++ii){
-                        for(jj=0, sum=0.0; jj<=ii; ++jj)
-                            sum+=ptr2[ii*pnp+jj]*Wtda[jj];
-                        for( ; jj<pnp; ++jj)
-                            sum+=ptr2[jj*pnp+ii]*Wtda[jj];
-                        ptr1[ii]=sum;
-                    }
-                }
+                sba_parallel_for(nthr, n, SBA_PTS_CHUNK, sba_motstr_db_pts, &pf);
 
 #ifdef TIMINGS
                 end = clock();
@@ -1473,7 +1615,7 @@ int sba_motstr_levmar_x(
 
                 /* ### compute ||e(pdp)||_2 */
                 if(covx==NULL)
-                    pdp_eL2=nrmL2xmy(hx, x, hx, nobs); /* hx=x-hx, pdp_eL2=||hx|| */
+                    pdp_eL2=nrmL2xmy_mt(hx, x, hx, nobs, nthr); /* hx=x-hx, pdp_eL2=||hx|| */
                 else
                     pdp_eL2=nrmCxmy(hx, x, hx, wght, mnp, nvis); /* hx=wght*(x-hx), pdp_eL2=||hx|| */
                 if(!SBA_FINITE(pdp_eL2)){
@@ -1487,11 +1629,6 @@ int sba_motstr_levmar_x(
                 /* Add in the camera constraints */
                 if (use_constraints) {
                     for (j = 0; j < m; j++) {
-                        int nnz = 0;
-
-                        for(i = 0; i < n; i++)
-                            nnz += vmask[i * m + j];
-
                         for (jj = 0; jj < cnp; jj++) {
                             if (constraints[j].constrained[jj]) {
                                 double diff = 
@@ -2055,6 +2192,7 @@ int sba_motstr_levmar_x(
 
     /* free whatever was allocated */
     free(W);   free(U);  free(V);
+    if(nthr>1) free(jac);
     free(e);   free(eab);
     free(E);   free(Yj); free(YWt);
     free(S);   free(dp); free(Wtda);
@@ -2072,11 +2210,14 @@ int sba_motstr_levmar_x(
     }
 
     sba_crsm_free(&idxij);
+    if(sparseS) sba_schur_free(&schur);
 
     /* free the memory allocated by the matrix inversion & linear solver routines */
     if(matinv) (*matinv)(NULL, 0);
     if(linsolver) (*linsolver)(NULL, NULL, NULL, 0, 0);
 
+    if(pooled) sba_pool_stop();
+
     return retval;
 }
 
@@ -2093,20 +2234,23 @@ int sba_mot_levmar_x(
                      const int mcon,/* number of images (starting from the 1st) whose parameters should not be modified.
                                      * All A_ij (see below) with j<mcon are assumed to be zero
                                      */
-                     char *vmask,  /* visibility mask: vmask[i, j]=1 if point i visible in image j, 0 otherwise. nxm */
+                     struct sba_crsm *vis, /* visibility: nxm sparse matrix with a nonzero (i, j) element iff point i is
+                                     * visible in image j. Column indices must be increasing within each row;
+                                     * only rowptr & colidx are used, val is ignored
+                                     */
                      double *p,    /* initial parameter vector p0: (a1, ..., am).
                                     * aj are the image j parameters, size m*cnp */
                      const int cnp,/* number of parameters for ONE camera; e.g. 6 for Euclidean cameras */
                      double *x,    /* measurements vector: (x_11^T, .. x_1m^T, ..., x_n1^T, .. x_nm^T)^T where
                                     * x_ij is the projection of the i-th point on the j-th image.
                                     * NOTE: some of the x_ij might be missing, if point i is not visible in image j;
-                                    * see vmask[i, j], max. size n*m*mnp
+                                    * see vis(i, j), max. size n*m*mnp
                                     */
                      double *covx, /* measurements covariance matrices: (Sigma_x_11, .. Sigma_x_1m, ..., Sigma_x_n1, .. Sigma_x_nm),
                                     * where Sigma_x_ij is the mnp x mnp covariance of x_ij stored row-by-row. Set to NULL if no
                                     * covariance estimates are available (identity matrices are implicitly used in this case).
                                     * NOTE: a certain Sigma_x_ij is missing if the corresponding x_ij is also missing;
-                                    * see vmask[i, j], max. size n*m*mnp*mnp
+                                    * see vis(i, j), max. size n*m*mnp*mnp
                                     */
                      const int mnp,/* number of parameters for EACH measurement; usually 2 */
                      void (*func)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *hx, void *adata),
@@ -2227,8 +2371,7 @@ int sba_mot_levmar_x(
     covsz=mnp * mnp;
   
     /* count total number of visible image points */
-    for(i=nvis=0, jj=n*m; i<jj; ++i)
-        nvis+=(vmask[i]!=0);
+    nvis=vis->rowptr[n];
 
     nobs=nvis*mnp;
     nvars=m*cnp;
@@ -2239,16 +2382,12 @@ int sba_mot_levmar_x(
 
     /* allocate & fill up the idxij structure */
     sba_crsm_alloc(&idxij, n, m, nvis);
-    for(i=k=0; i<n; ++i){
-        idxij.rowptr[i]=k;
-        ii=i*m;
-        for(j=0; j<m; ++j)
-            if(vmask[ii+j]){
-                idxij.val[k]=k;
-                idxij.colidx[k++]=j;
-            }
+    for(i=0; i<=n; ++i)
+        idxij.rowptr[i]=vis->rowptr[i];
+    for(k=0; k<nvis; ++k){
+        idxij.val[k]=k;
+        idxij.colidx[k]=vis->colidx[k];
     }
-    idxij.rowptr[n]=nvis;
 
     /* find the maximum number of visible image points in any single camera or coming from a single 3D point */
     /* cameras */
@@ -2256,11 +2395,14 @@ int sba_mot_levmar_x(
         if((k=idxij.rowptr[i+1]-idxij.rowptr[i])>maxCPvis) maxCPvis=k;
 
     /* points, note that maxCPvis is not reinitialized! */
-    for(j=0; j<m; ++j){
-        for(i=ii=0; i<n; ++i)
-            if(vmask[i*m+j]) ++ii;
-        if(ii>maxCPvis) maxCPvis=ii;
-    }
+    rcsubs=(int *)emalloc(m*sizeof(int)); /* temporary per camera counts */
+    for(j=0; j<m; ++j)
+        rcsubs[j]=0;
+    for(k=0; k<nvis; ++k)
+        ++rcsubs[idxij.colidx[k]];
+    for(j=0; j<m; ++j)
+        if(rcsubs[j]>maxCPvis) maxCPvis=rcsubs[j];
+    free(rcsubs);
 
     /* allocate work arrays */
     jac=(double *)emalloc(nvis*Asz*sizeof(double));
@@ -2343,12 +2485,6 @@ int sba_mot_levmar_x(
     /* Add in the camera constraints */
     if (use_constraints) {
         for (j = 0; j < m; j++) {
-            /* Find number of points projecting into this camera */
-            int nnz = 0;
-
-            for(i = 0; i < n; i++)
-                nnz += vmask[i * m + j];
-
             for (jj = 0; jj < cnp; jj++) {
                 if (constraints[j].constrained[jj]) {
                     double diff = 
@@ -2559,11 +2695,6 @@ int sba_mot_levmar_x(
                 /* Add in the camera constraints */
                 if (use_constraints) {
                     for (j = 0; j < m; j++) {
-                        int nnz = 0;
-
-                        for(i = 0; i < n; i++)
-                            nnz += vmask[i * m + j];
-
                         for (jj = 0; jj < cnp; jj++) {
                             if (constraints[j].constrained[jj]) {
                                 double diff = 
@@ -2698,20 +2829,23 @@ int sba_mot_levmar_x(
 int sba_str_levmar_x(
                      const int n,   /* number of points */
                      const int m,   /* number of images */
-                     char *vmask,  /* visibility mask: vmask[i, j]=1 if point i visible in image j, 0 otherwise. nxm */
+                     struct sba_crsm *vis, /* visibility: nxm sparse matrix with a nonzero (i, j) element iff point i is
+                                     * visible in image j. Column indices must be increasing within each row;
+                                     * only rowptr & colidx are used, val is ignored
+                                     */
                      double *p,    /* initial parameter vector p0: (b1, ..., bn).
                                     * bi are the i-th point parameters, * size n*pnp */
                      const int pnp,/* number of parameters for ONE point; e.g. 3 for Euclidean points */
                      double *x,    /* measurements vector: (x_11^T, .. x_1m^T, ..., x_n1^T, .. x_nm^T)^T where
                                     * x_ij is the projection of the i-th point on the j-th image.
                                     * NOTE: some of the x_ij might be missing, if point i is not visible in image j;
-                                    * see vmask[i, j], max. size n*m*mnp
+                                    * see vis(i, j), max. size n*m*mnp
                                     */
                      double *covx, /* measurements covariance matrices: (Sigma_x_11, .. Sigma_x_1m, ..., Sigma_x_n1, .. Sigma_x_nm),
                                     * where Sigma_x_ij is the mnp x mnp covariance of x_ij stored row-by-row. Set to NULL if no
                                     * covariance estimates are available (identity matrices are implicitly used in this case).
                                     * NOTE: a certain Sigma_x_ij is missing if the corresponding x_ij is also missing;
-                                    * see vmask[i, j], max. size n*m*mnp*mnp
+                                    * see vis(i, j), max. size n*m*mnp*mnp
                                     */
                      const int mnp,/* number of parameters for EACH measurement; usually 2 */
                      void (*func)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *hx, void *adata),
@@ -2831,8 +2965,7 @@ int sba_str_levmar_x(
     covsz=mnp * mnp;
 
     /* count total number of visible image points */
-    for(i=nvis=0, jj=n*m; i<jj; ++i)
-        nvis+=(vmask[i]!=0);
+    nvis=vis->rowptr[n];
 
     nobs=nvis*mnp;
     nvars=n*pnp;
@@ -2843,16 +2976,12 @@ int sba_str_levmar_x(
 
     /* allocate & fill up the idxij structure */
     sba_crsm_alloc(&idxij, n, m, nvis);
-    for(i=k=0; i<n; ++i){
-        idxij.rowptr[i]=k;
-        ii=i*m;
-        for(j=0; j<m; ++j)
-            if(vmask[ii+j]){
-                idxij.val[k]=k;
-                idxij.colidx[k++]=j;
-            }
+    for(i=0; i<=n; ++i)
+        idxij.rowptr[i]=vis->rowptr[i];
+    for(k=0; k<nvis; ++k){
+        idxij.val[k]=k;
+        idxij.colidx[k]=vis->colidx[k];
     }
-    idxij.rowptr[n]=nvis;
 
     /* find the maximum number of visible image points in any single camera or coming from a single 3D point */
     /* cameras */
@@ -2860,11 +2989,14 @@ int sba_str_levmar_x(
         if((k=idxij.rowptr[i+1]-idxij.rowptr[i])>maxCPvis) maxCPvis=k;
 
     /* points, note that maxCPvis is not reinitialized! */
-    for(j=0; j<m; ++j){
-        for(i=ii=0; i<n; ++i)
-            if(vmask[i*m+j]) ++ii;
-        if(ii>maxCPvis) maxCPvis=ii;
-    }
+    rcsubs=(int *)emalloc(m*sizeof(int)); /* temporary per camera counts */
+    for(j=0; j<m; ++j)
+        rcsubs[j]=0;
+    for(k=0; k<nvis; ++k)
+        ++rcsubs[idxij.colidx[k]];
+    for(j=0; j<m; ++j)
+        if(rcsubs[j]>maxCPvis) maxCPvis=rcsubs[j];
+    free(rcsubs);
 
     /* allocate work arrays */
     jac=(double *)emalloc(nvis*Bsz*sizeof(double));
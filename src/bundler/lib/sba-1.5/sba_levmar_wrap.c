@@ -35,6 +35,8 @@ struct wrap_motstr_data_ {
   void (*projac)(int j, int i, double *aj, double *bi, double *Aij, double *Bij, void *adata); // dQ/da, dQ/db
   int cnp, pnp, mnp; /* parameter numbers */
   void *adata;
+  int nthreads; /* proj & projac are called for different cameras in parallel */
+  int *rcidxs; /* work arrays of threads 1...nthreads-1, size (nthreads-1)*2*n */
 };
 
 struct wrap_mot_data_ {
@@ -62,33 +64,50 @@ struct wrap_str_data_ {
 
 /* FULL BUNDLE ADJUSTMENT */
 
-/* Given a parameter vector p made up of the 3D coordinates of n points and the parameters of m cameras, compute in
- * hx the prediction of the measurements, i.e. the projections of 3D points in the m images. The measurements
- * are returned in the order (hx_11^T, .. hx_1m^T, ..., hx_n1^T, .. hx_nm^T)^T, where hx_ij is the predicted
- * projection of the i-th point on the j-th camera.
- * Caller supplies rcidxs and rcsubs which can be used as working memory.
- * Notice that depending on idxij, some of the hx_ij might be missing
- *
+/* The routines below split the cameras among wdata->nthreads threads. All projections
+ * in a certain camera are evaluated by the same thread, thus proj & projac may cache
+ * per camera quantities. The results do not depend on the number of threads
  */
-static void sba_motstr_Qs(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *hx, void *adata)
+
+/* arguments of the routines below for their threads */
+struct wrap_motstr_pfor_ {
+  struct wrap_motstr_data_ *wdata;
+  double *p;
+  struct sba_crsm *idxij;
+  int *rcidxs, *rcsubs; /* work arrays of thread 0 */
+  double *out; /* hx or jac */
+};
+
+/* set rcidxs, rcsubs to the work arrays of a thread */
+static void wrap_motstr_thread_work(struct wrap_motstr_pfor_ *pf, int thread, int **rcidxs, int **rcsubs)
+{
+  if(thread==0){
+    *rcidxs=pf->rcidxs;
+    *rcsubs=pf->rcsubs;
+  }
+  else{
+    *rcidxs=pf->wdata->rcidxs + (thread-1)*2*pf->idxij->nr;
+    *rcsubs=*rcidxs + pf->idxij->nr;
+  }
+}
+
+/* compute the hx_ij of cameras first...last-1 */
+static void sba_motstr_Qs_cams(int first, int last, int thread, void *data)
 {
   register int i, j;
-  int cnp, pnp, mnp; 
+  struct wrap_motstr_pfor_ *pf=(struct wrap_motstr_pfor_ *)data;
+  struct wrap_motstr_data_ *wdata=pf->wdata;
+  struct sba_crsm *idxij=pf->idxij;
+  int cnp, pnp, mnp;
   double *pa, *pb, *paj, *pbi, *pxij;
-  int n, m, nnz;
-  struct wrap_motstr_data_ *wdata;
-  void (*proj)(int j, int i, double *aj, double *bi, double *xij, void *proj_adata);
-  void *proj_adata;
+  int m, nnz, *rcidxs, *rcsubs;
 
-  wdata=(struct wrap_motstr_data_ *)adata;
   cnp=wdata->cnp; pnp=wdata->pnp; mnp=wdata->mnp;
-  proj=wdata->proj;
-  proj_adata=wdata->adata;
-
-  n=idxij->nr; m=idxij->nc;
-  pa=p; pb=p+m*cnp;
+  m=idxij->nc;
+  pa=pf->p; pb=pf->p+m*cnp;
+  wrap_motstr_thread_work(pf, thread, &rcidxs, &rcsubs);
 
-  for(j=0; j<m; ++j){
+  for(j=first; j<last; ++j){
     /* j-th camera parameters */
     paj=pa+j*cnp;
 
@@ -96,42 +115,51 @@ static void sba_motstr_Qs(double *p, struct sba_crsm *idxij, int *rcidxs, int *r
 
     for(i=0; i<nnz; ++i){
       pbi=pb + rcsubs[i]*pnp;
-      pxij=hx + idxij->val[rcidxs[i]]*mnp; // set pxij to point to hx_ij
+      pxij=pf->out + idxij->val[rcidxs[i]]*mnp; // set pxij to point to hx_ij
 
-      (*proj)(j, rcsubs[i], paj, pbi, pxij, proj_adata); // evaluate Q in pxij
+      (*wdata->proj)(j, rcsubs[i], paj, pbi, pxij, wdata->adata); // evaluate Q in pxij
     }
   }
 }
 
 /* Given a parameter vector p made up of the 3D coordinates of n points and the parameters of m cameras, compute in
- * jac the jacobian of the predicted measurements, i.e. the jacobian of the projections of 3D points in the m images.
- * The jacobian is returned in the order (A_11, B_11, ..., A_1m, B_1m, ..., A_n1, B_n1, ..., A_nm, B_nm),
- * where A_ij=dx_ij/db_j and B_ij=dx_ij/db_i (see HZ).
+ * hx the prediction of the measurements, i.e. the projections of 3D points in the m images. The measurements
+ * are returned in the order (hx_11^T, .. hx_1m^T, ..., hx_n1^T, .. hx_nm^T)^T, where hx_ij is the predicted
+ * projection of the i-th point on the j-th camera.
  * Caller supplies rcidxs and rcsubs which can be used as working memory.
- * Notice that depending on idxij, some of the A_ij, B_ij might be missing
+ * Notice that depending on idxij, some of the hx_ij might be missing
  *
  */
-static void sba_motstr_Qs_jac(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *jac, void *adata)
+static void sba_motstr_Qs(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *hx, void *adata)
+{
+  struct wrap_motstr_pfor_ pf;
+
+  pf.wdata=(struct wrap_motstr_data_ *)adata;
+  pf.p=p; pf.idxij=idxij;
+  pf.rcidxs=rcidxs; pf.rcsubs=rcsubs;
+  pf.out=hx;
+
+  sba_parallel_for(pf.wdata->nthreads, idxij->nc, 1, sba_motstr_Qs_cams, &pf);
+}
+
+/* compute the A_ij, B_ij of cameras first...last-1 */
+static void sba_motstr_Qs_jac_cams(int first, int last, int thread, void *data)
 {
   register int i, j;
+  struct wrap_motstr_pfor_ *pf=(struct wrap_motstr_pfor_ *)data;
+  struct wrap_motstr_data_ *wdata=pf->wdata;
+  struct sba_crsm *idxij=pf->idxij;
   int cnp, pnp, mnp;
   double *pa, *pb, *paj, *pbi, *pAij, *pBij;
-  int n, m, nnz, Asz, Bsz, ABsz, idx;
-  struct wrap_motstr_data_ *wdata;
-  void (*projac)(int j, int i, double *aj, double *bi, double *Aij, double *Bij, void *projac_adata);
-  void *projac_adata;
+  int m, nnz, Asz, Bsz, ABsz, idx, *rcidxs, *rcsubs;
 
-  
-  wdata=(struct wrap_motstr_data_ *)adata;
   cnp=wdata->cnp; pnp=wdata->pnp; mnp=wdata->mnp;
-  projac=wdata->projac;
-  projac_adata=wdata->adata;
-
-  n=idxij->nr; m=idxij->nc;
-  pa=p; pb=p+m*cnp;
+  m=idxij->nc;
+  pa=pf->p; pb=pf->p+m*cnp;
   Asz=mnp*cnp; Bsz=mnp*pnp; ABsz=Asz+Bsz;
+  wrap_motstr_thread_work(pf, thread, &rcidxs, &rcsubs);
 
-  for(j=0; j<m; ++j){
+  for(j=first; j<last; ++j){
     /* j-th camera parameters */
     paj=pa+j*cnp;
 
@@ -140,70 +168,80 @@ static void sba_motstr_Qs_jac(double *p, struct sba_crsm *idxij, int *rcidxs, in
     for(i=0; i<nnz; ++i){
       pbi=pb + rcsubs[i]*pnp;
       idx=idxij->val[rcidxs[i]];
-      pAij=jac  + idx*ABsz; // set pAij to point to A_ij
+      pAij=pf->out + idx*ABsz; // set pAij to point to A_ij
       pBij=pAij + Asz; // set pBij to point to B_ij
 
-      (*projac)(j, rcsubs[i], paj, pbi, pAij, pBij, projac_adata); // evaluate dQ/da, dQ/db in pAij, pBij
+      (*wdata->projac)(j, rcsubs[i], paj, pbi, pAij, pBij, wdata->adata); // evaluate dQ/da, dQ/db in pAij, pBij
     }
   }
 }
 
 /* Given a parameter vector p made up of the 3D coordinates of n points and the parameters of m cameras, compute in
  * jac the jacobian of the predicted measurements, i.e. the jacobian of the projections of 3D points in the m images.
- * The jacobian is approximated with the aid of finite differences and is returned in the order
- * (A_11, B_11, ..., A_1m, B_1m, ..., A_n1, B_n1, ..., A_nm, B_nm),
- * where A_ij=dx_ij/da_j and B_ij=dx_ij/db_i (see HZ).
+ * The jacobian is returned in the order (A_11, B_11, ..., A_1m, B_1m, ..., A_n1, B_n1, ..., A_nm, B_nm),
+ * where A_ij=dx_ij/db_j and B_ij=dx_ij/db_i (see HZ).
+ * Caller supplies rcidxs and rcsubs which can be used as working memory.
  * Notice that depending on idxij, some of the A_ij, B_ij might be missing
  *
- * Problem-specific information is assumed to be stored in a structure pointed to by "dat".
- *
- * NOTE: This function is provided mainly for illustration purposes; in case that execution time is a concern,
- * the jacobian should be computed analytically
  */
-static void sba_motstr_Qs_fdjac(
-    double *p,                /* I: current parameter estimate, (m*cnp+n*pnp)x1 */
-    struct sba_crsm *idxij,   /* I: sparse matrix containing the location of x_ij in hx */
-    int    *rcidxs,           /* work array for the indexes of nonzero elements of a single sparse matrix row/column */
-    int    *rcsubs,           /* work array for the subscripts of nonzero elements in a single sparse matrix row/column */
-    double *jac,              /* O: array for storing the approximated jacobian */
-    void   *dat)              /* I: points to a "wrap_motstr_data_" structure */
+static void sba_motstr_Qs_jac(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *jac, void *adata)
+{
+  struct wrap_motstr_pfor_ pf;
+
+  pf.wdata=(struct wrap_motstr_data_ *)adata;
+  pf.p=p; pf.idxij=idxij;
+  pf.rcidxs=rcidxs; pf.rcsubs=rcsubs;
+  pf.out=jac;
+
+  sba_parallel_for(pf.wdata->nthreads, idxij->nc, 1, sba_motstr_Qs_jac_cams, &pf);
+}
+
+/* approximate the A_ij, B_ij of cameras first...last-1 with finite differences */
+static void sba_motstr_Qs_fdjac_cams(int first, int last, int thread, void *data)
 {
   register int i, j, ii, jj;
+  struct wrap_motstr_pfor_ *pf=(struct wrap_motstr_pfor_ *)data;
+  struct wrap_motstr_data_ *fdjd=pf->wdata;
+  struct sba_crsm *idxij=pf->idxij;
   double *pa, *pb, *paj, *pbi;
   register double *pAB;
-  int n, m, nnz, Asz, Bsz, ABsz;
+  int m, nnz, Asz, ABsz, *rcidxs, *rcsubs;
 
   double tmp;
   register double d, d1;
 
-  struct wrap_motstr_data_ *fdjd;
   void (*proj)(int j, int i, double *aj, double *bi, double *xij, void *adata);
-  double *hxij, *hxxij;
+  double *hxij, *hxxij, *bi;
   int cnp, pnp, mnp;
   void *adata;
 
-  /* retrieve problem-specific information passed in *dat */
-  fdjd=(struct wrap_motstr_data_ *)dat;
   proj=fdjd->proj;
   cnp=fdjd->cnp; pnp=fdjd->pnp; mnp=fdjd->mnp;
   adata=fdjd->adata;
 
-  n=idxij->nr; m=idxij->nc;
-  pa=p; pb=p+m*cnp;
-  Asz=mnp*cnp; Bsz=mnp*pnp; ABsz=Asz+Bsz;
+  m=idxij->nc;
+  pa=pf->p; pb=pf->p+m*cnp;
+  Asz=mnp*cnp; ABsz=Asz+mnp*pnp;
+  wrap_motstr_thread_work(pf, thread, &rcidxs, &rcsubs);
 
-  /* allocate memory for hxij, hxxij */
-  if((hxij=malloc(2*mnp*sizeof(double)))==NULL){
+  /* allocate memory for hxij, hxxij, bi */
+  if((hxij=malloc((2*mnp+pnp)*sizeof(double)))==NULL){
     fprintf(stderr, "memory allocation request failed in sba_motstr_Qs_fdjac()!\n");
     exit(1);
   }
   hxxij=hxij+mnp;
+  bi=hxxij+mnp;
+
+  for(j=first; j<last; ++j){
+    paj=pa+j*cnp; // j-th camera parameters
 
-    /* compute A_ij */
-    for(j=0; j<m; ++j){
-      paj=pa+j*cnp; // j-th camera parameters
+    nnz=sba_crsm_col_elmidxs(idxij, j, rcidxs, rcsubs); /* find nonzero A_ij, B_ij, i=0...n-1 */
+    for(i=0; i<nnz; ++i){
+      pbi=pb + rcsubs[i]*pnp; // i-th point parameters
+      pAB=pf->out + idxij->val[rcidxs[i]]*ABsz; // set pAB to point to A_ij
+      (*proj)(j, rcsubs[i], paj, pbi, hxij, adata); // evaluate supplied function on current solution
 
-      nnz=sba_crsm_col_elmidxs(idxij, j, rcidxs, rcsubs); /* find nonzero A_ij, i=0...n-1 */
+      /* compute A_ij. Camera j belongs to this thread, thus aj can be changed in place */
       for(jj=0; jj<cnp; ++jj){
         /* determine d=max(SBA_DELTA_SCALE*|paj[jj]|, SBA_MIN_DELTA), see HZ */
         d=(double)(SBA_DELTA_SCALE)*paj[jj]; // force evaluation
@@ -211,27 +249,19 @@ static void sba_motstr_Qs_fdjac(
         if(d<SBA_MIN_DELTA) d=SBA_MIN_DELTA;
         d1=1.0/d; /* invert so that divisions can be carried out faster as multiplications */
 
-        for(i=0; i<nnz; ++i){
-          pbi=pb + rcsubs[i]*pnp; // i-th point parameters
-          (*proj)(j, rcsubs[i], paj, pbi, hxij, adata); // evaluate supplied function on current solution
-
-          tmp=paj[jj];
-          paj[jj]+=d;
-          (*proj)(j, rcsubs[i], paj, pbi, hxxij, adata);
-          paj[jj]=tmp; /* restore */
+        tmp=paj[jj];
+        paj[jj]+=d;
+        (*proj)(j, rcsubs[i], paj, pbi, hxxij, adata);
+        paj[jj]=tmp; /* restore */
 
-          pAB=jac + idxij->val[rcidxs[i]]*ABsz; // set pAB to point to A_ij
-          for(ii=0; ii<mnp; ++ii)
-            pAB[ii*cnp+jj]=(hxxij[ii]-hxij[ii])*d1;
-        }
+        for(ii=0; ii<mnp; ++ii)
+          pAB[ii*cnp+jj]=(hxxij[ii]-hxij[ii])*d1;
       }
-    }
-
-    /* compute B_ij */
-    for(i=0; i<n; ++i){
-      pbi=pb+i*pnp; // i-th point parameters
 
-      nnz=sba_crsm_row_elmidxs(idxij, i, rcidxs, rcsubs); /* find nonzero B_ij, j=0...m-1 */
+      /* compute B_ij. Point i is shared with other threads, thus a copy of bi is changed */
+      pAB+=Asz; // set pAB to point to B_ij
+      for(jj=0; jj<pnp; ++jj)
+        bi[jj]=pbi[jj];
       for(jj=0; jj<pnp; ++jj){
         /* determine d=max(SBA_DELTA_SCALE*|pbi[jj]|, SBA_MIN_DELTA), see HZ */
         d=(double)(SBA_DELTA_SCALE)*pbi[jj]; // force evaluation
@@ -239,25 +269,50 @@ static void sba_motstr_Qs_fdjac(
         if(d<SBA_MIN_DELTA) d=SBA_MIN_DELTA;
         d1=1.0/d; /* invert so that divisions can be carried out faster as multiplications */
 
-        for(j=0; j<nnz; ++j){
-          paj=pa + rcsubs[j]*cnp; // j-th camera parameters
-          (*proj)(rcsubs[j], i, paj, pbi, hxij, adata); // evaluate supplied function on current solution
+        bi[jj]+=d;
+        (*proj)(j, rcsubs[i], paj, bi, hxxij, adata);
+        bi[jj]=pbi[jj]; /* restore */
 
-          tmp=pbi[jj];
-          pbi[jj]+=d;
-          (*proj)(rcsubs[j], i, paj, pbi, hxxij, adata);
-          pbi[jj]=tmp; /* restore */
-
-          pAB=jac + idxij->val[rcidxs[j]]*ABsz + Asz; // set pAB to point to B_ij
-          for(ii=0; ii<mnp; ++ii)
-            pAB[ii*pnp+jj]=(hxxij[ii]-hxij[ii])*d1;
-        }
+        for(ii=0; ii<mnp; ++ii)
+          pAB[ii*pnp+jj]=(hxxij[ii]-hxij[ii])*d1;
       }
     }
+  }
 
   free(hxij);
 }
 
+/* Given a parameter vector p made up of the 3D coordinates of n points and the parameters of m cameras, compute in
+ * jac the jacobian of the predicted measurements, i.e. the jacobian of the projections of 3D points in the m images.
+ * The jacobian is approximated with the aid of finite differences and is returned in the order
+ * (A_11, B_11, ..., A_1m, B_1m, ..., A_n1, B_n1, ..., A_nm, B_nm),
+ * where A_ij=dx_ij/da_j and B_ij=dx_ij/db_i (see HZ).
+ * Notice that depending on idxij, some of the A_ij, B_ij might be missing
+ *
+ * Problem-specific information is assumed to be stored in a structure pointed to by "dat".
+ *
+ * NOTE: This function is provided mainly for illustration purposes; in case that execution time is a concern,
+ * the jacobian should be computed analytically
+ */
+static void sba_motstr_Qs_fdjac(
+    double *p,                /* I: current parameter estimate, (m*cnp+n*pnp)x1 */
+    struct sba_crsm *idxij,   /* I: sparse matrix containing the location of x_ij in hx */
+    int    *rcidxs,           /* work array for the indexes of nonzero elements of a single sparse matrix row/column */
+    int    *rcsubs,           /* work array for the subscripts of nonzero elements in a single sparse matrix row/column */
+    double *jac,              /* O: array for storing the approximated jacobian */
+    void   *dat)              /* I: points to a "wrap_motstr_data_" structure */
+{
+  struct wrap_motstr_pfor_ pf;
+
+  /* retrieve problem-specific information passed in *dat */
+  pf.wdata=(struct wrap_motstr_data_ *)dat;
+  pf.p=p; pf.idxij=idxij;
+  pf.rcidxs=rcidxs; pf.rcsubs=rcsubs;
+  pf.out=jac;
+
+  sba_parallel_for(pf.wdata->nthreads, idxij->nc, 1, sba_motstr_Qs_fdjac_cams, &pf);
+}
+
 /* BUNDLE ADJUSTMENT FOR CAMERA PARAMETERS ONLY */
 
 /* Given a parameter vector p made up of the parameters of m cameras, compute in
@@ -602,7 +657,9 @@ int sba_motstr_levmar(
     const int mcon,/* number of images (starting from the 1st) whose parameters should not be modified.
 					          * All A_ij (see below) with j<mcon are assumed to be zero
 					          */
-    char *vmask,  /* visibility mask: vmask[i, j]=1 if point i visible in image j, 0 otherwise. nxm */
+    struct sba_crsm *vis, /* visibility: nxm sparse matrix with a nonzero (i, j) element iff point i is
+                        * visible in image j, column indices increasing within each row
+                        */
     double *p,    /* initial parameter vector p0: (a1, ..., am, b1, ..., bn).
                    * aj are the image j parameters, bi are the i-th point parameters,
                    * size m*cnp + n*pnp
@@ -612,13 +669,13 @@ int sba_motstr_levmar(
     double *x,    /* measurements vector: (x_11^T, .. x_1m^T, ..., x_n1^T, .. x_nm^T)^T where
                    * x_ij is the projection of the i-th point on the j-th image.
                    * NOTE: some of the x_ij might be missing, if point i is not visible in image j;
-                   * see vmask[i, j], max. size n*m*mnp
+                   * see vis(i, j), max. size n*m*mnp
                    */
     double *covx, /* measurements covariance matrices: (Sigma_x_11, .. Sigma_x_1m, ..., Sigma_x_n1, .. Sigma_x_nm),
                    * where Sigma_x_ij is the mnp x mnp covariance of x_ij stored row-by-row. Set to NULL if no
                    * covariance estimates are available (identity matrices are implicitly used in this case).
                    * NOTE: a certain Sigma_x_ij is missing if the corresponding x_ij is also missing;
-                   * see vmask[i, j], max. size n*m*mnp*mnp
+                   * see vis(i, j), max. size n*m*mnp*mnp
                    */
     const int mnp,/* number of parameters for EACH measurement; usually 2 */
     void (*proj)(int j, int i, double *aj, double *bi, double *xij, void *adata),
@@ -626,13 +683,13 @@ int sba_motstr_levmar(
                                                * the parameters of point i are bi and the parameters of camera j aj,
                                                * computes a prediction of \hat{x}_{ij}. aj is cnp x 1, bi is pnp x 1 and
                                                * xij is mnp x 1. This function is called only if point i is visible in
-                                               * image j (i.e. vmask[i, j]==1)
+                                               * image j (i.e. vis(i, j)!=0)
                                                */
     void (*projac)(int j, int i, double *aj, double *bi, double *Aij, double *Bij, void *adata),
                                               /* functional relation to evaluate d x_ij / d a_j and
                                                * d x_ij / d b_i in Aij and Bij resp.
                                                * This function is called only if point i is visible in * image j
-                                               * (i.e. vmask[i, j]==1). Also, A_ij and B_ij are mnp x cnp and mnp x pnp
+                                               * (i.e. vis(i, j)!=0). Also, A_ij and B_ij are mnp x cnp and mnp x pnp
                                                * matrices resp. and they should be stored in row-major order.
                                                *
                                                * If NULL, the jacobians are approximated by repetitive proj calls
@@ -665,11 +722,14 @@ int sba_motstr_levmar(
                   int use_constraints, camera_constraints_t *constraints, 
                   int use_point_constraints, 
                   point_constraints_t *point_constraints, 
-                  double *Vout, double *Sout, double *Uout, double *Wout)
+                  double *Vout, double *Sout, double *Uout, double *Wout,
+                  const int nthreads /* I: number of threads; proj & projac are called in parallel
+                                      * for different cameras if >1, but never for the same camera
+                                      */)
 {
 int retval;
 struct wrap_motstr_data_ wdata;
-static void (*fjac)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *jac, void *adata);
+void (*fjac)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *jac, void *adata);
 
   wdata.proj=proj;
   wdata.projac=projac;
@@ -677,17 +737,22 @@ static void (*fjac)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs,
   wdata.pnp=pnp;
   wdata.mnp=mnp;
   wdata.adata=adata;
+  wdata.nthreads=(nthreads>1)? nthreads : 1;
+  wdata.rcidxs=NULL;
+  if(wdata.nthreads>1 && (wdata.rcidxs=malloc((wdata.nthreads-1)*2*n*sizeof(int)))==NULL){
+    fprintf(stderr, "memory allocation request failed in sba_motstr_levmar()!\n");
+    exit(1);
+  }
 
   fjac=(projac)? sba_motstr_Qs_jac : sba_motstr_Qs_fdjac;
-  retval=sba_motstr_levmar_x(n, m, mcon, vmask, p, cnp, pnp, x, covx, mnp, sba_motstr_Qs, fjac, &wdata, itmax, verbose, opts, info, use_constraints, constraints, use_point_constraints, point_constraints, Vout, Sout, Uout, Wout);
+  retval=sba_motstr_levmar_x(n, m, mcon, vis, p, cnp, pnp, x, covx, mnp, sba_motstr_Qs, fjac, &wdata, itmax, verbose, opts, info, use_constraints, constraints, use_point_constraints, point_constraints, Vout, Sout, Uout, Wout, wdata.nthreads);
+  if(wdata.rcidxs) free(wdata.rcidxs);
 
   if(info){
-    register int i;
     int nvis;
 
     /* count visible image points */
-    for(i=nvis=0; i<n*m; ++i)
-      nvis+=(vmask[i]!=0);
+    nvis=vis->rowptr[n];
 
     /* each "func" & "fjac" evaluation requires nvis "proj" & "projac" evaluations */
     info[7]*=nvis;
@@ -710,32 +775,34 @@ int sba_mot_levmar(
     const int mcon,/* number of images (starting from the 1st) whose parameters should not be modified.
 					          * All A_ij (see below) with j<mcon are assumed to be zero
 					          */
-    char *vmask,  /* visibility mask: vmask[i, j]=1 if point i visible in image j, 0 otherwise. nxm */
+    struct sba_crsm *vis, /* visibility: nxm sparse matrix with a nonzero (i, j) element iff point i is
+                        * visible in image j, column indices increasing within each row
+                        */
     double *p,    /* initial parameter vector p0: (a1, ..., am).
                    * aj are the image j parameters, size m*cnp */
     const int cnp,/* number of parameters for ONE camera; e.g. 6 for Euclidean cameras */
     double *x,    /* measurements vector: (x_11^T, .. x_1m^T, ..., x_n1^T, .. x_nm^T)^T where
                    * x_ij is the projection of the i-th point on the j-th image.
                    * NOTE: some of the x_ij might be missing, if point i is not visible in image j;
-                   * see vmask[i, j], max. size n*m*mnp
+                   * see vis(i, j), max. size n*m*mnp
                    */
     double *covx, /* measurements covariance matrices: (Sigma_x_11, .. Sigma_x_1m, ..., Sigma_x_n1, .. Sigma_x_nm),
                    * where Sigma_x_ij is the mnp x mnp covariance of x_ij stored row-by-row. Set to NULL if no
                    * covariance estimates are available (identity matrices are implicitly used in this case).
                    * NOTE: a certain Sigma_x_ij is missing if the corresponding x_ij is also missing;
-                   * see vmask[i, j], max. size n*m*mnp*mnp
+                   * see vis(i, j), max. size n*m*mnp*mnp
                    */
     const int mnp,/* number of parameters for EACH measurement; usually 2 */
     void (*proj)(int j, int i, double *aj, double *xij, void *adata),
                                               /* functional relation computing a SINGLE image measurement. Assuming that
                                                * the parameters of camera j are aj, computes a prediction of \hat{x}_{ij}
                                                * for point i. aj is cnp x 1 and xij is mnp x 1.
-                                               * This function is called only if point i is visible in  image j (i.e. vmask[i, j]==1)
+                                               * This function is called only if point i is visible in  image j (i.e. vis(i, j)!=0)
                                                */
     void (*projac)(int j, int i, double *aj, double *Aij, void *adata),
                                               /* functional relation to evaluate d x_ij / d a_j in Aij 
                                                * This function is called only if point i is visible in image j
-                                               * (i.e. vmask[i, j]==1). Also, A_ij are a mnp x cnp matrices
+                                               * (i.e. vis(i, j)!=0). Also, A_ij are a mnp x cnp matrices
                                                * and should be stored in row-major order.
                                                *
                                                * If NULL, the jacobian is approximated by repetitive proj calls
@@ -778,15 +845,13 @@ void (*fjac)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double
   wdata.adata=adata;
 
   fjac=(projac)? sba_mot_Qs_jac : sba_mot_Qs_fdjac;
-  retval=sba_mot_levmar_x(n, m, mcon, vmask, p, cnp, x, covx, mnp, sba_mot_Qs, fjac, &wdata, itmax, verbose, opts, info, use_constraints, constraints);
+  retval=sba_mot_levmar_x(n, m, mcon, vis, p, cnp, x, covx, mnp, sba_mot_Qs, fjac, &wdata, itmax, verbose, opts, info, use_constraints, constraints);
 
   if(info){
-    register int i;
     int nvis;
 
     /* count visible image points */
-    for(i=nvis=0; i<n*m; ++i)
-      nvis+=(vmask[i]!=0);
+    nvis=vis->rowptr[n];
 
     /* each "func" & "fjac" evaluation requires nvis "proj" & "projac" evaluations */
     info[7]*=nvis;
@@ -805,7 +870,9 @@ void (*fjac)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double
 int sba_str_levmar(
     const int n,   /* number of points */
     const int m,   /* number of images */
-    char *vmask,  /* visibility mask: vmask[i, j]=1 if point i visible in image j, 0 otherwise. nxm */
+    struct sba_crsm *vis, /* visibility: nxm sparse matrix with a nonzero (i, j) element iff point i is
+                        * visible in image j, column indices increasing within each row
+                        */
     double *p,    /* initial parameter vector p0: (b1, ..., bn).
                    * bi are the i-th point parameters, size n*pnp
                    */
@@ -813,25 +880,25 @@ int sba_str_levmar(
     double *x,    /* measurements vector: (x_11^T, .. x_1m^T, ..., x_n1^T, .. x_nm^T)^T where
                    * x_ij is the projection of the i-th point on the j-th image.
                    * NOTE: some of the x_ij might be missing, if point i is not visible in image j;
-                   * see vmask[i, j], max. size n*m*mnp
+                   * see vis(i, j), max. size n*m*mnp
                    */
     double *covx, /* measurements covariance matrices: (Sigma_x_11, .. Sigma_x_1m, ..., Sigma_x_n1, .. Sigma_x_nm),
                    * where Sigma_x_ij is the mnp x mnp covariance of x_ij stored row-by-row. Set to NULL if no
                    * covariance estimates are available (identity matrices are implicitly used in this case).
                    * NOTE: a certain Sigma_x_ij is missing if the corresponding x_ij is also missing;
-                   * see vmask[i, j], max. size n*m*mnp*mnp
+                   * see vis(i, j), max. size n*m*mnp*mnp
                    */
     const int mnp,/* number of parameters for EACH measurement; usually 2 */
     void (*proj)(int j, int i, double *bi, double *xij, void *adata),
                                               /* functional relation computing a SINGLE image measurement. Assuming that
                                                * the parameters of point i are bi, computes a prediction of \hat{x}_{ij}.
                                                * bi is pnp x 1 and  xij is mnp x 1. This function is called only if point
-                                               * i is visible in image j (i.e. vmask[i, j]==1)
+                                               * i is visible in image j (i.e. vis(i, j)!=0)
                                                */
     void (*projac)(int j, int i, double *bi, double *Bij, void *adata),
                                               /* functional relation to evaluate d x_ij / d b_i in Bij.
                                                * This function is called only if point i is visible in image j
-                                               * (i.e. vmask[i, j]==1). Also, B_ij are mnp x pnp matrices
+                                               * (i.e. vis(i, j)!=0). Also, B_ij are mnp x pnp matrices
                                                * and they should be stored in row-major order.
                                                *
                                                * If NULL, the jacobians are approximated by repetitive proj calls
@@ -865,7 +932,7 @@ int sba_str_levmar(
 {
 int retval;
 struct wrap_str_data_ wdata;
-static void (*fjac)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *jac, void *adata);
+void (*fjac)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs, double *jac, void *adata);
 
   wdata.proj=proj;
   wdata.projac=projac;
@@ -874,15 +941,13 @@ static void (*fjac)(double *p, struct sba_crsm *idxij, int *rcidxs, int *rcsubs,
   wdata.adata=adata;
 
   fjac=(projac)? sba_str_Qs_jac : sba_str_Qs_fdjac;
-  retval=sba_str_levmar_x(n, m, vmask, p, pnp, x, covx, mnp, sba_str_Qs, fjac, &wdata, itmax, verbose, opts, info);
+  retval=sba_str_levmar_x(n, m, vis, p, pnp, x, covx, mnp, sba_str_Qs, fjac, &wdata, itmax, verbose, opts, info);
 
   if(info){
-    register int i;
     int nvis;
 
     /* count visible image points */
-    for(i=nvis=0; i<n*m; ++i)
-      nvis+=(vmask[i]!=0);
+    nvis=vis->rowptr[n];
 
     /* each "func" & "fjac" evaluation requires nvis "proj" & "projac" evaluations */
     info[7]*=nvis;
@@ -0,0 +1,729 @@
+/////////////////////////////////////////////////////////////////////////////////
+////
+////  Block sparse reduced camera system for sparse bundle adjustment
+////
+////  This program is free software; you can redistribute it and/or modify
+////  it under the terms of the GNU General Public License as published by
+////  the Free Software Foundation; either version 2 of the License, or
+////  (at your option) any later version.
+////
+////  This program is distributed in the hope that it will be useful,
+////  but WITHOUT ANY WARRANTY; without even the implied warranty of
+////  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+////  GNU General Public License for more details.
+////
+///////////////////////////////////////////////////////////////////////////////////
+
+/* The reduced camera matrix S of sba_motstr_levmar_x() has a nonzero block S_jk
+ * only if cameras j and k see a common point. Instead of being stored & factored
+ * as a dense (m-mcon)*cnp square matrix, S is stored here by blocks following the
+ * camera co-visibility and solved either with a sparse block Cholesky factorization
+ * (after a minimum degree ordering of the cameras) or, if SBA_SCHUR_PCG is defined,
+ * with conjugate gradients preconditioned by the inverses of the diagonal blocks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "compiler.h"
+#include "sba.h"
+
+#define emalloc(sz)       emalloc_(__FILE__, __LINE__, sz)
+
+/* auxiliary memory allocation routine with error checking */
+inline static void *emalloc_(char *file, int line, size_t sz)
+{
+void *ptr;
+
+  ptr=(void *)malloc(sz);
+  if(ptr==NULL){
+    fprintf(stderr, "SBA: memory allocation request for %lu bytes failed in file %s, line %d, exiting", (unsigned long)sz, file, line);
+    exit(1);
+  }
+
+  return ptr;
+}
+
+/* in place Cholesky factorization A=L L^T of a symmetric positive definite nxn block.
+ * The lower triangle of A (row major) is overwritten by L, its strict upper triangle is
+ * not referenced. Returns 0 if A is not positive definite
+ */
+static int sba_blk_chol(double *A, int n)
+{
+register int i, j, k;
+register double sum;
+
+  for(j=0; j<n; ++j){
+    for(k=0, sum=A[j*n+j]; k<j; ++k)
+      sum-=A[j*n+k]*A[j*n+k];
+    if(!(sum>0.0)) return 0; /* also catches NaNs */
+    A[j*n+j]=sum=sqrt(sum);
+
+    for(i=j+1; i<n; ++i){
+      register double s;
+
+      for(k=0, s=A[i*n+j]; k<j; ++k)
+        s-=A[i*n+k]*A[j*n+k];
+      A[i*n+j]=s/sum;
+    }
+  }
+
+  return 1;
+}
+
+/* solve L x = b in place, L being the nxn lower triangular output of sba_blk_chol() */
+static void sba_blk_lsolve(double *L, double *x, int n)
+{
+register int i, k;
+register double sum;
+
+  for(i=0; i<n; ++i){
+    for(k=0, sum=x[i]; k<i; ++k)
+      sum-=L[i*n+k]*x[k];
+    x[i]=sum/L[i*n+i];
+  }
+}
+
+/* solve L^T x = b in place */
+static void sba_blk_ltsolve(double *L, double *x, int n)
+{
+register int i, k;
+register double sum;
+
+  for(i=n-1; i>=0; --i){
+    for(k=i+1, sum=x[i]; k<n; ++k)
+      sum-=L[k*n+i]*x[k];
+    x[i]=sum/L[i*n+i];
+  }
+}
+
+/* a growable array of ints, used for the elimination graph */
+struct sba_ivec{
+  int n, sz;
+  int *v;
+};
+
+static void sba_ivec_push(struct sba_ivec *vec, int val)
+{
+  if(vec->n==vec->sz){
+    vec->sz=(vec->sz>0)? 2*vec->sz : 8;
+    vec->v=(int *)realloc(vec->v, vec->sz*sizeof(int));
+    if(!vec->v){
+      fprintf(stderr, "SBA: memory allocation request failed in sba_ivec_push()\n");
+      exit(1);
+    }
+  }
+  vec->v[vec->n++]=val;
+}
+
+static int sba_intcmp(const void *a, const void *b)
+{
+  return *(const int *)a - *(const int *)b;
+}
+
+/* Order the nb blocks of a symmetric matrix with the given adjacency so that its
+ * Cholesky factor has few nonzero blocks, by repeatedly eliminating the block with
+ * the fewest neighbors (ties go to the lowest index, so the ordering is deterministic).
+ * The nonzero off-diagonal blocks of column c of the factor are the neighbors of the
+ * c-th eliminated block at the time of its elimination; they are returned in
+ * cols[c] (as block indices, not positions), and perm[j] is the position of block j
+ */
+#ifndef SBA_SCHUR_PCG
+static void sba_schur_mindeg(int nb, int *aptr, int *aidx, int *perm, struct sba_ivec *cols)
+{
+struct sba_ivec *adj, tmp;
+char *done;
+int *mark, stamp;
+register int i, j, k, u, v, step;
+
+  adj=(struct sba_ivec *)emalloc(nb*sizeof(struct sba_ivec));
+  done=(char *)emalloc(nb*sizeof(char));
+  mark=(int *)emalloc(nb*sizeof(int));
+  for(j=0; j<nb; ++j){
+    adj[j].n=adj[j].sz=0; adj[j].v=NULL;
+    for(k=aptr[j]; k<aptr[j+1]; ++k)
+      sba_ivec_push(adj+j, aidx[k]);
+    done[j]=0;
+    mark[j]=-1;
+  }
+  tmp.n=tmp.sz=0; tmp.v=NULL;
+  stamp=0;
+
+  for(step=0; step<nb; ++step){
+    for(j=0, v=-1; j<nb; ++j)
+      if(!done[j] && (v==-1 || adj[j].n<adj[v].n)) v=j;
+
+    perm[v]=step;
+    done[v]=1;
+    cols[step]=adj[v];
+
+    /* the neighbors of v become a clique */
+    for(i=0; i<adj[v].n; ++i){
+      u=adj[v].v[i];
+
+      tmp.n=0;
+      mark[u]=mark[v]=++stamp;
+      for(k=0; k<adj[u].n; ++k)
+        if(mark[adj[u].v[k]]!=stamp){
+          mark[adj[u].v[k]]=stamp;
+          sba_ivec_push(&tmp, adj[u].v[k]);
+        }
+      for(k=0; k<adj[v].n; ++k)
+        if(mark[adj[v].v[k]]!=stamp){
+          mark[adj[v].v[k]]=stamp;
+          sba_ivec_push(&tmp, adj[v].v[k]);
+        }
+
+      /* swap the merged list in */
+      k=adj[u].sz; adj[u].sz=tmp.sz; tmp.sz=k;
+      k=adj[u].n; adj[u].n=tmp.n; tmp.n=k;
+      { int *p=adj[u].v; adj[u].v=tmp.v; tmp.v=p; }
+    }
+  }
+
+  if(tmp.v) free(tmp.v);
+  free(adj); /* the lists of eliminated blocks have been handed over to cols */
+  free(done);
+  free(mark);
+}
+#endif /* SBA_SCHUR_PCG */
+
+/* returns the index of block (r, c), r>=c, of the factor; -1 if it is zero */
+static int sba_schur_blkidx(struct sba_schur *sc, int r, int c)
+{
+register int low, high, mid;
+
+  low=sc->colptr[c];
+  high=sc->colptr[c+1]-1;
+  while(low<=high){
+    mid=(low+high)>>1;
+    if(r<sc->rowidx[mid]) high=mid-1;
+    else if(r>sc->rowidx[mid]) low=mid+1;
+    else return mid;
+  }
+
+  return -1;
+}
+
+/* Set up the block structure of S for the visibility idxij (see sba_motstr_levmar_x()),
+ * cnp camera & pnp point parameters and the first mcon cameras fixed. This depends only
+ * on the visibility and is thus done once for a minimization. S is built by nthreads threads.
+ *
+ * Returns 1 if S should be solved as a sparse matrix, 0 if its factor would be so dense
+ * that the caller should rather use a dense LAPACK solver, in which case nothing remains
+ * allocated
+ */
+int sba_schur_alloc(struct sba_schur *sc, struct sba_crsm *idxij, int mcon, int cnp, int pnp,
+                    int nthreads)
+{
+int nb, n, bsz2, nnzb;
+int *aptr, *aidx=NULL, *mark;
+struct sba_ivec *cols;
+register int i, j, k, l, r, c;
+
+  nb=idxij->nc-mcon;
+  n=idxij->nr;
+  bsz2=cnp*cnp;
+  if(nb<=0) return 0;
+
+  sc->nb=nb;
+  sc->bsz=cnp;
+  sc->mcon=mcon;
+  sc->pnp=pnp;
+  sc->nthreads=(nthreads>1)? nthreads : 1;
+
+  /* the projections of each camera, in increasing point order */
+  sc->cptr=(int *)emalloc((nb+1)*sizeof(int));
+  for(j=0; j<=nb; ++j)
+    sc->cptr[j]=0;
+  for(l=0; l<idxij->nnz; ++l)
+    if(idxij->colidx[l]>=mcon) ++sc->cptr[idxij->colidx[l]-mcon+1];
+  for(j=0; j<nb; ++j)
+    sc->cptr[j+1]+=sc->cptr[j];
+  sc->cpts=(int *)emalloc(sc->cptr[nb]*sizeof(int));
+  sc->cvis=(int *)emalloc(sc->cptr[nb]*sizeof(int));
+  mark=(int *)emalloc(nb*sizeof(int));
+  for(j=0; j<nb; ++j)
+    mark[j]=sc->cptr[j];
+  for(i=0; i<n; ++i)
+    for(l=idxij->rowptr[i]; l<idxij->rowptr[i+1]; ++l)
+      if((j=idxij->colidx[l]-mcon)>=0){
+        sc->cpts[mark[j]]=i;
+        sc->cvis[mark[j]++]=l;
+      }
+
+  /* camera co-visibility; adjacency lists are increasing and exclude the camera itself */
+  aptr=(int *)emalloc((nb+1)*sizeof(int));
+  for(j=0; j<nb; ++j)
+    mark[j]=-1;
+  for(l=0; l<2; ++l){ /* count, then fill */
+    for(j=0, k=0; j<nb; ++j){
+      int first=k;
+
+      if(l==0) aptr[j]=k;
+      mark[j]=j;
+      for(r=sc->cptr[j]; r<sc->cptr[j+1]; ++r){
+        i=sc->cpts[r];
+        for(c=idxij->rowptr[i]; c<idxij->rowptr[i+1]; ++c){
+          int kk=idxij->colidx[c]-mcon;
+
+          if(kk<0 || mark[kk]==j) continue;
+          mark[kk]=j;
+          if(l==1) aidx[k]=kk;
+          ++k;
+        }
+      }
+      if(l==1) qsort(aidx+first, k-first, sizeof(int), sba_intcmp);
+    }
+    if(l==0){
+      aptr[nb]=k;
+      aidx=(int *)emalloc((k>0? k : 1)*sizeof(int));
+      for(j=0; j<nb; ++j)
+        mark[j]=-1;
+    }
+  }
+
+  /* order the cameras & find the nonzero blocks of the factor */
+  sc->perm=(int *)emalloc(nb*sizeof(int));
+  cols=(struct sba_ivec *)emalloc(nb*sizeof(struct sba_ivec));
+#ifndef SBA_SCHUR_PCG
+  sba_schur_mindeg(nb, aptr, aidx, sc->perm, cols);
+#else
+  /* no factorization, just the lower triangle of S in the original order */
+  for(j=0; j<nb; ++j){
+    sc->perm[j]=j;
+    cols[j].n=cols[j].sz=0; cols[j].v=NULL;
+    for(k=aptr[j]; k<aptr[j+1]; ++k)
+      if(aidx[k]>j) sba_ivec_push(cols+j, aidx[k]);
+  }
+#endif /* SBA_SCHUR_PCG */
+
+  for(c=0, nnzb=nb; c<nb; ++c)
+    nnzb+=cols[c].n;
+
+#ifndef SBA_SCHUR_PCG
+  if(nnzb>SBA_SCHUR_MAX_FILL*(0.5*nb*(nb+1))){
+    for(c=0; c<nb; ++c)
+      if(cols[c].v) free(cols[c].v);
+    free(cols); free(aptr); free(aidx); free(mark);
+    free(sc->cptr); free(sc->cpts); free(sc->cvis); free(sc->perm);
+    return 0;
+  }
+#endif /* SBA_SCHUR_PCG */
+
+  sc->nnzb=nnzb;
+  sc->colptr=(int *)emalloc((nb+1)*sizeof(int));
+  sc->rowidx=(int *)emalloc(nnzb*sizeof(int));
+  for(c=0, k=0; c<nb; ++c){
+    sc->colptr[c]=k;
+    sc->rowidx[k++]=c;
+    for(l=0; l<cols[c].n; ++l)
+      sc->rowidx[k++]=sc->perm[cols[c].v[l]];
+    qsort(sc->rowidx+sc->colptr[c]+1, cols[c].n, sizeof(int), sba_intcmp);
+    if(cols[c].v) free(cols[c].v);
+  }
+  sc->colptr[nb]=k;
+  free(cols);
+
+  /* the upper triangle of S in camera order & where its blocks are stored */
+  sc->sptr=(int *)emalloc((nb+1)*sizeof(int));
+  sc->sidx=(int *)emalloc((nb+(aptr[nb]>>1))*sizeof(int));
+  sc->sblk=(int *)emalloc((nb+(aptr[nb]>>1))*sizeof(int));
+  sc->strans=(char *)emalloc((nb+(aptr[nb]>>1))*sizeof(char));
+  for(j=0, l=0; j<nb; ++j){
+    sc->sptr[j]=l;
+    sc->sidx[l]=j;
+    sc->sblk[l]=sba_schur_blkidx(sc, sc->perm[j], sc->perm[j]);
+    sc->strans[l++]=0;
+    for(k=aptr[j]; k<aptr[j+1]; ++k){
+      if((i=aidx[k])<j) continue;
+
+      sc->sidx[l]=i;
+      if(sc->perm[j]>sc->perm[i]){ /* block (perm[j], perm[i]) holds S_ji */
+        sc->sblk[l]=sba_schur_blkidx(sc, sc->perm[j], sc->perm[i]);
+        sc->strans[l++]=0;
+      }
+      else{ /* block (perm[i], perm[j]) holds S_ij=S_ji^T */
+        sc->sblk[l]=sba_schur_blkidx(sc, sc->perm[i], sc->perm[j]);
+        sc->strans[l++]=1;
+      }
+    }
+  }
+  sc->sptr[nb]=l;
+  free(aptr); free(aidx);
+
+  sc->val=(double *)emalloc(nnzb*bsz2*sizeof(double));
+  free(mark);
+  for(j=0, sc->maxpts=1; j<nb; ++j)
+    if(sc->cptr[j+1]-sc->cptr[j]>sc->maxpts) sc->maxpts=sc->cptr[j+1]-sc->cptr[j];
+  sc->map=(int *)emalloc(sc->nthreads*nb*sizeof(int));
+  sc->Yj=(double *)emalloc(sc->nthreads*sc->maxpts*cnp*pnp*sizeof(double));
+#ifndef SBA_SCHUR_PCG
+  sc->work=(double *)emalloc(((nb>cnp)? nb : cnp)*cnp*sizeof(double));
+#else
+  sc->work=(double *)emalloc((4*nb*cnp + nb*bsz2)*sizeof(double));
+#endif /* SBA_SCHUR_PCG */
+
+  return 1;
+}
+
+/* free the memory allocated by sba_schur_alloc() */
+void sba_schur_free(struct sba_schur *sc)
+{
+  free(sc->cptr); free(sc->cpts); free(sc->cvis);
+  free(sc->perm);
+  free(sc->colptr); free(sc->rowidx);
+  free(sc->sptr); free(sc->sidx); free(sc->sblk); free(sc->strans);
+  free(sc->val);
+  free(sc->map); free(sc->Yj);
+  free(sc->work);
+  sc->nb=sc->nnzb=0;
+}
+
+/* arguments of sba_schur_build() for its threads */
+struct sba_schur_build_{
+  struct sba_schur *sc;
+  struct sba_crsm *idxij;
+  double *U, *V, *W, *ea, *eb, *E;
+};
+
+/* Compute the blocks S_jk, k>=j, and e_j for the cameras j in [first+mcon, last+mcon).
+ * Each camera writes only its own blocks, so cameras can be processed in any order
+ */
+static void sba_schur_build_cams(int first, int last, int thread, void *data)
+{
+struct sba_schur_build_ *bd=(struct sba_schur_build_ *)data;
+struct sba_schur *sc=bd->sc;
+struct sba_crsm *idxij=bd->idxij;
+double *U=bd->U, *V=bd->V, *W=bd->W, *ea=bd->ea, *eb=bd->eb, *E=bd->E;
+const int cnp=sc->bsz, pnp=sc->pnp, bsz2=cnp*cnp, Vsz=pnp*pnp, Wsz=cnp*pnp;
+int nnz, j, jj, kk, l, lend;
+register int i, ii, k;
+register double *ptr1, *ptr2, *ptr3, *ptr4, *pYWt, sum;
+double *blk, *Yj;
+int *map;
+
+  Yj=sc->Yj + thread*sc->maxpts*Wsz;
+  map=sc->map + thread*sc->nb;
+
+  for(jj=first; jj<last; ++jj){
+    j=jj+sc->mcon;
+    nnz=sc->cptr[jj+1]-sc->cptr[jj];
+
+    /* compute all Y_ij = W_ij (V*_i)^-1 for this j */
+    for(i=0; i<nnz; ++i){
+      ptr3=V + sc->cpts[sc->cptr[jj]+i]*Vsz; /* (V*_i)^-1 */
+      ptr1=Yj + i*Wsz;
+      ptr2=W + idxij->val[sc->cvis[sc->cptr[jj]+i]]*Wsz;
+      for(ii=0; ii<cnp; ++ii){
+        ptr4=ptr2+ii*pnp;
+        for(kk=0; kk<pnp; ++kk){
+          for(k=0, sum=0.0; k<=kk; ++k)
+            sum+=ptr4[k]*ptr3[kk*pnp+k];
+          for( ; k<pnp; ++k)
+            sum+=ptr4[k]*ptr3[k*pnp+kk];
+          ptr1[ii*pnp+kk]=sum;
+        }
+      }
+    }
+
+    /* locate the blocks S_jk, k>=j */
+    for(l=sc->sptr[jj]; l<sc->sptr[jj+1]; ++l)
+      map[sc->sidx[l]]=l;
+
+    /* add Y_ij W_ik^T to S_jk for all points i seen by j and all cameras k>=j seeing them */
+    for(i=0; i<nnz; ++i){
+      ptr1=Yj + i*Wsz;
+      l=sc->cvis[sc->cptr[jj]+i]; /* W_ij */
+      lend=idxij->rowptr[sc->cpts[sc->cptr[jj]+i]+1];
+      for( ; l<lend; ++l){
+        kk=map[idxij->colidx[l]-sc->mcon];
+        ptr2=W + idxij->val[l]*Wsz; /* W_ik */
+        blk=sc->val + sc->sblk[kk]*bsz2;
+
+        for(ii=0; ii<cnp; ++ii){
+          ptr3=ptr1+ii*pnp;
+          ptr4=ptr2;
+          if(!sc->strans[kk]){
+            pYWt=blk+ii*cnp;
+            for(k=0; k<cnp; ++k, ptr4+=pnp){
+              register int m;
+              for(m=0, sum=0.0; m<pnp; ++m)
+                sum+=ptr3[m]*ptr4[m];
+              pYWt[k]+=sum;
+            }
+          }
+          else{
+            pYWt=blk+ii;
+            for(k=0; k<cnp; ++k, ptr4+=pnp){
+              register int m;
+              for(m=0, sum=0.0; m<pnp; ++m)
+                sum+=ptr3[m]*ptr4[m];
+              pYWt[k*cnp]+=sum;
+            }
+          }
+        }
+      }
+    }
+
+    /* S_jj=U*_j - \sum_i Y_ij W_ij^T, S_jk=-\sum_i Y_ij W_ik^T */
+    for(l=sc->sptr[jj]; l<sc->sptr[jj+1]; ++l){
+      blk=sc->val + sc->sblk[l]*bsz2;
+      if(sc->sidx[l]==jj){
+        ptr1=U + j*bsz2;
+        for(k=0; k<bsz2; ++k)
+          blk[k]=ptr1[k] - blk[k];
+      }
+      else
+        for(k=0; k<bsz2; ++k)
+          blk[k]=-blk[k];
+    }
+
+    /* compute e_j=ea_j - \sum_i Y_ij eb_i */
+    ptr1=E + j*cnp;
+    for(ii=0; ii<cnp; ++ii)
+      ptr1[ii]=0.0;
+    for(i=0; i<nnz; ++i){
+      ptr2=Yj + i*Wsz;
+      ptr3=eb + sc->cpts[sc->cptr[jj]+i]*pnp;
+      for(ii=0; ii<cnp; ++ii){
+        ptr4=ptr2+ii*pnp;
+        for(k=0, sum=0.0; k<pnp; ++k)
+          sum+=ptr4[k]*ptr3[k];
+        ptr1[ii]+=sum;
+      }
+    }
+    ptr2=ea + j*cnp;
+    for(ii=0; ii<cnp; ++ii)
+      ptr1[ii]=ptr2[ii] - ptr1[ii];
+  }
+}
+
+/* Compute the blocks of S=U* - \sum_i Y_ij W_ik^T and e_j=ea_j - \sum_i Y_ij eb_i for
+ * all cameras j>=mcon, where Y_ij=W_ij (V*_i)^-1. U, V, W, ea, eb, E are laid out as
+ * in sba_motstr_levmar_x(); only the lower triangles of the (V*_i)^-1 are used.
+ * The cameras are split among sc->nthreads threads. Contributions to each block are
+ * summed in the same order as in the dense computation of S, for any number of threads
+ */
+void sba_schur_build(struct sba_schur *sc, struct sba_crsm *idxij,
+                     double *U, double *V, double *W, double *ea, double *eb, double *E)
+{
+struct sba_schur_build_ bd;
+
+  memset(sc->val, 0, sc->nnzb*sc->bsz*sc->bsz*sizeof(double));
+
+  bd.sc=sc; bd.idxij=idxij;
+  bd.U=U; bd.V=V; bd.W=W;
+  bd.ea=ea; bd.eb=eb; bd.E=E;
+  sba_parallel_for(sc->nthreads, sc->nb, 4, sba_schur_build_cams, &bd);
+}
+
+#ifndef SBA_SCHUR_PCG
+/* right looking block Cholesky factorization of S, in place. Returns 0 if S is
+ * not positive definite
+ */
+static int sba_schur_factor(struct sba_schur *sc)
+{
+const int n=sc->bsz, bsz2=n*n;
+int c, b, b1, b2, r2, end;
+register int i, j, k;
+register double *L, *A, *B, *T, sum;
+
+  for(c=0; c<sc->nb; ++c){
+    L=sc->val + sc->colptr[c]*bsz2;
+    if(!sba_blk_chol(L, n)) return 0;
+
+    end=sc->colptr[c+1];
+    /* L_rc=S_rc L_cc^-T, i.e. solve L_cc x=s for each row s of S_rc */
+    for(b=sc->colptr[c]+1; b<end; ++b){
+      A=sc->val + b*bsz2;
+      for(i=0; i<n; ++i)
+        sba_blk_lsolve(L, A+i*n, n);
+    }
+
+    /* S_r1r2 -= L_r1c L_r2c^T for all r1>=r2 in column c */
+    for(b2=sc->colptr[c]+1; b2<end; ++b2){
+      r2=sc->rowidx[b2];
+      for(b=sc->colptr[r2]; b<sc->colptr[r2+1]; ++b)
+        sc->map[sc->rowidx[b]]=b;
+
+      /* B=L_r2c^T, so that the innermost loop below runs over contiguous rows */
+      B=sc->work;
+      A=sc->val + b2*bsz2;
+      for(i=0; i<n; ++i)
+        for(j=0; j<n; ++j)
+          B[j*n+i]=A[i*n+j];
+
+      for(b1=b2; b1<end; ++b1){
+        A=sc->val + b1*bsz2;
+        T=sc->val + sc->map[sc->rowidx[b1]]*bsz2;
+        for(i=0; i<n; ++i, T+=n)
+          for(k=0; k<n; ++k){
+            sum=A[i*n+k];
+            for(j=0; j<n; ++j)
+              T[j]-=sum*B[k*n+j];
+          }
+      }
+    }
+  }
+
+  return 1;
+}
+
+#else
+
+/* y=S x, S being stored by its lower triangle */
+static void sba_schur_mult(struct sba_schur *sc, double *x, double *y)
+{
+const int n=sc->bsz, bsz2=n*n;
+int c, b, r;
+register int i, j;
+register double *A, sum;
+
+  memset(y, 0, sc->nb*n*sizeof(double));
+  for(c=0; c<sc->nb; ++c)
+    for(b=sc->colptr[c]; b<sc->colptr[c+1]; ++b){
+      r=sc->rowidx[b];
+      A=sc->val + b*bsz2;
+      for(i=0; i<n; ++i){
+        for(j=0, sum=0.0; j<n; ++j)
+          sum+=A[i*n+j]*x[c*n+j];
+        y[r*n+i]+=sum;
+      }
+      if(r!=c)
+        for(j=0; j<n; ++j){
+          for(i=0, sum=0.0; i<n; ++i)
+            sum+=A[i*n+j]*x[r*n+i];
+          y[c*n+j]+=sum;
+        }
+    }
+}
+
+/* z=M^-1 r, M being the block diagonal of S given by the Cholesky factors D of its blocks */
+static void sba_schur_precond(struct sba_schur *sc, double *D, double *r, double *z)
+{
+const int n=sc->bsz;
+int c;
+
+  memcpy(z, r, sc->nb*n*sizeof(double));
+  for(c=0; c<sc->nb; ++c){
+    sba_blk_lsolve(D + c*n*n, z + c*n, n);
+    sba_blk_ltsolve(D + c*n*n, z + c*n, n);
+  }
+}
+#endif /* SBA_SCHUR_PCG */
+
+/* Solve S da=E for the da_j of the cameras that are not fixed, S having been computed
+ * with sba_schur_build(). E and da point to the e_j and da_j of the first camera that
+ * is not fixed. S is destroyed. Returns 0 if the system could not be solved
+ */
+int sba_schur_solve(struct sba_schur *sc, double *E, double *da)
+{
+const int n=sc->bsz, dim=sc->nb*n;
+int c;
+register int i;
+register double sum;
+
+#ifndef SBA_SCHUR_PCG
+  int b, r;
+  register int j;
+  register double *A, *y;
+
+  if(!sba_schur_factor(sc)) return 0;
+
+  y=sc->work;
+  for(c=0; c<sc->nb; ++c)
+    memcpy(y + sc->perm[c]*n, E + c*n, n*sizeof(double));
+
+  /* L z=y */
+  for(c=0; c<sc->nb; ++c){
+    sba_blk_lsolve(sc->val + sc->colptr[c]*n*n, y + c*n, n);
+    for(b=sc->colptr[c]+1; b<sc->colptr[c+1]; ++b){
+      r=sc->rowidx[b];
+      A=sc->val + b*n*n;
+      for(i=0; i<n; ++i){
+        for(j=0, sum=0.0; j<n; ++j)
+          sum+=A[i*n+j]*y[c*n+j];
+        y[r*n+i]-=sum;
+      }
+    }
+  }
+
+  /* L^T x=z */
+  for(c=sc->nb-1; c>=0; --c){
+    for(b=sc->colptr[c]+1; b<sc->colptr[c+1]; ++b){
+      r=sc->rowidx[b];
+      A=sc->val + b*n*n;
+      for(j=0; j<n; ++j){
+        for(i=0, sum=0.0; i<n; ++i)
+          sum+=A[i*n+j]*y[r*n+i];
+        y[c*n+j]-=sum;
+      }
+    }
+    sba_blk_ltsolve(sc->val + sc->colptr[c]*n*n, y + c*n, n);
+  }
+
+  for(c=0; c<sc->nb; ++c)
+    memcpy(da + c*n, y + sc->perm[c]*n, n*sizeof(double));
+
+  for(i=0; i<dim; ++i)
+    if(!SBA_FINITE(da[i])) return 0;
+
+  return 1;
+#else
+  double *res, *z, *p, *q, *D;
+  double rz, rz1, alpha, bnorm, rnorm;
+  int iter, niter=(3*dim)/2;
+  const double eps=1E-10;
+
+  res=sc->work; z=res+dim; p=z+dim; q=p+dim; D=q+dim;
+
+  /* block Jacobi preconditioner */
+  for(c=0; c<sc->nb; ++c){
+    memcpy(D + c*n*n, sc->val + sc->colptr[c]*n*n, n*n*sizeof(double));
+    if(!sba_blk_chol(D + c*n*n, n)) return 0;
+  }
+
+  for(i=0, bnorm=0.0; i<dim; ++i){
+    da[i]=0.0;
+    res[i]=E[i];
+    bnorm+=E[i]*E[i];
+  }
+  if(bnorm==0.0) return 1;
+
+  sba_schur_precond(sc, D, res, z);
+  for(i=0, rz=0.0; i<dim; ++i){
+    p[i]=z[i];
+    rz+=res[i]*z[i];
+  }
+
+  for(iter=0; iter<niter; ++iter){
+    sba_schur_mult(sc, p, q);
+    for(i=0, sum=0.0; i<dim; ++i)
+      sum+=p[i]*q[i];
+    if(!(sum>0.0)) return 0; /* S is not positive definite */
+    alpha=rz/sum;
+
+    for(i=0, rnorm=0.0; i<dim; ++i){
+      da[i]+=alpha*p[i];
+      res[i]-=alpha*q[i];
+      rnorm+=res[i]*res[i];
+    }
+    if(rnorm<=eps*eps*bnorm) break;
+
+    sba_schur_precond(sc, D, res, z);
+    for(i=0, rz1=0.0; i<dim; ++i)
+      rz1+=res[i]*z[i];
+    for(i=0, sum=rz1/rz; i<dim; ++i)
+      p[i]=z[i] + sum*p[i];
+    rz=rz1;
+  }
+
+  for(i=0; i<dim; ++i)
+    if(!SBA_FINITE(da[i])) return 0;
+
+  return 1;
+#endif /* SBA_SCHUR_PCG */
+}
@@ -0,0 +1,277 @@
+/////////////////////////////////////////////////////////////////////////////////
+////
+////  Parallel loops for sparse bundle adjustment
+////
+////  This program is free software; you can redistribute it and/or modify
+////  it under the terms of the GNU General Public License as published by
+////  the Free Software Foundation; either version 2 of the License, or
+////  (at your option) any later version.
+////
+////  This program is distributed in the hope that it will be useful,
+////  but WITHOUT ANY WARRANTY; without even the implied warranty of
+////  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+////  GNU General Public License for more details.
+////
+///////////////////////////////////////////////////////////////////////////////////
+
+/* The iterations of a loop are split in chunks of consecutive iterations that
+ * the threads claim one at a time. Which thread runs a chunk changes from run
+ * to run, the chunks themselves do not: a loop whose iterations write disjoint
+ * results, or that reduces per chunk partial results in chunk order, computes
+ * the same values for any number of threads.
+ *
+ * A minimization runs several loops per iteration. So that they do not start
+ * and join threads every time, sba_pool_start() starts a pool of workers for the
+ * calling thread, which its loops use until sba_pool_stop().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "compiler.h"
+#include "sba.h"
+
+struct sba_pfor_{
+  pthread_mutex_t lock; /* guards next */
+  int next, n, chunk;
+  void (*body)(int first, int last, int thread, void *data);
+  void *data;
+};
+
+struct sba_pfor_thread_{
+  struct sba_pfor_ *pf;
+  int thread;
+};
+
+static void *sba_pfor_run(void *arg)
+{
+struct sba_pfor_thread_ *t=(struct sba_pfor_thread_ *)arg;
+struct sba_pfor_ *pf=t->pf;
+int first, last;
+
+  while(1){
+    pthread_mutex_lock(&pf->lock);
+    first=pf->next;
+    if(first<pf->n) pf->next+=pf->chunk;
+    pthread_mutex_unlock(&pf->lock);
+
+    if(first>=pf->n) break;
+    last=(pf->n-first>pf->chunk)? first+pf->chunk : pf->n;
+    (*pf->body)(first, last, t->thread, pf->data);
+  }
+
+  return NULL;
+}
+
+struct sba_pool_arg_{
+  struct sba_pfor_thread_ run; /* the loop the worker takes part in */
+  struct sba_pool_ *pool;
+};
+
+struct sba_pool_{
+  int nworkers;         /* workers besides the thread that owns the pool */
+  pthread_t *threads;
+  struct sba_pool_arg_ *args; /* args[i] for worker i, 1<=i<=nworkers */
+  pthread_mutex_t lock; /* guards the fields below */
+  pthread_cond_t go, done;
+  unsigned long gen;    /* number of loops handed out */
+  int nactive;          /* threads of the current loop, the owner included */
+  int running;          /* workers still running the current loop */
+  int quit;
+  int busy;             /* the owner is in a loop; touched by the owner only */
+};
+
+#ifdef SBA_HAVE_THREAD_LOCAL
+/* the pool of the calling thread, if it started one */
+static SBA_THREAD_LOCAL struct sba_pool_ *sba_pool=NULL;
+#endif
+
+static void *sba_pool_run(void *arg)
+{
+struct sba_pool_arg_ *a=(struct sba_pool_arg_ *)arg;
+struct sba_pool_ *pool=a->pool;
+unsigned long seen=0;
+
+  pthread_mutex_lock(&pool->lock);
+  while(1){
+    while(pool->gen==seen && !pool->quit)
+      pthread_cond_wait(&pool->go, &pool->lock);
+    if(pool->quit) break;
+
+    seen=pool->gen;
+    if(a->run.thread>=pool->nactive) continue; /* not needed for this loop */
+
+    pthread_mutex_unlock(&pool->lock);
+    sba_pfor_run(&a->run);
+    pthread_mutex_lock(&pool->lock);
+
+    if(--pool->running==0)
+      pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+/* Start nthreads-1 workers that the parallel loops of the calling thread use
+ * until sba_pool_stop(). Returns 1 if a pool was started, 0 if not, e.g. because
+ * nthreads<=1 or the thread already has one; the loops then start their own
+ * threads as needed
+ */
+int sba_pool_start(int nthreads)
+{
+#ifdef SBA_HAVE_THREAD_LOCAL
+struct sba_pool_ *pool;
+register int i;
+
+  if(nthreads<=1 || sba_pool!=NULL) return 0;
+
+  pool=(struct sba_pool_ *)malloc(sizeof(struct sba_pool_));
+  if(pool==NULL) return 0;
+  pool->threads=(pthread_t *)malloc(nthreads*sizeof(pthread_t));
+  pool->args=(struct sba_pool_arg_ *)malloc(nthreads*sizeof(struct sba_pool_arg_));
+  if(pool->threads==NULL || pool->args==NULL){
+    free(pool->threads); free(pool->args); free(pool);
+    return 0;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->go, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->gen=0; pool->nactive=1; pool->running=0;
+  pool->quit=0; pool->busy=0;
+
+  /* workers that cannot be started just leave their chunks to the others */
+  for(i=1; i<nthreads; ++i){
+    pool->args[i].run.pf=NULL;
+    pool->args[i].run.thread=i;
+    pool->args[i].pool=pool;
+    if(pthread_create(pool->threads+i, NULL, sba_pool_run, pool->args+i)) break;
+  }
+  pool->nworkers=i-1;
+
+  sba_pool=pool;
+  return 1;
+#else
+  return 0; /* the pool could not be told apart from those of other threads */
+#endif
+}
+
+/* End the workers started by sba_pool_start() */
+void sba_pool_stop(void)
+{
+#ifdef SBA_HAVE_THREAD_LOCAL
+struct sba_pool_ *pool=sba_pool;
+register int i;
+
+  if(pool==NULL) return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->quit=1;
+  pthread_cond_broadcast(&pool->go);
+  pthread_mutex_unlock(&pool->lock);
+
+  for(i=1; i<=pool->nworkers; ++i)
+    pthread_join(pool->threads[i], NULL);
+
+  pthread_cond_destroy(&pool->go);
+  pthread_cond_destroy(&pool->done);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->threads);
+  free(pool->args);
+  free(pool);
+  sba_pool=NULL;
+#endif
+}
+
+/* Call body(first, last, thread, data) for the chunks [first, last) of at most
+ * chunk iterations that make up [0, n), on nthreads threads. thread is in
+ * [0, nthreads) and identifies the calling thread, e.g. to select its work
+ * arrays; the caller runs as thread 0. With nthreads<=1 the chunks are run in
+ * order by the caller. Handing a loop to the workers of the caller's pool costs
+ * a wakeup per worker; without a pool (or in a loop nested in another one)
+ * threads are created and joined for the loop
+ */
+void sba_parallel_for(int nthreads, int n, int chunk,
+                      void (*body)(int first, int last, int thread, void *data), void *data)
+{
+struct sba_pfor_ pf;
+struct sba_pfor_thread_ *args;
+pthread_t *threads;
+register int i;
+int nchunks, nstarted;
+#ifdef SBA_HAVE_THREAD_LOCAL
+struct sba_pool_ *pool;
+#endif
+
+  if(n<=0) return;
+  if(chunk<1) chunk=1;
+  nchunks=(n-1)/chunk + 1;
+  if(nthreads>nchunks) nthreads=nchunks;
+
+  if(nthreads<=1){
+    for(i=0; i<n; i+=chunk)
+      (*body)(i, (n-i>chunk)? i+chunk : n, 0, data);
+    return;
+  }
+
+  pthread_mutex_init(&pf.lock, NULL);
+  pf.next=0; pf.n=n; pf.chunk=chunk;
+  pf.body=body; pf.data=data;
+
+#ifdef SBA_HAVE_THREAD_LOCAL
+  pool=sba_pool;
+  if(pool!=NULL && !pool->busy && pool->nworkers>0){
+    struct sba_pfor_thread_ self;
+
+    if(nthreads>pool->nworkers+1) nthreads=pool->nworkers+1;
+    pool->busy=1;
+
+    pthread_mutex_lock(&pool->lock);
+    for(i=1; i<nthreads; ++i)
+      pool->args[i].run.pf=&pf;
+    pool->nactive=nthreads;
+    pool->running=nthreads-1;
+    ++pool->gen;
+    pthread_cond_broadcast(&pool->go);
+    pthread_mutex_unlock(&pool->lock);
+
+    self.pf=&pf;
+    self.thread=0;
+    sba_pfor_run(&self);
+
+    pthread_mutex_lock(&pool->lock);
+    while(pool->running>0)
+      pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool->busy=0;
+    pthread_mutex_destroy(&pf.lock);
+    return;
+  }
+#endif
+
+  threads=(pthread_t *)malloc(nthreads*sizeof(pthread_t));
+  args=(struct sba_pfor_thread_ *)malloc(nthreads*sizeof(struct sba_pfor_thread_));
+  if(threads==NULL || args==NULL){
+    fprintf(stderr, "SBA: memory allocation request failed in sba_parallel_for(), exiting\n");
+    exit(1);
+  }
+
+  for(i=0; i<nthreads; ++i){
+    args[i].pf=&pf;
+    args[i].thread=i;
+  }
+
+  /* threads that cannot be started just leave their chunks to the others */
+  for(i=1, nstarted=1; i<nthreads; ++i, ++nstarted)
+    if(pthread_create(threads+i, NULL, sba_pfor_run, args+i)) break;
+  sba_pfor_run(args);
+  for(i=1; i<nstarted; ++i)
+    pthread_join(threads[i], NULL);
+
+  pthread_mutex_destroy(&pf.lock);
+  free(threads);
+  free(args);
+}
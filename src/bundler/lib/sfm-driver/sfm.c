@@ -23,7 +23,9 @@
 #include <string.h>
 
 #include "sba.h"
+#include "sba_chkjac.h"
 
+#include "defines.h"
 #include "matrix.h"
 #include "vector.h"
 #include "sfm.h"
@@ -52,6 +54,12 @@ typedef struct {
     camera_params_t *init_params;  /* Initial camera parameters */
 
     v3_t *points;
+
+    /* Rotation of each camera for the last update w seen by the
+     * projection functions (see sfm_update_rotation).  Only the
+     * thread projecting camera j touches entry j */
+    double *last_ws;
+    double *last_Rs;
 } sfm_global_t;
 
 static void *safe_malloc(int n, char *where)
@@ -373,8 +381,22 @@ void sfm_project_rd(camera_params_t *init, double *K, double *k,
     }
 }
 
-static double *global_last_ws = NULL;
-static double *global_last_Rs = NULL;
+/* Return the rotation of camera j after the update w, recomputing it
+ * only when w has changed since the last call */
+static double *sfm_update_rotation(sfm_global_t *globs, int j, double *w)
+{
+    if (w[0] != globs->last_ws[3 * j + 0] ||
+	w[1] != globs->last_ws[3 * j + 1] ||
+	w[2] != globs->last_ws[3 * j + 2]) {
+
+	rot_update(globs->init_params[j].R, w, globs->last_Rs + 9 * j);
+	globs->last_ws[3 * j + 0] = w[0];
+	globs->last_ws[3 * j + 1] = w[1];
+	globs->last_ws[3 * j + 2] = w[2];
+    }
+
+    return globs->last_Rs + 9 * j;
+}
 
 static void sfm_project_point(int j, int i, double *aj, double *bi, 
                               double *xij, void *adata)
@@ -478,19 +500,8 @@ static void sfm_project_point2_fisheye(int j, int i, double *aj, double *bi,
     dt[2] = 0.0;
 #endif
 
-    if (w[0] != global_last_ws[3 * j + 0] ||
-	w[1] != global_last_ws[3 * j + 1] ||
-	w[2] != global_last_ws[3 * j + 2]) {
-
-	// printf("updating w: %0.3f, %0.3f, %0.3f\n", w[0], w[1], w[2]);
-
-	rot_update(globs->init_params[j].R, w, global_last_Rs + 9 * j);
-	global_last_ws[3 * j + 0] = w[0];
-	global_last_ws[3 * j + 1] = w[1];
-	global_last_ws[3 * j + 2] = w[2];
-    }
-    
-    sfm_project2(globs->init_params + j, f, global_last_Rs + 9 * j, 
+    sfm_project2(globs->init_params + j, f, 
+                 sfm_update_rotation(globs, j, w), 
 		 dt, bi, xij_tmp, globs->explicit_camera_centers);
 
     /* Distort the point */
@@ -542,21 +553,221 @@ static void sfm_project_point3(int j, int i, double *aj, double *bi,
     else
         k = aj + 6;
 
-    if (w[0] != global_last_ws[3 * j + 0] ||
-	w[1] != global_last_ws[3 * j + 1] ||
-	w[2] != global_last_ws[3 * j + 2]) {
-
-	rot_update(globs->init_params[j].R, w, global_last_Rs + 9 * j);
-	global_last_ws[3 * j + 0] = w[0];
-	global_last_ws[3 * j + 1] = w[1];
-	global_last_ws[3 * j + 2] = w[2];
-    }
-    
-    sfm_project_rd(globs->init_params + j, K, k, global_last_Rs + 9 * j, 
+    sfm_project_rd(globs->init_params + j, K, k, 
+                   sfm_update_rotation(globs, j, w), 
                    dt, bi, xij, globs->estimate_distortion, 
                    globs->explicit_camera_centers);
 }
 
+/* Analytic Jacobian of sfm_project_point3.  Fills in Aij, the 2 x cnp
+ * derivative of the projection with respect to the camera parameters
+ * (translation, rotation update, focal length, distortion, in that
+ * order), and Bij, the 2 x 3 derivative with respect to the point.
+ * Both are stored row by row, as sba expects.
+ *
+ * The rotation is R = exp([w]_x) R0, so the derivative of R * y with
+ * respect to w is -[R * y]_x J(w), where J is the left Jacobian of
+ * the exponential map:
+ *
+ *   J(w) = I + (1 - cos t) / t^2 [w]_x + (t - sin t) / t^3 [w]_x^2,
+ *
+ * with t = |w|. */
+static void sfm_project_point3_jac(int j, int i, double *aj, double *bi,
+                                   double *Aij, double *Bij, void *adata)
+{
+    sfm_global_t *globs = (sfm_global_t *) adata;
+    camera_params_t *cam = globs->init_params + j;
+    int cnp = globs->num_params_per_camera;
+
+    double *dt = aj + 0, *w = aj + 3, *k, *R;
+    double f, df = 0.0;  /* focal length, d f / d aj[6] */
+    double k_scale = 1.0;
+
+    double y[3], b_cam[3];
+    double wx[9], wxsq[9], Jw[9], yx[9], dX_dw[9];
+    double du_dX[6];     /* d (u, v) / d b_cam */
+    double dp_du[4];     /* d p / d (u, v) before radial distortion */
+    double dp_df[2];     /* d p / d f before radial distortion */
+    double M[4];         /* d x_ij / d p */
+    double dx_dX[6];     /* d x_ij / d b_cam */
+    double dx_df[2];
+    double p[2], u, v, theta;
+    int c, r;
+
+    /* Intrinsics, as in sfm_project_point3 */
+    if (!globs->est_focal_length) {
+        f = cam->f;
+    } else if (globs->const_focal_length) {
+        f = globs->global_params.f;
+    } else {
+#ifndef TEST_FOCAL
+        f = aj[6];
+        df = 1.0;
+#else
+        f = aj[6] / cam->f_scale;
+        df = 1.0 / cam->f_scale;
+#endif
+    }
+
+#ifdef TEST_FOCAL
+    k_scale = cam->k_scale;
+#endif
+
+    k = aj + (globs->est_focal_length ? 7 : 6);
+    R = sfm_update_rotation(globs, j, w);
+
+    /* Point in camera coordinates */
+    if (!globs->explicit_camera_centers) {
+        matrix_product331(R, bi, y);
+        b_cam[0] = y[0] + dt[0];
+        b_cam[1] = y[1] + dt[1];
+        b_cam[2] = y[2] + dt[2];
+    } else {
+        double b2[3] = { bi[0] - dt[0], bi[1] - dt[1], bi[2] - dt[2] };
+        matrix_product331(R, b2, y);
+        b_cam[0] = y[0];
+        b_cam[1] = y[1];
+        b_cam[2] = y[2];
+    }
+
+    /* d b_cam / d w = -[y]_x J(w) = yx * J(w) */
+    wx[0] = 0.0;   wx[1] = -w[2]; wx[2] = w[1];
+    wx[3] = w[2];  wx[4] = 0.0;   wx[5] = -w[0];
+    wx[6] = -w[1]; wx[7] = w[0];  wx[8] = 0.0;
+
+    matrix_product33(wx, wx, wxsq);
+    theta = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+
+    for (r = 0; r < 9; r++)
+        Jw[r] = (r % 4 == 0) ? 1.0 : 0.0;
+
+    if (theta < 1.0e-8) {
+        for (r = 0; r < 9; r++)
+            Jw[r] += 0.5 * wx[r];
+    } else {
+        double a = (1.0 - cos(theta)) / (theta * theta);
+        double b = (theta - sin(theta)) / (theta * theta * theta);
+        for (r = 0; r < 9; r++)
+            Jw[r] += a * wx[r] + b * wxsq[r];
+    }
+
+    yx[0] = 0.0;   yx[1] = y[2];  yx[2] = -y[1];
+    yx[3] = -y[2]; yx[4] = 0.0;   yx[5] = y[0];
+    yx[6] = y[1];  yx[7] = -y[0]; yx[8] = 0.0;
+    matrix_product33(yx, Jw, dX_dw);
+
+    /* Perspective division */
+    u = -b_cam[0] / b_cam[2];
+    v = -b_cam[1] / b_cam[2];
+
+    du_dX[0] = -1.0 / b_cam[2]; du_dX[1] = 0.0; du_dX[2] = -u / b_cam[2];
+    du_dX[3] = 0.0; du_dX[4] = -1.0 / b_cam[2]; du_dX[5] = -v / b_cam[2];
+
+    /* Intrinsics */
+    if (!cam->known_intrinsics) {
+        p[0] = f * u;
+        p[1] = f * v;
+        dp_du[0] = f;   dp_du[1] = 0.0;
+        dp_du[2] = 0.0; dp_du[3] = f;
+        dp_df[0] = u;
+        dp_df[1] = v;
+    } else {
+        double *kk = cam->k_known;
+        double *K = cam->K_known;
+        double rsq = u * u + v * v;
+        double factor = 1.0 + kk[0] * rsq + 
+            kk[1] * rsq * rsq + kk[4] * rsq * rsq * rsq;
+        double g = kk[0] + 2.0 * kk[1] * rsq + 3.0 * kk[4] * rsq * rsq;
+
+        double x_d = u * factor + 
+            2 * kk[2] * u * v + kk[3] * (rsq + 2 * u * u);
+        double y_d = v * factor + 
+            kk[2] * (rsq + 2 * v * v) + 2 * kk[3] * u * v;
+
+        double dxd_du = factor + 2 * g * u * u + 2 * kk[2] * v + 6 * kk[3] * u;
+        double dxd_dv = 2 * g * u * v + 2 * kk[2] * u + 2 * kk[3] * v;
+        double dyd_du = 2 * g * u * v + 2 * kk[2] * u + 2 * kk[3] * v;
+        double dyd_dv = factor + 2 * g * v * v + 6 * kk[2] * v + 2 * kk[3] * u;
+
+        p[0] = K[0] * x_d + K[1] * y_d + K[2];
+        p[1] = K[4] * y_d + K[5];
+
+        dp_du[0] = K[0] * dxd_du + K[1] * dyd_du;
+        dp_du[1] = K[0] * dxd_dv + K[1] * dyd_dv;
+        dp_du[2] = K[4] * dyd_du;
+        dp_du[3] = K[4] * dyd_dv;
+        dp_df[0] = dp_df[1] = 0.0;
+    }
+
+    /* Radial distortion */
+    M[0] = 1.0; M[1] = 0.0;
+    M[2] = 0.0; M[3] = 1.0;
+    dx_df[0] = dp_df[0];
+    dx_df[1] = dp_df[1];
+
+    c = globs->est_focal_length ? 7 : 6;
+
+    if (globs->estimate_distortion) {
+        double k1 = k[0] / k_scale, k2 = k[1] / k_scale;
+        double rsq = (p[0] * p[0] + p[1] * p[1]) / (f * f);
+        double factor = 1.0 + k1 * rsq + k2 * rsq * rsq;
+        double g = k1 + 2.0 * k2 * rsq;
+
+        M[0] = factor + 2.0 * g * p[0] * p[0] / (f * f);
+        M[1] = 2.0 * g * p[0] * p[1] / (f * f);
+        M[2] = M[1];
+        M[3] = factor + 2.0 * g * p[1] * p[1] / (f * f);
+
+        dx_df[0] = M[0] * dp_df[0] + M[1] * dp_df[1] - 2.0 * g * p[0] * rsq / f;
+        dx_df[1] = M[2] * dp_df[0] + M[3] * dp_df[1] - 2.0 * g * p[1] * rsq / f;
+
+        Aij[0 * cnp + c + 0] = p[0] * rsq / k_scale;
+        Aij[0 * cnp + c + 1] = p[0] * rsq * rsq / k_scale;
+        Aij[1 * cnp + c + 0] = p[1] * rsq / k_scale;
+        Aij[1 * cnp + c + 1] = p[1] * rsq * rsq / k_scale;
+    }
+
+    /* d x_ij / d b_cam = M * dp_du * du_dX */
+    for (r = 0; r < 2; r++) {
+        double a0 = M[2 * r + 0] * dp_du[0] + M[2 * r + 1] * dp_du[2];
+        double a1 = M[2 * r + 0] * dp_du[1] + M[2 * r + 1] * dp_du[3];
+
+        for (c = 0; c < 3; c++)
+            dx_dX[3 * r + c] = a0 * du_dX[c] + a1 * du_dX[3 + c];
+    }
+
+    /* Chain through b_cam */
+    for (r = 0; r < 2; r++) {
+        for (c = 0; c < 3; c++) {
+            double d_db = dx_dX[3 * r + 0] * R[0 + c] + 
+                dx_dX[3 * r + 1] * R[3 + c] + dx_dX[3 * r + 2] * R[6 + c];
+
+            double d_dw = dx_dX[3 * r + 0] * dX_dw[0 + c] + 
+                dx_dX[3 * r + 1] * dX_dw[3 + c] + dx_dX[3 * r + 2] * dX_dw[6 + c];
+
+            Bij[3 * r + c] = d_db;
+            Aij[cnp * r + 3 + c] = d_dw;
+
+            /* d b_cam / d dt is I, or -R with explicit camera centers */
+            Aij[cnp * r + c] = 
+                globs->explicit_camera_centers ? -d_db : dx_dX[3 * r + c];
+        }
+
+        if (globs->est_focal_length)
+            Aij[cnp * r + 6] = dx_df[r] * df;
+    }
+}
+
+static void sfm_project_point3_mot_jac(int j, int i, double *aj, 
+                                       double *Aij, void *adata)
+{
+    sfm_global_t *globs = (sfm_global_t *) adata;
+    double *b = globs->points[i].p;
+    double Bij[6];
+
+    sfm_project_point3_jac(j, i, aj, b, Aij, Bij, adata);
+}
+
 static void sfm_project_point3_mot(int j, int i, double *aj, 
                                    double *xij, void *adata)
 {
@@ -596,7 +807,7 @@ static void sfm_mot_project_point(int j, int i, double *bi,
 #define SBA_V121
 
 void run_sfm(int num_pts, int num_cameras, int ncons,
-             char *vmask,
+             struct sba_crsm *vis,
              double *projections,
              int est_focal_length,
              int const_focal_length,
@@ -611,6 +822,8 @@ void run_sfm(int num_pts, int num_cameras, int ncons,
              int fix_points,
              int optimize_for_fisheye,
              double eps2,
+             int check_jacobians,
+             int num_threads,
              double *Vout, 
              double *Sout,
              double *Uout, double *Wout
@@ -799,23 +1012,61 @@ void run_sfm(int num_pts, int num_cameras, int ncons,
     global_params.global_params.f = 1.0;
     global_params.init_params = init_camera_params;
 
-    global_last_ws = 
-	safe_malloc(3 * num_cameras * sizeof(double), "global_last_ws");
+    global_params.last_ws = 
+	safe_malloc(3 * num_cameras * sizeof(double), "last_ws");
 
-    global_last_Rs = 
-	safe_malloc(9 * num_cameras * sizeof(double), "global_last_ws");
+    global_params.last_Rs = 
+	safe_malloc(9 * num_cameras * sizeof(double), "last_Rs");
 
     global_params.points = init_pts;
 
     for (i = 0; i < num_cameras; i++) {
-	global_last_ws[3 * i + 0] = 0.0;
-	global_last_ws[3 * i + 1] = 0.0;
-	global_last_ws[3 * i + 2] = 0.0;
+	global_params.last_ws[3 * i + 0] = 0.0;
+	global_params.last_ws[3 * i + 1] = 0.0;
+	global_params.last_ws[3 * i + 2] = 0.0;
 
-	memcpy(global_last_Rs + 9 * i, 
+	memcpy(global_params.last_Rs + 9 * i, 
 	       init_camera_params[i].R, 9 * sizeof(double));
     }
 
+    /* Compare the analytic Jacobians against finite differences at
+     * the starting point */
+    if (check_jacobians && optimize_for_fisheye == 0) {
+        int num_checked = 0, num_suspicious = 0;
+
+        for (i = 0; i < num_pts; i++) {
+            int k;
+            for (k = vis->rowptr[i]; k < vis->rowptr[i+1]; k++) {
+                j = vis->colidx[k];
+
+                if (j < ncons)
+                    continue;
+
+                if (fix_points == 0) {
+                    num_suspicious += 
+                        sba_motstr_chkjac(sfm_project_point3, 
+                                          sfm_project_point3_jac,
+                                          params + cnp * j, 
+                                          params + num_camera_params + 3 * i,
+                                          j, i, cnp, 3, 2, 
+                                          &global_params, &global_params);
+                } else {
+                    num_suspicious += 
+                        sba_mot_chkjac(sfm_project_point3_mot, 
+                                       sfm_project_point3_mot_jac,
+                                       params + cnp * j, NULL,
+                                       j, i, cnp, 0, 2, 
+                                       &global_params, &global_params);
+                }
+
+                num_checked++;
+            }
+        }
+
+        printf("[run_sfm] Jacobian check: %d suspicious gradients "
+               "in %d projections\n", num_suspicious, num_checked);
+    }
+
     /* Run sparse bundle adjustment */
 #define MAX_ITERS 150 // 256
 #define VERBOSITY 3
@@ -824,35 +1075,38 @@ void run_sfm(int num_pts, int num_cameras, int ncons,
     if (fix_points == 0) {
         if (optimize_for_fisheye == 0) {
             sba_motstr_levmar(num_pts, num_cameras, ncons, 
-                              vmask, params, cnp, 3, projections, NULL, 2, 
+                              vis, params, cnp, 3, projections, NULL, 2, 
                               //remove NULL in prev line for sba v1.2.1
-                              sfm_project_point3, NULL, 
+                              sfm_project_point3, sfm_project_point3_jac, 
                               (void *) (&global_params),
                               MAX_ITERS, VERBOSITY, opts, info,
                               use_constraints, constraints,
                               use_point_constraints,
-                              point_constraints, Vout, Sout, Uout, Wout);
+                              point_constraints, Vout, Sout, Uout, Wout,
+                              num_threads);
         } else {
             sba_motstr_levmar(num_pts, num_cameras, ncons, 
-                              vmask, params, cnp, 3, projections, NULL, 2,
+                              vis, params, cnp, 3, projections, NULL, 2,
                               sfm_project_point2_fisheye, NULL, 
                               (void *) (&global_params),
                               MAX_ITERS, VERBOSITY, opts, info,
                               use_constraints, constraints,
                               use_point_constraints,
-                              point_constraints, Vout, Sout, Uout, Wout); 
+                              point_constraints, Vout, Sout, Uout, Wout,
+                              num_threads);
         }
     } else {
         if (optimize_for_fisheye == 0) {
             sba_mot_levmar(num_pts, num_cameras, ncons, 
-                           vmask, params, cnp, projections, NULL, 2,
-                           sfm_project_point3_mot, NULL, 
+                           vis, params, cnp, projections, NULL, 2,
+                           sfm_project_point3_mot, 
+                           sfm_project_point3_mot_jac, 
                            (void *) (&global_params),
                            MAX_ITERS, VERBOSITY, opts, info,
                            use_constraints, constraints);
         } else {
             sba_mot_levmar(num_pts, num_cameras, ncons, 
-                           vmask, params, cnp, projections, NULL, 2,
+                           vis, params, cnp, projections, NULL, 2,
                            sfm_project_point2_fisheye_mot, NULL, 
                            (void *) (&global_params),
                            MAX_ITERS, VERBOSITY, opts, info,
@@ -862,14 +1116,14 @@ void run_sfm(int num_pts, int num_cameras, int ncons,
 #else
     if (fix_points == 0) {
 	sba_motstr_levmar(num_pts, num_cameras, ncons, 
-			  vmask, params, cnp, 3, projections, 2,
+			  vis, params, cnp, 3, projections, 2,
 			  sfm_project_point2, NULL, (void *) (&global_params),
 			  MAX_ITERS, VERBOSITY, opts, info, 
 			  use_constraints, constraints, 
                           Vout, Sout, Uout, Wout);
     } else {
 	sba_mot_levmar(num_pts, num_cameras, ncons, 
-		       vmask, params, cnp, projections, 2,
+		       vis, params, cnp, projections, 2,
 		       sfm_mot_project_point, NULL, (void *) (&global_params),
 		       MAX_ITERS, VERBOSITY, opts, info);
     }
@@ -956,8 +1210,9 @@ void run_sfm(int num_pts, int num_cameras, int ncons,
 	for (j = 0; j < num_pts; j++) {
 	    double b[3], pr[2];
 	    double dx, dy, dist;
+            int k = sba_crsm_elmidx(vis, j, i);
 
-	    if (!vmask[j * num_cameras + i])
+	    if (k == -1)
 		continue;
 
 	    b[0] = Vx(init_pts[j]);
@@ -967,8 +1222,8 @@ void run_sfm(int num_pts, int num_cameras, int ncons,
 	    sfm_project(&(init_camera_params[i]), K, w, dt, b, pr,
 			global_params.explicit_camera_centers);
 
-	    dx = pr[0] - Vx(projections[j * num_cameras + i]);
-	    dy = pr[1] - Vy(projections[j * num_cameras + i]);
+	    dx = pr[0] - projections[2 * k + 0];
+	    dy = pr[1] - projections[2 * k + 1];
 
 	    dist = dx * dx + dy * dy;
 	    error += dist;
@@ -976,8 +1231,8 @@ void run_sfm(int num_pts, int num_cameras, int ncons,
 	    if (dist > error_max) {
 		idx_max = j;
 		error_max = dist;
-		px_max = Vx(projections[j * num_cameras + i]);
-		py_max = Vy(projections[j * num_cameras + i]);
+		px_max = projections[2 * k + 0];
+		py_max = projections[2 * k + 1];
 	    }
 	    
 	    num_projs++;
@@ -1002,22 +1257,24 @@ void run_sfm(int num_pts, int num_cameras, int ncons,
 	free(constraints);
     }
 
-    free(global_last_ws);
-    free(global_last_Rs);
+    free(global_params.last_ws);
+    free(global_params.last_Rs);
 
     // #endif
 }
 
 
-static int global_num_points = 0;
-static sfm_global_t *global_params = NULL;
-static v3_t *global_points = NULL;
-static v2_t *global_projections = NULL;
-static int global_constrain_focal = 0;
-static double global_init_focal = 0.0;
-static double global_constrain_focal_weight = 0.0;
-static double global_constrain_rd_weight = 0.0;
-static int global_round = 0;
+/* Data of camera_refine_residual, which lmdif calls without any
+ * context; kept per thread so that threads can refine cameras */
+static THREAD_LOCAL int global_num_points = 0;
+static THREAD_LOCAL sfm_global_t *global_params = NULL;
+static THREAD_LOCAL v3_t *global_points = NULL;
+static THREAD_LOCAL v2_t *global_projections = NULL;
+static THREAD_LOCAL int global_constrain_focal = 0;
+static THREAD_LOCAL double global_init_focal = 0.0;
+static THREAD_LOCAL double global_constrain_focal_weight = 0.0;
+static THREAD_LOCAL double global_constrain_rd_weight = 0.0;
+static THREAD_LOCAL int global_round = 0;
 
 void camera_refine_residual(const int *m, const int *n, 
 			    double *x, double *fvec, int *iflag) 
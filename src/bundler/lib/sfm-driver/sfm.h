@@ -26,6 +26,8 @@ extern "C" {
 
 #include "vector.h"
 
+struct sba_crsm;
+
 #define NUM_CAMERA_PARAMS 9
 #define POLY_INVERSE_DEGREE 6
 
@@ -65,8 +67,15 @@ void sfm_project_rd(camera_params_t *init, double *K, double *k,
 v2_t sfm_project_final(camera_params_t *params, v3_t pt,
 		       int explicit_camera_centers, int undistort);
 
+/* vis is the num_pts x num_cameras visibility structure (see sba.h):
+ * row i lists, in increasing order, the cameras that see point i.
+ * projections holds the matching (x, y) pairs in the same order.
+ * If check_jacobians is set, the analytic projection Jacobians are
+ * checked against finite differences before optimizing.  The
+ * bundle adjustment runs on num_threads threads; the result does not
+ * depend on their number */
 void run_sfm(int num_pts, int num_cameras, int ncons,
-             char *vmask,
+             struct sba_crsm *vis,
              double *projections,
              int est_focal_length,
              int const_focal_length,
@@ -81,6 +90,8 @@ void run_sfm(int num_pts, int num_cameras, int ncons,
              int fix_points,
              int optimize_for_fisheye, 
              double eps2,
+             int check_jacobians,
+             int num_threads,
              double *Vout,
              double *Sout,
              double *Uout, double *Wout);
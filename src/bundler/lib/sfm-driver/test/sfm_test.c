@@ -0,0 +1,236 @@
+/*
+ *  Copyright (c) 2008  Noah Snavely (snavely (at) cs.washington.edu)
+ *    and the University of Washington
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/* sfm_test.c */
+/* Check that run_sfm can run on several threads at once.  Two
+ * different synthetic problems are solved one after the other, then
+ * both at the same time on their own threads; the results must be
+ * bit-identical. */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "sba.h"
+#include "sfm.h"
+#include "vector.h"
+
+#define NUM_ROUNDS 4
+
+typedef struct {
+    unsigned int seed;        /* Seed for the synthetic scene */
+    int num_cameras;
+    int num_points;
+    int estimate_distortion;
+    int num_threads;          /* Threads given to run_sfm */
+
+    camera_params_t *cameras; /* Solution */
+    v3_t *points;
+} sfm_problem_t;
+
+/* Uniform random number in [-0.5, 0.5) from a private LCG state */
+static double test_rand(unsigned int *state)
+{
+    *state = *state * 1103515245u + 12345u;
+    return ((*state >> 8) & 0xffffff) / (double) 0x1000000 - 0.5;
+}
+
+static void rotation_y(double a, double *R)
+{
+    memset(R, 0, 9 * sizeof(double));
+
+    R[0] = cos(a);   R[2] = sin(a);
+    R[4] = 1.0;
+    R[6] = -sin(a);  R[8] = cos(a);
+}
+
+/* Build a row of cameras looking down -z at a strip of points, add
+ * noise to the projections and perturb the starting guess, then
+ * bundle adjust */
+static void *solve_problem(void *arg)
+{
+    sfm_problem_t *prob = (sfm_problem_t *) arg;
+    unsigned int state = prob->seed;
+    int m = prob->num_cameras, n = prob->num_points;
+    camera_params_t *cameras;
+    v3_t *points;
+    struct sba_crsm vis;
+    double *projections;
+    int i, j, k, nvis;
+
+    cameras = (camera_params_t *) calloc(m, sizeof(camera_params_t));
+    points = (v3_t *) malloc(n * sizeof(v3_t));
+
+    for (j = 0; j < m; j++) {
+        rotation_y(0.05 * test_rand(&state), cameras[j].R);
+        cameras[j].t[0] = 0.5 * j;
+        cameras[j].t[1] = 0.1 * test_rand(&state);
+        cameras[j].t[2] = 0.0;
+        cameras[j].f = 500.0;
+        cameras[j].f_scale = 1.0;
+        cameras[j].k_scale = 1.0;
+    }
+
+    for (i = 0; i < n; i++) {
+        points[i] = v3_new(0.5 * m * (test_rand(&state) + 0.5),
+                           test_rand(&state),
+                           -5.5 - test_rand(&state));
+    }
+
+    /* Each point is seen by the seven cameras nearest to it */
+    nvis = 0;
+    for (i = 0; i < n; i++) {
+        int c = (int) (Vx(points[i]) / 0.5);
+        for (j = c - 3; j <= c + 3; j++)
+            if (j >= 0 && j < m) nvis++;
+    }
+
+    sba_crsm_alloc(&vis, n, m, nvis);
+
+    k = 0;
+    for (i = 0; i < n; i++) {
+        int c = (int) (Vx(points[i]) / 0.5);
+
+        vis.rowptr[i] = k;
+        for (j = c - 3; j <= c + 3; j++) {
+            if (j >= 0 && j < m) {
+                vis.val[k] = k;
+                vis.colidx[k] = j;
+                k++;
+            }
+        }
+    }
+    vis.rowptr[n] = k;
+
+    projections = (double *) malloc(2 * nvis * sizeof(double));
+    for (i = 0; i < n; i++) {
+        for (k = vis.rowptr[i]; k < vis.rowptr[i+1]; k++) {
+            v2_t p = sfm_project_final(cameras + vis.colidx[k],
+                                       points[i], 1, 0);
+
+            projections[2 * k + 0] = Vx(p) + 0.5 * test_rand(&state);
+            projections[2 * k + 1] = Vy(p) + 0.5 * test_rand(&state);
+        }
+    }
+
+    for (j = 1; j < m; j++) {
+        for (k = 0; k < 3; k++)
+            cameras[j].t[k] += 0.01 * test_rand(&state);
+        cameras[j].f += 5.0 * test_rand(&state);
+    }
+
+    for (i = 0; i < n; i++) {
+        Vx(points[i]) += 0.01 * test_rand(&state);
+        Vz(points[i]) += 0.01 * test_rand(&state);
+    }
+
+    run_sfm(n, m, 1, &vis, projections,
+            1, 0, prob->estimate_distortion, 1,
+            cameras, points, 0, 0, NULL, 0.0, 0, 0, 1.0e-12, 0,
+            prob->num_threads, NULL, NULL, NULL, NULL);
+
+    sba_crsm_free(&vis);
+    free(projections);
+
+    prob->cameras = cameras;
+    prob->points = points;
+
+    return NULL;
+}
+
+static void free_problem(sfm_problem_t *prob)
+{
+    free(prob->cameras);
+    free(prob->points);
+    prob->cameras = NULL;
+    prob->points = NULL;
+}
+
+/* Return 1 if two solutions of the same problem match bit for bit */
+static int same_solution(sfm_problem_t *a, sfm_problem_t *b)
+{
+    int j;
+
+    if (memcmp(a->points, b->points, a->num_points * sizeof(v3_t)) != 0)
+        return 0;
+
+    for (j = 0; j < a->num_cameras; j++) {
+        camera_params_t *ca = a->cameras + j, *cb = b->cameras + j;
+
+        if (memcmp(ca->R, cb->R, 9 * sizeof(double)) != 0 ||
+            memcmp(ca->t, cb->t, 3 * sizeof(double)) != 0 ||
+            memcmp(&ca->f, &cb->f, sizeof(double)) != 0 ||
+            memcmp(ca->k, cb->k, 2 * sizeof(double)) != 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    /* Different sizes, and only the second estimates distortion, so
+     * the two runs never take the same steps */
+    sfm_problem_t serial[2] = { { 1, 60, 3000, 0, 1, NULL, NULL },
+                                { 7, 45, 2000, 1, 1, NULL, NULL } };
+    sfm_problem_t threaded[2];
+    int round, i, failures = 0;
+
+    for (i = 0; i < 2; i++)
+        solve_problem(serial + i);
+
+    for (round = 0; round < NUM_ROUNDS; round++) {
+        pthread_t threads[2];
+
+        for (i = 0; i < 2; i++) {
+            threaded[i] = serial[i];
+            threaded[i].num_threads = 1 + (round + i) % 3;
+            pthread_create(threads + i, NULL, solve_problem, threaded + i);
+        }
+
+        for (i = 0; i < 2; i++)
+            pthread_join(threads[i], NULL);
+
+        for (i = 0; i < 2; i++) {
+            int same = same_solution(serial + i, threaded + i);
+
+            fprintf(stderr, "[sfm_test] Round %d, problem %d "
+                    "(%d threads): %s\n", round, i,
+                    threaded[i].num_threads,
+                    same ? "identical" : "DIFFERENT");
+
+            if (!same) failures++;
+
+            free_problem(threaded + i);
+        }
+    }
+
+    for (i = 0; i < 2; i++)
+        free_problem(serial + i);
+
+    if (failures > 0) {
+        fprintf(stderr, "[sfm_test] %d concurrent runs differ "
+                "from the serial ones\n", failures);
+        return 1;
+    }
+
+    fprintf(stderr, "[sfm_test] All concurrent runs match\n");
+
+    return 0;
+}
@@ -73,6 +73,10 @@ Keypoint &BaseApp::GetKey(int img, int key) {
     return m_image_data[img].m_keys[key];
 }
 
+const Keypoint &BaseApp::GetKey(int img, int key) const {
+    return m_image_data[img].m_keys[key];
+}
+
 KeypointWithDesc &BaseApp::GetKeyWithDesc(int img, int key) {
     return m_image_data[img].m_keys_desc[key];
 }
@@ -360,6 +360,7 @@ public:
 
     /* Get keys */
     Keypoint &GetKey(int img, int key);
+    const Keypoint &GetKey(int img, int key) const;
     KeypointWithDesc &GetKeyWithDesc(int img, int key);
     int GetNumKeys(int img);
     /* Get the index of a registered camera */
@@ -367,11 +368,14 @@ public:
 
     /* Load a list of image names from a file */
     void LoadImageNamesFromFile(FILE *f);
+    /* Map a key store and serve every image's keys from it */
+    bool LoadKeyStore(const char *filename);
 
     /* Load matches from files */
     void LoadMatches();
     void ReadMatchFile(int i, int j);
     void LoadMatchTable(const char *filename);
+    void LoadMatchTableBinary(const char *filename);
     void LoadMatchIndexes(const char *index_dir);
     /* Load keys from files */
     void LoadKeys(bool descriptor = true);
@@ -584,6 +588,9 @@ public:
     char *m_match_index_dir;     /* Which directory are match indexes
                                   * stored in? */
     char *m_match_table;         /* File where match table is stored */
+    char *m_key_store_file;      /* Key store to map keys from */
+    KeyStoreMap *m_key_store;    /* Mapped key store (or NULL) */
+    int m_num_threads;           /* Number of worker threads */
     char *m_key_directory;
     char *m_image_directory;
     char *m_sift_binary;         /* Where can we find the sift binary? */
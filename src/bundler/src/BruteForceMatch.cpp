@@ -0,0 +1,211 @@
+/* 
+ *  Copyright (c) 2008  Noah Snavely (snavely (at) cs.washington.edu)
+ *    and the University of Washington
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/* BruteForceMatch.cpp */
+/* Exact, vectorized two-nearest-neighbor search over SIFT descriptors */
+
+#include <limits.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#include <immintrin.h>
+#define BRUTE_FORCE_AVX2
+#endif
+
+#include "BruteForceMatch.h"
+
+#define DESC_LEN 128
+
+/* Queries and database keys are processed in blocks so that a block
+ * of the database (DB_BLOCK * 128 bytes) stays in cache while every
+ * query of the query block is compared against it */
+#define QUERY_BLOCK 64
+#define DB_BLOCK 256
+
+static inline void UpdateTwoNearest(int idx, int dist, int *best_idx,
+                                    int *best_dist)
+{
+    if (dist < best_dist[0]) {
+        best_dist[1] = best_dist[0];
+        best_idx[1] = best_idx[0];
+        best_dist[0] = dist;
+        best_idx[0] = idx;
+    } else if (dist < best_dist[1]) {
+        best_dist[1] = dist;
+        best_idx[1] = idx;
+    }
+}
+
+#if !defined(__SSE2__)
+static inline int DistanceScalar(const unsigned char *a, 
+                                 const unsigned char *b)
+{
+    int dist = 0;
+
+    for (int k = 0; k < DESC_LEN; k++) {
+        int d = (int) a[k] - (int) b[k];
+        dist += d * d;
+    }
+
+    return dist;
+}
+#endif
+
+#if defined(__SSE2__)
+/* |a - b| is formed with saturating subtracts, widened to 16 bits and
+ * squared and pair-summed with pmaddwd.  The largest possible
+ * distance, 128 * 255^2, fits comfortably in 32 bits. */
+static inline int DistanceSSE2(const unsigned char *a, 
+                               const unsigned char *b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+
+    for (int k = 0; k < DESC_LEN; k += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *) (a + k));
+        __m128i vb = _mm_loadu_si128((const __m128i *) (b + k));
+        __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), 
+                                 _mm_subs_epu8(vb, va));
+        __m128i lo = _mm_unpacklo_epi8(d, zero);
+        __m128i hi = _mm_unpackhi_epi8(d, zero);
+
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+    }
+
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1,0,3,2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2,3,0,1)));
+
+    return _mm_cvtsi128_si32(acc);
+}
+#endif
+
+#ifdef BRUTE_FORCE_AVX2
+__attribute__((target("avx2")))
+static inline int DistanceAVX2(const unsigned char *a, 
+                               const unsigned char *b)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+
+    for (int k = 0; k < DESC_LEN; k += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *) (a + k));
+        __m256i vb = _mm256_loadu_si256((const __m256i *) (b + k));
+        __m256i d = _mm256_or_si256(_mm256_subs_epu8(va, vb), 
+                                    _mm256_subs_epu8(vb, va));
+        __m256i lo = _mm256_unpacklo_epi8(d, zero);
+        __m256i hi = _mm256_unpackhi_epi8(d, zero);
+
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(lo, lo));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(hi, hi));
+    }
+
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                                _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1,0,3,2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2,3,0,1)));
+
+    return _mm_cvtsi128_si32(sum);
+}
+#endif
+
+/* The blocked search loop, instantiated once per distance kernel so
+ * that the kernel is inlined into the inner loop */
+#define DEFINE_FIND_TWO_NEAREST(name, distance)                         \
+static void name(int num_query, const unsigned char *query,             \
+                 int num_db, const unsigned char *db,                   \
+                 int *nn_idx, int *nn_dist)                             \
+{                                                                       \
+    for (int q0 = 0; q0 < num_query; q0 += QUERY_BLOCK) {               \
+        int q1 = q0 + QUERY_BLOCK < num_query ? q0 + QUERY_BLOCK : num_query; \
+                                                                        \
+        for (int d0 = 0; d0 < num_db; d0 += DB_BLOCK) {                 \
+            int d1 = d0 + DB_BLOCK < num_db ? d0 + DB_BLOCK : num_db;   \
+                                                                        \
+            for (int q = q0; q < q1; q++) {                             \
+                const unsigned char *qd = query + DESC_LEN * q;         \
+                int *best_idx = nn_idx + 2 * q;                         \
+                int *best_dist = nn_dist + 2 * q;                       \
+                                                                        \
+                for (int d = d0; d < d1; d++) {                         \
+                    int dist = distance(qd, db + DESC_LEN * d);         \
+                    if (dist < best_dist[1])                            \
+                        UpdateTwoNearest(d, dist, best_idx, best_dist); \
+                }                                                       \
+            }                                                           \
+        }                                                               \
+    }                                                                   \
+}
+
+#if defined(__SSE2__)
+DEFINE_FIND_TWO_NEAREST(FindTwoNearestSSE2, DistanceSSE2)
+#else
+DEFINE_FIND_TWO_NEAREST(FindTwoNearestScalar, DistanceScalar)
+#endif
+
+#ifdef BRUTE_FORCE_AVX2
+__attribute__((target("avx2")))
+DEFINE_FIND_TWO_NEAREST(FindTwoNearestAVX2, DistanceAVX2)
+#endif
+
+typedef void (*find_two_nearest_t)(int num_query, 
+                                   const unsigned char *query,
+                                   int num_db, const unsigned char *db,
+                                   int *nn_idx, int *nn_dist);
+
+static find_two_nearest_t SelectKernel(const char **name)
+{
+#ifdef BRUTE_FORCE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return FindTwoNearestAVX2;
+    }
+#endif
+
+#if defined(__SSE2__)
+    *name = "sse2";
+    return FindTwoNearestSSE2;
+#else
+    *name = "scalar";
+    return FindTwoNearestScalar;
+#endif
+}
+
+static const char *kernel_name = NULL;
+static find_two_nearest_t kernel = SelectKernel(&kernel_name);
+
+const char *GetBruteForceMatchKernel()
+{
+    return kernel_name;
+}
+
+void FindTwoNearestNeighbors(int num_query, const unsigned char *query,
+                             int num_db, const unsigned char *db,
+                             int *nn_idx, int *nn_dist)
+{
+    for (int i = 0; i < 2 * num_query; i++) {
+        nn_idx[i] = -1;
+        nn_dist[i] = INT_MAX;
+    }
+
+    kernel(num_query, query, num_db, db, nn_idx, nn_dist);
+}
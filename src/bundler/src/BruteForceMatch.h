@@ -0,0 +1,37 @@
+/* 
+ *  Copyright (c) 2008  Noah Snavely (snavely (at) cs.washington.edu)
+ *    and the University of Washington
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/* BruteForceMatch.h */
+/* Exact, vectorized two-nearest-neighbor search over SIFT descriptors */
+
+#ifndef __brute_force_match_h__
+#define __brute_force_match_h__
+
+/* For each of the num_query 128-byte descriptors in query, find the
+ * two descriptors in db with the smallest squared L2 distance.
+ * nn_idx and nn_dist must hold 2 * num_query entries; the nearest
+ * neighbor of query i is written to entry 2 * i, the second nearest
+ * to 2 * i + 1.  Missing neighbors (num_db < 2) get index -1 and
+ * distance INT_MAX.  Ties go to the lower db index, so the result
+ * does not depend on which kernel is used. */
+void FindTwoNearestNeighbors(int num_query, const unsigned char *query,
+                             int num_db, const unsigned char *db,
+                             int *nn_idx, int *nn_dist);
+
+/* Name of the kernel FindTwoNearestNeighbors uses on this machine */
+const char *GetBruteForceMatchKernel();
+
+#endif /* __brute_force_match_h__ */
@@ -0,0 +1,113 @@
+/*
+ *  Copyright (c) 2008  Noah Snavely (snavely (at) cs.washington.edu)
+ *    and the University of Washington
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/* BuildKeyStore.cpp */
+/* Pack the key files of a list into a single mappable key store */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "keys2a.h"
+#include "KeyStore.h"
+
+int main(int argc, char **argv) 
+{
+    if (argc != 3) {
+        printf("Usage: %s <list.txt> <keys.store>\n", argv[0]);
+        return -1;
+    }
+
+    const char *list_in = argv[1];
+    const char *file_out = argv[2];
+
+    FILE *f = fopen(list_in, "r");
+    if (f == NULL) {
+        printf("Error opening file %s for reading\n", list_in);
+        return 1;
+    }
+
+    std::vector<std::string> key_files;
+
+    char buf[512];
+    while (fgets(buf, 512, f)) {
+        /* Remove trailing newline */
+        const int l = strlen(buf);
+        if (l > 1 && buf[l - 1] == '\n') {
+            if (l > 2 && buf[l - 2] == '\r')
+                buf[l - 2] = 0;
+            buf[l - 1] = 0;
+        }
+        
+        key_files.push_back(std::string(buf));
+    }
+
+    fclose(f);
+
+    int num_images = (int) key_files.size();
+
+    /* First pass: count the keys so the layout can be fixed */
+    std::vector<const char *> names(num_images);
+    std::vector<int> num_keys(num_images);
+
+    for (int i = 0; i < num_images; i++) {
+        names[i] = key_files[i].c_str();
+        num_keys[i] = GetNumberOfKeys(names[i]);
+    }
+
+    KeyStoreWriter writer;
+    if (!writer.Open(file_out, names, num_keys))
+        return 1;
+
+    /* Second pass: read each image and write it out */
+    for (int i = 0; i < num_images; i++) {
+        unsigned char *keys = NULL;
+        keypt_t *info = NULL;
+
+        int n = ReadKeyFile(names[i], &keys, &info);
+
+        if (n != num_keys[i]) {
+            printf("Error: %s has %d keys, expected %d\n", 
+                   names[i], n, num_keys[i]);
+            writer.Close();
+            return 1;
+        }
+
+        std::vector<float> x(n), y(n), scale(n), orient(n);
+        for (int k = 0; k < n; k++) {
+            x[k] = info[k].x;
+            y[k] = info[k].y;
+            scale[k] = info[k].scale;
+            orient[k] = info[k].orient;
+        }
+
+        if (n > 0) {
+            writer.WriteImage(i, &x[0], &y[0], &scale[0], &orient[0], keys);
+        }
+
+        printf("[BuildKeyStore] %s: %d keys\n", names[i], n);
+
+        if (keys != NULL)
+            delete [] keys;
+        if (info != NULL)
+            delete [] info;
+    }
+
+    return writer.Close() ? 0 : 1;
+}
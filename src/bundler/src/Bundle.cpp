@@ -22,6 +22,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <pthread.h>
+#include <algorithm>
 #include <queue>
 #include <vector>
 
@@ -31,6 +33,7 @@
 #include "matrix.h"
 #include "qsort.h"
 #include "resample.h"
+#include "sba.h"
 #include "sfm.h"
 #include "triangulate.h"
 #include "util.h"
@@ -556,33 +559,39 @@ double BundlerApp::RunSFM(int num_pts, int num_cameras, int start_camera,
             break;
         }
 
-        /* Set up the vmask and projections */
-        char *vmask = NULL;
+        /* Set up the (sparse) visibility and projections.  The views
+         * of each point are stored in the order the cameras were
+         * added, so the column indices come out increasing, as sba
+         * expects */
         double *projections = NULL;
 
         int num_projections = 0;
+        int num_nz_pts = 0;
         for (int i = 0; i < num_pts; i++) {
             num_projections += (int) pt_views[i].size();
+            if (pt_views[i].size() > 0)
+                num_nz_pts++;
         }
 
-        vmask = new char[num_pts * num_cameras];
+        struct sba_crsm vis;
+        sba_crsm_alloc(&vis, num_nz_pts, num_cameras, num_projections);
         projections = new double[2 * num_projections];
 
-        for (int i = 0; i < num_pts * num_cameras; i++)
-            vmask[i] = 0;
-
         int arr_idx = 0;
         int nz_count = 0;
         for (int i = 0; i < num_pts; i++) {
             int num_views = (int) pt_views[i].size();
 
             if (num_views > 0) {
+                vis.rowptr[nz_count] = arr_idx;
+
                 for (int j = 0; j < num_views; j++) {
                     int c = pt_views[i][j].first;
                     int v = added_order[c];
                     int k = pt_views[i][j].second;
 
-                    vmask[nz_count * num_cameras + c] = 1;
+                    vis.val[arr_idx] = arr_idx;
+                    vis.colidx[arr_idx] = c;
 
                     projections[2 * arr_idx + 0] = GetKey(v,k).m_x;
                     projections[2 * arr_idx + 1] = GetKey(v,k).m_y;
@@ -604,14 +613,17 @@ double BundlerApp::RunSFM(int num_pts, int num_cameras, int start_camera,
         bool fixed_focal = m_fixed_focal_length;
         clock_t start = clock();
 
-        run_sfm(nz_count, num_cameras, start_camera, vmask, projections, 
+        vis.rowptr[nz_count] = arr_idx;
+
+        run_sfm(nz_count, num_cameras, start_camera, &vis, projections, 
             fixed_focal ? 0 : 1, 0,
             m_estimate_distortion ? 1 : 0, 1,
             init_camera_params, nz_pts, 
             (m_use_constraints || m_constrain_focal) ? 1 : 0,
             (m_use_point_constraints) ? 1 : 0,
             m_point_constraints, m_point_constraint_weight,
-            fix_points ? 1 : 0, m_optimize_for_fisheye, eps2, V, S, U, W);
+            fix_points ? 1 : 0, m_optimize_for_fisheye, eps2, 
+            m_check_jacobians ? 1 : 0, m_num_threads, V, S, U, W);
 
         clock_t end = clock();
 
@@ -665,13 +677,19 @@ double BundlerApp::RunSFM(int num_pts, int num_cameras, int start_camera,
 
             int num_keys = GetNumKeys(added_order[i]);
 
+            /* Only the points in this optimization count (a camera
+             * held fixed by RunSFMLocal can see others) */
             int num_pts_proj = 0;
             for (int j = 0; j < num_keys; j++) {
-                if (GetKey(added_order[i], j).m_extra >= 0) {
+                int pt_idx = GetKey(added_order[i], j).m_extra;
+                if (pt_idx >= 0 && remap[pt_idx] != -1) {
                     num_pts_proj++;
                 }
             }
 
+            if (num_pts_proj == 0)
+                continue;
+
             double *dists = new double[num_pts_proj];
             int pt_count = 0;
 
@@ -683,7 +701,7 @@ double BundlerApp::RunSFM(int num_pts, int num_cameras, int start_camera,
 
                     const Keypoint &key = *iter;
 
-                    if (key.m_extra >= 0) {
+                    if (key.m_extra >= 0 && remap[key.m_extra] != -1) {
                         double b[3], pr[2];
                         double dx, dy, dist;
                         int pt_idx = key.m_extra;
@@ -748,7 +766,7 @@ double BundlerApp::RunSFM(int num_pts, int num_cameras, int start_camera,
             for (int j = 0; j < num_keys; j++) {
                 int pt_idx = GetKey(added_order[i],j).m_extra;
 
-                if (pt_idx < 0)
+                if (pt_idx < 0 || remap[pt_idx] == -1)
                     continue;
 
                 /* Don't remove constrained points */
@@ -825,8 +843,6 @@ double BundlerApp::RunSFM(int num_pts, int num_cameras, int start_camera,
                     int v = pt_views[idx][j].first;
                     int k = pt_views[idx][j].second;
 
-                    vmask[idx * num_cameras + v] = 0;
-
                     /* Sanity check */
                     if (GetKey(added_order[v], k).m_extra != idx)
                         printf("Error!  Entry for (%d,%d) "
@@ -850,7 +866,7 @@ double BundlerApp::RunSFM(int num_pts, int num_cameras, int start_camera,
             printf("[RunSFM] Removing %d outliers\n", num_outliers);
         }
 
-        delete [] vmask;
+        sba_crsm_free(&vis);
         delete [] projections;
 
         for (int i = 0; i < num_pts; i++) {
@@ -869,6 +885,196 @@ double BundlerApp::RunSFM(int num_pts, int num_cameras, int start_camera,
     return dist_total / num_dists;
 }
 
+/* Run bundle adjustment on the cameras [first_new_camera,
+ * num_cameras), the m_local_bundle_neighbors older cameras that share
+ * the most points with them, and the points these cameras see.  The
+ * other cameras that see those points are held fixed, everything
+ * else is left alone */
+double BundlerApp::RunSFMLocal(int num_pts, int num_cameras, 
+                               int first_new_camera,
+                               camera_params_t *cameras, v3_t *points,
+                               int *added_order, v3_t *colors,
+                               std::vector<ImageKeyVector> &pt_views)
+{
+    /* Count the points each old camera shares with the new ones */
+    std::vector<int> shared(num_cameras, 0);
+
+    for (int i = 0; i < num_pts; i++) {
+        int num_views = (int) pt_views[i].size();
+
+        bool seen_new = false;
+        for (int j = 0; j < num_views; j++) {
+            if (pt_views[i][j].first >= first_new_camera) {
+                seen_new = true;
+                break;
+            }
+        }
+
+        if (!seen_new)
+            continue;
+
+        for (int j = 0; j < num_views; j++) {
+            int c = pt_views[i][j].first;
+            if (c < first_new_camera)
+                shared[c]++;
+        }
+    }
+
+    /* Pick the neighbors, the most shared points first */
+    std::vector<std::pair<int, int> > neighbors;
+    for (int c = 0; c < first_new_camera; c++) {
+        if (shared[c] > 0)
+            neighbors.push_back(std::pair<int, int>(-shared[c], c));
+    }
+
+    std::sort(neighbors.begin(), neighbors.end());
+
+    /* 0: left alone, 1: held fixed, 2: adjusted */
+    std::vector<int> role(num_cameras, 0);
+    for (int c = first_new_camera; c < num_cameras; c++)
+        role[c] = 2;
+
+    int num_neighbors = MIN(m_local_bundle_neighbors, (int) neighbors.size());
+    for (int i = 0; i < num_neighbors; i++)
+        role[neighbors[i].second] = 2;
+
+    /* Find the points seen by the adjusted cameras, and the cameras
+     * to hold fixed */
+    std::vector<bool> local_pt(num_pts, false);
+    int num_local_pts = 0;
+
+    for (int i = 0; i < num_pts; i++) {
+        int num_views = (int) pt_views[i].size();
+
+        for (int j = 0; j < num_views; j++) {
+            if (role[pt_views[i][j].first] == 2) {
+                local_pt[i] = true;
+                num_local_pts++;
+                break;
+            }
+        }
+
+        if (!local_pt[i])
+            continue;
+
+        for (int j = 0; j < num_views; j++) {
+            int c = pt_views[i][j].first;
+            if (role[c] == 0)
+                role[c] = 1;
+        }
+    }
+
+    /* run_sfm holds the first cameras fixed */
+    std::vector<int> order;
+    for (int c = 0; c < num_cameras; c++) {
+        if (role[c] == 1)
+            order.push_back(c);
+    }
+
+    int num_fixed = (int) order.size();
+
+    for (int c = 0; c < num_cameras; c++) {
+        if (role[c] == 2)
+            order.push_back(c);
+    }
+
+    int num_local_cameras = (int) order.size();
+
+    if (num_local_cameras == num_fixed) {
+        printf("[RunSFMLocal] No cameras to adjust\n");
+        return 0.0;
+    }
+
+    printf("[RunSFMLocal] Adjusting %d of %d cameras (%d held fixed), "
+           "%d points\n", num_local_cameras - num_fixed, num_cameras, 
+           num_fixed, num_local_pts);
+
+    std::vector<int> local_idx(num_cameras, -1);
+    camera_params_t *local_cameras = new camera_params_t[num_local_cameras];
+    int *local_order = new int[num_local_cameras];
+
+    for (int i = 0; i < num_local_cameras; i++) {
+        local_idx[order[i]] = i;
+        local_cameras[i] = cameras[order[i]];
+        local_order[i] = added_order[order[i]];
+    }
+
+    /* The views of each point go in increasing camera order */
+    std::vector<ImageKeyVector> local_views(num_pts);
+    for (int i = 0; i < num_pts; i++) {
+        if (!local_pt[i])
+            continue;
+
+        int num_views = (int) pt_views[i].size();
+        for (int j = 0; j < num_views; j++) {
+            local_views[i].push_back(ImageKey(local_idx[pt_views[i][j].first],
+                                              pt_views[i][j].second));
+        }
+
+        std::sort(local_views[i].begin(), local_views[i].end());
+    }
+
+    double error = RunSFM(num_pts, num_local_cameras, num_fixed, false,
+                          local_cameras, points, local_order, colors, 
+                          local_views);
+
+    for (int i = num_fixed; i < num_local_cameras; i++)
+        cameras[order[i]] = local_cameras[i];
+
+    /* Drop the points removed as outliers */
+    for (int i = 0; i < num_pts; i++) {
+        if (local_pt[i] && local_views[i].size() == 0)
+            pt_views[i].clear();
+    }
+
+    delete [] local_cameras;
+    delete [] local_order;
+
+    return error;
+}
+
+/* Run bundle adjustment once the cameras [first_new_camera,
+ * num_cameras) have been added.  With m_local_bundle only a window
+ * around the new cameras is adjusted (see RunSFMLocal), unless
+ * m_global_bundle_interval cameras were added or the model grew by
+ * m_global_bundle_growth since the last global adjustment, or
+ * force_global is set */
+double BundlerApp::RunSFMIncremental(int num_pts, int num_cameras, 
+                                     int first_new_camera,
+                                     camera_params_t *cameras, 
+                                     v3_t *points, int *added_order, 
+                                     v3_t *colors,
+                                     std::vector<ImageKeyVector> &pt_views,
+                                     bool force_global)
+{
+    int num_added = num_cameras - m_global_bundle_cameras;
+    bool global = !m_local_bundle || force_global ||
+        num_added >= m_global_bundle_interval ||
+        num_added >= m_global_bundle_growth * m_global_bundle_cameras;
+
+    clock_t start = clock();
+
+    double error;
+    if (global) {
+        error = RunSFM(num_pts, num_cameras, 0, false,
+                       cameras, points, added_order, colors, pt_views);
+        m_global_bundle_cameras = num_cameras;
+    } else {
+        error = RunSFMLocal(num_pts, num_cameras, first_new_camera,
+                            cameras, points, added_order, colors, 
+                            pt_views);
+    }
+
+    clock_t end = clock();
+
+    printf("[RunSFMIncremental] %s bundle adjustment of %d cameras "
+           "took %0.3fs, mean error %0.3f\n", 
+           global ? "Global" : "Local", num_cameras, 
+           (double) (end - start) / (double) CLOCKS_PER_SEC, error);
+
+    return error;
+}
+
 void BundlerApp::ClearCameraConstraints(camera_params_t *params) 
 {
     for (int i = 0; i < NUM_CAMERA_PARAMS; i++) {
@@ -878,7 +1084,8 @@ void BundlerApp::ClearCameraConstraints(camera_params_t *params)
     }
 }
 
-void BundlerApp::SetCameraConstraints(int cam_idx, camera_params_t *params) 
+void BundlerApp::SetCameraConstraints(int cam_idx, 
+                                      camera_params_t *params) const
 {
     const CameraInfo &cam = m_image_data[cam_idx].m_camera;
 
@@ -926,7 +1133,7 @@ void BundlerApp::SetCameraConstraints(int cam_idx, camera_params_t *params)
 }
 
 void BundlerApp::SetFocalConstraint(const ImageData &data, 
-                                    camera_params_t *params)
+                                    camera_params_t *params) const
 {
     if (data.m_has_init_focal) {
         params->constrained[6] = true;
@@ -2256,6 +2463,8 @@ void BundlerApp::BundleAdjust()
         pt_count = curr_num_pts = (int) m_point_data.size();
     }
 
+    m_global_bundle_cameras = curr_num_cameras;
+
     for (int round = curr_num_cameras; 
         round < num_images; 
         round++, curr_num_cameras++) {
@@ -2325,7 +2534,7 @@ void BundlerApp::BundleAdjust()
             fflush(stdout);
 
             /* Run sfm again to update parameters */
-            RunSFM(curr_num_pts, round + 1, 0, false,
+            RunSFMIncremental(curr_num_pts, round + 1, round,
                 cameras, points, added_order, colors, pt_views);
 
             /* Remove bad points and cameras */
@@ -2374,6 +2583,16 @@ void BundlerApp::BundleAdjust()
             }
     }
 
+    if (m_local_bundle && m_global_bundle_cameras < curr_num_cameras) {
+        /* The last rounds were local, finish with a global one */
+        RunSFMIncremental(curr_num_pts, curr_num_cameras, curr_num_cameras,
+            cameras, points, added_order, colors, pt_views, true);
+
+        RemoveBadPointsAndCameras(curr_num_pts, curr_num_cameras, 
+            added_order, cameras, points, colors, 
+            pt_views);
+    }
+
     clock_t end = clock();
 
     printf("[BundleAdjust] Bundle adjustment took %0.3fs\n",
@@ -2642,10 +2861,10 @@ std::vector<int> RefineCameraParameters(const ImageData &data,
 
 
 double BundlerApp::RefinePoints(int num_points, v3_t *points, v2_t *projs,
-                                int *pt_idxs, camera_params_t *cameras,
-                                int *added_order,
+                                int *pt_idxs, const camera_params_t *cameras,
+                                const int *added_order,
                                 const std::vector<ImageKeyVector> &pt_views,
-                                camera_params_t *camera_out)
+                                camera_params_t *camera_out) const
 {
     double error = 0.0;
 
@@ -2662,13 +2881,13 @@ double BundlerApp::RefinePoints(int num_points, v3_t *points, v2_t *projs,
         double *ts = new double[3 * num_views];
 
         for (int j = 0; j < num_views; j++) {
-            camera_params_t *cam = NULL;
+            const camera_params_t *cam = NULL;
 
             if (j < num_views - 1) {
                 int camera_idx = pt_views[pt_idx][j].first;
                 int image_idx = added_order[camera_idx];
                 int key_idx = pt_views[pt_idx][j].second;
-                Keypoint &key = GetKey(image_idx, key_idx);
+                const Keypoint &key = GetKey(image_idx, key_idx);
 
                 double p3[3] = { key.m_x, key.m_y, 1.0 };
                 double K[9], Kinv[9];
@@ -2725,11 +2944,11 @@ std::vector<int>
 BundlerApp::RefineCameraAndPoints(const ImageData &data, int num_points,
                                   v3_t *points, v2_t *projs,
                                   int *pt_idxs, 
-                                  camera_params_t *cameras,
-                                  int *added_order,
+                                  const camera_params_t *cameras,
+                                  const int *added_order,
                                   const std::vector<ImageKeyVector> &pt_views,
                                   camera_params_t *camera_out,
-                                  bool remove_outliers)
+                                  bool remove_outliers) const
 {
     // double error_thresh = 1.0e-6;
     double error_old = DBL_MAX;
@@ -2838,17 +3057,18 @@ bool FindAndVerifyCamera(int num_points, v3_t *points_solve, v2_t *projs_solve,
                          double proj_estimation_threshold_weak,
                          std::vector<int> &inliers,
                          std::vector<int> &inliers_weak,
-                         std::vector<int> &outliers)
+                         std::vector<int> &outliers,
+                         unsigned int *seed = NULL)
 {
     /* First, find the projection matrix */
     double P[12];
     int r = -1;
 
     if (num_points >= 9) {
-        r = find_projection_3x4_ransac(num_points, 
+        r = find_projection_3x4_ransac_r(num_points, 
             points_solve, projs_solve, 
             P, /* 2048 */ 4096 /* 100000 */, 
-            proj_estimation_threshold);
+            proj_estimation_threshold, seed);
     }
 
     if (r == -1) {
@@ -2957,15 +3177,38 @@ BundlerApp::BundleInitializeImage(ImageData &data,
                                   bool *success_out,
                                   bool refine_cameras_and_points)
 {
-    clock_t start = clock();
-
-    if (success_out != NULL)
-        *success_out = true;
-
     /* Load the keys */
     data.LoadKeys(false, !m_optimize_for_fisheye);
     SetTracks(image_idx);
 
+    CameraResection resection = 
+        ResectImage(data, image_idx, num_points, added_order, points, 
+                    parent, cameras, pt_views, refine_cameras_and_points,
+                    NULL);
+
+    ConnectResection(data, camera_idx, resection, pt_views);
+
+    if (success_out != NULL)
+        *success_out = resection.m_success;
+
+    return resection.m_camera;
+}
+
+CameraResection BundlerApp::ResectImage(const ImageData &data, 
+                                        int image_idx, int num_points,
+                                        const int *added_order, 
+                                        const v3_t *points,
+                                        const camera_params_t *parent,
+                                        const camera_params_t *cameras,
+                                        const std::vector<ImageKeyVector> 
+                                            &pt_views,
+                                        bool refine_cameras_and_points,
+                                        unsigned int *seed) const
+{
+    clock_t start = clock();
+
+    CameraResection resection;
+
     /* **** Connect the new camera to any existing points **** */
     int num_pts_solve = 0;
     int num_keys = (int) data.m_keys.size();
@@ -2979,7 +3222,7 @@ BundlerApp::BundleInitializeImage(ImageData &data,
         "Connecting existing matches...\n");
 
     /* Find the tracks seen by this image */
-    std::vector<int> &tracks = data.m_visible_points;
+    const std::vector<int> &tracks = data.m_visible_points;
     int num_tracks = (int) tracks.size();
 
     for (int i = 0; i < num_tracks; i++) {
@@ -3022,20 +3265,13 @@ BundlerApp::BundleInitializeImage(ImageData &data,
     if (num_pts_solve < m_min_max_matches) {
         printf("[BundleInitializeImage] Couldn't initialize\n");
 
-        if (success_out != NULL)
-            *success_out = false;
-
-        camera_params_t dummy;
-
         delete [] points_solve;
         delete [] projs_solve;
         delete [] projs_solve_orig;
         delete [] idxs_solve;
         delete [] keys_solve;
 
-        m_image_data[image_idx].UnloadKeys();
-
-        return dummy;
+        return resection;
     }
 
     /* **** Solve for the camera position **** */
@@ -3048,28 +3284,21 @@ BundlerApp::BundleInitializeImage(ImageData &data,
         idxs_solve, Kinit, Rinit, tinit, 
         m_projection_estimation_threshold, 
         16.0 * m_projection_estimation_threshold, /*4.0*/
-        inliers, inliers_weak, outliers);
+        inliers, inliers_weak, outliers, seed);
 
     if (!success) {
         printf("[BundleInitializeImage] Couldn't initialize\n");
 
-        if (success_out != NULL)
-            *success_out = false;
-
-        camera_params_t dummy;
-
         delete [] points_solve;
         delete [] projs_solve;
         delete [] projs_solve_orig;
         delete [] idxs_solve;
         delete [] keys_solve;
 
-        m_image_data[image_idx].UnloadKeys();
-
-        return dummy;
+        return resection;
     }
 
-    camera_params_t camera_new;
+    camera_params_t &camera_new = resection.m_camera;
 
     InitializeCameraParams(data, camera_new);
 
@@ -3083,7 +3312,7 @@ BundlerApp::BundleInitializeImage(ImageData &data,
         matrix_scale(3, 1, camera_new.t, -1.0, camera_new.t);
 
         /* Set up the new focal length */
-        SetCameraConstraints(added_order[num_cameras], &camera_new);
+        SetCameraConstraints(image_idx, &camera_new);
 
         if (m_fixed_focal_length) {
             camera_new.f = m_init_focal_length;
@@ -3103,8 +3332,7 @@ BundlerApp::BundleInitializeImage(ImageData &data,
                     if (ratio < 1.4 || m_trust_focal_estimate) {
                         camera_new.f = data.m_init_focal;
                         if (m_constrain_focal)
-                            SetFocalConstraint(m_image_data[image_idx], 
-                            &camera_new);
+                            SetFocalConstraint(data, &camera_new);
                     } else {
                         printf("[BundleInitializeImage] "
                             "Estimated focal length of %0.3f "
@@ -3171,35 +3399,17 @@ BundlerApp::BundleInitializeImage(ImageData &data,
 
     if ((int) inliers.size() < 8 || camera_new.f < 0.1 * data.GetWidth()) {
         printf("[BundleInitializeImage] Bad camera\n");
-        if (success_out)
-            *success_out = false;
-
-        delete [] points_final;
-        delete [] projs_final;
-        delete [] idxs_final;
-        delete [] keys_final;
-
-        delete [] points_solve;
-        delete [] projs_solve;
-        delete [] projs_solve_orig;
-        delete [] idxs_solve;
-        delete [] keys_solve;
-
-        camera_params_t dummy;
-        return dummy;
-    }
+    } else {
+        /* The keys to connect to their points */
+        num_inliers = (int) inliers.size();
+        for (int i = 0; i < num_inliers; i++) {
+            int inlier_idx = inliers[i];
+            resection.m_keys.push_back(keys_final[inlier_idx]);
+            resection.m_points.push_back(idxs_final[inlier_idx]);
+        }
 
-    /* Point the keys to their corresponding points */
-    num_inliers = (int) inliers.size();
-    for (int i = 0; i < num_inliers; i++) {
-        int inlier_idx = inliers[i];
-        // printf("[BundleInitializeImage] Connecting point [%d]\n",
-        //        idxs_final[inlier_idx]);
-        data.m_keys[keys_final[inlier_idx]].m_extra = idxs_final[inlier_idx];
-        pt_views[idxs_final[inlier_idx]].
-            push_back(ImageKey(camera_idx, keys_final[inlier_idx]));
+        resection.m_success = true;
     }
-    fflush(stdout);
 
     delete [] points_final;
     delete [] projs_final;
@@ -3212,17 +3422,132 @@ BundlerApp::BundleInitializeImage(ImageData &data,
     delete [] idxs_solve;
     delete [] keys_solve;
 
-    clock_t end = clock();
+    if (resection.m_success) {
+        clock_t end = clock();
 
-    printf("[BundleInitializeImage] Initializing took %0.3fs\n",
-        (double) (end - start) / CLOCKS_PER_SEC);
+        printf("[BundleInitializeImage] Initializing took %0.3fs\n",
+            (double) (end - start) / CLOCKS_PER_SEC);
+    }
 
-    data.ReadKeyColors();
-    data.m_camera.m_adjusted = true;
+    return resection;
+}
+
+/* Images handed out to the threads of ResectImages */
+typedef struct {
+    const BundlerApp *app;
+    const std::vector<int> *image_idxs;
+    int num_points;
+    const int *added_order;
+    const v3_t *points;
+    const camera_params_t *cameras;
+    const std::vector<ImageKeyVector> *pt_views;
+
+    std::vector<CameraResection> *resections;
+    int next;                   /* Next image to hand out */
+    pthread_mutex_t lock;       /* Guards next */
+} resection_job_t;
+
+static void *ResectionWorker(void *arg)
+{
+    resection_job_t *job = (resection_job_t *) arg;
+    int num_images = (int) job->image_idxs->size();
+
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        int i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (i >= num_images)
+            break;
+
+        /* Each image draws its own random numbers, so that its
+         * result does not depend on the thread running it */
+        int image_idx = (*job->image_idxs)[i];
+        unsigned int seed = (unsigned int) image_idx;
+
+        (*job->resections)[i] = 
+            job->app->ResectImage(job->app->m_image_data[image_idx], 
+                                  image_idx, job->num_points, 
+                                  job->added_order, job->points, NULL,
+                                  job->cameras, *job->pt_views, false, 
+                                  &seed);
+    }
+
+    return NULL;
+}
+
+std::vector<CameraResection> 
+BundlerApp::ResectImages(const std::vector<int> &image_idxs,
+                         int num_points, const int *added_order, 
+                         const v3_t *points, const camera_params_t *cameras,
+                         const std::vector<ImageKeyVector> &pt_views)
+{
+    int num_images = (int) image_idxs.size();
+    std::vector<CameraResection> resections(num_images);
+
+    /* Load the keys */
+    for (int i = 0; i < num_images; i++) {
+        int image_idx = image_idxs[i];
+        m_image_data[image_idx].LoadKeys(false, !m_optimize_for_fisheye);
+        SetTracks(image_idx);
+    }
+
+    resection_job_t job;
+    job.app = this;
+    job.image_idxs = &image_idxs;
+    job.num_points = num_points;
+    job.added_order = added_order;
+    job.points = points;
+    job.cameras = cameras;
+    job.pt_views = &pt_views;
+    job.resections = &resections;
+    job.next = 0;
+    pthread_mutex_init(&job.lock, NULL);
+
+    int num_threads = MIN(m_num_threads, num_images);
+
+    if (num_threads <= 1) {
+        ResectionWorker(&job);
+    } else {
+        pthread_t *threads = new pthread_t[num_threads];
+
+        for (int t = 0; t < num_threads; t++)
+            pthread_create(threads + t, NULL, ResectionWorker, &job);
+        for (int t = 0; t < num_threads; t++)
+            pthread_join(threads[t], NULL);
 
-    return camera_new;
+        delete [] threads;
+    }
+
+    pthread_mutex_destroy(&job.lock);
+
+    return resections;
 }
 
+void BundlerApp::ConnectResection(ImageData &data, int camera_idx,
+                                  const CameraResection &resection,
+                                  std::vector<ImageKeyVector> &pt_views)
+{
+    if (!resection.m_success) {
+        data.UnloadKeys();
+        return;
+    }
+
+    /* Point the keys to their corresponding points */
+    int num_inliers = (int) resection.m_keys.size();
+    for (int i = 0; i < num_inliers; i++) {
+        int key = resection.m_keys[i];
+        int pt = resection.m_points[i];
+
+        // printf("[BundleInitializeImage] Connecting point [%d]\n", pt);
+        data.m_keys[key].m_extra = pt;
+        pt_views[pt].push_back(ImageKey(camera_idx, key));
+    }
+    fflush(stdout);
+
+    data.ReadKeyColors();
+    data.m_camera.m_adjusted = true;
+}
 
 void BundlerApp::BundleInitializeImageFullBundle(int image_idx, int parent_idx,
                                                  int num_cameras,
@@ -3520,7 +3845,7 @@ void BundlerApp::BundleInitializeImageFullBundle(int image_idx, int parent_idx,
 
     if (!m_skip_full_bundle) {
         /* Run sfm again to update parameters */
-        RunSFM(num_points, num_cameras + 1, 0, false,
+        RunSFMIncremental(num_points, num_cameras + 1, num_cameras,
             cameras, points, added_order, colors, pt_views);
     }
 }
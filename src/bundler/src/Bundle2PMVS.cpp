@@ -11,12 +11,17 @@
 #include "matrix.h"
 #include "sfm.h"
 #include "LoadJPEG.h"
+#include "ViewCluster.h"
+
+/* Points in each cluster's own images that are needed to reconstruct
+ * them (the PMVS minImageNum) */
+#define MIN_CLUSTER_VIEWS 3
 
 typedef struct 
 {
     double pos[3];
     double color[3];
-    
+    std::vector<int> views;     /* Cameras that see the point */
 } point_t;
 
 void ReadListFile(char *list_file, std::vector<std::string> &files)
@@ -127,6 +132,8 @@ void ReadBundleFile(char *bundle_file,
             double x, y;
             if (bundle_version >= 0.3)
                 fscanf(f, "%lf %lf", &x, &y);
+
+            pt.views.push_back(view);
 	}
 
         if (num_visible > 0) {
@@ -137,9 +144,64 @@ void ReadBundleFile(char *bundle_file,
     fclose(f);
 }
 
+/* Write the images each image shares points with, in the PMVS
+ * vis.dat format */
+void WriteVisData(const char *filename, 
+                  const std::vector<std::vector<std::pair<int,int> > > &shared)
+{
+    FILE *f = fopen(filename, "w");
+    assert(f);
+
+    int num_images = (int) shared.size();
+    fprintf(f, "VISDATA\n");
+    fprintf(f, "%d\n", num_images);
+    for (int i = 0; i < num_images; i++) {
+        fprintf(f, "%d %d", i, (int) shared[i].size());
+        for (int j = 0; j < (int) shared[i].size(); j++)
+            fprintf(f, " %d", shared[i][j].first);
+        fprintf(f, "\n");
+    }
+
+    fclose(f);
+}
+
+/* Write a PMVS option file for a cluster.  Patches are only
+ * reconstructed in the core images (timages); the border images
+ * (oimages) just help to verify them, so every patch belongs to
+ * exactly one cluster. */
+void WriteClusterOption(const char *filename, const view_cluster_t &cluster)
+{
+    FILE *f = fopen(filename, "w");
+    assert(f);
+
+    fprintf(f, "level 1\n");
+    fprintf(f, "csize 2\n");
+    fprintf(f, "threshold 0.7\n");
+    fprintf(f, "wsize 7\n");
+    fprintf(f, "minImageNum %d\n", MIN_CLUSTER_VIEWS);
+    fprintf(f, "CPU 4\n");
+    fprintf(f, "setEdge 0\n");
+    fprintf(f, "useBound 0\n");
+    fprintf(f, "useVisData 1\n");
+    fprintf(f, "sequence -1\n");
+
+    fprintf(f, "timages %d", (int) cluster.core.size());
+    for (int i = 0; i < (int) cluster.core.size(); i++)
+        fprintf(f, " %d", cluster.core[i]);
+    fprintf(f, "\n");
+
+    fprintf(f, "oimages %d", (int) cluster.border.size());
+    for (int i = 0; i < (int) cluster.border.size(); i++)
+        fprintf(f, " %d", cluster.border[i]);
+    fprintf(f, "\n");
+
+    fclose(f);
+}
+
 void WritePMVS(char *list_file, char *bundle_file,
                std::vector<std::string> images, 
-               std::vector<camera_params_t> &cameras)
+               std::vector<camera_params_t> &cameras,
+               std::vector<point_t> &points, int max_cluster_size)
 {
     int num_cameras = (int) cameras.size();
 
@@ -156,11 +218,16 @@ void WritePMVS(char *list_file, char *bundle_file,
     fprintf(f_scr, "mkdir -p pmvs/models/\n");
     fprintf(f_scr, "\n# Copy and rename files\n");
 
+    /* Index of each camera in pmvs/, or -1 */
+    std::vector<int> pmvs_index(num_cameras, -1);
+
     int count = 0;
     for (int i = 0; i < num_cameras; i++) {
         if (cameras[i].f == 0.0)
             continue;
 
+        pmvs_index[i] = count;
+
         char buf[256];
         sprintf(buf, "%04d.txt", count);
         FILE *f = fopen(buf, "w");
@@ -205,22 +272,70 @@ void WritePMVS(char *list_file, char *bundle_file,
         count++;
     }
 
+    int num_clusters = 0;
+    if (max_cluster_size > 0) {
+        std::vector<std::vector<int> > views(points.size());
+        for (int p = 0; p < (int) points.size(); p++) {
+            for (int j = 0; j < (int) points[p].views.size(); j++) {
+                int view = points[p].views[j];
+                if (view >= 0 && view < num_cameras && pmvs_index[view] != -1)
+                    views[p].push_back(pmvs_index[view]);
+            }
+        }
+
+        std::vector<std::vector<std::pair<int,int> > > shared;
+        ComputeSharedPoints(count, views, shared);
+        WriteVisData("vis.dat", shared);
+
+        std::vector<view_cluster_t> clusters;
+        ClusterViews(count, views, max_cluster_size, MIN_CLUSTER_VIEWS,
+                     clusters);
+        num_clusters = (int) clusters.size();
+
+        fprintf(f_scr, "\n# Clusters of images for running pmvs\n");
+        fprintf(f_scr, "mv vis.dat pmvs/\n");
+        for (int c = 0; c < num_clusters; c++) {
+            char buf[256];
+            sprintf(buf, "option-%04d", c);
+            WriteClusterOption(buf, clusters[c]);
+            fprintf(f_scr, "mv %s pmvs/\n", buf);
+        }
+    }
+
     fprintf(f_scr, "\n# Sample commands for running pmvs:\n");
-    fprintf(f_scr, "#   affine %d pmvs/ 4\n", count);
-    fprintf(f_scr, "#   match %d pmvs/ 2 0 0 1 0.7 5\n", count);
+    if (num_clusters > 0) {
+        fprintf(f_scr, "#   (each cluster can run in its own process)\n");
+        for (int c = 0; c < num_clusters; c++)
+            fprintf(f_scr, "#   pmvs2 pmvs/ option-%04d\n", c);
+        fprintf(f_scr, "#   mergePatches pmvs/ merged");
+        for (int c = 0; c < num_clusters; c++)
+            fprintf(f_scr, " option-%04d", c);
+        fprintf(f_scr, "\n");
+    } else {
+        fprintf(f_scr, "#   affine %d pmvs/ 4\n", count);
+        fprintf(f_scr, "#   match %d pmvs/ 2 0 0 1 0.7 5\n", count);
+    }
 
     fclose(f_scr);
 }
 
 int main(int argc, char **argv) 
 {
-    if (argc != 3) {
-        printf("Usage: %s <list.txt> <bundle.out>\n", argv[0]);
+    if (argc != 3 && argc != 4) {
+        printf("Usage: %s <list.txt> <bundle.out> [max_cluster_size]\n", 
+               argv[0]);
+        printf("   With max_cluster_size, the images are split into "
+               "overlapping clusters\n"
+               "   of at most that many images, with one pmvs option "
+               "file each\n");
         return 1;
     }
     
     char *list_file = argv[1];
     char *bundle_file = argv[2];
+    int max_cluster_size = 0;
+    if (argc == 4)
+        max_cluster_size = atoi(argv[3]);
 
     /* Read the list file */
     FILE *f = fopen(list_file, "r");
@@ -239,7 +354,8 @@ int main(int argc, char **argv)
     ReadBundleFile(bundle_file, cameras, points, bundle_version);
 
     /* Write camera geometry in the PMVS file format */
-    WritePMVS(list_file, bundle_file, images, cameras);
+    WritePMVS(list_file, bundle_file, images, cameras, points,
+              max_cluster_size);
 
     printf("\n\n");
     printf("@@ Conversion complete, execute \"sh prep_pmvs.sh\" to finalize\n");
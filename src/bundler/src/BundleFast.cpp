@@ -259,6 +259,8 @@ void BundlerApp::BundleAdjustFast()
 	pt_count = curr_num_pts = (int) m_point_data.size();
     }
     
+    m_global_bundle_cameras = curr_num_cameras;
+
     int round = 0;
     while (curr_num_cameras < num_images) {
 	int parent_idx;
@@ -295,7 +297,16 @@ void BundlerApp::BundleAdjustFast()
 	    printf("[SifterApp::BundleAdjustFast] Adjusting camera %d\n",
 		   image_set[i].first);
 
-	/* Now, throw the new cameras into the mix */
+	/* **** Set up the new cameras **** */
+        std::vector<int> image_idxs;
+	for (int i = 0; i < num_added_images; i++)
+            image_idxs.push_back(image_set[i].first);
+
+        std::vector<CameraResection> resections = 
+            ResectImages(image_idxs, curr_num_pts, added_order, points,
+                         cameras, pt_views);
+
+	/* Now, throw the new cameras into the mix, in order */
         int image_count = 0;
 	for (int i = 0; i < num_added_images; i++) {
 	    int next_idx = image_set[i].first;
@@ -308,18 +319,13 @@ void BundlerApp::BundleAdjustFast()
 		   round, next_idx, 
                    (parent_idx == -1 ? -1 : added_order[parent_idx]));
 
-	    /* **** Set up the new camera **** */
-            bool success = false;
-            camera_params_t camera_new = 
-		BundleInitializeImage(m_image_data[next_idx], 
-				      next_idx, curr_num_cameras + image_count,
-				      curr_num_cameras, curr_num_pts,
-				      added_order, points, 
-				      NULL /*cameras + parent_idx*/, cameras, 
-				      pt_views, &success);
-
-            if (success) {
-                cameras[curr_num_cameras+image_count] = camera_new;
+            ConnectResection(m_image_data[next_idx], 
+                             curr_num_cameras + image_count, 
+                             resections[i], pt_views);
+
+            if (resections[i].m_success) {
+                cameras[curr_num_cameras+image_count] = 
+                    resections[i].m_camera;
                 image_count++;
             } else {
                 printf("[BundleAdjust] Couldn't initialize image %d\n",
@@ -368,8 +374,10 @@ void BundlerApp::BundleAdjustFast()
 
         if (!m_skip_full_bundle) {
             /* Run sfm again to update parameters */
-            RunSFM(curr_num_pts, curr_num_cameras, 0, false,
-                   cameras, points, added_order, colors, pt_views);
+            RunSFMIncremental(curr_num_pts, curr_num_cameras, 
+                              curr_num_cameras - image_count,
+                              cameras, points, added_order, colors, 
+                              pt_views);
 
             /* Remove bad points and cameras */
             RemoveBadPointsAndCameras(curr_num_pts, curr_num_cameras + 1, 
@@ -428,6 +436,18 @@ void BundlerApp::BundleAdjustFast()
 	round++;
     }
 
+    if (m_local_bundle && !m_skip_full_bundle && 
+        m_global_bundle_cameras < curr_num_cameras) {
+        /* The last rounds were local, finish with a global one */
+        RunSFMIncremental(curr_num_pts, curr_num_cameras, curr_num_cameras,
+                          cameras, points, added_order, colors, pt_views, 
+                          true);
+
+        RemoveBadPointsAndCameras(curr_num_pts, curr_num_cameras, 
+                                  added_order, cameras, points, colors, 
+                                  pt_views);
+    }
+
     clock_t end = clock();
 
     printf("[BundleAdjust] Bundle adjustment took %0.3fs\n",
@@ -26,6 +26,7 @@
 
 #include "BaseApp.h"
 #include "LoadJPEG.h"
+#include "MatchFile.h"
 #include "SifterUtil.h"
 
 #include "defines.h"
@@ -124,6 +125,11 @@ void BaseApp::LoadMatchTable(const char *filename) {
     // ClearMatches();
     RemoveAllMatches();
 
+    if (IsBinaryMatchFile(filename)) {
+        LoadMatchTableBinary(filename);
+        return;
+    }
+
     FILE *f = fopen(filename, "r");
 
     if (f == NULL) {
@@ -179,6 +185,56 @@ void BaseApp::LoadMatchTable(const char *filename) {
     fclose(f);
 }    
 
+/* Load a binary match table (see MatchFile.h).  The match lists are
+ * filled straight from the mapped file */
+void BaseApp::LoadMatchTableBinary(const char *filename) {
+    MatchFileMap map;
+
+    if (!map.Open(filename)) {
+        printf("[LoadMatchTableBinary] Error opening file '%s' "
+               "for reading\n", filename);
+        fflush(stdout);
+        exit(1);
+    }
+
+    int num_pairs = map.GetNumPairs();
+    unsigned long num_matches_total = 0;
+
+    for (int p = 0; p < num_pairs; p++) {
+        const match_file_entry_t &e = map.GetEntry(p);
+        const int32_t *idx_pairs = map.GetMatches(p);
+
+        SetMatch(e.i1, e.i2);
+
+        MatchIndex idx = GetMatchIndex(e.i1, e.i2);
+        std::vector<KeypointMatch> &list = m_matches.GetMatchList(idx);
+
+#ifndef KEY_LIMIT
+        /* The on-disk pairs have the layout of KeypointMatch */
+        assert(sizeof(KeypointMatch) == 2 * sizeof(int32_t));
+        const KeypointMatch *matches = (const KeypointMatch *) idx_pairs;
+        list.assign(matches, matches + e.num_matches);
+#else
+        list.clear();
+        for (unsigned int k = 0; k < e.num_matches; k++) {
+            int idx1 = idx_pairs[2 * k + 0];
+            int idx2 = idx_pairs[2 * k + 1];
+
+            if (idx1 > KEY_LIMIT || idx2 > KEY_LIMIT)
+                continue;
+
+            list.push_back(KeypointMatch(idx1, idx2));
+        }
+#endif /* KEY_LIMIT */
+
+        num_matches_total += e.num_matches;
+    }
+
+    printf("[LoadMatchTableBinary] Read %d pairs, %lu matches\n", 
+           num_pairs, num_matches_total);
+    fflush(stdout);
+}
+
 void BaseApp::LoadMatchIndexes(const char *index_dir)
 {
     int num_images = GetNumImages();
@@ -432,10 +488,48 @@ void BaseApp::LoadImageNamesFromFile(FILE *f)
     m_matches_computed = true;
     m_num_original_images = GetNumImages();
 
+    if (m_key_store_file != NULL)
+        LoadKeyStore(m_key_store_file);
+
     if (m_use_intrinsics)
         ReadIntrinsicsFile();
 }
 
+bool BaseApp::LoadKeyStore(const char *filename)
+{
+    printf("[LoadKeyStore] Mapping key store %s\n", filename);
+
+    KeyStoreMap *store = new KeyStoreMap;
+
+    if (!store->Open(filename)) {
+        delete store;
+        return false;
+    }
+
+    int num_images = GetNumImages();
+
+    if (store->GetNumImages() != num_images) {
+        printf("[LoadKeyStore] Error: key store has %d images, "
+               "but the image list has %d; using key files instead\n",
+               store->GetNumImages(), num_images);
+        delete store;
+        return false;
+    }
+
+    if (m_key_store != NULL)
+        delete m_key_store;
+
+    m_key_store = store;
+
+    for (int i = 0; i < num_images; i++) {
+        m_image_data[i].m_key_store = m_key_store;
+        m_image_data[i].m_key_store_index = i;
+        m_image_data[i].m_cached_keys = false;
+    }
+
+    return true;
+}
+
 /* Read in information about the world */
 void BaseApp::ReadBundleFile(char *filename)
 {
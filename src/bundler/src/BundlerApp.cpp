@@ -203,6 +203,19 @@ void PrintUsage()
            "      --slow_bundle\n"
            "         Run the slow version of bundle adjustment (adds one\n"
            "         image at a time)\n"
+           "      --local_bundle\n"
+           "         After adding images, adjust only the new cameras,\n"
+           "         their nearest co-visible cameras and the points\n"
+           "         these see, holding the rest of the model fixed\n"
+           "      --local_bundle_neighbors <k>\n"
+           "         Adjust the <k> cameras sharing the most points\n"
+           "         with the new ones.  Default is 10.\n"
+           "      --global_bundle_interval <n>\n"
+           "      --global_bundle_growth <x>\n"
+           "         With --local_bundle, still adjust the whole model\n"
+           "         after <n> new cameras, or when the number of\n"
+           "         cameras grew by a fraction <x>, since the last\n"
+           "         global adjustment.  Defaults are 20 and 0.25.\n"
            "\n"
            "  [Output options]\n"
            "    --output <file>\n"
@@ -218,6 +231,15 @@ void PrintUsage()
            "    --match_dir <dir>\n"
            "       Specifies the directory where the match-*-*.txt\n"
            "       files are stored.\n"
+           "    --key_store <file>\n"
+           "       Map keys from a key store built by BuildKeyStore\n"
+           "       instead of reading the .key files.\n"
+           "    --num_threads <n>\n"
+           "       Use <n> threads where the work is parallel\n"
+           "       (default: 1).\n"
+           "    --check_jacobians\n"
+           "       Check the analytic bundle adjustment Jacobians\n"
+           "       against finite differences before each run.\n"
            "    --help\n"
            "       Print this message\n\n");
 }
@@ -242,6 +264,10 @@ void BundlerApp::ProcessOptions(int argc, char **argv)
             {"slow_bundle",  0, 0, 'D'},
             {"skip_full_bundle", 0, 0, 321},//
             {"skip_add_points", 0, 0, 322},//
+            {"local_bundle", 0, 0, 373},
+            {"local_bundle_neighbors", 1, 0, 374},
+            {"global_bundle_interval", 1, 0, 375},
+            {"global_bundle_growth", 1, 0, 376},
 
             {"compress_list", 0, 0, '4'},
             {"scale_focal", 1, 0, 305},//
@@ -319,6 +345,9 @@ void BundlerApp::ProcessOptions(int argc, char **argv)
 {"match_dir",    1, 0, 'm'},
 {"match_index_dir", 1, 0, 366},
 {"match_table",  1, 0, 364},
+{"key_store",    1, 0, 370},
+{"num_threads",  1, 0, 371},
+{"check_jacobians", 0, 0, 372},
 {"image_dir",    1, 0, 300},//
 {"key_dir",      1, 0, 301},//
 
@@ -434,6 +463,22 @@ void BundlerApp::ProcessOptions(int argc, char **argv)
             m_skip_add_points = true;
             break;
 
+        case 373:
+            m_local_bundle = true;
+            break;
+
+        case 374:
+            m_local_bundle_neighbors = atoi(optarg);
+            break;
+
+        case 375:
+            m_global_bundle_interval = atoi(optarg);
+            break;
+
+        case 376:
+            m_global_bundle_growth = atof(optarg);
+            break;
+
         case '4':
             m_compress_list = true;
             break;
@@ -643,6 +688,17 @@ void BundlerApp::ProcessOptions(int argc, char **argv)
         case 364:
             m_match_table = strdup(optarg);
             break;
+        case 370:
+            m_key_store_file = strdup(optarg);
+            break;
+        case 371:
+            m_num_threads = atoi(optarg);
+            if (m_num_threads < 1)
+                m_num_threads = 1;
+            break;
+        case 372:
+            m_check_jacobians = true;
+            break;
         case 300:
             m_image_directory = strdup(optarg);
             break;
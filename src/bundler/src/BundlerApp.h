@@ -26,6 +26,18 @@
 
 typedef std::pair<int,int> ImagePair;
 
+/* The pose of an image estimated from the points of the current
+ * model it sees (see BundlerApp::ResectImage) */
+class CameraResection {
+public:
+    CameraResection() : m_success(false) { }
+
+    bool m_success;             /* Was the pose found? */
+    camera_params_t m_camera;   /* The new camera */
+    std::vector<int> m_keys;    /* Keys of the image that see... */
+    std::vector<int> m_points;  /* ...these points */
+};
+
 class BundlerApp : public BaseApp
 {
 public:
@@ -70,6 +82,7 @@ public:
         m_min_camera_distance_ratio = 0.0;
         m_baseline_threshold = -1.0;
         m_optimize_for_fisheye = false;
+        m_check_jacobians = false;
         m_use_focal_estimate = false;
         m_trust_focal_estimate = false;
         m_factor_essential = true;
@@ -91,6 +104,9 @@ public:
         m_match_directory = ".";
         m_match_index_dir = NULL;
         m_match_table = NULL;
+        m_key_store_file = NULL;
+        m_key_store = NULL;
+        m_num_threads = 1;
         m_key_directory = ".";
         m_image_directory = ".";
         m_output_directory = ".";
@@ -120,6 +136,11 @@ public:
         m_fast_bundle = true;
         m_skip_full_bundle = false;
         m_skip_add_points = false;
+        m_local_bundle = false;
+        m_local_bundle_neighbors = 10;
+        m_global_bundle_interval = 20;
+        m_global_bundle_growth = 0.25;
+        m_global_bundle_cameras = 0;
         m_use_angular_score = false;
 
         m_compress_list = false;
@@ -211,8 +232,9 @@ public:
 
 #ifndef __DEMO__
     /* Set constraints on cameras */
-    void SetCameraConstraints(int cam_idx, camera_params_t *params);
-    void SetFocalConstraint(const ImageData &data, camera_params_t *params);
+    void SetCameraConstraints(int cam_idx, camera_params_t *params) const;
+    void SetFocalConstraint(const ImageData &data, 
+                            camera_params_t *params) const;
     void ClearCameraConstraints(camera_params_t *params);
 #endif /* __DEMO__ */
 
@@ -339,6 +361,33 @@ public:
                               bool *success_out = NULL,
 			      bool refine_cameras_and_points = false);
 
+    /* Estimate the pose of an image from the points of the current
+     * model.  The keys and tracks of the image must be loaded.  Only
+     * reads the model, so it can run on several images at once; seed,
+     * if not NULL, is the state of the random numbers used */
+    CameraResection ResectImage(const ImageData &data, int image_idx,
+                                int num_points, const int *added_order,
+                                const v3_t *points, 
+                                const camera_params_t *parent,
+                                const camera_params_t *cameras,
+                                const std::vector<ImageKeyVector> &pt_views,
+                                bool refine_cameras_and_points,
+                                unsigned int *seed) const;
+
+    /* Estimate the poses of several images on m_num_threads threads.
+     * The result of each image only depends on the image and the
+     * model */
+    std::vector<CameraResection> 
+        ResectImages(const std::vector<int> &image_idxs,
+                     int num_points, const int *added_order, 
+                     const v3_t *points, const camera_params_t *cameras,
+                     const std::vector<ImageKeyVector> &pt_views);
+
+    /* Connect a resected image to the model as camera camera_idx */
+    void ConnectResection(ImageData &data, int camera_idx,
+                          const CameraResection &resection,
+                          std::vector<ImageKeyVector> &pt_views);
+
     /* Initialize an image for bundle adjustment (running a full
      * optimization) */
     void BundleInitializeImageFullBundle(int image_idx, int parent_idx,
@@ -353,22 +402,22 @@ public:
 
     /* Refine a set of 3D points */
     double RefinePoints(int num_points, v3_t *points, v2_t *projs,
-			int *pt_idxs, camera_params_t *cameras,
-			int *added_order,
+			int *pt_idxs, const camera_params_t *cameras,
+			const int *added_order,
 			const std::vector<ImageKeyVector> &pt_views,
-			camera_params_t *camera_out);
+			camera_params_t *camera_out) const;
 
     /* Refine a given camera and the points it observes */
     std::vector<int> RefineCameraAndPoints(const ImageData &data, 
                                            int num_points,
 					   v3_t *points, v2_t *projs,
 					   int *pt_idxs, 
-					   camera_params_t *cameras,
-					   int *added_order,
+					   const camera_params_t *cameras,
+					   const int *added_order,
 					   const std::vector<ImageKeyVector> 
 					      &pt_views,
 					   camera_params_t *camera_out,
-					     bool remove_outliers);
+					     bool remove_outliers) const;
 
     
     void MatchCloseImagesAndAddTracks(ImageData &data, int this_cam_idx,
@@ -385,6 +434,16 @@ public:
 		  std::vector<ImageKeyVector> &pt_views, double eps2 = 1.0e-12,
                   double *S = NULL, double *U = NULL, double *V = NULL,
                   double *W = NULL, bool remove_outliers = true);
+    double RunSFMLocal(int num_pts, int num_cameras, int first_new_camera,
+                       camera_params_t *cameras, v3_t *points,
+                       int *added_order, v3_t *colors,
+                       std::vector<ImageKeyVector> &pt_views);
+    double RunSFMIncremental(int num_pts, int num_cameras, 
+                             int first_new_camera,
+                             camera_params_t *cameras, v3_t *points,
+                             int *added_order, v3_t *colors,
+                             std::vector<ImageKeyVector> &pt_views,
+                             bool force_global = false);
     double RunSFMNecker(int i1, int i2, 
                         camera_params_t *cameras, 
                         int num_points, v3_t *points, v3_t *colors,
@@ -483,6 +542,9 @@ public:
 
     bool m_optimize_for_fisheye; /* Optimize for fisheye-distorted
                                   * points */
+    bool m_check_jacobians;      /* Check the bundle adjustment
+                                  * Jacobians against finite
+                                  * differences */
 
     int m_homography_rounds;     /* Homography RANSAC params */
     double m_homography_threshold;
@@ -574,6 +636,16 @@ public:
     bool m_skip_full_bundle;     /* Skip full optimization stages */
     bool m_skip_add_points;      /* Don't add new points to the
                                   * optimization */
+    bool m_local_bundle;         /* Adjust only the new cameras and
+                                  * their neighbors in most rounds */
+    int m_local_bundle_neighbors;   /* Number of neighbors adjusted
+                                     * with the new cameras */
+    int m_global_bundle_interval;   /* Run a global adjustment after
+                                     * this many new cameras... */
+    double m_global_bundle_growth;  /* ...or when the model grew by
+                                     * this fraction */
+    int m_global_bundle_cameras;    /* Number of cameras at the last
+                                     * global adjustment */
 
     /* Operations on bundle files */
     bool m_compress_list;        /* Output a compressed list and
@@ -688,7 +688,7 @@ std::vector<KeypointMatch>
    BundlerApp::MatchKeysToPoints(const std::vector<KeypointWithDesc> &k1, 
                                  double ratio) 
 {
-    ann_1_1_char::annMaxPtsVisit(20000);
+    ann_1_1_char::ANNsearchContext ctx(20000);
 
     int num_points = (int) m_point_data.size();
     std::vector<KeypointMatch> matches;
@@ -723,7 +723,7 @@ std::vector<KeypointMatch>
 	ann_1_1_char::ANNidx nn_idx[2];
 	ann_1_1_char::ANNdist dist[2];
 
-	tree->annkPriSearch(query, 2, nn_idx, dist, 0.0);
+	tree->annkPriSearch(query, 2, nn_idx, dist, 0.0, ctx);
 
 	if (sqrt(((double) dist[0]) / ((double) dist[1])) < ratio) {
 	    matches.push_back(KeypointMatch(i, nn_idx[0]));
@@ -753,7 +753,7 @@ std::vector<KeypointMatch>
    BundlerApp::MatchPointsToKeys(const std::vector<KeypointWithDesc> &keys, 
                                  double ratio) 
 {
-    ann_1_1_char::annMaxPtsVisit(200);
+    ann_1_1_char::ANNsearchContext ctx(200);
 
     int num_points = (int) keys.size();
     std::vector<KeypointMatch> matches;
@@ -786,7 +786,7 @@ std::vector<KeypointMatch>
 	ann_1_1_char::ANNidx nn_idx[2];
 	ann_1_1_char::ANNdist dist[2];
 
-	tree->annkPriSearch(query, 2, nn_idx, dist, 0.0);
+	tree->annkPriSearch(query, 2, nn_idx, dist, 0.0, ctx);
 
 	if (sqrt(((double) dist[0]) / ((double) dist[1])) < ratio) {
 	    matches.push_back(KeypointMatch(i, nn_idx[0]));
@@ -17,10 +17,15 @@
 /* ComputeTracks.cpp */
 /* Code for linking matches into tracks */
 
-#include <queue>
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <algorithm>
 
 #include "keys.h"
 
@@ -31,266 +36,469 @@ bool CompareFirst(const KeypointMatch &k1, const KeypointMatch &k2) {
     return (k1.m_idx1 < k2.m_idx1);
 }
 
-/* Compute a set of tracks that explain the matches */
-#define LARGE_NUMBER 99999999
-void BundlerApp::ComputeTracks(int new_image_start) 
+/* Tracks are built in stages over the (image, key) nodes, numbered
+ * image by image:
+ *
+ *   1. Sort every match list by m_idx1.
+ *   2. Build the match graph: for every node (img1, f1) and every
+ *      neighbor k of img1, in increasing order of k, an edge to the
+ *      first match of f1 in the (img1, k) list.  These are exactly the
+ *      lookups the breadth-first search used to do with equal_range.
+ *   3. Find the connected components of the graph with a concurrent
+ *      union-find.
+ *   4. Within every component, run the breadth-first search (at most
+ *      one key per image in a track, first come first served) from
+ *      each unvisited node in (image, key) order.
+ *
+ * A search never leaves its component, so running the searches of
+ * each component separately, then sorting the tracks by their first
+ * node, yields the same tracks in the same order as one serial search
+ * over all nodes.  All stages but the bookkeeping between them run on
+ * m_num_threads threads. */
+
+typedef struct track_job_t track_job_t;
+typedef void (*track_stage_t)(track_job_t *job, int item, int thread);
+
+struct track_job_t {
+    BundlerApp *app;
+    int num_images;
+    const int *node_offset;     /* First node of each image, and the
+                                 * total number of nodes at the end */
+    int *edge_offset;           /* First edge of each node */
+    int *edge_cursor;           /* Fill position of each node */
+    ImageKey *edges;            /* Edge targets */
+    int *parent;                /* Union-find forest */
+    char *visited;              /* Visited flags for the search */
+
+    const int *comp_offset;     /* First member of each component */
+    const int *comp_members;    /* Nodes of the components, in order */
+
+    bool **img_marked;          /* Per-thread image flags */
+    std::vector<int> *touched;  /* Per-thread list of flagged images */
+    std::vector<int> *track_start;     /* Per-thread first nodes */
+    std::vector<ImageKeyVector> *track_views; /* Per-thread tracks */
+
+    track_stage_t stage;
+    int num_items;
+    int chunk;
+    int next;                   /* Next item to hand out */
+    pthread_mutex_t lock;       /* Guards next */
+};
+
+typedef struct {
+    track_job_t *job;
+    int thread;
+} track_worker_t;
+
+static void *TrackWorker(void *arg)
 {
-    unsigned int num_images = GetNumImages();
+    track_worker_t *w = (track_worker_t *) arg;
+    track_job_t *job = w->job;
 
-    /* Clear all marks for new images */
-    for (unsigned int i = 0; i < num_images; i++) {
-        /* If this image has no neighbors, don't worry about its keys */
-        // std::list<unsigned int> &nbrs = m_matches.GetNeighbors(i);
-        // int num_nbrs = (int) nbrs.size();
-        int num_nbrs = (int) m_matches.GetNumNeighbors(i);
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        int start = job->next;
+        job->next += job->chunk;
+        pthread_mutex_unlock(&job->lock);
 
-        if (num_nbrs == 0)
-            continue;
+        if (start >= job->num_items)
+            break;
 
-        // m_image_data[i].LoadKeys(false);
-	// int num_features = GetNumKeys(i);
-        int num_features = m_image_data[i].GetNumKeys();
-        m_image_data[i].m_key_flags.resize(num_features);
+        int end = std::min(start + job->chunk, job->num_items);
+        for (int item = start; item < end; item++)
+            job->stage(job, item, w->thread);
+    }
+
+    return NULL;
+}
 
-	// for (int j = 0; j < num_features; j++) {
-	//     GetKey(i,j).m_extra = -1;
-	// }
+/* Run a stage over items [0, num_items), handing them out in chunks */
+static void RunTrackStage(track_job_t *job, track_stage_t stage, 
+                          int num_items, int chunk, int num_threads)
+{
+    job->stage = stage;
+    job->num_items = num_items;
+    job->chunk = chunk;
+    job->next = 0;
+
+    track_worker_t *workers = new track_worker_t[num_threads];
+    for (int t = 0; t < num_threads; t++) {
+        workers[t].job = job;
+        workers[t].thread = t;
     }
 
-    int pt_idx = 0;
+    if (num_threads == 1) {
+        TrackWorker(workers + 0);
+    } else {
+        pthread_t *threads = new pthread_t[num_threads];
 
-    std::vector<TrackData> tracks;
+        for (int t = 0; t < num_threads; t++)
+            pthread_create(threads + t, NULL, TrackWorker, workers + t);
+        for (int t = 0; t < num_threads; t++)
+            pthread_join(threads[t], NULL);
 
-    // KeymatchHashHash hashes;
-    // CreateKeymatchHashes(hashes);
+        delete [] threads;
+    }
 
-    /* Sort all match lists */
-#if 0
-    for (int i = 0; i < num_images; i++) {
-        for (int j = 0; j < num_images; j++) {
-            if (i == j)
-                continue;
+    delete [] workers;
+}
 
-            if (!ImagesMatch(i,j))
-                continue;
+/* Union-find with path halving.  Roots are always linked to the
+ * smaller root with a compare-and-swap, so concurrent unions are safe
+ * and the root of every component is its smallest node */
+static int FindRoot(int *parent, int x)
+{
+    while (1) {
+        int p = parent[x];
+        if (p == x)
+            return x;
+
+        int gp = parent[p];
+        if (gp != p)
+            __sync_bool_compare_and_swap(parent + x, p, gp);
 
-            MatchIndex idx = GetMatchIndex(i, j);
+        x = p;
+    }
+}
 
-            std::vector<KeypointMatch> &list = m_match_lists[idx];
+static void UnionRoots(int *parent, int a, int b)
+{
+    while (1) {
+        a = FindRoot(parent, a);
+        b = FindRoot(parent, b);
 
-            sort(list.begin(), list.end(), CompareFirst);
-        }
+        if (a == b)
+            return;
+
+        if (a > b)
+            std::swap(a, b);
+
+        if (__sync_bool_compare_and_swap(parent + b, b, a))
+            return;
+    }
+}
+
+static void SortMatchListsStage(track_job_t *job, int i, int thread)
+{
+    MatchTable &matches = job->app->m_matches;
+
+    MatchAdjList::iterator iter;
+    for (iter = matches.Begin(i); iter != matches.End(i); iter++) {
+        std::vector<KeypointMatch> &list = iter->m_match_list;
+        sort(list.begin(), list.end(), CompareFirst);
     }
-#else
-    for (unsigned int i = 0; i < num_images; i++) {
-        MatchAdjList::iterator iter;
-        for (iter = m_matches.Begin(i); iter != m_matches.End(i); iter++) {
-            // MatchIndex idx = *iter;
-            std::vector<KeypointMatch> &list = iter->m_match_list; // iter->second; // m_match_lists[idx];
-            sort(list.begin(), list.end(), CompareFirst);
+}
+
+/* Visit the edges out of image i's nodes: for each neighbor k (in
+ * increasing order) and each key f1, the first match of f1 in the
+ * sorted (i, k) list.  Matches to keys that are out of range, or to
+ * images without matches of their own, are skipped */
+static void VisitImageEdges(track_job_t *job, int i, bool fill)
+{
+    MatchTable &matches = job->app->m_matches;
+    int num_features = job->node_offset[i+1] - job->node_offset[i];
+
+    MatchAdjList::iterator iter;
+    for (iter = matches.Begin(i); iter != matches.End(i); iter++) {
+        int k = iter->m_index;
+        int num_features_k = job->node_offset[k+1] - job->node_offset[k];
+        const std::vector<KeypointMatch> &list = iter->m_match_list;
+        int num_matches = (int) list.size();
+
+        for (int m = 0; m < num_matches; m++) {
+            int f1 = list[m].m_idx1;
+            int f2 = list[m].m_idx2;
+
+            if (m > 0 && list[m-1].m_idx1 == f1)
+                continue;  /* only the first match of f1 is used */
+
+            if (f1 >= num_features || f2 >= num_features_k)
+                continue;
+
+            int node = job->node_offset[i] + f1;
+            if (fill)
+                job->edges[job->edge_cursor[node]++] = ImageKey(k, f2);
+            else
+                job->edge_offset[node + 1]++;
         }
     }
-#endif
+}
+
+static void CountEdgesStage(track_job_t *job, int i, int thread)
+{
+    VisitImageEdges(job, i, false);
+}
+
+static void FillEdgesStage(track_job_t *job, int i, int thread)
+{
+    VisitImageEdges(job, i, true);
+}
 
-    bool *img_marked = new bool[num_images];
-    memset(img_marked, 0, num_images * sizeof(bool));
+static void UnionStage(track_job_t *job, int i, int thread)
+{
+    for (int n = job->node_offset[i]; n < job->node_offset[i+1]; n++) {
+        for (int e = job->edge_offset[n]; e < job->edge_offset[n+1]; e++) {
+            const ImageKey &t = job->edges[e];
+            UnionRoots(job->parent, n, job->node_offset[t.first] + t.second);
+        }
+    }
+}
 
-    std::vector<int> touched;
-    touched.reserve(num_images);
+static void FlattenStage(track_job_t *job, int i, int thread)
+{
+    for (int n = job->node_offset[i]; n < job->node_offset[i+1]; n++)
+        job->parent[n] = FindRoot(job->parent, n);
+}
 
-    for (unsigned int i = 0; i < num_images; i++) {
-	int num_features = m_image_data[i].GetNumKeys(); // GetNumKeys(i);
+/* Run the breadth-first searches of component c */
+static void SearchComponentStage(track_job_t *job, int c, int thread)
+{
+    bool *img_marked = job->img_marked[thread];
+    std::vector<int> &touched = job->touched[thread];
+    const int *node_offset = job->node_offset;
 
-        /* If this image has no neighbors, skip it */
-        // std::list<unsigned int> &nbrs = m_matches.GetNeighbors(i);
-        // int num_nbrs = (int) nbrs.size();
-        int num_nbrs = (int) m_matches.GetNumNeighbors(i);
+    for (int m = job->comp_offset[c]; m < job->comp_offset[c+1]; m++) {
+        int start = job->comp_members[m];
 
-        if (num_nbrs == 0)
+        if (job->visited[start])
             continue;
 
-	for (int j = 0; j < num_features; j++) {
-	    ImageKeyVector features;
-	    std::queue<ImageKey> features_queue;
-
-	    /* Check if this feature was visited */
-	    // if (GetKey(i,j).m_extra >= 0)
-            //      continue;
-            if (m_image_data[i].m_key_flags[j])
-                continue; // already visited this feature
-
-            // memset(img_marked, 0, num_images * sizeof(bool));
-            /* Reset flags */
-            int num_touched = touched.size();
-            for (int k = 0; k < num_touched; k++)
-                img_marked[touched[k]] = false;
-            touched.clear();
-
-	    /* Do a breadth first search given this feature */
-	    // GetKey(i,j).m_extra = pt_idx;
-            m_image_data[i].m_key_flags[j] = true;
+        /* Reset flags */
+        int num_touched = (int) touched.size();
+        for (int k = 0; k < num_touched; k++)
+            img_marked[touched[k]] = false;
+        touched.clear();
 
-	    features.push_back(ImageKey(i, j));
-	    features_queue.push(ImageKey(i, j));
-
-            img_marked[i] = true;
-            touched.push_back(i);
-
-	    int num_rounds = 0;
-	    while (!features_queue.empty()) {
-		num_rounds++;
-
-		ImageKey feature = features_queue.front();
-		features_queue.pop();
-		
-		int img1 = feature.first;
-		int f1 = feature.second;
-                KeypointMatch dummy;
-                dummy.m_idx1 = f1;
-
-		int start_idx;
-		/* Limit new images to point only to other new images */
-		if (img1 >= new_image_start) {
-		    start_idx = new_image_start;
-		} else {
-		    start_idx = 0;
-		}
-
-		// for (unsigned int k = start_idx; k < num_images; k++) {
-                /* Check all adjacent images */
-                // std::list<unsigned int> &nbrs = m_matches.GetNeighbors(img1);
-                // int num_nbrs = (int) nbrs.size();
-                MatchAdjList &nbrs = m_matches.GetNeighbors(img1);
-
-                // std::list<unsigned int>::iterator iter;
-                MatchAdjList::iterator iter;
-                for (iter = nbrs.begin(); iter != nbrs.end(); iter++) {
-                    // for (int nbr = 0; nbr < num_nbrs; nbr++) {
-                    unsigned int k = iter->m_index; // *iter; // nbrs[nbr];
-
-                    if (img_marked[k])
-                        continue;
-
-		    /* Skip non-matching images */
-		    // if (!ImagesMatch(img1, k))
-                    //     continue;
-
-		    MatchIndex base = GetMatchIndex(img1, k);
-
-                    std::vector<KeypointMatch> &list = 
-                        m_matches.GetMatchList(base); // m_match_lists[base];
-
-                    /* Do a binary search for the feature */
-                    std::pair<std::vector<KeypointMatch>::iterator, 
-                              std::vector<KeypointMatch>::iterator> p;
-
-                    p = equal_range(list.begin(), list.end(), 
-                                    dummy, CompareFirst);
-
-                    if (p.first == p.second)
-                        continue;  /* not found */
-
-                    assert((p.first)->m_idx1 == f1);
-                    int idx2 = (p.first)->m_idx2;
-			    
-                    /* Check if we visited this point already */
-                    // if (GetKey(k,idx2).m_extra >= 0)
-                    //     continue;
-                    assert(idx2 < m_image_data[k].GetNumKeys());
-
-                    if (m_image_data[k].m_key_flags[idx2])
-                        continue;
-
-                    /* Mark and push the point */
-                    // GetKey(k,idx2).m_extra = pt_idx;
-                    m_image_data[k].m_key_flags[idx2] = true;
-                    features.push_back(ImageKey(k, idx2));
-                    features_queue.push(ImageKey(k, idx2));
-
-                    img_marked[k] = true;
-                    touched.push_back(k);
-		}
-	    } /* while loop */
-
-#if 0
-	    /* Check for consistency between features */
-	    bool consistent;
-	    int num_inconsistent = 0;
-	    do {
-		consistent = true;
-		
-		for (int k = 0; k < num_images; k++) {
-		    int track_size = (int) features.size();
-		    int count = 0;
-		    for (int l = 0; l < track_size; l++) {
-			if (features[l].first == k)
-			    count++;
-		    }
-
-		    if (count > 1) {
-			/* Remove the points associated with this
-			 * image */
-
-			for (int l = 0; l < track_size; l++) {
-			    if (features[l].first == k) {
-				int img = features[l].first;
-				int idx = features[l].second;
-				
-				// GetKey(img,idx).m_extra = LARGE_NUMBER;
-
-				features.erase(features.begin() + l);
-				track_size--;
-				l--;
-			    }
-			}
-
-			consistent = false;
-			num_inconsistent++;
-
-			break;
-		    }
-		}
-	    } while (!consistent);
-#endif
+        int i = (int) (std::upper_bound(node_offset, 
+                                        node_offset + job->num_images, 
+                                        start) - node_offset) - 1;
+
+        ImageKeyVector features;
+        features.push_back(ImageKey(i, start - node_offset[i]));
+        job->visited[start] = 1;
+
+        img_marked[i] = true;
+        touched.push_back(i);
+
+        /* The vector doubles as the queue */
+        for (int q = 0; q < (int) features.size(); q++) {
+            int node = node_offset[features[q].first] + features[q].second;
 
-	    if (features.size() >= 2) {
-		printf("Point with %d projections found\n", 
-                       //  (%d inconsistent)\n",
-		       (int) features.size()); // , num_inconsistent);
-		fflush(stdout);
+            for (int e = job->edge_offset[node]; 
+                 e < job->edge_offset[node+1]; e++) {
+                int k = job->edges[e].first;
+                int idx2 = job->edges[e].second;
 
-		tracks.push_back(TrackData(features));
+                if (img_marked[k])
+                    continue;
 
-		pt_idx++;
-	    } else {
-		// printf("Feature only has %d points (%d inconsistent)\n", 
-		//       (int) features.size(), num_inconsistent);
-	    }
+                int node2 = node_offset[k] + idx2;
+                if (job->visited[node2])
+                    continue;
 
-	} /* for loop over features */
-    } /* for loop over images */
+                /* Mark and push the point */
+                job->visited[node2] = 1;
+                features.push_back(ImageKey(k, idx2));
 
-    printf("[SifterApp::ComputeTracks] Found %d points\n", pt_idx);
+                img_marked[k] = true;
+                touched.push_back(k);
+            }
+        }
+
+        if (features.size() >= 2) {
+            job->track_start[thread].push_back(start);
+            job->track_views[thread].push_back(ImageKeyVector());
+            job->track_views[thread].back().swap(features);
+        }
+    }
+}
+
+/* Compute a set of tracks that explain the matches */
+void BundlerApp::ComputeTracks(int new_image_start) 
+{
+    int num_images = GetNumImages();
+    int num_threads = std::max(m_num_threads, 1);
+
+    /* Number the keys of every image that has neighbors */
+    int *node_offset = new int[num_images + 1];
+    node_offset[0] = 0;
+
+    for (int i = 0; i < num_images; i++) {
+        int num_features = 0;
+
+        /* If this image has no neighbors, don't worry about its keys */
+        if (m_matches.GetNumNeighbors(i) > 0) {
+            num_features = m_image_data[i].GetNumKeys();
+            m_image_data[i].m_key_flags.resize(num_features);
+        }
+
+        node_offset[i+1] = node_offset[i] + num_features;
+    }
+
+    int num_nodes = node_offset[num_images];
+
+    track_job_t job;
+    job.app = this;
+    job.num_images = num_images;
+    job.node_offset = node_offset;
+    pthread_mutex_init(&job.lock, NULL);
+
+    clock_t start = clock();
+
+    /* Sort all match lists */
+    RunTrackStage(&job, SortMatchListsStage, num_images, 1, num_threads);
+
+    /* Build the match graph */
+    job.edge_offset = new int[num_nodes + 1];
+    memset(job.edge_offset, 0, (num_nodes + 1) * sizeof(int));
+    RunTrackStage(&job, CountEdgesStage, num_images, 1, num_threads);
+
+    for (int n = 0; n < num_nodes; n++)
+        job.edge_offset[n+1] += job.edge_offset[n];
+
+    int num_edges = job.edge_offset[num_nodes];
+    job.edges = new ImageKey[num_edges];
+    job.edge_cursor = new int[num_nodes];
+    memcpy(job.edge_cursor, job.edge_offset, num_nodes * sizeof(int));
+    RunTrackStage(&job, FillEdgesStage, num_images, 1, num_threads);
+    delete [] job.edge_cursor;
+
+    printf("[ComputeTracks] Built match graph with %d keys and %d edges "
+           "in %0.3fs\n", num_nodes, num_edges, 
+           (double) (clock() - start) / CLOCKS_PER_SEC);
     fflush(stdout);
 
-    if (pt_idx != (int) tracks.size()) {
-	printf("[SifterApp::ComputeTracks] Error: point count "
-	       "inconsistent!\n");
-	fflush(stdout);
+    /* Find the connected components */
+    start = clock();
+
+    job.parent = new int[num_nodes];
+    for (int n = 0; n < num_nodes; n++)
+        job.parent[n] = n;
+
+    RunTrackStage(&job, UnionStage, num_images, 1, num_threads);
+    RunTrackStage(&job, FlattenStage, num_images, 1, num_threads);
+
+    /* Gather the components with more than one key, ordered by their
+     * smallest node, with members in increasing order */
+    int *comp_size = new int[num_nodes];
+    memset(comp_size, 0, num_nodes * sizeof(int));
+    for (int n = 0; n < num_nodes; n++)
+        comp_size[job.parent[n]]++;
+
+    std::vector<int> comp_offset;
+    int *comp_index = comp_size;  /* reused: root -> component index */
+    int num_members = 0;
+
+    for (int n = 0; n < num_nodes; n++) {
+        if (job.parent[n] != n)
+            continue;
+
+        int size = comp_size[n];
+        if (size < 2) {
+            comp_index[n] = -1;
+            continue;
+        }
+
+        comp_index[n] = (int) comp_offset.size();
+        comp_offset.push_back(num_members);
+        num_members += size;
     }
 
-    /* Clear match lists */
-    printf("[SifterApp::ComputeTracks] Clearing match lists...\n");
+    int num_comps = (int) comp_offset.size();
+    comp_offset.push_back(num_members);
+
+    int *comp_members = new int[num_members];
+    std::vector<int> comp_fill(comp_offset.begin(), comp_offset.end() - 1);
+    for (int n = 0; n < num_nodes; n++) {
+        int c = comp_index[job.parent[n]];
+        if (c >= 0)
+            comp_members[comp_fill[c]++] = n;
+    }
+
+    delete [] comp_size;
+    delete [] job.parent;
+
+    printf("[ComputeTracks] Found %d connected components covering "
+           "%d keys in %0.3fs\n", num_comps, num_members,
+           (double) (clock() - start) / CLOCKS_PER_SEC);
     fflush(stdout);
 
-    RemoveAllMatches();
+    /* Search each component for tracks */
+    start = clock();
 
-    /* Create the new consistent match lists */
-    printf("[SifterApp::ComputeTracks] Creating consistent match lists...\n");
+    job.visited = new char[num_nodes];
+    for (int i = 0; i < num_images; i++) {
+        for (int n = node_offset[i]; n < node_offset[i+1]; n++) {
+            job.visited[n] = 
+                m_image_data[i].m_key_flags[n - node_offset[i]] ? 1 : 0;
+        }
+    }
+
+    job.comp_offset = &comp_offset[0];
+    job.comp_members = comp_members;
+    job.img_marked = new bool *[num_threads];
+    job.touched = new std::vector<int>[num_threads];
+    job.track_start = new std::vector<int>[num_threads];
+    job.track_views = new std::vector<ImageKeyVector>[num_threads];
+
+    for (int t = 0; t < num_threads; t++) {
+        job.img_marked[t] = new bool[num_images];
+        memset(job.img_marked[t], 0, num_images * sizeof(bool));
+    }
+
+    RunTrackStage(&job, SearchComponentStage, num_comps, 64, num_threads);
+
+    /* Every key of an image with neighbors is now visited */
+    for (int i = 0; i < num_images; i++) {
+        int num_features = node_offset[i+1] - node_offset[i];
+        for (int j = 0; j < num_features; j++)
+            m_image_data[i].m_key_flags[j] = true;
+    }
+
+    /* Order the tracks by their first node, as a serial search over
+     * all nodes would have found them */
+    std::vector< std::pair<int, std::pair<int,int> > > order;
+    for (int t = 0; t < num_threads; t++) {
+        for (int k = 0; k < (int) job.track_start[t].size(); k++) {
+            order.push_back(std::make_pair(job.track_start[t][k], 
+                                           std::make_pair(t, k)));
+        }
+    }
+
+    std::sort(order.begin(), order.end());
+
+    int num_pts = (int) order.size();
+
+    std::vector<TrackData> tracks(num_pts);
+    for (int p = 0; p < num_pts; p++) {
+        int t = order[p].second.first;
+        int k = order[p].second.second;
+        tracks[p].m_views.swap(job.track_views[t][k]);
+    }
+
+    for (int t = 0; t < num_threads; t++)
+        delete [] job.img_marked[t];
+
+    delete [] job.img_marked;
+    delete [] job.touched;
+    delete [] job.track_start;
+    delete [] job.track_views;
+    delete [] job.visited;
+    delete [] job.edges;
+    delete [] job.edge_offset;
+    delete [] comp_members;
+    delete [] node_offset;
+    pthread_mutex_destroy(&job.lock);
+
+    printf("[ComputeTracks] Found %d points in %0.3fs (%d threads)\n", 
+           num_pts, (double) (clock() - start) / CLOCKS_PER_SEC, 
+           num_threads);
     fflush(stdout);
 
-    int num_pts = pt_idx;
+    /* Clear match lists */
+    RemoveAllMatches();
 
+    /* Create the new consistent match lists */
     for (int i = 0; i < num_pts; i++) {
 	int num_features = (int) tracks[i].m_views.size();
 
@@ -0,0 +1,122 @@
+/*
+ *  Copyright (c) 2008  Noah Snavely (snavely (at) cs.washington.edu)
+ *    and the University of Washington
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/* ConvertMatchTable.cpp */
+/* Convert a match table between the text and binary formats */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "MatchFile.h"
+
+/* Convert a text match table (as written by KeyMatchFull) to binary */
+static int TextToBinary(const char *file_in, const char *file_out)
+{
+    FILE *f = fopen(file_in, "r");
+    if (f == NULL) {
+        printf("Error opening file %s for reading\n", file_in);
+        return 1;
+    }
+
+    MatchFileWriter writer;
+    if (!writer.Open(file_out)) {
+        fclose(f);
+        return 1;
+    }
+
+    std::vector<int> idx;
+    int num_pairs = 0;
+    int i1, i2, num_matches;
+
+    while (fscanf(f, "%d %d", &i1, &i2) == 2) {
+        if (fscanf(f, "%d", &num_matches) != 1) {
+            printf("Error reading match count for pair (%d, %d)\n", i1, i2);
+            fclose(f);
+            writer.Close();
+            return 1;
+        }
+
+        idx.resize(2 * num_matches);
+        for (int k = 0; k < num_matches; k++) {
+            if (fscanf(f, "%d %d", &idx[2 * k + 0], &idx[2 * k + 1]) != 2) {
+                printf("Error reading match %d for pair (%d, %d)\n", 
+                       k, i1, i2);
+                fclose(f);
+                writer.Close();
+                return 1;
+            }
+        }
+
+        writer.WritePair(i1, i2, num_matches, 
+                         num_matches > 0 ? &idx[0] : NULL);
+        num_pairs++;
+    }
+
+    fclose(f);
+
+    printf("[ConvertMatchTable] Wrote %d pairs to %s\n", num_pairs, file_out);
+
+    return writer.Close() ? 0 : 1;
+}
+
+/* Convert a binary match table back to text */
+static int BinaryToText(const char *file_in, const char *file_out)
+{
+    MatchFileMap map;
+    if (!map.Open(file_in))
+        return 1;
+
+    FILE *f = fopen(file_out, "w");
+    if (f == NULL) {
+        printf("Error opening file %s for writing\n", file_out);
+        return 1;
+    }
+
+    int num_pairs = map.GetNumPairs();
+    for (int p = 0; p < num_pairs; p++) {
+        const match_file_entry_t &e = map.GetEntry(p);
+        const int32_t *idx = map.GetMatches(p);
+
+        fprintf(f, "%d %d\n", e.i1, e.i2);
+        fprintf(f, "%d\n", e.num_matches);
+
+        for (unsigned int k = 0; k < e.num_matches; k++)
+            fprintf(f, "%d %d\n", idx[2 * k + 0], idx[2 * k + 1]);
+    }
+
+    fclose(f);
+
+    printf("[ConvertMatchTable] Wrote %d pairs to %s\n", num_pairs, file_out);
+
+    return 0;
+}
+
+int main(int argc, char **argv) 
+{
+    if (argc != 3) {
+        printf("Usage: %s <matches.in> <matches.out>\n", argv[0]);
+        printf("  Converts a text match table to binary, or a binary "
+               "match table to text\n");
+        return -1;
+    }
+
+    if (IsBinaryMatchFile(argv[1]))
+        return BinaryToText(argv[1], argv[2]);
+    else
+        return TextToBinary(argv[1], argv[2]);
+}
@@ -728,7 +728,8 @@ void ImageData::LoadOrExtractKeys(char *sift_binary, bool undistort)
     char gzKeyName[512];
     sprintf(gzKeyName, "%s.gz", m_key_name);
 
-    if (FileExists(m_key_name) || FileExists(gzKeyName)) {
+    if (m_key_store != NULL || 
+        FileExists(m_key_name) || FileExists(gzKeyName)) {
 	LoadKeys(true, undistort);
     } else {
 	ExtractFeatures(sift_binary, undistort);
@@ -823,7 +824,21 @@ void ImageData::LoadKeys(bool descriptor, bool undistort) {
 
     /* Try to find a keypoint file */
     if (!descriptor) {
-        std::vector<Keypoint> kps = ReadKeyFile(m_key_name);
+        std::vector<Keypoint> kps;
+
+        if (m_key_store != NULL) {
+            int num_keys = m_key_store->GetNumKeys(m_key_store_index);
+            const float *x = m_key_store->GetX(m_key_store_index);
+            const float *y = m_key_store->GetY(m_key_store_index);
+
+            kps.resize(num_keys);
+            for (int k = 0; k < num_keys; k++) {
+                kps[k].m_x = x[k];
+                kps[k].m_y = y[k];
+            }
+        } else {
+            kps = ReadKeyFile(m_key_name);
+        }
 
         /* Flip y-axis to make things easier */
         for (int k = 0; k < (int) kps.size(); k++) {
@@ -840,8 +855,24 @@ void ImageData::LoadKeys(bool descriptor, bool undistort) {
     
         m_keys_loaded = true;
     } else {
-        std::vector<KeypointWithDesc> kps = 
-            ReadKeyFileWithDesc(m_key_name, true);
+        std::vector<KeypointWithDesc> kps;
+
+        if (m_key_store != NULL) {
+            /* Descriptors point straight into the mapped store */
+            int num_keys = m_key_store->GetNumKeys(m_key_store_index);
+            const float *x = m_key_store->GetX(m_key_store_index);
+            const float *y = m_key_store->GetY(m_key_store_index);
+            unsigned char *d = (unsigned char *)
+                m_key_store->GetDescriptors(m_key_store_index);
+
+            kps.resize(num_keys);
+            for (int k = 0; k < num_keys; k++) {
+                kps[k] = KeypointWithDesc(x[k], y[k], 
+                                          d + KEY_STORE_DESC_LEN * k);
+            }
+        } else {
+            kps = ReadKeyFileWithDesc(m_key_name, true);
+        }
 
         /* Flip y-axis to make things easier */
         for (int k = 0; k < (int) kps.size(); k++) {
@@ -871,7 +902,8 @@ void ImageData::UnloadKeys() {
         int num_keys = (int) m_keys_desc.size();
 
         for (int i = 0; i < num_keys; i++) {
-            if (m_keys_desc[i].m_d)
+            /* Descriptors from a key store belong to the mapping */
+            if (m_keys_desc[i].m_d && m_key_store == NULL)
                 delete [] m_keys_desc[i].m_d;
 
             m_keys_desc[i].m_d = NULL;
@@ -891,9 +923,29 @@ void ImageData::LoadKeysWithScaleRot(bool descriptor, bool undistort)
     if (m_keys_scale_rot_loaded)
 	return;   /* Already loaded the keys */
 
-    /* Try to find a keypoint file */    
-    std::vector<KeypointWithScaleRot> kps = 
-        ReadKeyFileWithScaleRot(m_key_name, descriptor);
+    std::vector<KeypointWithScaleRot> kps;
+
+    if (m_key_store != NULL) {
+        int num_keys = m_key_store->GetNumKeys(m_key_store_index);
+        const float *x = m_key_store->GetX(m_key_store_index);
+        const float *y = m_key_store->GetY(m_key_store_index);
+        const float *scale = m_key_store->GetScale(m_key_store_index);
+        const float *orient = m_key_store->GetOrient(m_key_store_index);
+        unsigned char *d = (unsigned char *)
+            m_key_store->GetDescriptors(m_key_store_index);
+
+        kps.resize(num_keys);
+        for (int k = 0; k < num_keys; k++) {
+            kps[k].m_x = x[k];
+            kps[k].m_y = y[k];
+            kps[k].m_scale = scale[k];
+            kps[k].m_orient = orient[k];
+            kps[k].m_d = descriptor ? d + KEY_STORE_DESC_LEN * k : NULL;
+        }
+    } else {
+        /* Try to find a keypoint file */    
+        kps = ReadKeyFileWithScaleRot(m_key_name, descriptor);
+    }
 
     /* Flip y-axis to make things easier */
     for (int k = 0; k < (int) kps.size(); k++) {
@@ -933,7 +985,10 @@ void ImageData::UnloadKeysWithScaleRot() {
 void ImageData::CacheNumKeys()
 {
 #ifndef __DEMO__
-    m_num_keys = GetNumberOfKeys(m_key_name);
+    if (m_key_store != NULL)
+        m_num_keys = m_key_store->GetNumKeys(m_key_store_index);
+    else
+        m_num_keys = GetNumberOfKeys(m_key_name);
 #else
     m_num_keys = 0;
 #endif
@@ -942,7 +997,7 @@ void ImageData::CacheNumKeys()
 }
 
 /* Save the dimensions of the image */
-void ImageData::CacheDimensions() 
+void ImageData::CacheDimensions() const
 {
     int w = 1504, h = 1000;
 
@@ -991,7 +1046,7 @@ void ImageData::CacheDimensions()
     m_cached_dimensions = true;
 }
 
-int ImageData::GetWidth() { 
+int ImageData::GetWidth() const { 
     if (m_image_loaded) return iround(global_scale * m_img->w);
     else { 
 	if (m_cached_dimensions)
@@ -1003,7 +1058,7 @@ int ImageData::GetWidth() {
 
     // return DEFAULT_WIDTH; /* hack */
 }
-int ImageData::GetHeight() { 
+int ImageData::GetHeight() const { 
     if (m_image_loaded) return iround(global_scale * m_img->h); 
     else { 
 	if (m_cached_dimensions)
@@ -31,6 +31,7 @@ using namespace std;
 #include "Geometry.h"
 #include "ParameterBound.h"
 // #include "Polygon.h"
+#include "KeyStore.h"
 #include "keys.h"
 
 
@@ -136,6 +137,8 @@ public:
         m_keys_scale_rot_loaded = false;
         m_cached_dimensions = false; 
         m_cached_keys = false;
+        m_key_store = NULL;
+        m_key_store_index = -1;
         //m_k0 = 1.0;
         //m_k1 = m_k2 = m_k3 = m_k4 = 0.0; 
         m_known_intrinsics = false;
@@ -186,12 +189,12 @@ public:
     void FromNDC(double x_n, double y_n, double &x, double &y);
 
     /* Save the dimensions of the image */
-    void CacheDimensions();
+    void CacheDimensions() const;
     void CacheNumKeys();
 
     /* Return the image dimensions */
-    int GetWidth();
-    int GetHeight();
+    int GetWidth() const;
+    int GetHeight() const;
     int GetArea();
 
     void GetBaseName(char *buf);    
@@ -317,9 +320,9 @@ public:
     void ComputeHistogramLUVNorm(int nbins, double *L_hist, 
         double *U_hist, double *V_hist);
 
-    int m_width, m_height;   /* Cached dimensions */
+    mutable int m_width, m_height;   /* Cached dimensions */
     int m_xmin,m_xmax,m_ymin,m_ymax; /*dimensions of bounding box of geometry projected onto the image*/
-    bool m_cached_dimensions;
+    mutable bool m_cached_dimensions;
 
     int m_num_keys;          /* Cached number of keys */
     bool m_cached_keys;
@@ -333,6 +336,9 @@ public:
     char *m_real_name;
     char *m_name;             /* Filename */
     char *m_key_name;         /* Key filename */
+    const KeyStoreMap *m_key_store; /* Mapped key store holding this
+                                     * image's keys (or NULL) */
+    int m_key_store_index;    /* Index of this image in m_key_store */
     char m_user_name[256];    /* User name */
     char m_flickr_index[256]; /* Flickr index */
     ImageDate m_date;         /* Date / time the photo was taken */
@@ -20,125 +20,654 @@
 #include <assert.h>
 #include <time.h>
 #include <string.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+
+#include <algorithm>
+
+#ifdef WIN32
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#endif
 
 #include "keys2a.h"
+#include "BruteForceMatch.h"
+#include "KeyStore.h"
+#include "MatchFile.h"
+
+/* Matches found between one pair of images */
+class PairMatches {
+public:
+    PairMatches() 
+    { }
+
+    PairMatches(int j) : m_j(j)
+    { }
+
+    int m_j;
+    std::vector<KeypointMatch> m_matches;
+};
+
+/* State shared by the match workers of one tree image */
+typedef struct {
+    int i;                      /* Index of the image in the tree */
+    ANNkd_tree *tree;           /* Search tree for image i (read-only),
+                                 * or NULL for exhaustive matching */
+    unsigned char **keys;
+    int *num_keys;
+    double ratio;
+
+    const std::vector<int> *candidates; /* Images j < i to match, or
+                                         * NULL to match all of them */
+    int next_j;                 /* Next image (or candidate) to hand out */
+    pthread_mutex_t lock;       /* Guards next_j */
+} match_job_t;
+
+typedef struct {
+    match_job_t *job;
+    std::vector<PairMatches> *out;  /* Per-thread result buffer */
+} match_worker_t;
+
+static void *MatchWorker(void *arg) 
+{
+    match_worker_t *w = (match_worker_t *) arg;
+    match_job_t *job = w->job;
+
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        int j = job->next_j++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (job->candidates != NULL) {
+            if (j >= (int) job->candidates->size())
+                break;
+
+            j = (*job->candidates)[j];
+        } else if (j >= job->i) {
+            break;
+        }
+
+        if (job->num_keys[j] == 0)
+            continue;
+
+        /* Compute likely matches between two sets of keypoints.
+         * MatchKeys searches with its own ANN search context, so the
+         * workers can share the tree. */
+        w->out->push_back(PairMatches(j));
+        if (job->tree != NULL) {
+            w->out->back().m_matches = 
+                MatchKeys(job->num_keys[j], job->keys[j], 
+                          job->tree, job->ratio);
+        } else {
+            w->out->back().m_matches = 
+                MatchKeysBruteForce(job->num_keys[j], job->keys[j],
+                                    job->num_keys[job->i], 
+                                    job->keys[job->i], job->ratio);
+        }
+    }
+
+    return NULL;
+}
+
+static bool ComparePairMatches(const PairMatches &a, const PairMatches &b) 
+{
+    return a.m_j < b.m_j;
+}
+
+/* A checkpoint is written before each image is matched.  The header
+ * records the next image to match and how much of the output is
+ * valid; for binary output it is followed by the index entries of
+ * the pairs written so far, which are appended as matching goes on.
+ * It also records the input and the options the output depends on,
+ * so that a run with other ones does not resume from it */
+#define CHECKPOINT_MAGIC "BNDLCKPT"
+#define CHECKPOINT_VERSION 2
+
+typedef struct {
+    char magic[8];              /* CHECKPOINT_MAGIC, not terminated */
+    uint32_t version;           /* CHECKPOINT_VERSION */
+    int32_t next_image;         /* First image not yet matched */
+    uint32_t num_pairs;         /* Number of index entries that follow */
+    int32_t num_images;         /* Number of images in the key list */
+    uint64_t keys_hash;         /* Hash of the key file names and counts */
+    uint64_t pairs_hash;        /* Hash of the -p pairs, 0 if none */
+    double ratio;               /* Ratio test threshold */
+    int32_t binary;             /* Binary (1) or text (0) output */
+    int32_t exhaustive;         /* Exhaustive (1) or kd-tree (0) search */
+    int32_t new_image_start;    /* First new image given with -n */
+    uint32_t reserved;
+    uint64_t out_size;          /* Valid bytes in the output file */
+} checkpoint_header_t;
+
+/* FNV-1a hash of n bytes, continuing from hash */
+static uint64_t HashBytes(uint64_t hash, const void *data, size_t n)
+{
+    const unsigned char *p = (const unsigned char *) data;
+
+    for (size_t i = 0; i < n; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+/* Returns true if a checkpoint was made with the same input and
+ * options as this run, and says why not otherwise */
+static bool CheckpointMatches(const char *filename, const char *out_file,
+                              const checkpoint_header_t &header,
+                              const checkpoint_header_t &run)
+{
+    const char *reason = NULL;
+
+    /* Size of the output the checkpoint refers to */
+    int64_t out_size = -1;
+    FILE *f = fopen(out_file, "rb");
+    if (f != NULL) {
+        fseeko(f, 0, SEEK_END);
+        out_size = ftello(f);
+        fclose(f);
+    }
+
+    if (header.version != CHECKPOINT_VERSION)
+        reason = "it has another version";
+    else if (header.num_images != run.num_images || 
+             header.keys_hash != run.keys_hash)
+        reason = "the key files differ";
+    else if (header.pairs_hash != run.pairs_hash)
+        reason = "the -p pairs differ";
+    else if (header.ratio != run.ratio || 
+             header.binary != run.binary ||
+             header.exhaustive != run.exhaustive ||
+             header.new_image_start != run.new_image_start)
+        reason = "the options differ";
+    else if (header.next_image < run.new_image_start || 
+             header.next_image > run.num_images ||
+             (!header.binary && header.num_pairs != 0))
+        reason = "it is corrupt";
+    else if (out_size < 0 || (uint64_t) out_size < header.out_size)
+        reason = "the output file is shorter than it records";
+
+    if (reason != NULL) {
+        printf("[KeyMatchFull] Ignoring checkpoint %s: %s\n", 
+               filename, reason);
+        return false;
+    }
+
+    return true;
+}
+
+static bool ReadCheckpoint(const char *filename, checkpoint_header_t &header,
+                           std::vector<match_file_entry_t> &index)
+{
+    FILE *f = fopen(filename, "rb");
+
+    if (f == NULL)
+        return false;
+
+    bool ok = (fread(&header, sizeof(checkpoint_header_t), 1, f) == 1 &&
+               memcmp(header.magic, CHECKPOINT_MAGIC, 8) == 0);
+
+    /* The index entries must all be in the file */
+    if (ok) {
+        fseeko(f, 0, SEEK_END);
+        uint64_t size = ftello(f) - sizeof(checkpoint_header_t);
+        fseeko(f, sizeof(checkpoint_header_t), SEEK_SET);
+
+        ok = (header.num_pairs <= size / sizeof(match_file_entry_t));
+    }
+
+    if (ok) {
+        index.resize(header.num_pairs);
+        if (header.num_pairs > 0) {
+            ok = (fread(&index[0], sizeof(match_file_entry_t), 
+                        header.num_pairs, f) == header.num_pairs);
+        }
+    }
+
+    fclose(f);
+
+    if (!ok)
+        printf("[KeyMatchFull] Ignoring invalid checkpoint %s\n", filename);
+
+    return ok;
+}
+
+/* Record that all images before next_image are done.  The new index
+ * entries are written before the header, so a run killed in between
+ * leaves the previous checkpoint intact */
+static void WriteCheckpoint(FILE *f, const checkpoint_header_t &run,
+                            int next_image, uint64_t out_size, 
+                            const std::vector<match_file_entry_t> &index,
+                            int &num_written)
+{
+    int num_pairs = (int) index.size();
+
+    if (num_pairs > num_written) {
+        fseek(f, sizeof(checkpoint_header_t) + 
+              num_written * sizeof(match_file_entry_t), SEEK_SET);
+        fwrite(&index[num_written], sizeof(match_file_entry_t), 
+               num_pairs - num_written, f);
+        fflush(f);
+        num_written = num_pairs;
+    }
+
+    checkpoint_header_t header = run;
+    header.next_image = next_image;
+    header.num_pairs = num_pairs;
+    header.out_size = out_size;
+
+    fseek(f, 0, SEEK_SET);
+    fwrite(&header, sizeof(checkpoint_header_t), 1, f);
+    fflush(f);
+}
 
 int main(int argc, char **argv) {
     char *list_in;
     char *file_out;
     double ratio;
+    int num_threads = 1;
+    bool binary = false;
+    bool exhaustive = false;
+    const char *pairs_in = NULL;
+    int new_image_start = 0;
+    bool resumable = false;
+
+    /* Parse the options */
+    int arg = 1;
+    while (arg < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            num_threads = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-b") == 0) {
+            binary = true;
+            arg++;
+        } else if (strcmp(argv[arg], "-x") == 0) {
+            exhaustive = true;
+            arg++;
+        } else if (strcmp(argv[arg], "-p") == 0 && arg + 1 < argc) {
+            pairs_in = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc) {
+            new_image_start = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-r") == 0) {
+            resumable = true;
+            arg++;
+        } else {
+            break;
+        }
+    }
     
-    if (argc != 3) {
-	printf("Usage: %s <list.txt> <outfile>\n", argv[0]);
+    if (argc - arg != 2 || num_threads < 1 || new_image_start < 0) {
+	printf("Usage: %s [-j <num_threads>] [-b] [-x] [-p <pairs.txt>] "
+               "[-n <first new image>] [-r] "
+               "<list.txt|key store> <outfile>\n"
+               "  -j  match with the given number of threads\n"
+               "  -b  write a binary match table\n"
+               "  -x  exact, exhaustive matching instead of kd-trees\n"
+               "  -p  only match the image pairs listed in the file "
+               "(e.g., from KeyMatchPairs)\n"
+               "  -n  outfile already holds the matches among the images "
+               "before the given one;\n"
+               "      match only pairs involving the new images and "
+               "append them\n"
+               "  -r  checkpoint to <outfile>.ckpt after every image, and "
+               "resume from it\n"
+               "      if it exists\n"
+               "  A key store built by BuildKeyStore is mapped in place "
+               "of the key files\n", argv[0]);
 	return -1;
     }
     
-    list_in = argv[1];
+    list_in = argv[arg];
     ratio = 0.6;
-    file_out = argv[2];
+    file_out = argv[arg + 1];
 
     clock_t start = clock();
 
     unsigned char **keys;
     int *num_keys;
 
-    /* Read the list of files */
+    /* Read the list of files, unless we were given a key store */
     std::vector<std::string> key_files;
+    KeyStoreMap store;
+    bool mapped = IsKeyStoreFile(list_in);
+    FILE *f;
 
-    printf("list of key files: %s\n", list_in);
-    
-    FILE *f = fopen(list_in, "r");
-    if (f == NULL) {
-        printf("Error opening file %s for reading\n", list_in);
-        return 1;
-    }
+    if (mapped) {
+        printf("key store: %s\n", list_in);
 
-    char buf[512];
-    while (fgets(buf, 512, f)) {
-        /* Remove trailing newline */
-        const int l = strlen(buf);
-        if (l > 1 && buf[l - 1] == '\n') {
-            if (l > 2 && buf[l - 2] == '\r')
-                buf[l - 2] = 0;
-            buf[l - 1] = 0;
+        if (!store.Open(list_in))
+            return 1;
+    } else {
+        printf("list of key files: %s\n", list_in);
+    
+        f = fopen(list_in, "r");
+        if (f == NULL) {
+            printf("Error opening file %s for reading\n", list_in);
+            return 1;
         }
-        
-        key_files.push_back(std::string(buf));
-    }
 
-    fclose(f);
+        char buf[512];
+        while (fgets(buf, 512, f)) {
+            /* Remove trailing newline */
+            const int l = strlen(buf);
+            if (l > 1 && buf[l - 1] == '\n') {
+                if (l > 2 && buf[l - 2] == '\r')
+                    buf[l - 2] = 0;
+                buf[l - 1] = 0;
+            }
+        
+            key_files.push_back(std::string(buf));
+        }
 
-    f = fopen(file_out, "w");
-    assert(f != NULL);
+        fclose(f);
+    }
 
-    int num_images = (int) key_files.size();
+    int num_images = 
+        mapped ? store.GetNumImages() : (int) key_files.size();
 
     keys = new unsigned char *[num_images];
     num_keys = new int[num_images];
 
-    /* Read all keys */
+    /* Read all keys.  Mapped descriptors are used in place by the
+     * search trees and the matcher, so nothing is copied */
     for (int i = 0; i < num_images; i++) {
-        keys[i] = NULL;
-        num_keys[i] = ReadKeyFile(key_files[i].c_str(), keys+i);
+        if (mapped) {
+            keys[i] = (unsigned char *) store.GetDescriptors(i);
+            num_keys[i] = store.GetNumKeys(i);
+        } else {
+            keys[i] = NULL;
+            num_keys[i] = ReadKeyFile(key_files[i].c_str(), keys+i);
+        }
         printf("num: %d\n", num_keys[i]);
     }
 
     clock_t end = clock();    
     printf("[KeyMatchFull] Reading keys took %0.3fs\n", 
            (end - start) / ((double) CLOCKS_PER_SEC));
-    
+
+    /* Read the candidate pairs; candidates[i] lists the j < i to
+     * match against image i */
+    std::vector<int> *candidates = NULL;
+    if (pairs_in != NULL) {
+        FILE *fp = fopen(pairs_in, "r");
+        if (fp == NULL) {
+            printf("Error opening file %s for reading\n", pairs_in);
+            return 1;
+        }
+
+        candidates = new std::vector<int>[num_images];
+
+        int i1, i2, num_pairs = 0;
+        while (fscanf(fp, "%d %d", &i1, &i2) == 2) {
+            if (i1 == i2 || i1 < 0 || i2 < 0 || 
+                i1 >= num_images || i2 >= num_images) {
+                printf("[KeyMatchFull] Skipping invalid pair %d %d\n", 
+                       i1, i2);
+                continue;
+            }
+
+            candidates[std::max(i1, i2)].push_back(std::min(i1, i2));
+            num_pairs++;
+        }
+
+        fclose(fp);
+
+        for (int i = 0; i < num_images; i++) {
+            std::vector<int> &c = candidates[i];
+            std::sort(c.begin(), c.end());
+            c.erase(std::unique(c.begin(), c.end()), c.end());
+        }
+
+        printf("[KeyMatchFull] Matching %d candidate pairs from %s\n",
+               num_pairs, pairs_in);
+    }
+
+    /* Pick up where a killed run left off, if it matched the same
+     * keys with the same options */
+    std::string checkpoint_file = std::string(file_out) + ".ckpt";
+    checkpoint_header_t run;
+    memset(&run, 0, sizeof(checkpoint_header_t));
+    memcpy(run.magic, CHECKPOINT_MAGIC, 8);
+    run.version = CHECKPOINT_VERSION;
+    run.num_images = num_images;
+    run.keys_hash = 0xcbf29ce484222325ULL;
     for (int i = 0; i < num_images; i++) {
+        const char *name = mapped ? store.GetName(i) : key_files[i].c_str();
+        run.keys_hash = HashBytes(run.keys_hash, name, strlen(name) + 1);
+        run.keys_hash = HashBytes(run.keys_hash, num_keys + i, sizeof(int));
+    }
+    if (candidates != NULL) {
+        run.pairs_hash = 0xcbf29ce484222325ULL;
+        for (int i = 0; i < num_images; i++) {
+            int n = (int) candidates[i].size();
+            run.pairs_hash = HashBytes(run.pairs_hash, &n, sizeof(int));
+            if (n > 0) {
+                run.pairs_hash = HashBytes(run.pairs_hash, &candidates[i][0],
+                                           n * sizeof(int));
+            }
+        }
+    }
+    run.ratio = ratio;
+    run.binary = binary ? 1 : 0;
+    run.exhaustive = exhaustive ? 1 : 0;
+    run.new_image_start = new_image_start;
+
+    checkpoint_header_t checkpoint;
+    std::vector<match_file_entry_t> checkpoint_index;
+    bool resume = resumable && 
+        ReadCheckpoint(checkpoint_file.c_str(), checkpoint, 
+                       checkpoint_index) &&
+        CheckpointMatches(checkpoint_file.c_str(), file_out, 
+                          checkpoint, run);
+
+    int first_image = new_image_start;
+    if (resume) {
+        first_image = checkpoint.next_image;
+        printf("[KeyMatchFull] Resuming from image %d\n", first_image);
+    } else if (new_image_start > 0) {
+        printf("[KeyMatchFull] Appending matches for images %d and up "
+               "to %s\n", new_image_start, file_out);
+    }
+
+    /* Open the output; existing pairs are kept when appending or
+     * resuming */
+    MatchFileWriter writer;
+    f = NULL;
+    if (binary) {
+        bool ok;
+        if (resume)
+            ok = writer.Reopen(file_out, checkpoint.out_size, 
+                               checkpoint_index);
+        else if (new_image_start > 0)
+            ok = writer.OpenAppend(file_out);
+        else
+            ok = writer.Open(file_out);
+
+        if (!ok)
+            return 1;
+    } else {
+        if (resume && !TruncateMatchFile(file_out, checkpoint.out_size))
+            return 1;
+
+        f = fopen(file_out, (resume || new_image_start > 0) ? "a" : "w");
+        if (f == NULL) {
+            printf("Error opening file %s for writing\n", file_out);
+            return 1;
+        }
+    }
+
+    FILE *checkpoint_f = NULL;
+    int checkpoint_written = 0;
+    if (resumable) {
+        checkpoint_f = fopen(checkpoint_file.c_str(), resume ? "r+b" : "wb");
+        if (checkpoint_f == NULL) {
+            printf("Error opening file %s for writing\n", 
+                   checkpoint_file.c_str());
+            return 1;
+        }
+
+        if (resume)
+            checkpoint_written = checkpoint.num_pairs;
+    }
+
+    if (num_threads > 1)
+        printf("[KeyMatchFull] Matching with %d threads\n", num_threads);
+
+    if (exhaustive) {
+        printf("[KeyMatchFull] Exhaustive matching (%s kernel)\n",
+               GetBruteForceMatchKernel());
+    }
+
+    pthread_t *threads = new pthread_t[num_threads];
+    match_worker_t *workers = new match_worker_t[num_threads];
+    std::vector<PairMatches> *buffers = 
+        new std::vector<PairMatches>[num_threads];
+    
+    for (int i = first_image; i < num_images; i++) {
+        if (checkpoint_f != NULL) {
+            uint64_t out_size;
+            if (binary) {
+                writer.Flush();
+                out_size = writer.GetOffset();
+            } else {
+                fflush(f);
+                out_size = ftello(f);
+            }
+
+            WriteCheckpoint(checkpoint_f, run, i, out_size, 
+                            writer.GetIndex(), checkpoint_written);
+        }
+
         if (num_keys[i] == 0)
             continue;
 
+        if (candidates != NULL && candidates[i].empty())
+            continue;
+
         printf("[KeyMatchFull] Matching to image %d\n", i);
 
         start = clock();
+        time_t start_wall = time(NULL);
 
         /* Create a tree from the keys */
-        ANNkd_tree *tree = CreateSearchTree(num_keys[i], keys[i]);
+        ANNkd_tree *tree = NULL;
+        if (!exhaustive)
+            tree = CreateSearchTree(num_keys[i], keys[i]);
 
-        for (int j = 0; j < i; j++) {
-            if (num_keys[j] == 0)
-                continue;
+        /* Hand out the images j < i to the workers */
+        match_job_t job;
+        job.i = i;
+        job.tree = tree;
+        job.keys = keys;
+        job.num_keys = num_keys;
+        job.ratio = ratio;
+        job.candidates = candidates != NULL ? candidates + i : NULL;
+        job.next_j = 0;
+        pthread_mutex_init(&job.lock, NULL);
 
-            /* Compute likely matches between two sets of keypoints */
-            std::vector<KeypointMatch> matches = 
-                MatchKeys(num_keys[j], keys[j], tree, ratio);
-            
+        int num_jobs = 
+            candidates != NULL ? (int) candidates[i].size() : i;
+        int num_workers = std::min(num_threads, std::max(num_jobs, 1));
+        for (int t = 0; t < num_workers; t++) {
+            buffers[t].clear();
+            workers[t].job = &job;
+            workers[t].out = buffers + t;
+        }
+
+        if (num_workers == 1) {
+            MatchWorker(workers + 0);
+        } else {
+            for (int t = 0; t < num_workers; t++)
+                pthread_create(threads + t, NULL, MatchWorker, workers + t);
+            for (int t = 0; t < num_workers; t++)
+                pthread_join(threads[t], NULL);
+        }
+
+        pthread_mutex_destroy(&job.lock);
+
+        /* Merge the per-thread buffers in order of j, so the output
+         * does not depend on the number of threads */
+        std::vector<PairMatches> pairs;
+        for (int t = 0; t < num_workers; t++) {
+            for (int p = 0; p < (int) buffers[t].size(); p++) {
+                pairs.push_back(PairMatches(buffers[t][p].m_j));
+                pairs.back().m_matches.swap(buffers[t][p].m_matches);
+            }
+        }
+
+        std::sort(pairs.begin(), pairs.end(), ComparePairMatches);
+
+        for (int p = 0; p < (int) pairs.size(); p++) {
+            int j = pairs[p].m_j;
+            const std::vector<KeypointMatch> &matches = pairs[p].m_matches;
             int num_matches = (int) matches.size();
 
-            if (num_matches >= 16) {
+            if (num_matches >= 16 && binary) {
+                assert(sizeof(KeypointMatch) == 2 * sizeof(int));
+                writer.WritePair(j, i, num_matches, 
+                                 (const int *) &matches[0]);
+            } else if (num_matches >= 16) {
                 /* Write the pair */
                 fprintf(f, "%d %d\n", j, i);
 
                 /* Write the number of matches */
                 fprintf(f, "%d\n", (int) matches.size());
 
-                for (int i = 0; i < num_matches; i++) {
+                for (int k = 0; k < num_matches; k++) {
                     fprintf(f, "%d %d\n", 
-                            matches[i].m_idx1, matches[i].m_idx2);
+                            matches[k].m_idx1, matches[k].m_idx2);
                 }
             }
         }
 
         end = clock();    
-        printf("[KeyMatchFull] Matching took %0.3fs\n", 
-               (end - start) / ((double) CLOCKS_PER_SEC));
+        if (num_threads > 1) {
+            printf("[KeyMatchFull] Matching took %0.3fs (%ds wall)\n", 
+                   (end - start) / ((double) CLOCKS_PER_SEC),
+                   (int) (time(NULL) - start_wall));
+        } else {
+            printf("[KeyMatchFull] Matching took %0.3fs\n", 
+                   (end - start) / ((double) CLOCKS_PER_SEC));
+        }
         fflush(stdout);
 
-        // annDeallocPts(tree->pts);
-        delete tree;
+        if (tree != NULL)
+            DeleteSearchTree(tree);
     }
+
+    delete [] threads;
+    delete [] workers;
+    delete [] buffers;
+
+    if (candidates != NULL)
+        delete [] candidates;
     
     /* Free keypoints */
     for (int i = 0; i < num_images; i++) {
-        if (keys[i] != NULL)
+        if (keys[i] != NULL && !mapped)
             delete [] keys[i];
     }
     delete [] keys;
     delete [] num_keys;
     
-    fclose(f);
-    return 0;
+    bool ok;
+    if (binary) {
+        ok = writer.Close();
+    } else {
+        ok = (ferror(f) == 0);
+        fclose(f);
+    }
+
+    /* The output is complete, so the checkpoint is no longer needed */
+    if (checkpoint_f != NULL) {
+        fclose(checkpoint_f);
+        if (ok)
+            remove(checkpoint_file.c_str());
+    }
+
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,264 @@
+/* 
+ *  Copyright (c) 2008  Noah Snavely (snavely (at) cs.washington.edu)
+ *    and the University of Washington
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/* KeyMatchPairs.cpp */
+/* Select the image pairs worth matching with a vocabulary tree */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "keys2a.h"
+#include "KeyStore.h"
+#include "MatchFile.h"
+#include "VocabTree.h"
+
+typedef std::pair<int,int> ImagePair;
+
+/* Read the image pairs of a (text or binary) match table */
+static bool ReadMatchTablePairs(const char *filename, 
+                                std::vector<ImagePair> &pairs)
+{
+    pairs.clear();
+
+    if (IsBinaryMatchFile(filename)) {
+        MatchFileMap table;
+        if (!table.Open(filename))
+            return false;
+
+        for (int p = 0; p < table.GetNumPairs(); p++) {
+            const match_file_entry_t &e = table.GetEntry(p);
+            pairs.push_back(ImagePair(std::min(e.i1, e.i2), 
+                                      std::max(e.i1, e.i2)));
+        }
+    } else {
+        FILE *f = fopen(filename, "r");
+        if (f == NULL) {
+            printf("Error opening file %s for reading\n", filename);
+            return false;
+        }
+
+        int i1, i2, num_matches;
+        while (fscanf(f, "%d %d", &i1, &i2) == 2 &&
+               fscanf(f, "%d", &num_matches) == 1) {
+            for (int k = 0; k < num_matches; k++) {
+                int idx1, idx2;
+                if (fscanf(f, "%d %d", &idx1, &idx2) != 2)
+                    break;
+            }
+
+            pairs.push_back(ImagePair(std::min(i1, i2), std::max(i1, i2)));
+        }
+
+        fclose(f);
+    }
+
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+    return true;
+}
+
+static void PrintUsage(const char *prog)
+{
+    printf("Usage: %s [options] <list.txt|key store> <pairs.txt>\n"
+           "  -k <num>    candidate partners per image (default 10)\n"
+           "  -b <num>    vocabulary tree branching factor (default 8)\n"
+           "  -d <num>    vocabulary tree depth (default 4)\n"
+           "  -s <num>    max descriptors used to build the tree "
+           "(default 200000)\n"
+           "  -e <table>  report recall against a full match table\n"
+           "  The pairs file can be passed to KeyMatchFull -p\n", prog);
+}
+
+int main(int argc, char **argv) 
+{
+    int k = 10;
+    int branch = 8;
+    int depth = 4;
+    int max_sample = 200000;
+    const char *eval_table = NULL;
+
+    /* Parse the options */
+    int arg = 1;
+    while (arg + 1 < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-k") == 0) {
+            k = atoi(argv[arg + 1]);
+        } else if (strcmp(argv[arg], "-b") == 0) {
+            branch = atoi(argv[arg + 1]);
+        } else if (strcmp(argv[arg], "-d") == 0) {
+            depth = atoi(argv[arg + 1]);
+        } else if (strcmp(argv[arg], "-s") == 0) {
+            max_sample = atoi(argv[arg + 1]);
+        } else if (strcmp(argv[arg], "-e") == 0) {
+            eval_table = argv[arg + 1];
+        } else {
+            break;
+        }
+
+        arg += 2;
+    }
+
+    if (argc - arg != 2 || k < 1 || branch < 2 || depth < 1 || 
+        max_sample < 1) {
+        PrintUsage(argv[0]);
+        return -1;
+    }
+
+    const char *list_in = argv[arg];
+    const char *file_out = argv[arg + 1];
+
+    clock_t start = clock();
+
+    /* Read the keys, from a key store or a list of key files */
+    KeyStoreMap store;
+    bool mapped = IsKeyStoreFile(list_in);
+    std::vector<std::string> key_files;
+
+    if (mapped) {
+        if (!store.Open(list_in))
+            return 1;
+    } else {
+        FILE *f = fopen(list_in, "r");
+        if (f == NULL) {
+            printf("Error opening file %s for reading\n", list_in);
+            return 1;
+        }
+
+        char buf[512];
+        while (fgets(buf, 512, f)) {
+            /* Remove trailing newline */
+            const int l = strlen(buf);
+            if (l > 1 && buf[l - 1] == '\n') {
+                if (l > 2 && buf[l - 2] == '\r')
+                    buf[l - 2] = 0;
+                buf[l - 1] = 0;
+            }
+        
+            key_files.push_back(std::string(buf));
+        }
+
+        fclose(f);
+    }
+
+    int num_images = 
+        mapped ? store.GetNumImages() : (int) key_files.size();
+
+    std::vector<unsigned char *> keys(num_images);
+    std::vector<int> num_keys(num_images);
+    int total_keys = 0;
+
+    for (int i = 0; i < num_images; i++) {
+        if (mapped) {
+            keys[i] = (unsigned char *) store.GetDescriptors(i);
+            num_keys[i] = store.GetNumKeys(i);
+        } else {
+            keys[i] = NULL;
+            num_keys[i] = ReadKeyFile(key_files[i].c_str(), &keys[i]);
+        }
+
+        total_keys += num_keys[i];
+    }
+
+    printf("[KeyMatchPairs] Read %d keys from %d images\n", 
+           total_keys, num_images);
+
+    /* Build the vocabulary from an evenly strided sample of the keys */
+    int stride = std::max(1, (total_keys + max_sample - 1) / max_sample);
+    std::vector<unsigned char> sample;
+    int count = 0;
+
+    for (int i = 0; i < num_images; i++) {
+        for (int j = 0; j < num_keys[i]; j++, count++) {
+            if (count % stride == 0) {
+                sample.insert(sample.end(), keys[i] + 128 * j, 
+                              keys[i] + 128 * (j + 1));
+            }
+        }
+    }
+
+    int num_sample = (int) sample.size() / 128;
+
+    VocabTree tree;
+    tree.Build(num_sample, num_sample > 0 ? &sample[0] : NULL, 
+               branch, depth, 10);
+    sample.clear();
+
+    printf("[KeyMatchPairs] Built a vocabulary of %d words from %d keys\n",
+           tree.GetNumWords(), num_sample);
+
+    /* Quantize every key */
+    std::vector< std::vector<int> > words(num_images);
+    for (int i = 0; i < num_images; i++) {
+        words[i].resize(num_keys[i]);
+        for (int j = 0; j < num_keys[i]; j++)
+            words[i][j] = tree.Quantize(keys[i] + 128 * j);
+
+        if (!mapped && keys[i] != NULL)
+            delete [] keys[i];
+    }
+
+    std::vector<ImagePair> pairs;
+    SelectCandidatePairs(words, tree.GetNumWords(), k, pairs);
+
+    FILE *f = fopen(file_out, "w");
+    if (f == NULL) {
+        printf("Error opening file %s for writing\n", file_out);
+        return 1;
+    }
+
+    for (int p = 0; p < (int) pairs.size(); p++)
+        fprintf(f, "%d %d\n", pairs[p].first, pairs[p].second);
+
+    fclose(f);
+
+    clock_t end = clock();
+
+    int num_all = num_images * (num_images - 1) / 2;
+    printf("[KeyMatchPairs] Selected %d of %d pairs in %0.3fs\n",
+           (int) pairs.size(), num_all, 
+           (end - start) / ((double) CLOCKS_PER_SEC));
+
+    if (eval_table != NULL) {
+        /* Every pair in a full match table passed the matcher's
+         * minimum match count, so recall is the fraction of those
+         * pairs that were selected */
+        std::vector<ImagePair> ref;
+        if (!ReadMatchTablePairs(eval_table, ref))
+            return 1;
+
+        std::vector<ImagePair> found;
+        std::set_intersection(ref.begin(), ref.end(), 
+                              pairs.begin(), pairs.end(),
+                              std::back_inserter(found));
+
+        printf("[KeyMatchPairs] Recall: %d of %d matched pairs (%0.1f%%)\n",
+               (int) found.size(), (int) ref.size(),
+               ref.empty() ? 100.0 : 100.0 * found.size() / ref.size());
+        printf("[KeyMatchPairs] Matching work: %0.1f%% of full matching "
+               "(%0.2fx fewer pairs)\n",
+               num_all == 0 ? 100.0 : 100.0 * pairs.size() / num_all,
+               pairs.empty() ? 0.0 : (double) num_all / pairs.size());
+    }
+
+    return 0;
+}
@@ -0,0 +1,303 @@
+/*
+ *  Copyright (c) 2008  Noah Snavely (snavely (at) cs.washington.edu)
+ *    and the University of Washington
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/* KeyStore.cpp */
+/* Binary, memory-mappable container for the keypoints of a whole
+ * image collection */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#define fseeko _fseeki64
+#endif
+
+#include "KeyStore.h"
+
+static uint64_t AlignOffset(uint64_t offset)
+{
+    return (offset + KEY_STORE_ALIGN - 1) & ~((uint64_t) KEY_STORE_ALIGN - 1);
+}
+
+bool IsKeyStoreFile(const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+
+    if (f == NULL)
+        return false;
+
+    char magic[8];
+    bool store = (fread(magic, 1, 8, f) == 8 && 
+                  memcmp(magic, KEY_STORE_MAGIC, 8) == 0);
+
+    fclose(f);
+    return store;
+}
+
+bool KeyStoreWriter::Open(const char *filename, 
+                          const std::vector<const char *> &names,
+                          const std::vector<int> &num_keys)
+{
+    assert(names.size() == num_keys.size());
+
+    m_f = fopen(filename, "wb");
+
+    if (m_f == NULL) {
+        printf("[KeyStoreWriter::Open] Error opening file %s "
+               "for writing\n", filename);
+        return false;
+    }
+
+    int num_images = (int) names.size();
+
+    m_index.resize(num_images);
+
+    uint64_t total = 0;
+    for (int i = 0; i < num_images; i++) {
+        key_store_entry_t &e = m_index[i];
+        memset(&e, 0, sizeof(key_store_entry_t));
+
+        e.first_key = total;
+        e.num_keys = num_keys[i];
+
+        if (strlen(names[i]) >= KEY_STORE_NAME_LEN) {
+            printf("[KeyStoreWriter::Open] Warning: name %s truncated\n",
+                   names[i]);
+        }
+
+        strncpy(e.name, names[i], KEY_STORE_NAME_LEN - 1);
+
+        total += num_keys[i];
+    }
+
+    memset(&m_header, 0, sizeof(key_store_header_t));
+    memcpy(m_header.magic, KEY_STORE_MAGIC, 8);
+    m_header.version = KEY_STORE_VERSION;
+    m_header.byte_order = KEY_STORE_BYTE_ORDER;
+    m_header.num_images = num_images;
+    m_header.num_keys = total;
+
+    uint64_t offset = sizeof(key_store_header_t) + 
+        num_images * sizeof(key_store_entry_t);
+
+    m_header.x_offset = AlignOffset(offset);
+    m_header.y_offset = AlignOffset(m_header.x_offset + total * sizeof(float));
+    m_header.scale_offset = 
+        AlignOffset(m_header.y_offset + total * sizeof(float));
+    m_header.orient_offset = 
+        AlignOffset(m_header.scale_offset + total * sizeof(float));
+    m_header.desc_offset = 
+        AlignOffset(m_header.orient_offset + total * sizeof(float));
+
+    /* Write the header, the index, and extend the file to its final
+     * size so that images can be written out of order */
+    fwrite(&m_header, sizeof(key_store_header_t), 1, m_f);
+
+    if (num_images > 0)
+        fwrite(&m_index[0], sizeof(key_store_entry_t), num_images, m_f);
+
+    uint64_t end = m_header.desc_offset + KEY_STORE_DESC_LEN * total;
+    if (end > offset) {
+        char zero = 0;
+        fseeko(m_f, end - 1, SEEK_SET);
+        fwrite(&zero, 1, 1, m_f);
+    }
+
+    return true;
+}
+
+void KeyStoreWriter::WriteArray(uint64_t offset, uint64_t first, int n, 
+                                int elem_size, const void *data)
+{
+    /* Missing arrays are left as the zeros written by Open */
+    if (n == 0 || data == NULL)
+        return;
+
+    fseeko(m_f, offset + first * elem_size, SEEK_SET);
+    fwrite(data, elem_size, n, m_f);
+}
+
+void KeyStoreWriter::WriteImage(int i, const float *x, const float *y, 
+                                const float *scale, const float *orient,
+                                const unsigned char *desc)
+{
+    assert(m_f != NULL);
+    assert(i >= 0 && i < (int) m_index.size());
+
+    uint64_t first = m_index[i].first_key;
+    int n = m_index[i].num_keys;
+
+    WriteArray(m_header.x_offset, first, n, sizeof(float), x);
+    WriteArray(m_header.y_offset, first, n, sizeof(float), y);
+    WriteArray(m_header.scale_offset, first, n, sizeof(float), scale);
+    WriteArray(m_header.orient_offset, first, n, sizeof(float), orient);
+    WriteArray(m_header.desc_offset, first, n, KEY_STORE_DESC_LEN, desc);
+}
+
+bool KeyStoreWriter::Close()
+{
+    assert(m_f != NULL);
+
+    bool ok = (ferror(m_f) == 0);
+    fclose(m_f);
+    m_f = NULL;
+    m_index.clear();
+
+    if (!ok)
+        printf("[KeyStoreWriter::Close] Error writing key store\n");
+
+    return ok;
+}
+
+/* Returns true if count elements of elem_size bytes starting at
+ * offset lie inside a file of size bytes */
+static bool ArrayFits(uint64_t offset, uint64_t count, uint64_t elem_size,
+                      uint64_t size)
+{
+    return offset <= size && count <= (size - offset) / elem_size;
+}
+
+bool KeyStoreMap::Open(const char *filename)
+{
+    Close();
+
+#ifndef WIN32
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("[KeyStoreMap::Open] Error opening file %s\n", filename);
+        return false;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        printf("[KeyStoreMap::Open] Error: could not stat file %s\n", 
+               filename);
+        close(fd);
+        return false;
+    }
+
+    m_size = sb.st_size;
+    void *data = NULL;
+    if (m_size > 0)
+        data = mmap(NULL, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (data == NULL || data == MAP_FAILED) {
+        printf("[KeyStoreMap::Open] Error mapping file %s\n", filename);
+        m_size = 0;
+        return false;
+    }
+
+    m_data = (const char *) data;
+#else
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL) {
+        printf("[KeyStoreMap::Open] Error opening file %s\n", filename);
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    m_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    /* Keep the descriptors aligned as they would be in a mapping */
+    char *data = (char *) _aligned_malloc(m_size, KEY_STORE_ALIGN);
+    if (fread(data, 1, m_size, f) != m_size) {
+        printf("[KeyStoreMap::Open] Error reading file %s\n", filename);
+        _aligned_free(data);
+        fclose(f);
+        m_size = 0;
+        return false;
+    }
+    fclose(f);
+
+    m_data = data;
+#endif
+
+    const key_store_header_t *header = (const key_store_header_t *) m_data;
+
+    if (m_size < sizeof(key_store_header_t) || 
+        memcmp(header->magic, KEY_STORE_MAGIC, 8) != 0) {
+        printf("[KeyStoreMap::Open] %s is not a key store\n", filename);
+        Close();
+        return false;
+    }
+
+    if (header->version != KEY_STORE_VERSION || 
+        header->byte_order != KEY_STORE_BYTE_ORDER) {
+        printf("[KeyStoreMap::Open] Unsupported key store version %u "
+               "or byte order\n", header->version);
+        Close();
+        return false;
+    }
+
+    uint64_t num_keys = header->num_keys;
+    if (!ArrayFits(sizeof(key_store_header_t), header->num_images, 
+                   sizeof(key_store_entry_t), m_size) ||
+        !ArrayFits(header->x_offset, num_keys, sizeof(float), m_size) ||
+        !ArrayFits(header->y_offset, num_keys, sizeof(float), m_size) ||
+        !ArrayFits(header->scale_offset, num_keys, sizeof(float), m_size) ||
+        !ArrayFits(header->orient_offset, num_keys, sizeof(float), m_size) ||
+        !ArrayFits(header->desc_offset, num_keys, 
+                   KEY_STORE_DESC_LEN, m_size)) {
+        printf("[KeyStoreMap::Open] Key store %s is truncated\n", filename);
+        Close();
+        return false;
+    }
+
+    const key_store_entry_t *index = (const key_store_entry_t *) 
+        (m_data + sizeof(key_store_header_t));
+
+    /* Check every image's keys and name once, so that the accessors
+     * never read outside the mapping */
+    for (uint32_t i = 0; i < header->num_images; i++) {
+        if (index[i].first_key > num_keys ||
+            index[i].num_keys > num_keys - index[i].first_key ||
+            memchr(index[i].name, 0, KEY_STORE_NAME_LEN) == NULL) {
+            printf("[KeyStoreMap::Open] Key store %s has a bad entry "
+                   "for image %u\n", filename, i);
+            Close();
+            return false;
+        }
+    }
+
+    m_header = header;
+    m_index = index;
+
+    return true;
+}
+
+void KeyStoreMap::Close()
+{
+    if (m_data != NULL) {
+#ifndef WIN32
+        munmap((void *) m_data, m_size);
+#else
+        _aligned_free((void *) m_data);
+#endif
+    }
+
+    m_data = NULL;
+    m_size = 0;
+    m_header = NULL;
+    m_index = NULL;
+}
@@ -0,0 +1,170 @@
+/*
+ *  Copyright (c) 2008  Noah Snavely (snavely (at) cs.washington.edu)
+ *    and the University of Washington
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/* KeyStore.h */
+/* Binary, memory-mappable container for the keypoints of a whole
+ * image collection */
+
+#ifndef __key_store_h__
+#define __key_store_h__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <vector>
+
+/* The key store is laid out as follows (host byte order):
+ *
+ *   key_store_header_t                  header
+ *   key_store_entry_t[num_images]       index, one entry per image
+ *   float[num_keys]                     x of every key
+ *   float[num_keys]                     y
+ *   float[num_keys]                     scale
+ *   float[num_keys]                     orientation
+ *   unsigned char[num_keys * 128]       descriptors
+ *
+ * Keys of image i occupy [first_key, first_key + num_keys) of every
+ * array.  Positions are stored as in the .key file (x is the column,
+ * y the row).  Every array starts on a KEY_STORE_ALIGN boundary, and
+ * since descriptors are 128 bytes each, every descriptor is
+ * KEY_STORE_ALIGN aligned as well.  The mapped descriptors can
+ * therefore be handed directly to the matcher and the search trees
+ * without copying them. */
+
+#define KEY_STORE_MAGIC "BNDLKEYS"
+#define KEY_STORE_VERSION 1
+#define KEY_STORE_BYTE_ORDER 0x01020304
+#define KEY_STORE_ALIGN 64
+#define KEY_STORE_DESC_LEN 128
+#define KEY_STORE_NAME_LEN 240
+
+typedef struct {
+    char magic[8];              /* KEY_STORE_MAGIC, not terminated */
+    uint32_t version;           /* KEY_STORE_VERSION */
+    uint32_t byte_order;        /* KEY_STORE_BYTE_ORDER as written */
+    uint32_t num_images;        /* Number of entries in the index */
+    uint32_t reserved;
+    uint64_t num_keys;          /* Total number of keys */
+    uint64_t x_offset;          /* Byte offsets of the key arrays */
+    uint64_t y_offset;
+    uint64_t scale_offset;
+    uint64_t orient_offset;
+    uint64_t desc_offset;
+} key_store_header_t;
+
+typedef struct {
+    uint64_t first_key;         /* Index of the first key of the image */
+    uint32_t num_keys;          /* Number of keys in the image */
+    uint32_t reserved;
+    char name[KEY_STORE_NAME_LEN]; /* Key file the keys came from */
+} key_store_entry_t;
+
+/* Returns true if the file starts with the key store magic */
+bool IsKeyStoreFile(const char *filename);
+
+/* Writes a key store.  The number of keys in every image must be
+ * known up front; images can then be written in any order */
+class KeyStoreWriter {
+public:
+    KeyStoreWriter() : m_f(NULL)
+    { }
+
+    ~KeyStoreWriter() {
+        if (m_f != NULL)
+            Close();
+    }
+
+    bool Open(const char *filename, 
+              const std::vector<const char *> &names,
+              const std::vector<int> &num_keys);
+
+    /* Write the keys of image i.  Any of scale, orient, desc may be
+     * NULL, in which case zeros are written */
+    void WriteImage(int i, const float *x, const float *y, 
+                    const float *scale, const float *orient,
+                    const unsigned char *desc);
+
+    bool Close();
+
+private:
+    void WriteArray(uint64_t offset, uint64_t first, int n, 
+                    int elem_size, const void *data);
+
+    FILE *m_f;
+    key_store_header_t m_header;
+    std::vector<key_store_entry_t> m_index;
+};
+
+/* Read-only view of a key store, mapped into memory */
+class KeyStoreMap {
+public:
+    KeyStoreMap() : m_data(NULL), m_size(0), m_header(NULL), m_index(NULL)
+    { }
+
+    ~KeyStoreMap() {
+        Close();
+    }
+
+    bool Open(const char *filename);
+    void Close();
+
+    int GetNumImages() const {
+        return m_header->num_images;
+    }
+
+    int GetNumKeys(int i) const {
+        return m_index[i].num_keys;
+    }
+
+    const char *GetName(int i) const {
+        return m_index[i].name;
+    }
+
+    const float *GetX(int i) const {
+        return GetArray(m_header->x_offset, i);
+    }
+
+    const float *GetY(int i) const {
+        return GetArray(m_header->y_offset, i);
+    }
+
+    const float *GetScale(int i) const {
+        return GetArray(m_header->scale_offset, i);
+    }
+
+    const float *GetOrient(int i) const {
+        return GetArray(m_header->orient_offset, i);
+    }
+
+    /* Returns the 128 * num_keys descriptor bytes of image i */
+    const unsigned char *GetDescriptors(int i) const {
+        return (const unsigned char *) 
+            (m_data + m_header->desc_offset + 
+             KEY_STORE_DESC_LEN * m_index[i].first_key);
+    }
+
+private:
+    const float *GetArray(uint64_t offset, int i) const {
+        return ((const float *) (m_data + offset)) + m_index[i].first_key;
+    }
+
+    const char *m_data;
+    uint64_t m_size;
+    const key_store_header_t *m_header;
+    const key_store_entry_t *m_index;
+};
+
+#endif /* __key_store_h__ */
@@ -0,0 +1,307 @@
+/*
+ *  Copyright (c) 2008  Noah Snavely (snavely (at) cs.washington.edu)
+ *    and the University of Washington
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/* MatchFile.cpp */
+/* Binary, memory-mappable match table */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <io.h>
+#endif
+
+#include "MatchFile.h"
+
+bool IsBinaryMatchFile(const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+
+    if (f == NULL)
+        return false;
+
+    char magic[8];
+    bool binary = (fread(magic, 1, 8, f) == 8 && 
+                   memcmp(magic, MATCH_FILE_MAGIC, 8) == 0);
+
+    fclose(f);
+    return binary;
+}
+
+bool TruncateMatchFile(const char *filename, uint64_t size)
+{
+    FILE *f = fopen(filename, "r+b");
+
+    if (f == NULL) {
+        printf("[TruncateMatchFile] Error opening file %s\n", filename);
+        return false;
+    }
+
+#ifndef WIN32
+    bool ok = (ftruncate(fileno(f), (off_t) size) == 0);
+#else
+    bool ok = (_chsize_s(_fileno(f), size) == 0);
+#endif
+
+    fclose(f);
+
+    if (!ok)
+        printf("[TruncateMatchFile] Error truncating file %s\n", filename);
+
+    return ok;
+}
+
+bool MatchFileWriter::Open(const char *filename) 
+{
+    m_f = fopen(filename, "wb");
+
+    if (m_f == NULL) {
+        printf("[MatchFileWriter::Open] Error opening file %s "
+               "for writing\n", filename);
+        return false;
+    }
+
+    /* Leave room for the header; it is filled in by Close */
+    match_file_header_t header;
+    memset(&header, 0, sizeof(match_file_header_t));
+    fwrite(&header, sizeof(match_file_header_t), 1, m_f);
+
+    m_offset = sizeof(match_file_header_t);
+    m_index.clear();
+
+    return true;
+}
+
+bool MatchFileWriter::OpenAppend(const char *filename)
+{
+    MatchFileMap table;
+
+    if (!table.Open(filename))
+        return false;
+
+    std::vector<match_file_entry_t> index(table.GetNumPairs());
+    for (int p = 0; p < table.GetNumPairs(); p++)
+        index[p] = table.GetEntry(p);
+
+    /* New pairs go where the index is now */
+    uint64_t offset = sizeof(match_file_header_t);
+    if (!index.empty()) {
+        const match_file_entry_t &last = index.back();
+        offset = last.offset + 2 * sizeof(int32_t) * last.num_matches;
+    }
+
+    table.Close();
+
+    return Reopen(filename, offset, index);
+}
+
+bool MatchFileWriter::Reopen(const char *filename, uint64_t offset, 
+                             const std::vector<match_file_entry_t> &index)
+{
+    if (!TruncateMatchFile(filename, offset))
+        return false;
+
+    m_f = fopen(filename, "r+b");
+
+    if (m_f == NULL) {
+        printf("[MatchFileWriter::Reopen] Error opening file %s\n", 
+               filename);
+        return false;
+    }
+
+    fseek(m_f, 0, SEEK_END);
+
+    m_offset = offset;
+    m_index = index;
+
+    return true;
+}
+
+void MatchFileWriter::WritePair(int i1, int i2, int num_matches, 
+                                const int *idx)
+{
+    assert(m_f != NULL);
+
+    match_file_entry_t e;
+    e.i1 = i1;
+    e.i2 = i2;
+    e.num_matches = num_matches;
+    e.reserved = 0;
+    e.offset = m_offset;
+
+    m_index.push_back(e);
+
+    fwrite(idx, sizeof(int32_t), 2 * num_matches, m_f);
+    m_offset += 2 * sizeof(int32_t) * num_matches;
+}
+
+bool MatchFileWriter::Close()
+{
+    assert(m_f != NULL);
+
+    match_file_header_t header;
+    memcpy(header.magic, MATCH_FILE_MAGIC, 8);
+    header.version = MATCH_FILE_VERSION;
+    header.byte_order = MATCH_FILE_BYTE_ORDER;
+    header.num_pairs = (uint32_t) m_index.size();
+    header.reserved = 0;
+    header.index_offset = m_offset;
+
+    if (!m_index.empty()) {
+        fwrite(&m_index[0], sizeof(match_file_entry_t), 
+               m_index.size(), m_f);
+    }
+
+    fseek(m_f, 0, SEEK_SET);
+    fwrite(&header, sizeof(match_file_header_t), 1, m_f);
+
+    bool ok = (ferror(m_f) == 0);
+    fclose(m_f);
+    m_f = NULL;
+    m_index.clear();
+
+    if (!ok)
+        printf("[MatchFileWriter::Close] Error writing match table\n");
+
+    return ok;
+}
+
+bool MatchFileMap::Open(const char *filename)
+{
+    Close();
+
+#ifndef WIN32
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("[MatchFileMap::Open] Error opening file %s\n", filename);
+        return false;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        printf("[MatchFileMap::Open] Error: could not stat file %s\n", 
+               filename);
+        close(fd);
+        return false;
+    }
+
+    m_size = sb.st_size;
+    void *data = NULL;
+    if (m_size > 0)
+        data = mmap(NULL, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (data == NULL || data == MAP_FAILED) {
+        printf("[MatchFileMap::Open] Error mapping file %s\n", filename);
+        m_size = 0;
+        return false;
+    }
+
+    m_data = (const char *) data;
+#else
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL) {
+        printf("[MatchFileMap::Open] Error opening file %s\n", filename);
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    m_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char *data = (char *) malloc(m_size);
+    if (fread(data, 1, m_size, f) != m_size) {
+        printf("[MatchFileMap::Open] Error reading file %s\n", filename);
+        free(data);
+        fclose(f);
+        m_size = 0;
+        return false;
+    }
+    fclose(f);
+
+    m_data = data;
+#endif
+
+    const match_file_header_t *header = (const match_file_header_t *) m_data;
+
+    if (m_size < sizeof(match_file_header_t) || 
+        memcmp(header->magic, MATCH_FILE_MAGIC, 8) != 0) {
+        printf("[MatchFileMap::Open] %s is not a binary match table\n", 
+               filename);
+        Close();
+        return false;
+    }
+
+    if (header->version != MATCH_FILE_VERSION || 
+        header->byte_order != MATCH_FILE_BYTE_ORDER) {
+        printf("[MatchFileMap::Open] Unsupported match table version %u "
+               "or byte order\n", header->version);
+        Close();
+        return false;
+    }
+
+    if (header->index_offset > m_size ||
+        (uint64_t) header->num_pairs * sizeof(match_file_entry_t) > 
+        m_size - header->index_offset) {
+        printf("[MatchFileMap::Open] Match table %s is truncated\n", 
+               filename);
+        Close();
+        return false;
+    }
+
+    const match_file_entry_t *index = 
+        (const match_file_entry_t *) (m_data + header->index_offset);
+
+    /* Check that every pair's matches lie inside the file, so that
+     * GetMatches never reads past the end of the mapping */
+    for (uint32_t p = 0; p < header->num_pairs; p++) {
+        if (index[p].offset > m_size ||
+            2 * sizeof(int32_t) * (uint64_t) index[p].num_matches > 
+            m_size - index[p].offset) {
+            printf("[MatchFileMap::Open] Match table %s is truncated\n", 
+                   filename);
+            Close();
+            return false;
+        }
+    }
+
+    m_num_pairs = header->num_pairs;
+    m_index = index;
+
+    return true;
+}
+
+void MatchFileMap::Close()
+{
+    if (m_data != NULL) {
+#ifndef WIN32
+        munmap((void *) m_data, m_size);
+#else
+        free((void *) m_data);
+#endif
+    }
+
+    m_data = NULL;
+    m_size = 0;
+    m_index = NULL;
+    m_num_pairs = 0;
+}
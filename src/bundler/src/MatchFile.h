@@ -0,0 +1,146 @@
+/*
+ *  Copyright (c) 2008  Noah Snavely (snavely (at) cs.washington.edu)
+ *    and the University of Washington
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/* MatchFile.h */
+/* Binary, memory-mappable match table */
+
+#ifndef __match_file_h__
+#define __match_file_h__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <vector>
+
+/* The binary match table is laid out as follows (host byte order):
+ *
+ *   match_file_header_t           header
+ *   int32_t[2 * n] for each pair  (m_idx1, m_idx2) for the n matches
+ *   match_file_entry_t[]          index, one entry per image pair
+ *
+ * The index is written last so that the matcher can stream pairs out
+ * as it finds them.  Every match array starts at an 8-byte aligned
+ * offset, so it can be used in place as an array of KeypointMatch. */
+
+#define MATCH_FILE_MAGIC "BNDLMTCH"
+#define MATCH_FILE_VERSION 1
+#define MATCH_FILE_BYTE_ORDER 0x01020304
+
+typedef struct {
+    char magic[8];              /* MATCH_FILE_MAGIC, not terminated */
+    uint32_t version;           /* MATCH_FILE_VERSION */
+    uint32_t byte_order;        /* MATCH_FILE_BYTE_ORDER as written */
+    uint32_t num_pairs;         /* Number of entries in the index */
+    uint32_t reserved;
+    uint64_t index_offset;      /* Byte offset of the index */
+} match_file_header_t;
+
+typedef struct {
+    uint32_t i1, i2;            /* Image pair */
+    uint32_t num_matches;       /* Number of (m_idx1, m_idx2) pairs */
+    uint32_t reserved;
+    uint64_t offset;            /* Byte offset of the first match */
+} match_file_entry_t;
+
+/* Returns true if the file starts with the binary match table magic */
+bool IsBinaryMatchFile(const char *filename);
+
+/* Cut a (text or binary) match table file down to size bytes */
+bool TruncateMatchFile(const char *filename, uint64_t size);
+
+/* Streams image pairs out to a binary match table */
+class MatchFileWriter {
+public:
+    MatchFileWriter() : m_f(NULL), m_offset(0)
+    { }
+
+    ~MatchFileWriter() {
+        if (m_f != NULL)
+            Close();
+    }
+
+    bool Open(const char *filename);
+
+    /* Open an existing, complete table to add more pairs to it */
+    bool OpenAppend(const char *filename);
+
+    /* Reopen a partially written table whose first offset bytes hold
+     * the pairs described by index (e.g., as saved in a checkpoint);
+     * anything after that is dropped */
+    bool Reopen(const char *filename, uint64_t offset, 
+                const std::vector<match_file_entry_t> &index);
+
+    /* Write the matches for one image pair.  idx holds 2 * num_matches
+     * ints, (m_idx1, m_idx2) for each match */
+    void WritePair(int i1, int i2, int num_matches, const int *idx);
+
+    /* Write the index and fix up the header */
+    bool Close();
+
+    /* Push the pairs written so far out to the file */
+    void Flush() {
+        fflush(m_f);
+    }
+
+    /* Offset at which the next pair will be written */
+    uint64_t GetOffset() const {
+        return m_offset;
+    }
+
+    const std::vector<match_file_entry_t> &GetIndex() const {
+        return m_index;
+    }
+
+private:
+    FILE *m_f;
+    uint64_t m_offset;
+    std::vector<match_file_entry_t> m_index;
+};
+
+/* Read-only view of a binary match table, mapped into memory */
+class MatchFileMap {
+public:
+    MatchFileMap() : m_data(NULL), m_size(0), m_index(NULL), m_num_pairs(0)
+    { }
+
+    ~MatchFileMap() {
+        Close();
+    }
+
+    bool Open(const char *filename);
+    void Close();
+
+    int GetNumPairs() const {
+        return m_num_pairs;
+    }
+
+    const match_file_entry_t &GetEntry(int p) const {
+        return m_index[p];
+    }
+
+    /* Returns the 2 * num_matches ints for pair p */
+    const int32_t *GetMatches(int p) const {
+        return (const int32_t *) (m_data + m_index[p].offset);
+    }
+
+private:
+    const char *m_data;
+    uint64_t m_size;
+    const match_file_entry_t *m_index;
+    int m_num_pairs;
+};
+
+#endif /* __match_file_h__ */
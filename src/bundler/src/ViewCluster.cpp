@@ -0,0 +1,276 @@
+/*
+ *  Copyright (c) 2008  Noah Snavely (snavely (at) cs.washington.edu)
+ *    and the University of Washington
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/* ViewCluster.cpp */
+/* Split the cameras of a reconstruction into overlapping clusters
+ * that multi-view stereo can process independently */
+
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <queue>
+
+#include "ViewCluster.h"
+
+void ComputeSharedPoints(int num_images,
+                         const std::vector<std::vector<int> > &views,
+                         std::vector<std::vector<std::pair<int,int> > > &shared)
+{
+    std::vector<std::map<int,int> > counts(num_images);
+
+    int num_points = (int) views.size();
+    for (int p = 0; p < num_points; p++) {
+        int num_views = (int) views[p].size();
+        for (int i = 0; i < num_views; i++) {
+            for (int j = i + 1; j < num_views; j++) {
+                int v0 = views[p][i], v1 = views[p][j];
+                if (v0 == v1)
+                    continue;
+                counts[v0][v1]++;
+                counts[v1][v0]++;
+            }
+        }
+    }
+
+    shared.clear();
+    shared.resize(num_images);
+    for (int i = 0; i < num_images; i++)
+        shared[i].assign(counts[i].begin(), counts[i].end());
+}
+
+/* A candidate merge of clusters a and b.  The versions tell whether
+ * either cluster changed since the candidate was queued. */
+typedef struct
+{
+    double score;
+    int a, b;
+    int version_a, version_b;
+} cluster_merge_t;
+
+class CompareMerge
+{
+public:
+    bool operator()(const cluster_merge_t &lhs,
+                    const cluster_merge_t &rhs) const {
+        return lhs.score < rhs.score;
+    }
+};
+
+/* Agglomerative clustering: repeatedly merge the two clusters with
+ * the most shared points per pair of images, as long as the result
+ * has at most max_size images.  Normalizing by the sizes keeps the
+ * clusters balanced. */
+static void ClusterCores(int num_images,
+                         const std::vector<std::vector<std::pair<int,int> > > &shared,
+                         int max_size,
+                         std::vector<std::vector<int> > &cores)
+{
+    std::vector<std::vector<int> > members(num_images);
+    std::vector<std::map<int,double> > links(num_images);
+    std::vector<int> version(num_images, 0);
+    std::vector<bool> alive(num_images, true);
+
+    std::priority_queue<cluster_merge_t, std::vector<cluster_merge_t>,
+        CompareMerge> queue;
+
+    for (int i = 0; i < num_images; i++) {
+        members[i].push_back(i);
+        for (int k = 0; k < (int) shared[i].size(); k++)
+            links[i][shared[i][k].first] = shared[i][k].second;
+    }
+
+    if (max_size > 1) {
+        for (int i = 0; i < num_images; i++) {
+            std::map<int,double>::iterator iter;
+            for (iter = links[i].begin(); iter != links[i].end(); iter++) {
+                if (iter->first < i)
+                    continue;
+                cluster_merge_t m = { iter->second, i, iter->first, 0, 0 };
+                queue.push(m);
+            }
+        }
+    }
+
+    while (!queue.empty()) {
+        cluster_merge_t m = queue.top();
+        queue.pop();
+
+        if (!alive[m.a] || !alive[m.b] ||
+            version[m.a] != m.version_a || version[m.b] != m.version_b)
+            continue;
+
+        /* Clusters only grow, so this pair never fits again */
+        if ((int) (members[m.a].size() + members[m.b].size()) > max_size)
+            continue;
+
+        /* Merge b into a */
+        members[m.a].insert(members[m.a].end(),
+                            members[m.b].begin(), members[m.b].end());
+        members[m.b].clear();
+
+        std::map<int,double>::iterator iter;
+        for (iter = links[m.b].begin(); iter != links[m.b].end(); iter++) {
+            int c = iter->first;
+            if (c == m.a)
+                continue;
+            links[m.a][c] += iter->second;
+            links[c][m.a] += iter->second;
+            links[c].erase(m.b);
+        }
+        links[m.a].erase(m.b);
+        links[m.b].clear();
+        alive[m.b] = false;
+        version[m.a]++;
+
+        int size_a = (int) members[m.a].size();
+        for (iter = links[m.a].begin(); iter != links[m.a].end(); iter++) {
+            int c = iter->first;
+            int size_c = (int) members[c].size();
+            if (size_a + size_c > max_size)
+                continue;
+
+            cluster_merge_t n =
+                { iter->second / (size_a * size_c), m.a, c,
+                  version[m.a], version[c] };
+            queue.push(n);
+        }
+    }
+
+    cores.clear();
+    for (int i = 0; i < num_images; i++) {
+        if (alive[i]) {
+            std::sort(members[i].begin(), members[i].end());
+            cores.push_back(members[i]);
+        }
+    }
+}
+
+double ClusterViews(int num_images,
+                    const std::vector<std::vector<int> > &views,
+                    int max_size, int min_views,
+                    std::vector<view_cluster_t> &clusters)
+{
+    std::vector<std::vector<std::pair<int,int> > > shared;
+    ComputeSharedPoints(num_images, views, shared);
+
+    /* Leave a quarter of each cluster for border images */
+    int core_size = std::min(max_size, std::max(min_views, max_size * 3 / 4));
+
+    std::vector<std::vector<int> > cores;
+    ClusterCores(num_images, shared, core_size, cores);
+
+    /* Images that share no points with any other image cannot be
+     * used for stereo, and would each end up alone */
+    clusters.clear();
+    std::vector<int> owner(num_images, -1);
+    for (int c = 0; c < (int) cores.size(); c++) {
+        if (cores[c].size() == 1 && shared[cores[c][0]].empty())
+            continue;
+
+        view_cluster_t cluster;
+        cluster.core = cores[c];
+        for (int i = 0; i < (int) cores[c].size(); i++)
+            owner[cores[c][i]] = (int) clusters.size();
+        clusters.push_back(cluster);
+    }
+
+    int num_clusters = (int) clusters.size();
+    std::vector<std::vector<int> > border_of(num_images);
+    std::vector<int> count(num_clusters, 0);
+
+    int num_points = 0, num_covered = 0;
+    for (int p = 0; p < (int) views.size(); p++) {
+        const std::vector<int> &pviews = views[p];
+        if ((int) pviews.size() < min_views)
+            continue;
+        num_points++;
+
+        /* Number of the point's images in each cluster */
+        std::vector<int> touched;
+        for (int i = 0; i < (int) pviews.size(); i++) {
+            int v = pviews[i];
+            if (owner[v] != -1) {
+                if (count[owner[v]]++ == 0)
+                    touched.push_back(owner[v]);
+            }
+            for (int k = 0; k < (int) border_of[v].size(); k++) {
+                if (count[border_of[v][k]]++ == 0)
+                    touched.push_back(border_of[v][k]);
+            }
+        }
+
+        /* Try the clusters that already have the most images first.
+         * The reference image of a stereo patch is a core image, so
+         * the cluster must own at least one of them. */
+        std::vector<std::pair<int,int> > order;
+        bool covered = false;
+        for (int k = 0; k < (int) touched.size(); k++) {
+            int c = touched[k];
+            if (count[c] >= min_views)
+                covered = true;
+            order.push_back(std::pair<int,int>(-count[c], c));
+        }
+        std::sort(order.begin(), order.end());
+
+        for (int k = 0; k < (int) order.size() && !covered; k++) {
+            int c = order[k].second;
+            view_cluster_t &cluster = clusters[c];
+
+            int owned = 0;
+            for (int i = 0; i < (int) pviews.size(); i++)
+                if (owner[pviews[i]] == c)
+                    owned++;
+            if (owned == 0)
+                continue;
+
+            int needed = min_views - count[c];
+            int size = (int) (cluster.core.size() + cluster.border.size());
+            if (size + needed > max_size)
+                continue;
+
+            for (int i = 0; i < (int) pviews.size() && needed > 0; i++) {
+                int v = pviews[i];
+                if (owner[v] == c ||
+                    std::find(border_of[v].begin(), border_of[v].end(), c) !=
+                    border_of[v].end())
+                    continue;
+
+                cluster.border.push_back(v);
+                border_of[v].push_back(c);
+                needed--;
+            }
+            covered = true;
+        }
+
+        if (covered)
+            num_covered++;
+
+        for (int k = 0; k < (int) touched.size(); k++)
+            count[touched[k]] = 0;
+    }
+
+    for (int c = 0; c < num_clusters; c++)
+        std::sort(clusters[c].border.begin(), clusters[c].border.end());
+
+    double coverage = (num_points == 0) ? 1.0 :
+        (double) num_covered / num_points;
+
+    printf("[ClusterViews] %d images in %d clusters, %d of %d points "
+           "covered (%0.1f%%)\n", num_images, num_clusters,
+           num_covered, num_points, 100.0 * coverage);
+
+    return coverage;
+}
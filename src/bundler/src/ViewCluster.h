@@ -0,0 +1,50 @@
+/*
+ *  Copyright (c) 2008  Noah Snavely (snavely (at) cs.washington.edu)
+ *    and the University of Washington
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/* ViewCluster.h */
+/* Split the cameras of a reconstruction into overlapping clusters
+ * that multi-view stereo can process independently */
+
+#ifndef __view_cluster_h__
+#define __view_cluster_h__
+
+#include <vector>
+
+typedef struct
+{
+    std::vector<int> core;    /* Images that belong to this cluster */
+    std::vector<int> border;  /* Images borrowed from other clusters */
+} view_cluster_t;
+
+/* Count the points seen by each pair of images.  views[p] lists the
+ * images that see point p.  shared[i] maps image j to the number of
+ * points seen by both i and j. */
+void ComputeSharedPoints(int num_images,
+                         const std::vector<std::vector<int> > &views,
+                         std::vector<std::vector<std::pair<int,int> > > &shared);
+
+/* Cluster the images.  The cores of the clusters partition the
+ * images, grouping images that see many points in common.  Border
+ * images are then added so that every point seen by at least
+ * min_views images is seen by min_views images of one cluster, as
+ * long as no cluster grows beyond max_size images.  Returns the
+ * fraction of such points that are covered. */
+double ClusterViews(int num_images,
+                    const std::vector<std::vector<int> > &views,
+                    int max_size, int min_views,
+                    std::vector<view_cluster_t> &clusters);
+
+#endif /* __view_cluster_h__ */
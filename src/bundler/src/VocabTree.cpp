@@ -0,0 +1,306 @@
+/* 
+ *  Copyright (c) 2008  Noah Snavely (snavely (at) cs.washington.edu)
+ *    and the University of Washington
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/* VocabTree.cpp */
+/* Vocabulary tree over SIFT descriptors, used to find the image pairs
+ * worth matching */
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "VocabTree.h"
+
+#define DESC_LEN 128
+
+static inline float DistanceToCenter(const unsigned char *d, 
+                                     const float *center)
+{
+    float dist = 0.0f;
+
+    for (int k = 0; k < DESC_LEN; k++) {
+        float diff = (float) d[k] - center[k];
+        dist += diff * diff;
+    }
+
+    return dist;
+}
+
+int VocabTree::AddNode(const float *center)
+{
+    int node = (int) m_first_child.size();
+
+    m_centers.resize(m_centers.size() + DESC_LEN, 0.0f);
+    if (center != NULL)
+        memcpy(&m_centers[DESC_LEN * node], center, DESC_LEN * sizeof(float));
+
+    m_first_child.push_back(-1);
+    m_num_children.push_back(0);
+    m_word.push_back(-1);
+
+    return node;
+}
+
+void VocabTree::Build(int num_desc, const unsigned char *desc, 
+                      int branch, int depth, int iterations)
+{
+    m_num_words = 0;
+    m_centers.clear();
+    m_first_child.clear();
+    m_num_children.clear();
+    m_word.clear();
+
+    int root = AddNode(NULL);
+
+    std::vector<int> idx(num_desc);
+    for (int i = 0; i < num_desc; i++)
+        idx[i] = i;
+
+    BuildNode(root, desc, idx, 0, branch, depth, iterations);
+}
+
+/* Split the descriptors idx of a node with k-means and recurse */
+void VocabTree::BuildNode(int node, const unsigned char *desc, 
+                          std::vector<int> &idx, int level,
+                          int branch, int depth, int iterations)
+{
+    int n = (int) idx.size();
+
+    if (level == depth || n <= branch) {
+        m_word[node] = m_num_words++;
+        return;
+    }
+
+    /* Seed the centers with evenly spaced descriptors; this keeps the
+     * vocabulary deterministic */
+    std::vector<float> centers(branch * DESC_LEN);
+    for (int c = 0; c < branch; c++) {
+        const unsigned char *d = desc + DESC_LEN * idx[(c * n) / branch];
+        for (int k = 0; k < DESC_LEN; k++)
+            centers[DESC_LEN * c + k] = (float) d[k];
+    }
+
+    std::vector<int> assign(n, -1);
+    std::vector<int> counts(branch);
+    std::vector<double> sums(branch * DESC_LEN);
+
+    for (int iter = 0; iter < iterations; iter++) {
+        bool changed = false;
+
+        for (int p = 0; p < n; p++) {
+            const unsigned char *d = desc + DESC_LEN * idx[p];
+            int best = 0;
+            float best_dist = FLT_MAX;
+
+            for (int c = 0; c < branch; c++) {
+                float dist = DistanceToCenter(d, &centers[DESC_LEN * c]);
+                if (dist < best_dist) {
+                    best_dist = dist;
+                    best = c;
+                }
+            }
+
+            if (assign[p] != best) {
+                assign[p] = best;
+                changed = true;
+            }
+        }
+
+        if (!changed)
+            break;
+
+        /* Move the centers; empty clusters keep their old center */
+        std::fill(counts.begin(), counts.end(), 0);
+        std::fill(sums.begin(), sums.end(), 0.0);
+
+        for (int p = 0; p < n; p++) {
+            const unsigned char *d = desc + DESC_LEN * idx[p];
+            int c = assign[p];
+
+            counts[c]++;
+            for (int k = 0; k < DESC_LEN; k++)
+                sums[DESC_LEN * c + k] += d[k];
+        }
+
+        for (int c = 0; c < branch; c++) {
+            if (counts[c] == 0)
+                continue;
+
+            for (int k = 0; k < DESC_LEN; k++) {
+                centers[DESC_LEN * c + k] = 
+                    (float) (sums[DESC_LEN * c + k] / counts[c]);
+            }
+        }
+    }
+
+    /* Partition the descriptors among the non-empty clusters */
+    std::vector< std::vector<int> > parts(branch);
+    for (int p = 0; p < n; p++)
+        parts[assign[p]].push_back(idx[p]);
+
+    idx.clear();
+
+    std::vector<int> children;
+    for (int c = 0; c < branch; c++) {
+        if (parts[c].empty())
+            continue;
+
+        int child = AddNode(&centers[DESC_LEN * c]);
+        if (children.empty())
+            m_first_child[node] = child;
+
+        children.push_back(c);
+    }
+
+    m_num_children[node] = (int) children.size();
+
+    for (int i = 0; i < (int) children.size(); i++) {
+        BuildNode(m_first_child[node] + i, desc, parts[children[i]], 
+                  level + 1, branch, depth, iterations);
+    }
+}
+
+int VocabTree::Quantize(const unsigned char *d) const
+{
+    int node = 0;
+
+    while (m_num_children[node] > 0) {
+        int first = m_first_child[node];
+        int best = first;
+        float best_dist = FLT_MAX;
+
+        for (int c = first; c < first + m_num_children[node]; c++) {
+            float dist = DistanceToCenter(d, &m_centers[DESC_LEN * c]);
+            if (dist < best_dist) {
+                best_dist = dist;
+                best = c;
+            }
+        }
+
+        node = best;
+    }
+
+    return m_word[node];
+}
+
+class ScoredImage {
+public:
+    ScoredImage(int image, double score) : m_image(image), m_score(score)
+    { }
+
+    int m_image;
+    double m_score;
+};
+
+static bool CompareScoredImages(const ScoredImage &a, const ScoredImage &b)
+{
+    if (a.m_score != b.m_score)
+        return a.m_score > b.m_score;
+
+    return a.m_image < b.m_image;
+}
+
+void SelectCandidatePairs(const std::vector< std::vector<int> > &words, 
+                          int num_words, int k,
+                          std::vector< std::pair<int,int> > &pairs)
+{
+    int num_images = (int) words.size();
+
+    /* Term frequencies of every image, as sorted (word, count) lists */
+    std::vector< std::vector< std::pair<int,int> > > tf(num_images);
+    std::vector<int> df(num_words, 0);
+
+    for (int i = 0; i < num_images; i++) {
+        std::vector<int> w = words[i];
+        std::sort(w.begin(), w.end());
+
+        for (int p = 0; p < (int) w.size(); p++) {
+            if (p > 0 && w[p] == w[p-1]) {
+                tf[i].back().second++;
+            } else {
+                tf[i].push_back(std::pair<int,int>(w[p], 1));
+                df[w[p]]++;
+            }
+        }
+    }
+
+    /* Normalized tf-idf vectors, stored as an inverted file */
+    std::vector< std::vector< std::pair<int,double> > > inv(num_words);
+    std::vector< std::vector< std::pair<int,double> > > vec(num_images);
+
+    for (int i = 0; i < num_images; i++) {
+        double norm = 0.0;
+
+        for (int p = 0; p < (int) tf[i].size(); p++) {
+            int w = tf[i][p].first;
+            double weight = 
+                tf[i][p].second * log((double) num_images / df[w]);
+
+            if (weight <= 0.0)
+                continue;  /* Word occurs in every image */
+
+            vec[i].push_back(std::pair<int,double>(w, weight));
+            norm += weight * weight;
+        }
+
+        norm = sqrt(norm);
+
+        for (int p = 0; p < (int) vec[i].size(); p++) {
+            vec[i][p].second /= norm;
+            inv[vec[i][p].first].push_back
+                (std::pair<int,double>(i, vec[i][p].second));
+        }
+    }
+
+    /* Score each image against all others through the inverted file */
+    pairs.clear();
+    std::vector<double> scores(num_images);
+
+    for (int i = 0; i < num_images; i++) {
+        std::fill(scores.begin(), scores.end(), 0.0);
+
+        for (int p = 0; p < (int) vec[i].size(); p++) {
+            const std::vector< std::pair<int,double> > &list = 
+                inv[vec[i][p].first];
+            double weight = vec[i][p].second;
+
+            for (int q = 0; q < (int) list.size(); q++)
+                scores[list[q].first] += weight * list[q].second;
+        }
+
+        std::vector<ScoredImage> ranked;
+        for (int j = 0; j < num_images; j++) {
+            if (j != i && scores[j] > 0.0)
+                ranked.push_back(ScoredImage(j, scores[j]));
+        }
+
+        int num_kept = std::min(k, (int) ranked.size());
+        std::partial_sort(ranked.begin(), ranked.begin() + num_kept, 
+                          ranked.end(), CompareScoredImages);
+
+        for (int r = 0; r < num_kept; r++) {
+            int j = ranked[r].m_image;
+            pairs.push_back(std::pair<int,int>(std::min(i, j), 
+                                               std::max(i, j)));
+        }
+    }
+
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+}
@@ -0,0 +1,69 @@
+/* 
+ *  Copyright (c) 2008  Noah Snavely (snavely (at) cs.washington.edu)
+ *    and the University of Washington
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/* VocabTree.h */
+/* Vocabulary tree over SIFT descriptors, used to find the image pairs
+ * worth matching */
+
+#ifndef __vocab_tree_h__
+#define __vocab_tree_h__
+
+#include <vector>
+
+/* A vocabulary tree (Nister and Stewenius, CVPR 2006): descriptors
+ * are clustered by hierarchical k-means with the given branching
+ * factor and depth, and the leaves of the tree are the visual words.
+ * Quantizing a descriptor means descending to the closest child at
+ * every level. */
+class VocabTree 
+{
+public:
+    VocabTree() : m_num_words(0)
+    { }
+
+    /* Build the tree from num_desc 128-byte descriptors */
+    void Build(int num_desc, const unsigned char *desc, 
+               int branch, int depth, int iterations);
+
+    int GetNumWords() const {
+        return m_num_words;
+    }
+
+    /* Return the visual word a descriptor falls into */
+    int Quantize(const unsigned char *d) const;
+
+private:
+    void BuildNode(int node, const unsigned char *desc, 
+                   std::vector<int> &idx, int level,
+                   int branch, int depth, int iterations);
+
+    int AddNode(const float *center);
+
+    int m_num_words;
+    std::vector<float> m_centers;       /* 128 floats per node */
+    std::vector<int> m_first_child;     /* First child of each node */
+    std::vector<int> m_num_children;    /* 0 for leaves */
+    std::vector<int> m_word;            /* Word of each leaf, or -1 */
+};
+
+/* Score every pair of images by the cosine similarity of their tf-idf
+ * weighted bag-of-words vectors, and return up to k best partners for
+ * every image as pairs (i1, i2) with i1 < i2, sorted and unique */
+void SelectCandidatePairs(const std::vector< std::vector<int> > &words, 
+                          int num_words, int k,
+                          std::vector< std::pair<int,int> > &pairs);
+
+#endif /* __vocab_tree_h__ */
@@ -799,16 +799,10 @@ ann_1_1_char::ANNkd_tree
 
     int dim = 128;
 
-    ann_1_1_char::ANNpointArray pts = ann_1_1_char::annAllocPts(num_pts, dim);
+    ann_1_1_char::ANNpointArray pts = new ann_1_1_char::ANNpoint[num_pts];
 
-    int offset = 0;
-     
-    for (int i = 0; i < num_pts; i++) {
-        int j;
-        
-        for (j = 0; j < 128; j++)
-            pts[i][j+offset] = k[i].m_d[j];
-    }
+    for (int i = 0; i < num_pts; i++)
+        pts[i] = k[i].m_d;
     
     /* Create a search tree for k2 */
     ann_1_1_char::ANNkd_tree *tree = 
@@ -824,7 +818,7 @@ std::vector<KeypointMatch> MatchKeys(const std::vector<KeypointWithDesc> &k1,
 				     const std::vector<KeypointWithDesc> &k2, 
 				     bool registered, double ratio) 
 {
-    ann_1_1_char::annMaxPtsVisit(200);
+    ann_1_1_char::ANNsearchContext ctx(200);
 
     int num_pts = 0;
     std::vector<KeypointMatch> matches;
@@ -843,25 +837,17 @@ std::vector<KeypointMatch> MatchKeys(const std::vector<KeypointWithDesc> &k1,
 	}
     }
 
-    /* Create a new array of points */
-    ann_1_1_char::ANNpointArray pts = ann_1_1_char::annAllocPts(num_pts, 128);
+    /* Point the tree at the descriptors in place (they may live in a
+     * mapped key store) instead of copying them */
+    ann_1_1_char::ANNpointArray pts = new ann_1_1_char::ANNpoint[num_pts];
 
     if (!registered) {
 	for (int i = 0; i < num_pts; i++) {
-	    int j;
-
-	    for (j = 0; j < 128; j++) {
-		pts[i][j] = k2[i].m_d[j];
-	    }
+	    pts[i] = k2[i].m_d;
 	}
     } else {
 	for (int i = 0; i < num_pts; i++) {
-	    int j;
-	    int idx = registered_idxs[i];
-
-	    for (j = 0; j < 128; j++) {
-		pts[i][j] = k2[idx].m_d[j];
-	    }
+	    pts[i] = k2[registered_idxs[i]].m_d;
 	}	
     }
     
@@ -874,19 +860,14 @@ std::vector<KeypointMatch> MatchKeys(const std::vector<KeypointWithDesc> &k1,
     //        (end - start) / ((double) CLOCKS_PER_SEC));
 
     /* Now do the search */
-    ann_1_1_char::ANNpoint query = ann_1_1_char::annAllocPt(128);
     start = clock();
     for (int i = 0; i < (int) k1.size(); i++) {
-	int j;
-
-	for (j = 0; j < 128; j++) {
-	    query[j] = k1[i].m_d[j];
-	}
+	ann_1_1_char::ANNpoint query = k1[i].m_d;
 
 	ann_1_1_char::ANNidx nn_idx[2];
 	ann_1_1_char::ANNdist dist[2];
 
-	tree->annkPriSearch(query, 2, nn_idx, dist, 0.0);
+	tree->annkPriSearch(query, 2, nn_idx, dist, 0.0, ctx);
 
 	if (sqrt(((double) dist[0]) / ((double) dist[1])) <= ratio) {
 	    if (!registered) {
@@ -907,8 +888,7 @@ std::vector<KeypointMatch> MatchKeys(const std::vector<KeypointWithDesc> &k1,
     printf("[MatchKeys] Found %d matches\n", num_matches);
 
     /* Cleanup */
-    ann_1_1_char::annDeallocPts(pts);
-    ann_1_1_char::annDeallocPt(query);
+    delete [] pts;
 
     delete tree;
 
@@ -922,7 +902,7 @@ std::vector<KeypointMatchWithScore>
                        bool registered, 
                        double ratio)
 {
-    ann_1_1_char::annMaxPtsVisit(200);
+    ann_1_1_char::ANNsearchContext ctx(200);
 
     int num_pts = 0;
     std::vector<KeypointMatchWithScore> matches;
@@ -941,25 +921,17 @@ std::vector<KeypointMatchWithScore>
 	}
     }
 
-    /* Create a new array of points */
-    ann_1_1_char::ANNpointArray pts = ann_1_1_char::annAllocPts(num_pts, 128);
+    /* Point the tree at the descriptors in place (they may live in a
+     * mapped key store) instead of copying them */
+    ann_1_1_char::ANNpointArray pts = new ann_1_1_char::ANNpoint[num_pts];
 
     if (!registered) {
 	for (int i = 0; i < num_pts; i++) {
-	    int j;
-
-	    for (j = 0; j < 128; j++) {
-		pts[i][j] = k2[i].m_d[j];
-	    }
+	    pts[i] = k2[i].m_d;
 	}
     } else {
 	for (int i = 0; i < num_pts; i++) {
-	    int j;
-	    int idx = registered_idxs[i];
-
-	    for (j = 0; j < 128; j++) {
-		pts[i][j] = k2[idx].m_d[j];
-	    }
+	    pts[i] = k2[registered_idxs[i]].m_d;
 	}	
     }
     
@@ -972,19 +944,14 @@ std::vector<KeypointMatchWithScore>
     //        (end - start) / ((double) CLOCKS_PER_SEC));
 
     /* Now do the search */
-    ann_1_1_char::ANNpoint query = ann_1_1_char::annAllocPt(128);
     start = clock();
     for (int i = 0; i < (int) k1.size(); i++) {
-	int j;
-
-	for (j = 0; j < 128; j++) {
-	    query[j] = k1[i].m_d[j];
-	}
+	ann_1_1_char::ANNpoint query = k1[i].m_d;
 
 	ann_1_1_char::ANNidx nn_idx[2];
 	ann_1_1_char::ANNdist dist[2];
 
-	tree->annkPriSearch(query, 2, nn_idx, dist, 0.0);
+	tree->annkPriSearch(query, 2, nn_idx, dist, 0.0, ctx);
 
 	if (sqrt(((double) dist[0]) / ((double) dist[1])) <= ratio) {
 	    if (!registered) {
@@ -1008,8 +975,7 @@ std::vector<KeypointMatchWithScore>
     printf("[MatchKeysWithScore] Found %d matches\n", num_matches);
 
     /* Cleanup */
-    ann_1_1_char::annDeallocPts(pts);
-    ann_1_1_char::annDeallocPt(query);
+    delete [] pts;
 
     delete tree;
 
@@ -1086,25 +1052,17 @@ std::vector<KeypointMatch>
 	}
     }
 
-    /* Create a new array of points */
-    ann_1_1_char::ANNpointArray pts = ann_1_1_char::annAllocPts(num_pts, 128);
+    /* Point the tree at the descriptors in place (they may live in a
+     * mapped key store) instead of copying them */
+    ann_1_1_char::ANNpointArray pts = new ann_1_1_char::ANNpoint[num_pts];
 
     if (!registered) {
 	for (int i = 0; i < num_pts; i++) {
-	    int j;
-
-	    for (j = 0; j < 128; j++) {
-		pts[i][j] = k2[i].m_d[j];
-	    }
+	    pts[i] = k2[i].m_d;
 	}
     } else {
 	for (int i = 0; i < num_pts; i++) {
-	    int j;
-	    int idx = registered_idxs[i];
-
-	    for (j = 0; j < 128; j++) {
-		pts[i][j] = k2[idx].m_d[j];
-	    }
+	    pts[i] = k2[registered_idxs[i]].m_d;
 	}	
     }
     
@@ -1118,14 +1076,9 @@ std::vector<KeypointMatch>
     //        (end - start) / ((double) CLOCKS_PER_SEC));
 
     /* Now do the search */
-    ann_1_1_char::ANNpoint query = ann_1_1_char::annAllocPt(128);
     start = clock();
     for (int i = 0; i < (int) k1.size(); i++) {
-	int j;
-
-	for (j = 0; j < 128; j++) {
-	    query[j] = k1[i].m_d[j];
-	}
+	ann_1_1_char::ANNpoint query = k1[i].m_d;
 
 	ann_1_1_char::ANNidx nn_idx[2];
 	ann_1_1_char::ANNdist dist[2];
@@ -1151,8 +1104,7 @@ std::vector<KeypointMatch>
     printf("[MatchKeys] Found %d matches\n", num_matches);
 
     /* Cleanup */
-    ann_1_1_char::annDeallocPts(pts);
-    ann_1_1_char::annDeallocPt(query);
+    delete [] pts;
 
     delete tree;
 
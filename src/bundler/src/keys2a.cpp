@@ -27,6 +27,7 @@
 #include <zlib.h>
 
 #include "keys2a.h"
+#include "BruteForceMatch.h"
 
 int GetNumberOfKeysNormal(FILE *fp)
 {
@@ -329,11 +330,12 @@ ANNkd_tree *CreateSearchTree(int num_keys, unsigned char *keys)
 {
     // clock_t start = clock();
 
-    /* Create a new array of points */
-    ANNpointArray pts = annAllocPts(num_keys, 128);
+    /* Point the tree directly at the descriptors rather than copying
+     * them; keys must outlive the tree */
+    ANNpointArray pts = new ANNpoint[num_keys];
 
     for (int i = 0; i < num_keys; i++) {
-        memcpy(pts[i], keys + 128 * i, sizeof(unsigned char) * 128);
+        pts[i] = keys + 128 * i;
     }
 
     /* Create a search tree for k2 */
@@ -346,11 +348,19 @@ ANNkd_tree *CreateSearchTree(int num_keys, unsigned char *keys)
     return tree;
 }
 
+/* Free a tree created by CreateSearchTree (but not the keys) */
+void DeleteSearchTree(ANNkd_tree *tree)
+{
+    ANNpointArray pts = tree->thePoints();
+    delete tree;
+    delete [] pts;
+}
+
 std::vector<KeypointMatch> MatchKeys(int num_keys1, unsigned char *k1, 
                                      ANNkd_tree *tree2,
                                      double ratio, int max_pts_visit)
 {
-    annMaxPtsVisit(max_pts_visit);
+    ANNsearchContext ctx(max_pts_visit);
     std::vector<KeypointMatch> matches;
 
     /* Now do the search */
@@ -359,7 +369,7 @@ std::vector<KeypointMatch> MatchKeys(int num_keys1, unsigned char *k1,
         ANNidx nn_idx[2];
         ANNdist dist[2];
 
-        tree2->annkPriSearch(k1 + 128 * i, 2, nn_idx, dist, 0.0);
+        tree2->annkPriSearch(k1 + 128 * i, 2, nn_idx, dist, 0.0, ctx);
 
         if (((double) dist[0]) < ratio * ratio * ((double) dist[1])) {
             matches.push_back(KeypointMatch(i, nn_idx[0]));
@@ -378,7 +388,7 @@ std::vector<KeypointMatch> MatchKeys(int num_keys1, unsigned char *k1,
                                      int num_keys2, unsigned char *k2, 
                                      double ratio, int max_pts_visit) 
 {
-    annMaxPtsVisit(max_pts_visit);
+    ANNsearchContext ctx(max_pts_visit);
 
     int num_pts = 0;
     std::vector<KeypointMatch> matches;
@@ -386,15 +396,8 @@ std::vector<KeypointMatch> MatchKeys(int num_keys1, unsigned char *k1,
     num_pts = num_keys2;
     clock_t start = clock();
 
-    /* Create a new array of points */
-    ANNpointArray pts = annAllocPts(num_pts, 128);
-
-    for (int i = 0; i < num_pts; i++) {
-        memcpy(pts[i], k2 + 128 * i, sizeof(unsigned char) * 128);
-    }
-
     /* Create a search tree for k2 */
-    ANNkd_tree *tree = new ANNkd_tree(pts, num_pts, 128, 16);
+    ANNkd_tree *tree = CreateSearchTree(num_pts, k2);
     clock_t end = clock();
 
     // printf("Building tree took %0.3fs\n", 
@@ -406,7 +409,7 @@ std::vector<KeypointMatch> MatchKeys(int num_keys1, unsigned char *k1,
         ANNidx nn_idx[2];
         ANNdist dist[2];
 
-        tree->annkPriSearch(k1 + 128 * i, 2, nn_idx, dist, 0.0);
+        tree->annkPriSearch(k1 + 128 * i, 2, nn_idx, dist, 0.0, ctx);
 
         if (((double) dist[0]) < ratio * ratio * ((double) dist[1])) {
             matches.push_back(KeypointMatch(i, nn_idx[0]));
@@ -417,10 +420,36 @@ std::vector<KeypointMatch> MatchKeys(int num_keys1, unsigned char *k1,
     //        (end - start) / ((double) CLOCKS_PER_SEC));
 
     /* Cleanup */
-    annDeallocPts(pts);
-    // annDeallocPt(axis_weights);
+    DeleteSearchTree(tree);
 
-    delete tree;
+    return matches;
+}
+
+std::vector<KeypointMatch> MatchKeysBruteForce(int num_keys1, 
+                                               unsigned char *k1, 
+                                               int num_keys2, 
+                                               unsigned char *k2, 
+                                               double ratio)
+{
+    std::vector<KeypointMatch> matches;
+
+    if (num_keys1 == 0 || num_keys2 < 2)
+        return matches;
+
+    int *nn_idx = new int[2 * num_keys1];
+    int *nn_dist = new int[2 * num_keys1];
+
+    FindTwoNearestNeighbors(num_keys1, k1, num_keys2, k2, nn_idx, nn_dist);
+
+    for (int i = 0; i < num_keys1; i++) {
+        if (((double) nn_dist[2 * i]) < 
+            ratio * ratio * ((double) nn_dist[2 * i + 1])) {
+            matches.push_back(KeypointMatch(i, nn_idx[2 * i]));
+        }
+    }
+
+    delete [] nn_idx;
+    delete [] nn_dist;
 
     return matches;
 }
@@ -92,9 +92,13 @@ int ReadKeysGzip(gzFile fp, unsigned char **keys, keypt_t **info = NULL);
 /* Read keys using MMAP to speed things up */
 std::vector<Keypoint *> ReadKeysMMAP(FILE *fp);
 
-/* Create a search tree for the given set of keypoints */
+/* Create a search tree for the given set of keypoints.  The tree
+ * refers to keys in place, so keys must outlive it */
 ANNkd_tree *CreateSearchTree(int num_keys, unsigned char *keys);
 
+/* Free a tree created by CreateSearchTree (but not the keys) */
+void DeleteSearchTree(ANNkd_tree *tree);
+
 /* Compute likely matches between two sets of keypoints */
 std::vector<KeypointMatch> MatchKeys(int num_keys1, unsigned char *k1, 
 				     int num_keys2, unsigned char *k2,
@@ -106,4 +110,12 @@ std::vector<KeypointMatch> MatchKeys(int num_keys1, unsigned char *k1,
 				     double ratio = 0.6, 
                                      int max_pts_visit = 200);
 
+/* Compute matches between two sets of keypoints by exhaustive
+ * (exact) search, using the vectorized kernel in BruteForceMatch */
+std::vector<KeypointMatch> MatchKeysBruteForce(int num_keys1, 
+                                               unsigned char *k1, 
+                                               int num_keys2, 
+                                               unsigned char *k2, 
+                                               double ratio = 0.6);
+
 #endif /* __keys2_h__ */
@@ -1,4 +1,5 @@
 #include <list>
+#include <cstring>
 #include <fstream>
 #include "../numeric/mat4.h"
 #include "image.h"
@@ -18,6 +19,7 @@ using namespace Image;
 
 Cimage::Cimage(void) {
   m_alloc = 0;
+  m_cache = NULL;
 }
 
 Cimage::~Cimage() {
@@ -216,10 +218,81 @@ void Cimage::free(void) {
   vector<vector<unsigned char> >().swap(m_images);
   vector<vector<unsigned char> >().swap(m_masks);
   vector<vector<unsigned char> >().swap(m_edges);
+  m_cache = NULL;
+  vector<int>().swap(m_ctiles);
+  vector<int>().swap(m_mtiles);
+  vector<int>().swap(m_etiles);
   //vector<int>().swap(m_widths);
   //vector<int>().swap(m_heights);
 }
 
+void Cimage::tile(CtileCache& cache) {
+  if (m_alloc != 2) {
+    cerr << "First allocate" << endl;
+    exit (1);
+  }
+
+  m_ctiles.resize(m_maxLevel);  m_mtiles.resize(m_maxLevel);
+  m_etiles.resize(m_maxLevel);  m_tilesX.resize(m_maxLevel);
+  for (int level = 0; level < m_maxLevel; ++level) {
+    const int width = m_widths[level];
+    const int height = m_heights[level];
+    m_tilesX[level] = CtileCache::getTileNum(width);
+#ifdef FURUKAWA_IMAGE_GAMMA
+    m_ctiles[level] =
+      cache.addPlane((const unsigned char*)&m_dimages[level][0], width, height,
+                     3 * sizeof(float));
+#else
+    m_ctiles[level] = cache.addPlane(&m_images[level][0], width, height, 3);
+#endif
+    m_mtiles[level] = -1;
+    if (!m_masks[level].empty())
+      m_mtiles[level] = cache.addPlane(&m_masks[level][0], width, height, 1);
+    m_etiles[level] = -1;
+    if (!m_edges[level].empty())
+      m_etiles[level] = cache.addPlane(&m_edges[level][0], width, height, 1);
+  }
+  free(m_maxLevel);
+  m_cache = &cache;
+}
+
+void Cimage::untile(const std::vector<int>& tiles, const int level,
+                    const int bytes, std::vector<unsigned char>& data) const {
+  if (tiles[level] == -1)
+    return;
+  const int width = m_widths[level];
+  const int height = m_heights[level];
+  data.resize(width * height * bytes);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; x += CtileCache::SIZE) {
+      const int length = min(width - x, (int)CtileCache::SIZE) * bytes;
+      memcpy(&data[(y * width + x) * bytes],
+             getTilePixel(tiles, level, x, y, bytes), length);
+    }
+  }
+}
+
+void Cimage::prefetch(const Vec3f& icoord, const int level,
+                      const int margin) const {
+  if (m_cache == NULL)
+    return;
+  
+  const int xs[2] = {max(0, (int)floor(icoord[0]) - margin),
+                     min(m_widths[level] - 1, (int)floor(icoord[0]) + margin)};
+  const int ys[2] = {max(0, (int)floor(icoord[1]) - margin),
+                     min(m_heights[level] - 1, (int)floor(icoord[1]) + margin)};
+  if (xs[1] < xs[0] || ys[1] < ys[0])
+    return;
+
+  for (int ty = ys[0] >> CtileCache::LOG; ty <= ys[1] >> CtileCache::LOG; ++ty)
+    for (int tx = xs[0] >> CtileCache::LOG; tx <= xs[1] >> CtileCache::LOG; ++tx) {
+      const int offset = ty * m_tilesX[level] + tx;
+      m_cache->prefetch(m_ctiles[level] + offset);
+      if (m_mtiles[level] != -1)
+        m_cache->prefetch(m_mtiles[level] + offset);
+    }
+}
+
 void Cimage::buildImageMaskEdge(const int filter) {
   buildImage(filter);
 
@@ -392,6 +465,10 @@ void Cimage::buildEdge(void) {
 }
 
 void Cimage::setEdge(const float threshold) {
+  if (m_cache != NULL) {
+    cerr << "Cannot do setEdge on a tiled image." << endl;
+    exit (1);
+  }
   const int size = m_widths[0] * m_heights[0];
   m_edges[0].resize(size);
   for (int i = 0; i < size; ++i)
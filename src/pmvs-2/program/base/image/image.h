@@ -6,6 +6,7 @@
 #include <cstdlib>
 #include <cmath>
 #include "../numeric/vec3.h"
+#include "tileCache.h"
 
 namespace Image {
 
@@ -66,6 +67,14 @@ class Cimage {
   // free memory below the specified level
   void free(const int freeLevel);
 
+  // Move the image/mask/edge pyramids into cache and free them. After
+  // this, pixels are read from tiles. getImage/getMask/getEdge(level)
+  // copy a level back into memory, until free(level) is called.
+  void tile(CtileCache& cache);
+  inline int isTiled(void) const { return m_cache != NULL; }
+  // Prefetch the tiles within margin pixels of icoord
+  void prefetch(const Vec3f& icoord, const int level, const int margin) const;
+
   static int readPBMImage(const std::string file,
                           std::vector<unsigned char>& image,
                           int& width, int& height, const int fast);
@@ -173,6 +182,21 @@ class Cimage {
 #ifdef FURUKAWA_IMAGE_GAMMA
   void decodeGamma(void);
 #endif
+
+#ifdef FURUKAWA_IMAGE_GAMMA
+  typedef float Tcolor;
+#else
+  typedef unsigned char Tcolor;
+#endif
+  
+  // Address of pixel (ix, iy) in the tile of a level, where tiles is
+  // one of m_ctiles, m_mtiles, m_etiles
+  inline const unsigned char* getTilePixel(const std::vector<int>& tiles,
+                                           const int level, const int ix,
+                                           const int iy, const int bytes) const;
+  // Copy a tiled level back into data
+  void untile(const std::vector<int>& tiles, const int level,
+              const int bytes, std::vector<unsigned char>& data) const;
   
   //----------------------------------------------------------------------
   // Variables updated at every alloc/free
@@ -210,6 +234,17 @@ class Cimage {
   
   // number of levels
   int m_maxLevel;
+
+  //----------------------------------------------------------------------
+  // Tiled pyramids. m_cache is NULL unless tile() has been called
+  //----------------------------------------------------------------------
+  CtileCache* m_cache;
+  // First tile of each level of image/mask/edge. -1 if there is none
+  std::vector<int> m_ctiles;
+  std::vector<int> m_mtiles;
+  std::vector<int> m_etiles;
+  // Number of tiles in a row at each level
+  std::vector<int> m_tilesX;
 };
   
 inline int Cimage::isSafe(const Vec3f& icoord, const int level) const {
@@ -230,7 +265,7 @@ inline int Cimage::isSafe(const Vec3f& icoord, const int level) const {
  
 // Check if a mask image exists
 inline int Cimage::isMask(void) const {
-  if (m_masks[0].empty())
+  if (m_cache != NULL ? m_mtiles[0] == -1 : m_masks[0].empty())
     return 0;
   else
     return 1;
@@ -238,7 +273,7 @@ inline int Cimage::isMask(void) const {
  
 // Check if an edge image exists
 inline int Cimage::isEdge(void) const {
-  if (m_edges[0].empty())
+  if (m_cache != NULL ? m_etiles[0] == -1 : m_edges[0].empty())
     return 0;
   else
     return 1;
@@ -255,6 +290,10 @@ inline const std::vector<unsigned char>& Cimage::getImage(const int level) const
   exit (1);
 #endif
   
+  if (m_cache != NULL) {
+    std::cerr << "Tiled image is not in memory (getImage)" << std::endl;
+    exit (1);
+  }
   return m_images[level];
 };
 
@@ -263,6 +302,10 @@ inline const std::vector<unsigned char>& Cimage::getMask(const int level) const{
     std::cerr << "First allocate" << std::endl;
     exit (1);
   }  
+  if (m_cache != NULL) {
+    std::cerr << "Tiled image is not in memory (getMask)" << std::endl;
+    exit (1);
+  }
   return m_masks[level];
 };
 
@@ -271,6 +314,10 @@ inline const std::vector<unsigned char>& Cimage::getEdge(const int level) const{
     std::cerr << "First allocate" << std::endl;
     exit (1);
   }  
+  if (m_cache != NULL) {
+    std::cerr << "Tiled image is not in memory (getEdge)" << std::endl;
+    exit (1);
+  }
   return m_edges[level];
 };
 
@@ -285,6 +332,8 @@ inline std::vector<unsigned char>& Cimage::getImage(const int level){
   exit (1);
 #endif
   
+  if (m_cache != NULL && m_images[level].empty())
+    untile(m_ctiles, level, 3, m_images[level]);
   return m_images[level];
 };
 
@@ -293,6 +342,8 @@ inline std::vector<unsigned char>& Cimage::getMask(const int level){
     std::cerr << "First allocate" << std::endl;
     exit (1);
   }  
+  if (m_cache != NULL && m_masks[level].empty())
+    untile(m_mtiles, level, 1, m_masks[level]);
   return m_masks[level];
 };
 
@@ -301,6 +352,8 @@ inline std::vector<unsigned char>& Cimage::getEdge(const int level){
     std::cerr << "First allocate" << std::endl;
     exit (1);
   }  
+  if (m_cache != NULL && m_edges[level].empty())
+    untile(m_etiles, level, 1, m_edges[level]);
   return m_edges[level];
 };
 
@@ -372,117 +425,76 @@ Vec3f Cimage::getColor(const float x, const float y, const int level) const{
   f = 1 - q;
   const float wy2 = (((1) * f - 2) * f) * f + 1;
   
-  const int offset = m_widths[level] * 3;
-  const int index0 = ((y1 - 1) * m_widths[level] + x1 - 1) * 3;
-  const int index1 = index0 + offset;
-  const int index2 = index1 + offset;
-  const int index3 = index2 + offset;
-  
+  const Tcolor* p0;
+  int offset;
+  if (m_cache != NULL) {
+    offset = 3 * CtileCache::STRIDE;
+    p0 = (const Tcolor*)getTilePixel(m_ctiles, level, x1, y1, sizeof(Tcolor) * 3)
+      - offset - 3;
+  }
+  else {
+    offset = m_widths[level] * 3;
 #ifdef FURUKAWA_IMAGE_GAMMA
-  const float& r00 = m_dimages[level][index0];
-  const float& g00 = m_dimages[level][index0+1];
-  const float& b00 = m_dimages[level][index0+2];
-  const float& r01 = m_dimages[level][index0+3];
-  const float& g01 = m_dimages[level][index0+4];
-  const float& b01 = m_dimages[level][index0+5];
-  const float& r02 = m_dimages[level][index0+6];
-  const float& g02 = m_dimages[level][index0+7];
-  const float& b02 = m_dimages[level][index0+8];
-  const float& r03 = m_dimages[level][index0+9];
-  const float& g03 = m_dimages[level][index0+10];
-  const float& b03 = m_dimages[level][index0+11];
-  
-  const float& r10 = m_dimages[level][index1];
-  const float& g10 = m_dimages[level][index1+1];
-  const float& b10 = m_dimages[level][index1+2];
-  const float& r11 = m_dimages[level][index1+3];
-  const float& g11 = m_dimages[level][index1+4];
-  const float& b11 = m_dimages[level][index1+5];
-  const float& r12 = m_dimages[level][index1+6];
-  const float& g12 = m_dimages[level][index1+7];
-  const float& b12 = m_dimages[level][index1+8];
-  const float& r13 = m_dimages[level][index1+9];
-  const float& g13 = m_dimages[level][index1+10];
-  const float& b13 = m_dimages[level][index1+11];
-  
-  const float& r20 = m_dimages[level][index2];
-  const float& g20 = m_dimages[level][index2+1];
-  const float& b20 = m_dimages[level][index2+2];
-  const float& r21 = m_dimages[level][index2+3];
-  const float& g21 = m_dimages[level][index2+4];
-  const float& b21 = m_dimages[level][index2+5];
-  const float& r22 = m_dimages[level][index2+6];
-  const float& g22 = m_dimages[level][index2+7];
-  const float& b22 = m_dimages[level][index2+8];
-  const float& r23 = m_dimages[level][index2+9];
-  const float& g23 = m_dimages[level][index2+10];
-  const float& b23 = m_dimages[level][index2+11];
-  
-  const float& r30 = m_dimages[level][index3];
-  const float& g30 = m_dimages[level][index3+1];
-  const float& b30 = m_dimages[level][index3+2];
-  const float& r31 = m_dimages[level][index3+3];
-  const float& g31 = m_dimages[level][index3+4];
-  const float& b31 = m_dimages[level][index3+5];
-  const float& r32 = m_dimages[level][index3+6];
-  const float& g32 = m_dimages[level][index3+7];
-  const float& b32 = m_dimages[level][index3+8];
-  const float& r33 = m_dimages[level][index3+9];
-  const float& g33 = m_dimages[level][index3+10];
-  const float& b33 = m_dimages[level][index3+11];
+    p0 = &m_dimages[level][((y1 - 1) * m_widths[level] + x1 - 1) * 3];
 #else
-  const unsigned char& r00 = m_images[level][index0];
-  const unsigned char& g00 = m_images[level][index0+1];
-  const unsigned char& b00 = m_images[level][index0+2];
-  const unsigned char& r01 = m_images[level][index0+3];
-  const unsigned char& g01 = m_images[level][index0+4];
-  const unsigned char& b01 = m_images[level][index0+5];
-  const unsigned char& r02 = m_images[level][index0+6];
-  const unsigned char& g02 = m_images[level][index0+7];
-  const unsigned char& b02 = m_images[level][index0+8];
-  const unsigned char& r03 = m_images[level][index0+9];
-  const unsigned char& g03 = m_images[level][index0+10];
-  const unsigned char& b03 = m_images[level][index0+11];
-  
-  const unsigned char& r10 = m_images[level][index1];
-  const unsigned char& g10 = m_images[level][index1+1];
-  const unsigned char& b10 = m_images[level][index1+2];
-  const unsigned char& r11 = m_images[level][index1+3];
-  const unsigned char& g11 = m_images[level][index1+4];
-  const unsigned char& b11 = m_images[level][index1+5];
-  const unsigned char& r12 = m_images[level][index1+6];
-  const unsigned char& g12 = m_images[level][index1+7];
-  const unsigned char& b12 = m_images[level][index1+8];
-  const unsigned char& r13 = m_images[level][index1+9];
-  const unsigned char& g13 = m_images[level][index1+10];
-  const unsigned char& b13 = m_images[level][index1+11];
-  
-  const unsigned char& r20 = m_images[level][index2];
-  const unsigned char& g20 = m_images[level][index2+1];
-  const unsigned char& b20 = m_images[level][index2+2];
-  const unsigned char& r21 = m_images[level][index2+3];
-  const unsigned char& g21 = m_images[level][index2+4];
-  const unsigned char& b21 = m_images[level][index2+5];
-  const unsigned char& r22 = m_images[level][index2+6];
-  const unsigned char& g22 = m_images[level][index2+7];
-  const unsigned char& b22 = m_images[level][index2+8];
-  const unsigned char& r23 = m_images[level][index2+9];
-  const unsigned char& g23 = m_images[level][index2+10];
-  const unsigned char& b23 = m_images[level][index2+11];
-  
-  const unsigned char& r30 = m_images[level][index3];
-  const unsigned char& g30 = m_images[level][index3+1];
-  const unsigned char& b30 = m_images[level][index3+2];
-  const unsigned char& r31 = m_images[level][index3+3];
-  const unsigned char& g31 = m_images[level][index3+4];
-  const unsigned char& b31 = m_images[level][index3+5];
-  const unsigned char& r32 = m_images[level][index3+6];
-  const unsigned char& g32 = m_images[level][index3+7];
-  const unsigned char& b32 = m_images[level][index3+8];
-  const unsigned char& r33 = m_images[level][index3+9];
-  const unsigned char& g33 = m_images[level][index3+10];
-  const unsigned char& b33 = m_images[level][index3+11];
+    p0 = &m_images[level][((y1 - 1) * m_widths[level] + x1 - 1) * 3];
 #endif
+  }
+  const Tcolor* p1 = p0 + offset;
+  const Tcolor* p2 = p1 + offset;
+  const Tcolor* p3 = p2 + offset;
+  
+  const Tcolor& r00 = p0[0];
+  const Tcolor& g00 = p0[1];
+  const Tcolor& b00 = p0[2];
+  const Tcolor& r01 = p0[3];
+  const Tcolor& g01 = p0[4];
+  const Tcolor& b01 = p0[5];
+  const Tcolor& r02 = p0[6];
+  const Tcolor& g02 = p0[7];
+  const Tcolor& b02 = p0[8];
+  const Tcolor& r03 = p0[9];
+  const Tcolor& g03 = p0[10];
+  const Tcolor& b03 = p0[11];
+  
+  const Tcolor& r10 = p1[0];
+  const Tcolor& g10 = p1[1];
+  const Tcolor& b10 = p1[2];
+  const Tcolor& r11 = p1[3];
+  const Tcolor& g11 = p1[4];
+  const Tcolor& b11 = p1[5];
+  const Tcolor& r12 = p1[6];
+  const Tcolor& g12 = p1[7];
+  const Tcolor& b12 = p1[8];
+  const Tcolor& r13 = p1[9];
+  const Tcolor& g13 = p1[10];
+  const Tcolor& b13 = p1[11];
+  
+  const Tcolor& r20 = p2[0];
+  const Tcolor& g20 = p2[1];
+  const Tcolor& b20 = p2[2];
+  const Tcolor& r21 = p2[3];
+  const Tcolor& g21 = p2[4];
+  const Tcolor& b21 = p2[5];
+  const Tcolor& r22 = p2[6];
+  const Tcolor& g22 = p2[7];
+  const Tcolor& b22 = p2[8];
+  const Tcolor& r23 = p2[9];
+  const Tcolor& g23 = p2[10];
+  const Tcolor& b23 = p2[11];
+  
+  const Tcolor& r30 = p3[0];
+  const Tcolor& g30 = p3[1];
+  const Tcolor& b30 = p3[2];
+  const Tcolor& r31 = p3[3];
+  const Tcolor& g31 = p3[4];
+  const Tcolor& b31 = p3[5];
+  const Tcolor& r32 = p3[6];
+  const Tcolor& g32 = p3[7];
+  const Tcolor& b32 = p3[8];
+  const Tcolor& r33 = p3[9];
+  const Tcolor& g33 = p3[10];
+  const Tcolor& b33 = p3[11];
   // separate x and y
   const float row0[3] = {wx0 * r00 + wx1 * r01 + wx2 * r02 + wx3 * r03,
 			 wx0 * g00 + wx1 * g01 + wx2 * g02 + wx3 * g03,
@@ -506,56 +518,38 @@ Vec3f Cimage::getColor(const float x, const float y, const int level) const{
   // Bilinear case
   const int lx = (int)floor(x);
   const int ly = (int)floor(y);
-  const int index = 3 * (ly * m_widths[level] + lx);
 
   const float dx1 = x - lx;  const float dx0 = 1.0f - dx1;
   const float dy1 = y - ly;  const float dy0 = 1.0f - dy1;
   
   const float f00 = dx0 * dy0;  const float f01 = dx0 * dy1;
   const float f10 = dx1 * dy0;  const float f11 = dx1 * dy1;
-  const int index2 = index + 3 * m_widths[level];
-    
+
+  const Tcolor* cp0;
+  const Tcolor* cp1;
+  if (m_cache != NULL) {
+    cp0 = (const Tcolor*)getTilePixel(m_ctiles, level, lx, ly, sizeof(Tcolor) * 3) - 1;
+    cp1 = cp0 + 3 * CtileCache::STRIDE;
+  }
+  else {
+    const int index = 3 * (ly * m_widths[level] + lx);
+    const int index2 = index + 3 * m_widths[level];
 #ifdef FURUKAWA_IMAGE_GAMMA
-  const float* fp0 = &m_dimages[level][index] - 1;
-  const float* fp1 = &m_dimages[level][index2] - 1;
-  float r = 0.0f;  float g = 0.0f;  float b = 0.0f;
-  r += *(++fp0) * f00 + *(++fp1) * f01;
-  g += *(++fp0) * f00 + *(++fp1) * f01;
-  b += *(++fp0) * f00 + *(++fp1) * f01;
-  r += *(++fp0) * f10 + *(++fp1) * f11;
-  g += *(++fp0) * f10 + *(++fp1) * f11;
-  b += *(++fp0) * f10 + *(++fp1) * f11;
-  return Vec3f(r, g, b);
-  /*
-  return Vec3f(m_dimages[level][index] * f00 + m_dimages[level][index + 3] * f10 +
-               m_dimages[level][index2] * f01 + m_dimages[level][index2 + 3] * f11,
-               m_dimages[level][index + 1] * f00 + m_dimages[level][index + 4] * f10 +
-               m_dimages[level][index2 + 1] * f01 + m_dimages[level][index2 + 4] * f11,
-               m_dimages[level][index + 2] * f00 + m_dimages[level][index + 5] * f10 +
-               m_dimages[level][index2 + 2] * f01 + m_dimages[level][index2 + 5] * f11);
-  */
+    cp0 = &m_dimages[level][index] - 1;
+    cp1 = &m_dimages[level][index2] - 1;
 #else
-  const unsigned char* ucp0 = &m_images[level][index] - 1;
-  const unsigned char* ucp1 = &m_images[level][index2] - 1;
+    cp0 = &m_images[level][index] - 1;
+    cp1 = &m_images[level][index2] - 1;
+#endif
+  }
   float r = 0.0f;  float g = 0.0f;  float b = 0.0f;
-  r += *(++ucp0) * f00 + *(++ucp1) * f01;
-  g += *(++ucp0) * f00 + *(++ucp1) * f01;
-  b += *(++ucp0) * f00 + *(++ucp1) * f01;
-  r += *(++ucp0) * f10 + *(++ucp1) * f11;
-  g += *(++ucp0) * f10 + *(++ucp1) * f11;
-  b += *(++ucp0) * f10 + *(++ucp1) * f11;
+  r += *(++cp0) * f00 + *(++cp1) * f01;
+  g += *(++cp0) * f00 + *(++cp1) * f01;
+  b += *(++cp0) * f00 + *(++cp1) * f01;
+  r += *(++cp0) * f10 + *(++cp1) * f11;
+  g += *(++cp0) * f10 + *(++cp1) * f11;
+  b += *(++cp0) * f10 + *(++cp1) * f11;
   return Vec3f(r, g, b);
-  /*
-  return Vec3f(m_images[level][index] * f00 + m_images[level][index + 3] * f10 +
-               m_images[level][index2] * f01 + m_images[level][index2 + 3] * f11,
-               
-               m_images[level][index + 1] * f00 + m_images[level][index + 4] * f10 +
-               m_images[level][index2 + 1] * f01 + m_images[level][index2 + 4] * f11,
-               
-               m_images[level][index + 2] * f00 + m_images[level][index + 5] * f10 +
-               m_images[level][index2 + 2] * f01 + m_images[level][index2 + 5] * f11);
-  */
-#endif
   /*
   const int lx = (int)floor(x);    const int ux = lx + 1;
   const int ly = (int)floor(y);    const int uy = ly + 1;
@@ -578,6 +572,10 @@ void Cimage::setColor(const int ix, const int iy, const int level,
     exit (1);
   }  
 #endif  
+  if (m_cache != NULL) {
+    std::cerr << "Cannot do setColor on a tiled image." << std::endl;
+    exit (1);
+  }
   const int index = (iy * m_widths[level] + ix) * 3;
 
 #ifdef FURUKAWA_IMAGE_GAMMA
@@ -598,6 +596,12 @@ Vec3f Cimage::getColor(const int ix, const int iy, const int level) const{
     exit (1);
   }  
 #endif  
+  if (m_cache != NULL) {
+    const Tcolor* cp =
+      (const Tcolor*)getTilePixel(m_ctiles, level, ix, iy, sizeof(Tcolor) * 3);
+    return Vec3f(cp[0], cp[1], cp[2]);
+  }
+  
   const int index = (iy * m_widths[level] + ix) * 3;
 
 #ifdef FURUKAWA_IMAGE_GAMMA
@@ -612,14 +616,6 @@ Vec3f Cimage::getColor(const int ix, const int iy, const int level) const{
 };
 
 int Cimage::getMask(const float fx, const float fy, const int level) const{
-  if (m_alloc != 2) {
-    std::cerr << "First allocate" << std::endl;
-    exit (1);
-  }    
-  
-  if (m_masks[level].empty())
-    return 1;
-  
   const int ix = (int)floor(fx + 0.5f);
   const int iy = (int)floor(fy + 0.5f);
   return getMask(ix, iy, level);
@@ -631,24 +627,20 @@ int Cimage::getMask(const int ix, const int iy, const int level) const{
     exit (1);
   }    
 
-  if (m_masks[level].empty())
+  if (m_cache != NULL ? m_mtiles[level] == -1 : m_masks[level].empty())
     return 1;
 
   if (ix < 0 || m_widths[level] <= ix || iy < 0 || m_heights[level] <= iy)
     return 1;
+
+  if (m_cache != NULL)
+    return *getTilePixel(m_mtiles, level, ix, iy, 1);
   
   const int index = iy * m_widths[level] + ix;
   return m_masks[level][index];
 };
 
 int Cimage::getEdge(const float fx, const float fy, const int level) const{
-  if (m_alloc != 2) {
-    std::cerr << "First allocate" << std::endl;
-    exit (1);
-  }    
-
-  if (m_edges[level].empty())
-    return 1;    
   const int ix = (int)floor(fx + 0.5f);
   const int iy = (int)floor(fy + 0.5f);
   return getEdge(ix, iy, level);
@@ -660,15 +652,30 @@ int Cimage::getEdge(const int ix, const int iy, const int level) const{
     exit (1);
   }    
   
-  if (m_edges[level].empty())
+  if (m_cache != NULL ? m_etiles[level] == -1 : m_edges[level].empty())
     return 1;
 
   if (ix < 0 || m_widths[level] <= ix || iy < 0 || m_heights[level] <= iy)
     return 1;
+
+  if (m_cache != NULL)
+    return *getTilePixel(m_etiles, level, ix, iy, 1);
   
   const int index = iy * m_widths[level] + ix;
   return m_edges[level][index];
 };
+
+const unsigned char* Cimage::getTilePixel(const std::vector<int>& tiles,
+                                          const int level, const int ix,
+                                          const int iy, const int bytes) const {
+  const int tx = ix >> CtileCache::LOG;
+  const int ty = iy >> CtileCache::LOG;
+  const unsigned char* tile =
+    m_cache->getTile(tiles[level] + ty * m_tilesX[level] + tx);
+  const int x = ix - (tx << CtileCache::LOG) + CtileCache::BORDER;
+  const int y = iy - (ty << CtileCache::LOG) + CtileCache::BORDER;
+  return tile + (y * CtileCache::STRIDE + x) * bytes;
+};
   
 };
 
@@ -88,6 +88,23 @@ void Cphoto::normalize(std::vector<Vec3f>& tex) {
     tex[i] /= ave2;
 }
 
+float Cphoto::ssd(const Ctexture& tex0, const Ctexture& tex1) {
+  // Make sure that the score is below 2.0f
+  return Ctexture::ssd(tex0, tex1) / (255.0 * 255.0);
+}
+
+float Cphoto::idot(const Ctexture& tex0, const Ctexture& tex1) {
+  if (tex0.empty() || tex1.empty()) {
+    cerr << "Error in idot. Empty textures" << endl;
+    exit (1);
+  }
+  return 1.0f - Ctexture::dot(tex0, tex1);
+}
+
+void Cphoto::normalize(Ctexture& tex) {
+  tex.normalize();
+}
+
 void Cphoto::grabTex(const int level, const Vec2f& icoord,
 		     const Vec2f& xaxis, const Vec2f& yaxis,
 		     const int size, std::vector<Vec3f>& tex,
@@ -140,3 +157,52 @@ void Cphoto::grabTex(const int level, const Vec4f& coord,
   unitize(ray);
   weight = max(0.0f, pzaxis * ray);
 }
+
+void Cphoto::grabTex(const int level, const Vec2f& icoord,
+		     const Vec2f& xaxis, const Vec2f& yaxis,
+		     const int size, Ctexture& tex,
+                     const int normalizef) const{
+  const int margin = size / 2;
+  
+  // Check boundary condition
+  const float maxx = icoord[0] + size * fabs(xaxis[0]) + size * fabs(yaxis[0]);
+  const float minx = icoord[0] - size * fabs(xaxis[0]) - size * fabs(yaxis[0]);
+  const float maxy = icoord[1] + size * fabs(xaxis[1]) + size * fabs(yaxis[1]);
+  const float miny = icoord[1] - size * fabs(xaxis[1]) - size * fabs(yaxis[1]);
+  
+  tex.clear();
+  if (minx < 0 || getWidth(level) - 1 <= maxx ||
+      miny < 0 || getHeight(level) - 1 <= maxy)
+    return;
+
+  // Every row covers 2 * margin + 1 samples, as above
+  const int width = 2 * margin + 1;
+  const Vec2f left = icoord - margin * xaxis - margin * yaxis;
+  tex.sample(*this, level, Vec3f(left, 1.0f), Vec3f(xaxis, 0.0f),
+             Vec3f(yaxis, 0.0f), width);
+
+  if (normalizef)
+    normalize(tex);
+}
+
+void Cphoto::grabTex(const int level, const Vec4f& coord,
+		     const Vec4f& pxaxis, const Vec4f& pyaxis, const Vec4f& pzaxis,
+		     const int size, Ctexture& tex, float& weight,
+                     const int normalizef) const {
+  const int scale = 0x0001 << level;
+  
+  const Vec3f icoord3 = project(coord, level);
+  const Vec2f icoord(icoord3[0], icoord3[1]);
+  
+  const Vec3f xaxis3 = project(coord + pxaxis * scale, level) - icoord3;
+  const Vec2f xaxis(xaxis3[0], xaxis3[1]);
+  
+  const Vec3f yaxis3 = project(coord + pyaxis * scale, level) - icoord3;
+  const Vec2f yaxis(yaxis3[0], yaxis3[1]);
+
+  grabTex(level, icoord, xaxis, yaxis, size, tex, normalizef);
+
+  Vec4f ray = m_center - coord;
+  unitize(ray);
+  weight = max(0.0f, pzaxis * ray);
+}
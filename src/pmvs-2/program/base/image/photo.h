@@ -4,6 +4,7 @@
 #include "../numeric/vec4.h"
 #include "image.h"
 #include "camera.h"
+#include "texture.h"
 
 namespace Image {
 
@@ -31,6 +32,16 @@ class Cphoto : public Cimage, public Ccamera {
 	       const int size, std::vector<Vec3f>& tex, float& weight,
                const int normalizef = 1) const;
 
+  // Same as above, into a structure-of-arrays texture
+  void grabTex(const int level, const Vec2f& icoord,
+	       const Vec2f& xaxis, const Vec2f& yaxis, const int size,
+	       Ctexture& tex, const int normalizef = 1) const;
+
+  void grabTex(const int level, const Vec4f& coord,
+	       const Vec4f& pxaxis, const Vec4f& pyaxis, const Vec4f& pzaxis,
+	       const int size, Ctexture& tex, float& weight,
+               const int normalizef = 1) const;
+
 
   inline Vec3f getColor(const float fx, const float fy, const int level) const;  
   inline Vec3f getColor(const Vec4f& coord, const int level) const;
@@ -47,6 +58,10 @@ class Cphoto : public Cimage, public Ccamera {
 
   static float ssd(const std::vector<Vec3f>& tex0,
 		   const std::vector<Vec3f>& tex1);
+
+  static float idot(const Ctexture& tex0, const Ctexture& tex1);
+  static void normalize(Ctexture& tex);
+  static float ssd(const Ctexture& tex0, const Ctexture& tex1);
  protected:
 };
 
@@ -1,11 +1,13 @@
 #include <fstream>
 #include <algorithm>
+#include <unistd.h>
 #include "photoSetS.h"
 
 using namespace std;
 using namespace Image;
 
 CphotoSetS::CphotoSetS(void) {
+  m_avedis = 1.0f;
 }
 
 CphotoSetS::~CphotoSetS() {
@@ -13,7 +15,8 @@ CphotoSetS::~CphotoSetS() {
 
 
 void CphotoSetS::init(const std::vector<int>& images, const std::string prefix,
-                      const int maxLevel, const int size, const int alloc) {
+                      const int maxLevel, const int size, const int alloc,
+                      const int tileCache) {
   m_images = images;
   m_num = (int)images.size();
   
@@ -23,6 +26,13 @@ void CphotoSetS::init(const std::vector<int>& images, const std::string prefix,
   m_prefix = prefix;
   m_maxLevel = max(1, maxLevel);
   m_photos.resize(m_num);
+
+  if (alloc && 0 < tileCache) {
+    char buffer[1024];
+    sprintf(buffer, "%smodels/tiles.%d", prefix.c_str(), (int)getpid());
+    m_cache.open(buffer, (long long)tileCache * 1024 * 1024);
+  }
+  
   cerr << "Reading images: " << flush;
   for (int index = 0; index < m_num; ++index) {
     const int image = m_images[index];
@@ -44,6 +54,8 @@ void CphotoSetS::init(const std::vector<int>& images, const std::string prefix,
         m_photos[index].alloc();
       else
         m_photos[index].alloc(1);
+      if (m_cache.isOpen())
+        m_photos[index].tile(m_cache);
       cerr << '*' << flush;
     }
     // try 4 digits
@@ -61,6 +73,8 @@ void CphotoSetS::init(const std::vector<int>& images, const std::string prefix,
         m_photos[index].alloc();
       else
         m_photos[index].alloc(1);
+      if (m_cache.isOpen())
+        m_photos[index].tile(m_cache);
       cerr << '*' << flush;
     }
 
@@ -83,6 +97,8 @@ void CphotoSetS::init(const std::vector<int>& images, const std::string prefix,
     */
   }
   cerr << endl;
+  if (m_cache.isOpen())
+    m_cache.map();
   const int margin = size / 2;
   m_size = 2 * margin + 1;
 }
@@ -133,6 +149,20 @@ void CphotoSetS::grabTex(const int index, const int level, const Vec4f& coord,
                           m_size, tex, weight, normalizef);
 }
 
+void CphotoSetS::grabTex(const int index, const int level, const Vec2f& icoord,
+                         const Vec2f& xaxis, const Vec2f& yaxis,
+                         Ctexture& tex, const int normalizef) const{
+  m_photos[index].grabTex(level, icoord, xaxis, yaxis, m_size, tex, normalizef);
+}
+
+void CphotoSetS::grabTex(const int index, const int level, const Vec4f& coord,
+                         const Vec4f& pxaxis, const Vec4f& pyaxis, const Vec4f& pzaxis,
+                         Ctexture& tex, float& weight,
+                         const int normalizef) const {
+  m_photos[index].grabTex(level, coord, pxaxis, pyaxis, pzaxis,
+                          m_size, tex, weight, normalizef);
+}
+
 float CphotoSetS::incc(const std::vector<std::vector<Vec3f> >& texs,
                        const std::vector<float>& weights) {
   float incctmp = 0.0;
@@ -157,6 +187,30 @@ float CphotoSetS::incc(const std::vector<std::vector<Vec3f> >& texs,
     return incctmp / denom;
 }
 
+float CphotoSetS::incc(const std::vector<Ctexture>& texs,
+                       const std::vector<float>& weights) {
+  float incctmp = 0.0;
+  float denom = 0.0;
+  for (int i = 0; i < (int)weights.size(); ++i) {
+    if (texs[i].empty())
+      continue;
+    for (int j = i+1; j < (int)weights.size(); ++j) {
+      if (texs[j].empty())
+	continue;
+      
+      const float weight = weights[i] * weights[j];
+      const float ftmp = Cphoto::idot(texs[i], texs[j]);
+      incctmp += ftmp * weight;
+      denom += weight;
+    }
+  }
+  
+  if (denom == 0.0)
+    return 2.0f;
+  else
+    return incctmp / denom;
+}
+
 void CphotoSetS::getMinMaxAngles(const Vec4f& coord, const std::vector<int>& indexes,
                                  float& minAngle, float& maxAngle) const {
   minAngle = M_PI;
@@ -212,20 +266,15 @@ float CphotoSetS::computeDepth(const int index, const Vec4f& coord) const {
 }
 
 void CphotoSetS::setDistances(void) {
-  m_distances.resize(m_num);
+  m_avedis = 1.0f;
   float avedis = 0.0f;
   int denom = 0;
   for (int i = 0; i < m_num; ++i) {
-    m_distances[i].resize(m_num);
     for (int j = 0; j < m_num; ++j) {
       if (i == j)
-        m_distances[i][j] = 0.0f;
-      else {
-        const float ftmp = norm(m_photos[i].m_center - m_photos[j].m_center);
-        m_distances[i][j] = ftmp;
-        avedis += ftmp;
-        denom++;
-      }
+        continue;
+      avedis += norm(m_photos[i].m_center - m_photos[j].m_center);
+      denom++;
     }
   }
   if (denom == 0)
@@ -236,21 +285,7 @@ void CphotoSetS::setDistances(void) {
     cerr << "All the optical centers are identical..?" << endl;
     exit (1);
   }
-  
-  // plus angle difference
-  for (int i = 0; i < m_num; ++i) {
-    Vec4f ray0 = m_photos[i].m_oaxis;
-    ray0[3] = 0.0f;
-    for (int j = 0; j < m_num; ++j) {
-      Vec4f ray1 = m_photos[j].m_oaxis;
-      ray1[3] = 0.0f;
-      
-      m_distances[i][j] /= avedis;
-      const float margin = cos(10.0f * M_PI / 180.0f);
-      const float dis = max(0.0f, 1.0f - ray0 * ray1 - margin);
-      m_distances[i][j] += dis;
-    }
-  }
+  m_avedis = avedis;
 }
 
 int CphotoSetS::image2index(const int image) const {
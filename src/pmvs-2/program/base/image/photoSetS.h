@@ -11,8 +11,11 @@ class CphotoSetS {
   CphotoSetS(void);
   virtual ~CphotoSetS();
 
+  // If tileCache is positive, the image pyramids are kept in a tile
+  // cache file under prefix/models/ with tileCache MB of memory
   void init(const std::vector<int>& images, const std::string prefix,
-            const int maxLevel, const int size, const int alloc);
+            const int maxLevel, const int size, const int alloc,
+            const int tileCache = 0);
   
   // grabTex given 2D sampling information
   void grabTex(const int index, const int level, const Vec2f& icoord,
@@ -24,6 +27,15 @@ class CphotoSetS {
 	       const Vec4f& pxaxis, const Vec4f& pyaxis, const Vec4f& pzaxis,
 	       std::vector<Vec3f>& tex, float& weight,
                const int normalizef = 1) const;
+
+  void grabTex(const int index, const int level, const Vec2f& icoord,
+	       const Vec2f& xaxis, const Vec2f& yaxis,
+	       Ctexture& tex, const int normalizef = 1) const;
+
+  void grabTex(const int index, const int level, const Vec4f& coord,
+	       const Vec4f& pxaxis, const Vec4f& pyaxis, const Vec4f& pzaxis,
+	       Ctexture& tex, float& weight,
+               const int normalizef = 1) const;
   
   void write(const std::string outdir);
   void free(void);
@@ -37,6 +49,10 @@ class CphotoSetS {
   inline int getWidth(const int index, const int level) const;
   inline int getHeight(const int index, const int level) const;
 
+  // Prefetch tiles within margin pixels of the projection of coord
+  inline void prefetch(const int index, const Vec4f& coord, const int level,
+                       const int margin) const;
+
   inline Vec3f getColor(const Vec4f& coord, const int index,
                         const int level) const;
   inline Vec3f getColor(const int index, const float fx, const float fy,
@@ -59,6 +75,8 @@ class CphotoSetS {
   
   static float incc(const std::vector<std::vector<Vec3f> >& texs,
 		    const std::vector<float>& weights);
+  static float incc(const std::vector<Ctexture>& texs,
+		    const std::vector<float>& weights);
 
   int checkAngles(const Vec4f& coord, const std::vector<int>& indexes,
                   const float minAngle, const float maxAngle,
@@ -89,9 +107,15 @@ class CphotoSetS {
   void getPAxes(const int index, const Vec4f& coord, const Vec4f& normal,
 		Vec4f& pxaxis, Vec4f& pyaxis) const;
 
-  // pairwise distance based on optical center and viewing direction
+  // pairwise distance based on optical center and viewing direction.
+  // setDistances computes the average distance between optical
+  // centers, and getDistance the distance of a pair relative to it.
   void setDistances(void);
-  std::vector<std::vector<float> > m_distances;
+  inline float getDistance(const int index0, const int index1) const;
+  float m_avedis;
+
+  // Tiled image pyramids, if enabled in init
+  CtileCache m_cache;
  protected:  
 }; 
  
@@ -113,6 +137,12 @@ int CphotoSetS::getHeight(const int index, const int level) const {
   return m_photos[index].getHeight(level);
 };
 
+void CphotoSetS::prefetch(const int index, const Vec4f& coord, const int level,
+                          const int margin) const {
+  if (m_photos[index].isTiled())
+    m_photos[index].prefetch(project(index, coord, level), level, margin);
+};
+
 Vec3f CphotoSetS::getColor(const Vec4f& coord, const int index,
                           const int level) const {
   return m_photos[index].getColor(coord, level);
@@ -164,6 +194,23 @@ int CphotoSetS::getEdge(const int index, const int ix, const int iy,
                        const int level) const {
   return m_photos[index].Image::Cimage::getEdge(ix, iy, level); 
 };
+
+float CphotoSetS::getDistance(const int index0, const int index1) const {
+  if (index0 == index1)
+    return 0.0f;
+  
+  float distance = norm(m_photos[index0].m_center - m_photos[index1].m_center);
+  distance /= m_avedis;
+  
+  // plus angle difference
+  Vec4f ray0 = m_photos[index0].m_oaxis;
+  ray0[3] = 0.0f;
+  Vec4f ray1 = m_photos[index1].m_oaxis;
+  ray1[3] = 0.0f;
+  const float margin = cos(10.0f * M_PI / 180.0f);
+  distance += std::max(0.0f, 1.0f - ray0 * ray1 - margin);
+  return distance;
+};
  
 };
 
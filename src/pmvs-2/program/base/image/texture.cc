@@ -0,0 +1,340 @@
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include "texture.h"
+#include "image.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace Image;
+
+//----------------------------------------------------------------------
+// Vector operations. With AVX2 a vector holds 8 floats, with SSE2 4,
+// and 1 otherwise. m_stride is a multiple of 8, so every channel is a
+// whole number of vectors.
+//----------------------------------------------------------------------
+namespace {
+#if defined(__AVX2__)
+const int lanes = 8;
+typedef __m256 vfloat;
+inline vfloat vload(const float* p) { return _mm256_load_ps(p); }
+inline void vstore(float* p, const vfloat v) { _mm256_store_ps(p, v); }
+inline vfloat vset(const float f) { return _mm256_set1_ps(f); }
+inline vfloat vadd(const vfloat a, const vfloat b) { return _mm256_add_ps(a, b); }
+inline vfloat vsub(const vfloat a, const vfloat b) { return _mm256_sub_ps(a, b); }
+inline vfloat vmul(const vfloat a, const vfloat b) { return _mm256_mul_ps(a, b); }
+inline vfloat vabs(const vfloat a) {
+  return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);
+}
+inline float vsum(const vfloat a) {
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+}
+#elif defined(__SSE2__)
+const int lanes = 4;
+typedef __m128 vfloat;
+inline vfloat vload(const float* p) { return _mm_load_ps(p); }
+inline void vstore(float* p, const vfloat v) { _mm_store_ps(p, v); }
+inline vfloat vset(const float f) { return _mm_set1_ps(f); }
+inline vfloat vadd(const vfloat a, const vfloat b) { return _mm_add_ps(a, b); }
+inline vfloat vsub(const vfloat a, const vfloat b) { return _mm_sub_ps(a, b); }
+inline vfloat vmul(const vfloat a, const vfloat b) { return _mm_mul_ps(a, b); }
+inline vfloat vabs(const vfloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+inline float vsum(const vfloat a) {
+  __m128 s = _mm_add_ps(a, _mm_movehl_ps(a, a));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+}
+#else
+const int lanes = 1;
+typedef float vfloat;
+inline vfloat vload(const float* p) { return *p; }
+inline void vstore(float* p, const vfloat v) { *p = v; }
+inline vfloat vset(const float f) { return f; }
+inline vfloat vadd(const vfloat a, const vfloat b) { return a + b; }
+inline vfloat vsub(const vfloat a, const vfloat b) { return a - b; }
+inline vfloat vmul(const vfloat a, const vfloat b) { return a * b; }
+inline vfloat vabs(const vfloat a) { return a < 0.0f ? -a : a; }
+inline float vsum(const vfloat a) { return a; }
+#endif
+
+// Sum of num floats
+inline float sum(const float* p, const int num) {
+  vfloat ans = vset(0.0f);
+  for (int i = 0; i < num; i += lanes)
+    ans = vadd(ans, vload(p + i));
+  return vsum(ans);
+}
+};
+
+Ctexture::Ctexture(void)
+  : m_data(NULL), m_capacity(0), m_size(0), m_stride(0) {
+}
+
+Ctexture::Ctexture(const Ctexture& rhs)
+  : m_data(NULL), m_capacity(0), m_size(0), m_stride(0) {
+  *this = rhs;
+}
+
+Ctexture& Ctexture::operator=(const Ctexture& rhs) {
+  if (this == &rhs)
+    return *this;
+  reserve(rhs.m_capacity / 3);
+  m_size = rhs.m_size;
+  m_stride = rhs.m_stride;
+  if (m_size)
+    memcpy(m_data, rhs.m_data, sizeof(float) * 3 * m_stride);
+  return *this;
+}
+
+Ctexture::~Ctexture() {
+  free(m_data);
+}
+
+void Ctexture::reserve(const int size) {
+  const int capacity = 3 * ((size + 7) / 8 * 8);
+  if (capacity <= m_capacity)
+    return;
+
+  void* data = NULL;
+  if (posix_memalign(&data, 32, sizeof(float) * capacity) != 0) {
+    cerr << "Failed to allocate a texture of " << size << " samples" << endl;
+    exit (1);
+  }
+  if (m_size)
+    memcpy(data, m_data, sizeof(float) * 3 * m_stride);
+  free(m_data);
+  m_data = (float*)data;
+  m_capacity = capacity;
+}
+
+void Ctexture::resize(const int size) {
+  reserve(size);
+  m_size = size;
+  m_stride = (size + 7) / 8 * 8;
+  memset(m_data, 0, sizeof(float) * 3 * m_stride);
+}
+
+void Ctexture::clearPadding(void) {
+  for (int c = 0; c < 3; ++c) {
+    float* fp = channel(c);
+    for (int i = m_size; i < m_stride; ++i)
+      fp[i] = 0.0f;
+  }
+}
+
+void Ctexture::sample(const Cimage& image, const int level, const Vec3f& left,
+                      const Vec3f& dx, const Vec3f& dy, const int size) {
+  resize(size * size);
+  float* rp = channel(0);
+  float* gp = channel(1);
+  float* bp = channel(2);
+
+#if defined(__AVX2__) && !defined(FURUKAWA_IMAGE_BICUBIC) && !defined(FURUKAWA_IMAGE_GAMMA)
+  // Bilinear interpolation of 8 samples at a time. The 6 bytes of the
+  // two neighboring pixels in a row are fetched with two 32-bit
+  // gathers at offsets 0 and 2, which never read past the second pixel.
+  // Tiled images are not contiguous, and go through getColor below.
+  if (!image.isTiled()) {
+    const int width = image.getWidth(level);
+    const int* base = (const int*)&image.getImage(level)[0];
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i last = _mm256_set1_epi32(m_size - 1);
+    const __m256i byte = _mm256_set1_epi32(255);
+    const __m256i three = _mm256_set1_epi32(3);
+    const __m256i two = _mm256_set1_epi32(2);
+    const __m256i rowstep = _mm256_set1_epi32(3 * width);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const float fsize = (float)size;
+    const float isize = 1.0f / size;
+
+    for (int i = 0; i < m_size; i += 8) {
+      // Sample indexes beyond the end repeat the last sample; they land
+      // in the padding, which is cleared below
+      const __m256i k = _mm256_min_epi32(_mm256_add_epi32(_mm256_set1_epi32(i), lane),
+                                         last);
+      const __m256 fk = _mm256_cvtepi32_ps(k);
+      // y = k / size, x = k - y * size (exact for these small integers)
+      const __m256 sy = _mm256_floor_ps(_mm256_mul_ps(_mm256_add_ps(fk, _mm256_set1_ps(0.5f)),
+                                                      _mm256_set1_ps(isize)));
+      const __m256 sx = _mm256_sub_ps(fk, _mm256_mul_ps(sy, _mm256_set1_ps(fsize)));
+
+      const __m256 x = _mm256_add_ps(_mm256_set1_ps(left[0]),
+                                     _mm256_add_ps(_mm256_mul_ps(sx, _mm256_set1_ps(dx[0])),
+                                                   _mm256_mul_ps(sy, _mm256_set1_ps(dy[0]))));
+      const __m256 y = _mm256_add_ps(_mm256_set1_ps(left[1]),
+                                     _mm256_add_ps(_mm256_mul_ps(sx, _mm256_set1_ps(dx[1])),
+                                                   _mm256_mul_ps(sy, _mm256_set1_ps(dy[1]))));
+      const __m256 fx = _mm256_floor_ps(x);
+      const __m256 fy = _mm256_floor_ps(y);
+      const __m256 dx1 = _mm256_sub_ps(x, fx);
+      const __m256 dx0 = _mm256_sub_ps(one, dx1);
+      const __m256 dy1 = _mm256_sub_ps(y, fy);
+      const __m256 dy0 = _mm256_sub_ps(one, dy1);
+      const __m256 f00 = _mm256_mul_ps(dx0, dy0);
+      const __m256 f01 = _mm256_mul_ps(dx0, dy1);
+      const __m256 f10 = _mm256_mul_ps(dx1, dy0);
+      const __m256 f11 = _mm256_mul_ps(dx1, dy1);
+
+      const __m256i index0 =
+        _mm256_mullo_epi32(three, _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(fy),
+                                                                      _mm256_set1_epi32(width)),
+                                                   _mm256_cvttps_epi32(fx)));
+      const __m256i index1 = _mm256_add_epi32(index0, rowstep);
+
+      // r0 g0 b0 r1 and b0 r1 g1 b1
+      const __m256i w00 = _mm256_i32gather_epi32(base, index0, 1);
+      const __m256i w01 = _mm256_i32gather_epi32(base, _mm256_add_epi32(index0, two), 1);
+      const __m256i w10 = _mm256_i32gather_epi32(base, index1, 1);
+      const __m256i w11 = _mm256_i32gather_epi32(base, _mm256_add_epi32(index1, two), 1);
+
+#define PMVS_TEX_CHANNEL(w, s) \
+      _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(w, s), byte))
+      // (x, y), (x, y+1), (x+1, y), (x+1, y+1)
+      const __m256 r =
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(PMVS_TEX_CHANNEL(w00, 0), f00),
+                                    _mm256_mul_ps(PMVS_TEX_CHANNEL(w10, 0), f01)),
+                      _mm256_add_ps(_mm256_mul_ps(PMVS_TEX_CHANNEL(w00, 24), f10),
+                                    _mm256_mul_ps(PMVS_TEX_CHANNEL(w10, 24), f11)));
+      const __m256 g =
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(PMVS_TEX_CHANNEL(w00, 8), f00),
+                                    _mm256_mul_ps(PMVS_TEX_CHANNEL(w10, 8), f01)),
+                      _mm256_add_ps(_mm256_mul_ps(PMVS_TEX_CHANNEL(w01, 16), f10),
+                                    _mm256_mul_ps(PMVS_TEX_CHANNEL(w11, 16), f11)));
+      const __m256 b =
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(PMVS_TEX_CHANNEL(w00, 16), f00),
+                                    _mm256_mul_ps(PMVS_TEX_CHANNEL(w10, 16), f01)),
+                      _mm256_add_ps(_mm256_mul_ps(PMVS_TEX_CHANNEL(w01, 24), f10),
+                                    _mm256_mul_ps(PMVS_TEX_CHANNEL(w11, 24), f11)));
+#undef PMVS_TEX_CHANNEL
+      _mm256_store_ps(rp + i, r);
+      _mm256_store_ps(gp + i, g);
+      _mm256_store_ps(bp + i, b);
+    }
+    clearPadding();
+    return;
+  }
+#endif
+  int i = 0;
+  Vec3f vftmp0 = left;
+  for (int y = 0; y < size; ++y) {
+    Vec3f vftmp = vftmp0;
+    vftmp0 += dy;
+    for (int x = 0; x < size; ++x) {
+      const Vec3f color = image.getColor(vftmp[0], vftmp[1], level);
+      rp[i] = color[0];
+      gp[i] = color[1];
+      bp[i] = color[2];
+      ++i;
+      vftmp += dx;
+    }
+  }
+}
+
+void Ctexture::sampleGradient(const Cimage& image, const int level,
+                              const Vec3f& left, const Vec3f& dx,
+                              const Vec3f& dy, const int size,
+                              Ctexture& gx, Ctexture& gy) {
+  gx.resize(size * size);
+  gy.resize(size * size);
+
+  int i = 0;
+  for (int y = 0; y < size; ++y) {
+    for (int x = 0; x < size; ++x) {
+      const Vec3f pos = left + dx * (float)x + dy * (float)y;
+      const int lx = (int)floor(pos[0]);
+      const int ly = (int)floor(pos[1]);
+      const float dx1 = pos[0] - lx;
+      const float dy1 = pos[1] - ly;
+      const Vec3f c00 = image.getColor(lx, ly, level);
+      const Vec3f c10 = image.getColor(lx + 1, ly, level);
+      const Vec3f c01 = image.getColor(lx, ly + 1, level);
+      const Vec3f c11 = image.getColor(lx + 1, ly + 1, level);
+      const Vec3f vx = (c10 - c00) * (1.0f - dy1) + (c11 - c01) * dy1;
+      const Vec3f vy = (c01 - c00) * (1.0f - dx1) + (c11 - c10) * dx1;
+      for (int c = 0; c < 3; ++c) {
+        gx.channel(c)[i] = vx[c];
+        gy.channel(c)[i] = vy[c];
+      }
+      ++i;
+    }
+  }
+}
+
+Vec3f Ctexture::mean(void) const {
+  Vec3f ave;
+  if (m_size == 0)
+    return ave;
+  for (int c = 0; c < 3; ++c)
+    ave[c] = sum(channel(c), m_stride) / m_size;
+  return ave;
+}
+
+void Ctexture::scale(const Vec3f& scale) {
+  for (int c = 0; c < 3; ++c) {
+    float* fp = channel(c);
+    const vfloat s = vset(scale[c]);
+    for (int i = 0; i < m_stride; i += lanes)
+      vstore(fp + i, vmul(vload(fp + i), s));
+  }
+}
+
+float Ctexture::normalize(void) {
+  if (m_size == 0)
+    return 1.0f;
+
+  const Vec3f ave = mean();
+  for (int c = 0; c < 3; ++c) {
+    float* fp = channel(c);
+    const vfloat a = vset(ave[c]);
+    for (int i = 0; i < m_stride; i += lanes)
+      vstore(fp + i, vsub(vload(fp + i), a));
+  }
+  // The padding became -ave above
+  clearPadding();
+
+  float ave2 = sqrt(dot(*this, *this));
+  if (ave2 == 0.0f)
+    ave2 = 1.0f;
+  scale(Vec3f(1.0f / ave2, 1.0f / ave2, 1.0f / ave2));
+  return ave2;
+}
+
+float Ctexture::dot(const Ctexture& tex0, const Ctexture& tex1) {
+  const int num = 3 * tex0.m_stride;
+  const float* fp0 = tex0.m_data;
+  const float* fp1 = tex1.m_data;
+  vfloat ans = vset(0.0f);
+  for (int i = 0; i < num; i += lanes)
+    ans = vadd(ans, vmul(vload(fp0 + i), vload(fp1 + i)));
+  return vsum(ans) / (3 * tex0.m_size);
+}
+
+float Ctexture::sad(const Ctexture& tex0, const Ctexture& tex1) {
+  const int num = 3 * tex0.m_stride;
+  const float* fp0 = tex0.m_data;
+  const float* fp1 = tex1.m_data;
+  vfloat ans = vset(0.0f);
+  for (int i = 0; i < num; i += lanes)
+    ans = vadd(ans, vabs(vsub(vload(fp0 + i), vload(fp1 + i))));
+  return vsum(ans) / (3 * tex0.m_size);
+}
+
+float Ctexture::ssd(const Ctexture& tex0, const Ctexture& tex1) {
+  const int num = 3 * tex0.m_stride;
+  const float* fp0 = tex0.m_data;
+  const float* fp1 = tex1.m_data;
+  vfloat ans = vset(0.0f);
+  for (int i = 0; i < num; i += lanes) {
+    const vfloat f = vsub(vload(fp0 + i), vload(fp1 + i));
+    ans = vadd(ans, vmul(f, f));
+  }
+  return vsum(ans) / (3 * tex0.m_size);
+}
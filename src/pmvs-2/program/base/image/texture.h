@@ -0,0 +1,85 @@
+#ifndef IMAGE_TEXTURE_H
+#define IMAGE_TEXTURE_H
+
+#include "../numeric/vec3.h"
+
+namespace Image {
+
+class Cimage;
+
+// Ctexture is a patch texture sampled from an image, stored as
+// structure-of-arrays: red, green and blue samples live in three
+// separate arrays in one 32-byte aligned block. Each array is padded
+// with zeros to a multiple of 8 samples, so that the SSE/AVX kernels
+// below run over whole vectors without a scalar tail. Storage is
+// allocated once (reserve) and reused for every patch.
+class Ctexture {
+ public:
+  Ctexture(void);
+  Ctexture(const Ctexture& rhs);
+  Ctexture& operator=(const Ctexture& rhs);
+  virtual ~Ctexture();
+
+  // Allocate room for size samples
+  void reserve(const int size);
+  // Set the number of samples. All samples are set to 0
+  void resize(const int size);
+
+  inline void clear(void) { m_size = 0; }
+  inline int empty(void) const { return m_size == 0; }
+  inline int size(void) const { return m_size; }
+
+  // Red, green and blue samples
+  inline float* channel(const int c) { return m_data + c * m_stride; }
+  inline const float* channel(const int c) const {
+    return m_data + c * m_stride;
+  }
+  inline Vec3f getColor(const int i) const {
+    return Vec3f(m_data[i], m_data[m_stride + i], m_data[2 * m_stride + i]);
+  }
+
+  // Sample size x size colors at left + x * dx + y * dy (x, y = 0
+  // ... size-1) from image at level
+  void sample(const Cimage& image, const int level, const Vec3f& left,
+              const Vec3f& dx, const Vec3f& dy, const int size);
+
+  // Image gradients (d/dx, d/dy) of the bilinear interpolation at
+  // the positions used by sample
+  static void sampleGradient(const Cimage& image, const int level,
+                             const Vec3f& left, const Vec3f& dx,
+                             const Vec3f& dy, const int size,
+                             Ctexture& gx, Ctexture& gy);
+
+  // Subtract the average color, and scale to unit variance. Returns
+  // the standard deviation the colors were divided by
+  float normalize(void);
+  // Average color
+  Vec3f mean(void) const;
+  // Multiply each channel
+  void scale(const Vec3f& scale);
+
+  // The following average over the 3 * size() samples. Both textures
+  // must have the same size.
+  static float dot(const Ctexture& tex0, const Ctexture& tex1);
+  // Mean absolute difference
+  static float sad(const Ctexture& tex0, const Ctexture& tex1);
+  // Mean squared difference
+  static float ssd(const Ctexture& tex0, const Ctexture& tex1);
+
+ protected:
+  // Zero the padding after the last sample of each channel
+  void clearPadding(void);
+
+  // 3 * m_stride samples
+  float* m_data;
+  // Number of floats allocated
+  int m_capacity;
+  // Number of samples
+  int m_size;
+  // m_size rounded up to a multiple of 8
+  int m_stride;
+};
+
+};
+
+#endif // IMAGE_TEXTURE_H
@@ -0,0 +1,148 @@
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iomanip>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "tileCache.h"
+
+using namespace std;
+using namespace Image;
+
+CtileCache::CtileCache(void) {
+  m_fp = NULL;
+  m_data = NULL;
+  m_length = 0;
+  m_budget = 0;
+  m_clock = 0;
+  m_residentBytes = 0;
+  m_misses = 0;
+  m_evictions = 0;
+  m_prefetches = 0;
+  pthread_mutex_init(&m_lock, NULL);
+}
+
+CtileCache::~CtileCache() {
+  if (m_data != NULL)
+    munmap((void*)m_data, m_length);
+  if (m_fp != NULL)
+    fclose(m_fp);
+  pthread_mutex_destroy(&m_lock);
+}
+
+void CtileCache::open(const std::string file, const long long budget) {
+  m_file = file;
+  m_budget = budget;
+  m_fp = fopen(file.c_str(), "w+b");
+  if (m_fp == NULL) {
+    cerr << "Cannot open a tile cache: " << file << endl;
+    exit (1);
+  }
+}
+
+int CtileCache::addPlane(const unsigned char* data, const int width,
+                         const int height, const int bytes) {
+  if (m_data != NULL) {
+    cerr << "Tile cache is already mapped" << endl;
+    exit (1);
+  }
+
+  // Each tile starts on a page, so that it can be dropped on its own
+  const long long page = sysconf(_SC_PAGESIZE);
+  const int length =
+    (int)((STRIDE * STRIDE * bytes + page - 1) / page * page);
+  vector<unsigned char> buffer(length, 0);
+
+  const int first = (int)m_offsets.size();
+  const int xnum = getTileNum(width);
+  const int ynum = getTileNum(height);
+  for (int ty = 0; ty < ynum; ++ty) {
+    for (int tx = 0; tx < xnum; ++tx) {
+      for (int y = 0; y < STRIDE; ++y) {
+        const int iy =
+          min(height - 1, max(0, ty * SIZE - BORDER + y));
+        for (int x = 0; x < STRIDE; ++x) {
+          const int ix =
+            min(width - 1, max(0, tx * SIZE - BORDER + x));
+          memcpy(&buffer[(y * STRIDE + x) * bytes],
+                 &data[((long long)iy * width + ix) * bytes], bytes);
+        }
+      }
+      if (fwrite(&buffer[0], 1, length, m_fp) != (size_t)length) {
+        cerr << "Cannot write a tile cache: " << m_file << endl;
+        exit (1);
+      }
+      m_offsets.push_back(m_length);
+      m_lengths.push_back(length);
+      m_length += length;
+    }
+  }
+  return first;
+}
+
+void CtileCache::map(void) {
+  fflush(m_fp);
+  m_stamps.resize(m_offsets.size(), 0);
+  m_resident.resize(m_offsets.size(), 0);
+  if (m_length == 0)
+    return;
+
+  void* data = mmap(NULL, m_length, PROT_READ, MAP_SHARED, fileno(m_fp), 0);
+  if (data == MAP_FAILED) {
+    cerr << "Cannot map a tile cache: " << m_file << endl;
+    exit (1);
+  }
+  m_data = (const unsigned char*)data;
+  // The mapping keeps the file alive
+  unlink(m_file.c_str());
+
+  cerr << "Tile cache: " << (int)m_offsets.size() << " tiles, "
+       << m_length / (1024 * 1024) << " MB on disk, "
+       << m_budget / (1024 * 1024) << " MB in memory" << endl;
+}
+
+void CtileCache::prefetch(const int tile) {
+  if (__atomic_load_n(&m_resident[tile], __ATOMIC_RELAXED))
+    return;
+  __sync_fetch_and_add(&m_prefetches, 1);
+  madvise((void*)(m_data + m_offsets[tile]), m_lengths[tile], MADV_WILLNEED);
+}
+
+void CtileCache::touch(const int tile) {
+  pthread_mutex_lock(&m_lock);
+  if (!m_resident[tile]) {
+    __atomic_store_n(&m_resident[tile], 1, __ATOMIC_RELAXED);
+    m_residentBytes += m_lengths[tile];
+    ++m_misses;
+    __atomic_store_n(&m_clock, m_clock + 1, __ATOMIC_RELAXED);
+    if (m_budget < m_residentBytes)
+      evict();
+  }
+  pthread_mutex_unlock(&m_lock);
+}
+
+// Drop the least recently used tiles until 3/4 of the budget is
+// used. Another thread may still read an evicted tile: the pages are
+// simply read back from the file.
+void CtileCache::evict(void) {
+  vector<pair<unsigned int, int> > tiles;
+  for (int t = 0; t < (int)m_resident.size(); ++t)
+    if (m_resident[t])
+      tiles.push_back(pair<unsigned int, int>(__atomic_load_n(&m_stamps[t], __ATOMIC_RELAXED), t));
+  sort(tiles.begin(), tiles.end());
+
+  const long long target = m_budget / 4 * 3;
+  for (int i = 0; i < (int)tiles.size() && target < m_residentBytes; ++i) {
+    const int t = tiles[i].second;
+    __atomic_store_n(&m_resident[t], 0, __ATOMIC_RELAXED);
+    m_residentBytes -= m_lengths[t];
+    madvise((void*)(m_data + m_offsets[t]), m_lengths[t], MADV_DONTNEED);
+    ++m_evictions;
+  }
+}
+
+void CtileCache::printStats(std::ostream& ostr) const {
+  ostr << "Tile cache (misses evictions prefetches resident-MB): "
+       << m_misses << ' ' << m_evictions << ' ' << m_prefetches << ' '
+       << setprecision(3) << m_residentBytes / (1024.0 * 1024.0) << endl;
+}
@@ -0,0 +1,103 @@
+#ifndef IMAGE_TILECACHE_H
+#define IMAGE_TILECACHE_H
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstdio>
+#include <pthread.h>
+
+namespace Image {
+
+// CtileCache keeps image pyramids out of core. Every image level is
+// cut into square tiles, which are written to a cache file and mapped
+// back with mmap. Tiles are read on demand. When the tiles touched
+// so far exceed the memory budget, the least recently used ones are
+// dropped from memory (madvise), and are read back from the file the
+// next time they are accessed.
+//
+// A tile covers SIZE x SIZE pixels, plus a border of 1 pixel on the
+// left/top and 2 pixels on the right/bottom, so that bilinear and
+// bicubic interpolation never have to look at a neighboring tile.
+// Pixels outside an image replicate the closest pixel inside.
+//
+// Usage:
+//   cache.open(file, budget);
+//   first = cache.addPlane(data, width, height, bytes);  // for each plane
+//   cache.map();
+//   const unsigned char* tile = cache.getTile(first + t);
+class CtileCache {
+ public:
+  enum { LOG = 6, SIZE = 1 << LOG, BORDER = 1, STRIDE = SIZE + 3 };
+
+  CtileCache(void);
+  virtual ~CtileCache();
+
+  // Create the cache file. budget is in bytes. The file is removed
+  // from the file system once it is mapped.
+  void open(const std::string file, const long long budget);
+  inline int isOpen(void) const { return m_fp != NULL; }
+
+  // Append an image of width x height pixels with bytes bytes per
+  // pixel. Returns the index of its first tile. Tiles are stored row
+  // by row, (width + SIZE - 1) / SIZE of them in a row.
+  int addPlane(const unsigned char* data, const int width, const int height,
+               const int bytes);
+  // Map the file. Must be called after the last addPlane and before
+  // the first getTile.
+  void map(void);
+
+  // Tiles along x (or y) for an image of the given width (or height)
+  static inline int getTileNum(const int size) {
+    return (size + SIZE - 1) / SIZE;
+  }
+
+  // Tile data, STRIDE x STRIDE pixels. Marks the tile recently used.
+  inline const unsigned char* getTile(const int tile);
+  // Ask the system to start reading a tile that is not in memory
+  void prefetch(const int tile);
+
+  void printStats(std::ostream& ostr) const;
+
+ protected:
+  // Make a tile resident, evicting old tiles if over budget
+  void touch(const int tile);
+  void evict(void);
+
+  FILE* m_fp;
+  std::string m_file;
+  const unsigned char* m_data;
+  long long m_length;
+  // memory budget in bytes
+  long long m_budget;
+
+  // for each tile
+  std::vector<long long> m_offsets;
+  std::vector<int> m_lengths;
+  // Value of m_clock at the last access
+  std::vector<unsigned int> m_stamps;
+  std::vector<unsigned char> m_resident;
+
+  // Incremented at every miss
+  unsigned int m_clock;
+  // Bytes in resident tiles
+  long long m_residentBytes;
+  pthread_mutex_t m_lock;
+
+  // statistics
+  int m_misses;
+  int m_evictions;
+  int m_prefetches;
+};
+
+const unsigned char* CtileCache::getTile(const int tile) {
+  __atomic_store_n(&m_stamps[tile], __atomic_load_n(&m_clock, __ATOMIC_RELAXED),
+                   __ATOMIC_RELAXED);
+  if (!__atomic_load_n(&m_resident[tile], __ATOMIC_RELAXED))
+    touch(tile);
+  return m_data + m_offsets[tile];
+};
+
+};
+
+#endif // IMAGE_TILECACHE_H
@@ -0,0 +1,133 @@
+#ifndef NUMERIC_BFGS_H
+#define NUMERIC_BFGS_H
+
+#include <cmath>
+
+// Quasi-Newton (BFGS) minimizer for a small, fixed number of
+// parameters N. Everything lives on the stack, so it can be used in
+// the inner loops of the threads without any allocation.
+//
+// func(x, grad) must return f(x) and fill grad with df/dx. minimize
+// returns 0 when it converged (the step or gradient became small) and
+// 1 when it ran out of iterations.
+template<int N>
+class TBFGS {
+ public:
+  TBFGS(void) : m_maxIter(100), m_xtol(1.0e-3), m_gtol(1.0e-7),
+                m_maxStep(1.0) {}
+
+  template<class F>
+  int minimize(F& func, double* x, double& fx) {
+    double g[N], xnew[N], gnew[N], d[N], s[N], y[N], hy[N];
+    double h[N][N];
+
+    fx = func(x, g);
+    resetH(h, g);
+
+    for (m_iter = 0; m_iter < m_maxIter; ++m_iter) {
+      if (norm(g) < m_gtol)
+        return 0;
+
+      // Search direction, limited to m_maxStep
+      double gd = 0.0;
+      for (int i = 0; i < N; ++i) {
+        d[i] = 0.0;
+        for (int j = 0; j < N; ++j)
+          d[i] -= h[i][j] * g[j];
+        gd += g[i] * d[i];
+      }
+      // Not a descent direction: restart from steepest descent
+      if (gd >= 0.0) {
+        resetH(h, g);
+        for (int i = 0; i < N; ++i)
+          d[i] = - h[i][i] * g[i];
+        gd = 0.0;
+        for (int i = 0; i < N; ++i)
+          gd += g[i] * d[i];
+      }
+      const double dnorm = norm(d);
+      if (m_maxStep < dnorm) {
+        for (int i = 0; i < N; ++i)
+          d[i] *= m_maxStep / dnorm;
+        gd *= m_maxStep / dnorm;
+      }
+
+      // Backtracking line search (Armijo condition). Once the step is
+      // below m_xtol we are at the minimum up to that precision.
+      double t = 1.0;
+      double fnew;
+      while (1) {
+        for (int i = 0; i < N; ++i)
+          xnew[i] = x[i] + t * d[i];
+        fnew = func(xnew, gnew);
+        if (fnew <= fx + 1.0e-4 * t * gd)
+          break;
+        t /= 2.0;
+        if (t * norm(d) < m_xtol)
+          return 0;
+      }
+
+      // BFGS update of the inverse Hessian
+      double sy = 0.0;
+      for (int i = 0; i < N; ++i) {
+        s[i] = xnew[i] - x[i];
+        y[i] = gnew[i] - g[i];
+        sy += s[i] * y[i];
+      }
+      for (int i = 0; i < N; ++i) {
+        x[i] = xnew[i];
+        g[i] = gnew[i];
+      }
+      fx = fnew;
+
+      if (norm(s) < m_xtol)
+        return 0;
+
+      // Skip the update when the curvature condition fails
+      if (sy <= 1.0e-12)
+        continue;
+
+      double yhy = 0.0;
+      for (int i = 0; i < N; ++i) {
+        hy[i] = 0.0;
+        for (int j = 0; j < N; ++j)
+          hy[i] += h[i][j] * y[j];
+        yhy += y[i] * hy[i];
+      }
+      const double c = (sy + yhy) / (sy * sy);
+      for (int i = 0; i < N; ++i)
+        for (int j = 0; j < N; ++j)
+          h[i][j] += c * s[i] * s[j] - (hy[i] * s[j] + s[i] * hy[j]) / sy;
+    }
+    return 1;
+  }
+
+  // Maximum number of iterations
+  int m_maxIter;
+  // Convergence thresholds on the step and the gradient
+  double m_xtol;
+  double m_gtol;
+  // Maximum length of a step
+  double m_maxStep;
+  // Number of iterations of the last minimize
+  int m_iter;
+
+ protected:
+  static double norm(const double* v) {
+    double ans = 0.0;
+    for (int i = 0; i < N; ++i)
+      ans += v[i] * v[i];
+    return sqrt(ans);
+  }
+
+  // Scaled identity, so that the first step has length m_maxStep
+  void resetH(double h[N][N], const double* g) const {
+    const double gnorm = norm(g);
+    const double scale = gnorm == 0.0 ? 1.0 : m_maxStep / gnorm;
+    for (int i = 0; i < N; ++i)
+      for (int j = 0; j < N; ++j)
+        h[i][j] = (i == j) ? scale : 0.0;
+  }
+};
+
+#endif // NUMERIC_BFGS_H
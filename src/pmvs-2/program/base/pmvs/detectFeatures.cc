@@ -18,7 +18,7 @@ CdetectFeatures::~CdetectFeatures() {
   pthread_rwlock_destroy(&m_rwlock);
 }
 
-void CdetectFeatures::run(const CphotoSetS& pss, const int num,
+void CdetectFeatures::run(CphotoSetS& pss, const int num,
                           const int csize, const int level,
                           const int CPU) {
   m_ppss = &pss;
@@ -118,5 +118,9 @@ void CdetectFeatures::runThread(void) {
         rbegin++;
       }
     }
+
+    // Tiled images were copied into memory for detection
+    if (m_ppss->m_photos[index].isTiled())
+      m_ppss->m_photos[index].free(m_level + 1);
   }
 }
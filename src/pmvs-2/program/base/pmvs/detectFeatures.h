@@ -22,14 +22,14 @@ class CdetectFeatures {
   CdetectFeatures(void);
   virtual ~CdetectFeatures();
 
-  void run(const Image::CphotoSetS& pss,
+  void run(Image::CphotoSetS& pss,
            const int num, const int csize, const int level,
            const int CPU = 1);
 
   std::vector<std::vector<Cpoint> > m_points;
   
  protected:
-  const Image::CphotoSetS* m_ppss;
+  Image::CphotoSetS* m_ppss;
   int m_csize;
   int m_level;
   
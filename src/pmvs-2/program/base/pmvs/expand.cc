@@ -31,12 +31,11 @@ void Cexpand::run(void) {
   m_fm.m_pos.clearCounts();
   m_fm.m_pos.clearFlags();
   
-  if (!m_queue.empty()) {
-    cerr << "Queue is not empty in expand" << endl;
-    exit (1);
-  }
   // set queue
-  m_fm.m_pos.collectPatches(m_queue);
+  vector<Ppatch> ppatches;
+  m_fm.m_pos.collectPatches(ppatches);
+  m_pool.init(m_fm.m_CPU, ppatches);
+  ppatches.clear();
 
   cerr << "Expanding patches..." << flush;
   pthread_t threads[m_fm.m_CPU];
@@ -47,6 +46,9 @@ void Cexpand::run(void) {
   
   cerr << endl
        << "---- EXPANSION: " << (time(NULL) - starttime) << " secs ----" << endl;
+  m_pool.printStats(cerr);
+  if (m_fm.m_pss.m_cache.isOpen())
+    m_fm.m_pss.m_cache.printStats(cerr);
 
   const int trial = accumulate(m_ecounts.begin(), m_ecounts.end(), 0);
   const int fail0 = accumulate(m_fcounts0.begin(), m_fcounts0.end(), 0);
@@ -73,20 +75,9 @@ void Cexpand::expandThread(void) {
   const int id = m_fm.m_count++;
   pthread_rwlock_unlock(&m_fm.m_lock);
 
-  while (1) {
-    Ppatch ppatch;
-    int empty = 0;
-    pthread_rwlock_wrlock(&m_fm.m_lock);
-    if (m_queue.empty())
-      empty = 1;
-    else {
-      ppatch = m_queue.top();
-      m_queue.pop();
-    }
-    pthread_rwlock_unlock(&m_fm.m_lock);
-
-    if (empty)
-      break;
+  Ppatch ppatch;
+  while (m_pool.pop(id, ppatch)) {
+    prefetch(*ppatch);
     
     // For each direction;
     vector<vector<Vec4f> > canCoords;
@@ -100,9 +91,25 @@ void Cexpand::expandThread(void) {
           ppatch->m_dflag |= (0x0001) << i;
       }
     }
+    m_pool.done(id);
   }
 }
 
+// Expanding a patch samples its images and the images relevant to
+// its reference image around the patch. Ask for those tiles early.
+void Cexpand::prefetch(const Cpatch& patch) {
+  if (!m_fm.m_pss.m_cache.isOpen())
+    return;
+  
+  const int margin = 2 * m_fm.m_csize + m_fm.m_wsize;
+  for (int i = 0; i < (int)patch.m_images.size(); ++i)
+    m_fm.m_pss.prefetch(patch.m_images[i], patch.m_coord, m_fm.m_level, margin);
+  
+  const vector<int>& indexes = m_fm.m_visdata2[patch.m_images[0]];
+  for (int i = 0; i < (int)indexes.size(); ++i)
+    m_fm.m_pss.prefetch(indexes[i], patch.m_coord, m_fm.m_level, margin);
+}
+
 void Cexpand::findEmptyBlocks(const Ppatch& ppatch,
 			      std::vector<std::vector<Vec4f> >& canCoords) {
   // dnum must be at most 8, because m_dflag is char
@@ -248,18 +255,15 @@ int Cexpand::expandSub(const Ppatch& orgppatch, const int id,
 
   //-----------------------------------------------------------------
   // Finally
-  Ppatch ppatch(new Cpatch(patch));
+  Ppatch ppatch = Ppatch::create(patch);
 
   //patch.m_images = orgppatch->m_images;
   const int add = updateCounts(patch);
 
   m_fm.m_pos.addPatch(ppatch);
 
-  if (add) {
-    pthread_rwlock_wrlock(&m_fm.m_lock);      
-    m_queue.push(ppatch);
-    pthread_rwlock_unlock(&m_fm.m_lock);  
-  }    
+  if (add)
+    m_pool.push(id, ppatch);
 
   return 0;
 }
@@ -5,6 +5,7 @@
 #include <queue>
 #include <list>
 #include "patchOrganizerS.h"
+#include "taskPool.h"
 
 namespace PMVS3 {
 class CfindMatch;
@@ -29,10 +30,13 @@ class Cexpand {
   
   void findEmptyBlocks(const Patch::Ppatch& ppatch,
                        std::vector<std::vector<Vec4f> >& canCoords);
+
+  // Prefetch image tiles around a patch, if images are tiled
+  void prefetch(const Patch::Cpatch& patch);
  protected:
 
-  std::priority_queue<Patch::Ppatch, std::vector<Patch::Ppatch>, P_compare>
-    m_queue;
+  // Patches to expand from, ordered by m_tmp
+  CtaskPool<Patch::Ppatch, P_compare> m_pool;
   
   CfindMatch& m_fm;
   
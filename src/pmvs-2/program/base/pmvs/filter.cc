@@ -371,18 +371,13 @@ void* Cfilter::filterExactThreadTmp(void* arg) {
 }
 
 void Cfilter::filterNeighborThread(void) {
-  const int size = (int)m_fm.m_pos.m_ppatches.size();  
-  while (1) {
-    int jtmp = -1;
-    pthread_rwlock_wrlock(&m_fm.m_lock);
-    if (!m_fm.m_jobs.empty()) {
-      jtmp = m_fm.m_jobs.front();
-      m_fm.m_jobs.pop_front();
-    }
-    pthread_rwlock_unlock(&m_fm.m_lock);
-    if (jtmp == -1)
-      break;
+  pthread_rwlock_wrlock(&m_fm.m_lock);
+  const int id = m_fm.m_count++;
+  pthread_rwlock_unlock(&m_fm.m_lock);
 
+  const int size = (int)m_fm.m_pos.m_ppatches.size();  
+  int jtmp;
+  while (m_pool.pop(id, jtmp)) {
     const int begin = m_fm.m_junit * jtmp;
     const int end = min(size, m_fm.m_junit * (jtmp + 1));
 
@@ -405,6 +400,7 @@ void Cfilter::filterNeighborThread(void) {
           m_rejects[p] = m_time + 1;
       }
     }
+    m_pool.done(id);
   }
 
   /*
@@ -530,17 +526,20 @@ void Cfilter::filterNeighbor(const int times) {
   for (m_time = 0; m_time < times; ++m_time) {
     m_fm.m_count = 0;
 
-    m_fm.m_jobs.clear();
     const int jtmp = (int)ceil(m_fm.m_pos.m_ppatches.size() /
                                (float)m_fm.m_junit);
+    vector<int> chunks;
     for (int j = 0; j < jtmp; ++j)
-      m_fm.m_jobs.push_back(j);
+      chunks.push_back(j);
+    m_pool.m_batch = 4;
+    m_pool.init(m_fm.m_CPU, chunks);
     
     pthread_t threads[m_fm.m_CPU];
     for (int i = 0; i < m_fm.m_CPU; ++i)
       pthread_create(&threads[i], NULL, filterNeighborThreadTmp, (void*)this);
     for (int i = 0; i < m_fm.m_CPU; ++i)
       pthread_join(threads[i], NULL);
+    m_pool.printStats(cerr);
     
     vector<Ppatch>::iterator bpatch = m_fm.m_pos.m_ppatches.begin();
     vector<Ppatch>::iterator epatch = m_fm.m_pos.m_ppatches.end();
@@ -549,7 +548,7 @@ void Cfilter::filterNeighbor(const int times) {
     while (bpatch != epatch) {
       if ((*breject) == m_time + 1) {
         count++;
-        m_fm.m_pos.removePatch(*bpatch);;
+        m_fm.m_pos.removePatch(*bpatch);
       }
 
       ++bpatch;
@@ -576,78 +575,92 @@ void Cfilter::filterSmallGroups(void) {
     return;
   
   const int psize = (int)m_fm.m_pos.m_ppatches.size();
-  vector<int> label;
-  label.resize(psize);
-  fill(label.begin(), label.end(), -1);
+  for (int p = 0; p < psize; ++p)
+    m_fm.m_pos.m_ppatches[p]->m_flag = p;
 
-  list<int> untouch;
-  vector<Ppatch>::iterator bpatch = m_fm.m_pos.m_ppatches.begin();
-  for (int p = 0; p < psize; ++p, ++bpatch) {
-    untouch.push_back(p);
-    (*bpatch)->m_flag = p;
+  // Find neighbors, or union them with mergeGroups, in parallel
+  const int noj = 1000;
+  m_groupJob = max(1, psize / (noj - 1));
+  const int jnum = (psize + m_groupJob - 1) / m_groupJob;
+  if (m_fm.m_mergeGroups) {
+    m_parents.resize(psize);
+    for (int p = 0; p < psize; ++p)
+      m_parents[p] = p;
+  }
+  else {
+    m_groupBegins.resize(jnum);
+    m_groupNeighbors.resize(jnum);
   }
   
-  int id = -1;
-  while (!untouch.empty()) {
-    const int pid = untouch.front();
-    untouch.pop_front();
-
-    if (label[pid] != -1)
-      continue;
-
-    label[pid] = ++id;
-    list<int> ltmp;
-    ltmp.push_back(pid);
-
-    while (!ltmp.empty()) {
-      const int ptmp = ltmp.front();
-      ltmp.pop_front();
+  m_fm.m_count = 0;
+  pthread_t threads[m_fm.m_CPU];
+  for (int i = 0; i < m_fm.m_CPU; ++i)
+    pthread_create(&threads[i], NULL, filterSmallGroupsThreadTmp, (void*)this);
+  for (int i = 0; i < m_fm.m_CPU; ++i)
+    pthread_join(threads[i], NULL);
+  
+  vector<int> label;
+  label.resize(psize);
+  if (m_fm.m_mergeGroups) {
+    // Each group is labeled by its root
+    for (int p = 0; p < psize; ++p)
+      label[p] = findGroup(p);
+    vector<int>().swap(m_parents);
+  }
+  else {
+    // Grow groups from the patches in order, as the search did
+    // before it was threaded. A neighbor that already has a label is
+    // skipped, so the groups are exactly the ones it gave.
+    fill(label.begin(), label.end(), -1);
+    int id = -1;
+    vector<int> ltmp;
+    for (int pid = 0; pid < psize; ++pid) {
+      if (label[pid] != -1)
+        continue;
 
-      filterSmallGroupsSub(ptmp, id, label, ltmp);
+      label[pid] = ++id;
+      ltmp.push_back(pid);
+      
+      while (!ltmp.empty()) {
+        const int ptmp = ltmp.back();
+        ltmp.pop_back();
+        
+        const int job = ptmp / m_groupJob;
+        const int offset = ptmp - job * m_groupJob;
+        const vector<int>& neighbors = m_groupNeighbors[job];
+        for (int n = m_groupBegins[job][offset];
+             n < m_groupBegins[job][offset + 1]; ++n) {
+          const int itmp = neighbors[n];
+          if (label[itmp] != -1)
+            continue;
+          label[itmp] = id;
+          ltmp.push_back(itmp);
+        }
+      }
     }
-  }  
-  id++;
+    vector<vector<int> >().swap(m_groupBegins);
+    vector<vector<int> >().swap(m_groupNeighbors);
+  }
   
   vector<int> size;
-  size.resize(id);
-  vector<int>::iterator bite = label.begin();
-  vector<int>::iterator eite = label.end();
-  while (bite != eite) {
-    ++size[*bite];
-    ++bite;
-  }
+  size.resize(psize);
+  fill(size.begin(), size.end(), 0);
+  for (int p = 0; p < psize; ++p)
+    ++size[label[p]];
   
   const int threshold = max(20, psize / 10000);
   cerr << threshold << endl;
   
-  bite = size.begin();
-  eite = size.end();
-  while (bite != eite) {
-    if (*bite < threshold)
-      *bite = 0;
-    else
-      *bite = 1;
-    ++bite;
-  }
-
   int count = 0;
-
-  bite = label.begin();
-  eite = label.end();
-  bpatch = m_fm.m_pos.m_ppatches.begin();
-  while (bite != eite) {
-    if ((*bpatch)->m_fix) {
-      ++bite;
-      ++bpatch;
+  for (int p = 0; p < psize; ++p) {
+    Ppatch& ppatch = m_fm.m_pos.m_ppatches[p];
+    if (ppatch->m_fix)
       continue;
-    }
     
-    if (size[*bite] == 0) {
-      m_fm.m_pos.removePatch(*bpatch);
+    if (size[label[p]] < threshold) {
+      m_fm.m_pos.removePatch(ppatch);
       count++;
     }
-    ++bite;
-    ++bpatch;
   }
 
   cerr << (int)m_fm.m_pos.m_ppatches.size() << " -> "
@@ -656,10 +669,80 @@ void Cfilter::filterSmallGroups(void) {
        << "%)\t" << tv.tv_sec - curtime << " secs" << endl;
 }
 
-void Cfilter::filterSmallGroupsSub(const int pid, const int id,
-                                   std::vector<int>& label,
-                                   std::list<int>& ltmp) const {  
-  // find neighbors of ptmp and set their ids
+void* Cfilter::filterSmallGroupsThreadTmp(void* arg) {
+  ((Cfilter*)arg)->filterSmallGroupsThread();
+  return NULL;
+}
+
+void Cfilter::filterSmallGroupsThread(void) {
+  const int size = (int)m_fm.m_pos.m_ppatches.size();    
+  vector<int> neighbors;
+  
+  while (1) {
+    pthread_rwlock_wrlock(&m_fm.m_lock);
+    const int id = m_fm.m_count++;
+    pthread_rwlock_unlock(&m_fm.m_lock);
+
+    const int begin = id * m_groupJob;
+    const int end = min(size, (id + 1) * m_groupJob);
+    
+    if (size <= begin)
+      break;
+
+    if (m_fm.m_mergeGroups) {
+      for (int p = begin; p < end; ++p) {
+        neighbors.clear();
+        filterSmallGroupsSub(p, neighbors);
+        for (int n = 0; n < (int)neighbors.size(); ++n)
+          unionGroups(p, neighbors[n]);
+      }
+    }
+    else {
+      // Neighbors of the patches of this job, one range per patch
+      vector<int>& begins = m_groupBegins[id];
+      begins.resize(end - begin + 1);
+      begins[0] = 0;
+      for (int p = begin; p < end; ++p) {
+        filterSmallGroupsSub(p, m_groupNeighbors[id]);
+        begins[p - begin + 1] = (int)m_groupNeighbors[id].size();
+      }
+    }
+  }
+}
+
+// Root of the group of patch p. Halves the path on the way, which
+// is safe while other threads link roots.
+int Cfilter::findGroup(int p) {
+  while (1) {
+    const int parent = __atomic_load_n(&m_parents[p], __ATOMIC_RELAXED);
+    if (parent == p)
+      return p;
+    const int grandparent = __atomic_load_n(&m_parents[parent], __ATOMIC_RELAXED);
+    if (parent != grandparent)
+      __sync_bool_compare_and_swap(&m_parents[p], parent, grandparent);
+    p = grandparent;
+  }
+}
+
+// Merge the groups of p0 and p1. The larger root is always linked
+// under the smaller one, so every group ends up with its lowest patch
+// as the root, whatever the order of the unions.
+void Cfilter::unionGroups(int p0, int p1) {
+  while (1) {
+    p0 = findGroup(p0);
+    p1 = findGroup(p1);
+    if (p0 == p1)
+      return;
+    if (p0 < p1)
+      swap(p0, p1);
+    if (__sync_bool_compare_and_swap(&m_parents[p0], p0, p1))
+      return;
+  }
+}
+
+void Cfilter::filterSmallGroupsSub(const int pid,
+                                   std::vector<int>& neighbors) const {
+  // find neighbors of pid and append them
   const Cpatch& patch = *m_fm.m_pos.m_ppatches[pid];
   
   const int index = patch.m_images[0];
@@ -681,37 +764,19 @@ void Cfilter::filterSmallGroupsSub(const int pid, const int id,
       //continue;
 
       const int index2 = iytmp * gwidth + ixtmp;
-      vector<Ppatch>::iterator bgrid = m_fm.m_pos.m_pgrids[index][index2].begin();
-      vector<Ppatch>::iterator egrid = m_fm.m_pos.m_pgrids[index][index2].end();
-      while (bgrid != egrid) {
-        const int itmp = (*bgrid)->m_flag;
-	if (label[itmp] != -1) {
-          ++bgrid;
-	  continue;
-        }
-	
-	if (m_fm.isNeighbor(patch, **bgrid,
-			    m_fm.m_neighborThreshold2)) {
-	  label[itmp] = id;
-	  ltmp.push_back(itmp);
-	}
-        ++bgrid;
-      }
-      bgrid = m_fm.m_pos.m_vpgrids[index][index2].begin();
-      egrid = m_fm.m_pos.m_vpgrids[index][index2].end();
-      while (bgrid != egrid) {
-        const int itmp = (*bgrid)->m_flag;
-	if (label[itmp] != -1) {
+      for (int v = 0; v < 2; ++v) {
+        const vector<Ppatch>& ppatches = v == 0 ?
+          m_fm.m_pos.m_pgrids[index][index2] :
+          m_fm.m_pos.m_vpgrids[index][index2];
+        vector<Ppatch>::const_iterator bgrid = ppatches.begin();
+        vector<Ppatch>::const_iterator egrid = ppatches.end();
+        while (bgrid != egrid) {
+          const int itmp = (*bgrid)->m_flag;
+          if (itmp != pid &&
+              m_fm.isNeighbor(patch, **bgrid, m_fm.m_neighborThreshold2))
+            neighbors.push_back(itmp);
           ++bgrid;
-	  continue;
         }
-	
-	if (m_fm.isNeighbor(patch, **bgrid,
-			    m_fm.m_neighborThreshold2)) {
-	  label[itmp] = id;
-	  ltmp.push_back(itmp);
-	}
-        ++bgrid;
       }
     }
   }
@@ -790,6 +855,8 @@ void Cfilter::setDepthMapsThread(void) {
 void Cfilter::setDepthMapsVGridsVPGridsAddPatchV(const int additive) {
   m_fm.m_pos.collectPatches();
   setDepthMaps();
+  // Removed patches are no longer in m_ppatches and m_dpgrids
+  m_fm.m_pos.releasePatches();
 
   // clear m_vpgrids
   for (int index = 0; index < m_fm.m_tnum; ++index) {
@@ -2,7 +2,8 @@
 #define PMVS3_FILTER_H
 
 #include "patch.h"
-#include <list>
+#include <functional>
+#include "taskPool.h"
 #include "../numeric/vec2.h"
 
 namespace PMVS3 {
@@ -33,9 +34,11 @@ class Cfilter {
   
   void filterNeighbor(const int time);
   void filterSmallGroups(void);
-  void filterSmallGroupsSub(const int pid, const int id,
-                            std::vector<int>& label,
-                            std::list<int>& ltmp) const;
+  void filterSmallGroupsSub(const int pid,
+                            std::vector<int>& neighbors) const;
+  // Concurrent union-find over the patches of m_ppatches (mergeGroups)
+  int findGroup(int p);
+  void unionGroups(int p0, int p1);
   void setDepthMaps(void);
   void setDepthMapsVGridsVPGridsAddPatchV(const int additive);
   
@@ -48,6 +51,17 @@ class Cfilter {
 
   int m_time;
   std::vector<int> m_rejects;
+  // Union-find parents for filterSmallGroups with mergeGroups
+  std::vector<int> m_parents;
+  // Neighbors found by filterSmallGroups, per job of m_groupJob
+  // patches. Those of patch job * m_groupJob + i are in
+  // m_groupNeighbors[job], from m_groupBegins[job][i] up to
+  // m_groupBegins[job][i + 1]
+  int m_groupJob;
+  std::vector<std::vector<int> > m_groupBegins;
+  std::vector<std::vector<int> > m_groupNeighbors;
+  // Chunks of m_junit patches for filterNeighbor, lowest first
+  CtaskPool<int, std::greater<int> > m_pool;
   
   //----------------------------------------------------------------------
   // Thread related
@@ -63,6 +77,9 @@ class Cfilter {
 
   void filterNeighborThread(void);
   static void* filterNeighborThreadTmp(void* arg);
+
+  void filterSmallGroupsThread(void);
+  static void* filterSmallGroupsThreadTmp(void* arg);
   
   CfindMatch& m_fm;
   
@@ -1,8 +1,11 @@
 #include <map>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <sys/time.h>
 #include "findMatch.h"
 #include "detectFeatures.h"
+#include "patchIO.h"
 
 using namespace PMVS3;
 using namespace std;
@@ -47,6 +50,13 @@ void CfindMatch::init(const Soption& option) {
   m_minImageNumThreshold = option.m_minImageNum;
   m_CPU = option.m_CPU;
   m_setEdge = option.m_setEdge;
+  m_tileCache = option.m_tileCache;
+  if (m_setEdge != 0.0f && m_tileCache != 0) {
+    cerr << "setEdge needs images in memory. Tile cache is disabled." << endl;
+    m_tileCache = 0;
+  }
+  m_binary = option.m_binary;
+  m_mergeGroups = option.m_mergeGroups;
   m_sequenceThreshold = option.m_sequence;
 
   m_junit = 100;
@@ -61,7 +71,6 @@ void CfindMatch::init(const Soption& option) {
   
   // set target images and other images
   m_bindexes = option.m_bindexes;
-  m_visdata = option.m_visdata;
   m_visdata2 = option.m_visdata2;
   
   //----------------------------------------------------------------------
@@ -73,7 +82,7 @@ void CfindMatch::init(const Soption& option) {
     pthread_rwlock_init(&m_countLocks[image], NULL);
   }
   // We set m_level + 3, to use multi-resolutional texture grabbing
-  m_pss.init(m_images, m_prefix, m_level + 3, m_wsize, 1);
+  m_pss.init(m_images, m_prefix, m_level + 3, m_wsize, 1, m_tileCache);
 
   if (m_setEdge != 0.0f)
     m_pss.setEdge(m_setEdge);
@@ -188,23 +197,32 @@ int CfindMatch::isNeighborRadius(const Patch::Cpatch& lhs,
     return 0;
 }
 
-void CfindMatch::run(void) {
+void CfindMatch::run(const std::string checkpoint, const int resume) {
   struct timeval tv;
   gettimeofday(&tv, NULL); 
   time_t curtime = tv.tv_sec;
+
+  int phase = 0;
+  if (resume)
+    phase = readCheckpoint(checkpoint);
   
   //----------------------------------------------------------------------
   // Seed generation
-  m_seed.run();
-  m_seed.clear();
+  if (phase == 0) {
+    m_seed.run();
+    m_seed.clear();
   
-  ++m_depth;
-  m_pos.collectPatches();
+    ++m_depth;
+    m_pos.collectPatches();
+    writeCheckpoint(checkpoint, 1);
+  }
+  else
+    m_seed.clear();
   
   //----------------------------------------------------------------------
   // Expansion
   const int TIME = 3;
-  for (int t = 0; t < TIME; ++t) {
+  for (int t = max(0, phase - 1); t < TIME; ++t) {
     m_expand.run();
 
     m_filter.run();
@@ -220,6 +238,7 @@ void CfindMatch::run(void) {
     cout << endl;
     
     ++m_depth;
+    writeCheckpoint(checkpoint, t + 2);
   }
   cerr << "---- Total: " << tv.tv_sec - curtime << " secs ----" << endl;
 }
@@ -227,3 +246,104 @@ void CfindMatch::run(void) {
 void CfindMatch::write(const std::string prefix) {
   m_pos.writePatches2(prefix);
 }
+
+static const char checkpointMagic[] = "PMVSCKPT";
+
+// A checkpoint is
+//   char magic[8] = "PMVSCKPT", int version, int phase,
+//   int m_num, m_tnum, m_level, m_csize, int m_images[m_num],
+//   int m_depth, float m_nccThreshold, m_nccThresholdBefore,
+//   int m_countThreshold1, int size, int m_optim.m_status[size],
+//   and the patches (CpatchOrganizerS::writeCheckpoint)
+// in little endian. It is written to a temporary file first, so that
+// a crash while writing keeps the previous checkpoint.
+void CfindMatch::writeCheckpoint(const std::string file, const int phase) {
+  if (file.empty())
+    return;
+
+  vector<char> buffer(checkpointMagic, checkpointMagic + 8);
+  appendBinary(buffer, 1);
+  appendBinary(buffer, phase);
+  appendBinary(buffer, m_num);
+  appendBinary(buffer, m_tnum);
+  appendBinary(buffer, m_level);
+  appendBinary(buffer, m_csize);
+  for (int i = 0; i < m_num; ++i)
+    appendBinary(buffer, m_images[i]);
+  appendBinary(buffer, m_depth);
+  appendBinary(buffer, m_nccThreshold);
+  appendBinary(buffer, m_nccThresholdBefore);
+  appendBinary(buffer, m_countThreshold1);
+  appendBinary(buffer, (int)m_optim.m_status.size());
+  for (int i = 0; i < (int)m_optim.m_status.size(); ++i)
+    appendBinary(buffer, m_optim.m_status[i]);
+  m_pos.writeCheckpoint(buffer);
+
+  const string tmp = file + ".tmp";
+  ofstream ofstr;
+  ofstr.open(tmp.c_str(), ios::out | ios::binary);
+  ofstr.write(&buffer[0], buffer.size());
+  ofstr.close();
+  if (!ofstr || rename(tmp.c_str(), file.c_str()) != 0) {
+    cerr << "Cannot write a checkpoint: " << file << endl;
+    return;
+  }
+  cerr << "Checkpoint " << phase << ": " << (int)m_pos.m_ppatches.size()
+       << " patches, " << (int)buffer.size() / 1024 << " KB" << endl;
+}
+
+int CfindMatch::readCheckpoint(const std::string file) {
+  ifstream ifstr;
+  ifstr.open(file.c_str(), ios::in | ios::binary);
+  if (!ifstr.is_open()) {
+    cerr << "No checkpoint to resume from: " << file << endl;
+    return 0;
+  }
+
+  char magic[8];
+  int version = 0, phase = 0, num = 0, tnum = 0, level = 0, csize = 0;
+  ifstr.read(magic, 8);
+  extractBinary(ifstr, version);
+  extractBinary(ifstr, phase);
+  extractBinary(ifstr, num);
+  extractBinary(ifstr, tnum);
+  extractBinary(ifstr, level);
+  extractBinary(ifstr, csize);
+  int same = ifstr && memcmp(magic, checkpointMagic, 8) == 0 && version == 1 &&
+    num == m_num && tnum == m_tnum && level == m_level && csize == m_csize;
+  for (int i = 0; same && i < m_num; ++i) {
+    int image = -1;
+    extractBinary(ifstr, image);
+    same = image == m_images[i];
+  }
+  if (!same || !ifstr || phase < 1) {
+    cerr << "Checkpoint does not match the options: " << file << endl;
+    return 0;
+  }
+
+  int depth = 0, size = 0;
+  extractBinary(ifstr, depth);
+  extractBinary(ifstr, m_nccThreshold);
+  extractBinary(ifstr, m_nccThresholdBefore);
+  extractBinary(ifstr, m_countThreshold1);
+  extractBinary(ifstr, size);
+  m_optim.m_status.resize(size);
+  for (int i = 0; i < size; ++i)
+    extractBinary(ifstr, m_optim.m_status[i]);
+
+  // All patches are added with the depth of the phase just finished.
+  // After seeding (0) this adds no visible grids or depth maps, as in
+  // the seeding itself. After a round, Cfilter::run has rebuilt them
+  // for every patch, whichever phase made it, and so does addPatch.
+  m_depth = depth - 1;
+  if (!ifstr || !m_pos.readCheckpoint(ifstr)) {
+    cerr << "Broken checkpoint: " << file << endl;
+    exit (1);
+  }
+  m_depth = depth;
+  m_pos.collectPatches();
+
+  cerr << "Resuming from checkpoint " << phase << ": "
+       << (int)m_pos.m_ppatches.size() << " patches" << endl;
+  return phase;
+}
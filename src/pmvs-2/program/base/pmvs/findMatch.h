@@ -27,7 +27,10 @@ class CfindMatch {
   virtual ~CfindMatch();
 
   void init(const PMVS3::Soption& option);
-  void run(void);
+  // Saves the state to checkpoint (if not empty) after seed generation
+  // and after every expansion round. With resume, starts from the
+  // state in checkpoint, if any.
+  void run(const std::string checkpoint = std::string(), const int resume = 0);
   void write(const std::string prefix);
   
   int insideBimages(const Vec4f& coord) const;
@@ -67,11 +70,15 @@ class CfindMatch {
   int m_minImageNumThreshold;
   // use edge detection or not
   float m_setEdge;
+  // memory budget (MB) of the tiled image cache. 0: no cache
+  int m_tileCache;
+  // write .patch and .ply files in binary
+  int m_binary;
+  // filterSmallGroups merges neighbors found from either side
+  int m_mergeGroups;
   // bounding images
   std::vector<int> m_bindexes;
-  // visdata from SfM. m_num x m_num matrix
-  std::vector<std::vector<int> > m_visdata;
-  // an array of relavant images
+  // an array of relavant images, sorted
   std::vector<std::vector<int> > m_visdata2;  
   // sequence Threshold
   int m_sequenceThreshold;
@@ -161,6 +168,13 @@ class CfindMatch {
   void initTargets(void);
   void updateThreshold(void);
   void initImages(void);
+
+  // phase is the number of finished phases: 1 after seed generation,
+  // 1 + t after t expansion rounds
+  void writeCheckpoint(const std::string file, const int phase);
+  // Returns the number of finished phases, or 0 if there is no usable
+  // checkpoint
+  int readCheckpoint(const std::string file);
 };
 };
 
@@ -6,6 +6,7 @@
 #include "optim.h"
 
 using namespace Patch;
+using namespace Image;
 using namespace PMVS3;
 using namespace std;
 
@@ -29,12 +30,20 @@ void Coptim::init(void) {
   
   m_texsT.resize(m_fm.m_CPU);
   m_weightsT.resize(m_fm.m_CPU);
+  m_gradsT.resize(m_fm.m_CPU);
+  m_gtexsT.resize(m_fm.m_CPU);
 
+  const int wsize2 = m_fm.m_wsize * m_fm.m_wsize;
   for (int c = 0; c < m_fm.m_CPU; ++c) {
     m_texsT[c].resize(m_fm.m_num);
     m_weightsT[c].resize(m_fm.m_num);
-    for (int j = 0; j < m_fm.m_tau; ++j)
-      m_texsT[c][j].resize(3 * m_fm.m_wsize * m_fm.m_wsize);
+    m_gradsT[c].resize(m_fm.m_num);
+    for (int j = 0; j < m_fm.m_num; ++j) {
+      m_texsT[c][j].reserve(wsize2);
+      m_gradsT[c][j].m_gx.reserve(wsize2);
+      m_gradsT[c][j].m_gy.reserve(wsize2);
+    }
+    m_gtexsT[c].reserve(wsize2);
   }
   
   setAxesScales();
@@ -68,9 +77,9 @@ void Coptim::setAxesScales(void) {
 }
 
 void Coptim::collectImages(const int index, std::vector<int>& indexes) const{
-  // Find images with constraints m_angleThreshold, m_visdata,
+  // Find images with constraints m_angleThreshold, m_visdata2,
   // m_sequenceThreshold, m_targets. Results are sorted by
-  // CphotoSet::m_distances.
+  // CphotoSet::getDistance.
   indexes.clear();
   Vec4f ray0 = m_fm.m_pss.m_photos[index].m_oaxis;
   ray0[3] = 0.0f;
@@ -92,7 +101,7 @@ void Coptim::collectImages(const int index, std::vector<int>& indexes) const{
     if (ray0 * ray1 < cos(m_fm.m_angleThreshold0))
       continue;
     
-    candidates.push_back(Vec2f(m_fm.m_pss.m_distances[index][indextmp], indextmp));
+    candidates.push_back(Vec2f(m_fm.m_pss.getDistance(index, indextmp), indextmp));
   }
   
   sort(candidates.begin(), candidates.end(), Svec2cmp<float>());
@@ -415,24 +424,16 @@ void Coptim::removeImagesEdge(Patch::Cpatch& patch) const{
 
 void Coptim::addImages(Patch::Cpatch& patch) const{
   // take into account m_edge
-  vector<int> used;
-  used.resize(m_fm.m_num);
-  for (int index = 0; index < m_fm.m_num; ++index)
-    used[index] = 0;
-
-  vector<int>::const_iterator bimage = patch.m_images.begin();
-  vector<int>::const_iterator eimage = patch.m_images.end();
-  while (bimage != eimage) {
-    used[*bimage] = 1;
-    ++bimage;
-  }
+  // Images already in the patch. There are only a few of them.
+  const int size = (int)patch.m_images.size();
 
-  bimage = m_fm.m_visdata2[patch.m_images[0]].begin();
-  eimage = m_fm.m_visdata2[patch.m_images[0]].end();
+  vector<int>::const_iterator bimage = m_fm.m_visdata2[patch.m_images[0]].begin();
+  vector<int>::const_iterator eimage = m_fm.m_visdata2[patch.m_images[0]].end();
 
   const float athreshold = cos(m_fm.m_angleThreshold0);
   while (bimage != eimage) {
-    if (used[*bimage]) {
+    if (find(patch.m_images.begin(), patch.m_images.begin() + size, *bimage) !=
+        patch.m_images.begin() + size) {
       ++bimage;
       continue;
     }
@@ -607,126 +608,177 @@ double Coptim::my_f(const gsl_vector *v, void *params) {
 /* The gradient of f, df = (df/dx, df/dy). */
 void Coptim::my_df(const gsl_vector *v, void *params,
                    gsl_vector *df) {
-  int which = 1;
-  if (which == 0) {
-      const double x0 = gsl_vector_get(v, 0);
-  const double x1 = gsl_vector_get(v, 1);
-  const double x2 = gsl_vector_get(v, 2);
-
-  double dfdx0, dfdx1, dfdx2;
-
-  //????
-  const double step = 0.4f;//0.4f;
-  gsl_vector* x = gsl_vector_alloc (3);
-  //-------------------------------------------------------
-  gsl_vector_set(x, 0, x0 + step);
-  gsl_vector_set(x, 1, x1);
-  gsl_vector_set(x, 2, x2);
-  dfdx0 = my_f(x, params);
-  gsl_vector_set(x, 0, x0 - step);
-  dfdx0 -= my_f(x, params);
-  dfdx0 /= 2.0 * step;
-  //-------------------------------------------------------
-  gsl_vector_set(x, 0, x0);
-  gsl_vector_set(x, 1, x1 + step);
-  dfdx1 = my_f(x, params);
-  gsl_vector_set(x, 1, x1 - step);
-  dfdx1 -= my_f(x, params);
-  dfdx1 /= 2.0 * step;
-  //-------------------------------------------------------
-  gsl_vector_set(x, 1, x1);
-  gsl_vector_set(x, 2, x2 + step);
-  dfdx2 = my_f(x, params);
-  gsl_vector_set(x, 2, x2 - step);
-  dfdx2 -= my_f(x, params);
-  dfdx2 /= 2.0 * step;
-  //-------------------------------------------------------
-  gsl_vector_set(df, 0, dfdx0);
-  gsl_vector_set(df, 1, dfdx1);
-  gsl_vector_set(df, 2, dfdx2);
-
-  gsl_vector_free(x);
-  }
-  else {
-    //???check h is 0.5 or 1.0?
-    const float h = 0.5f;//0.5f;//1.0f;
-    const int id = *((int*)params);
-
-  const double x0 = gsl_vector_get(v, 0);
-  const double x1 = gsl_vector_get(v, 1);
-  const double x2 = gsl_vector_get(v, 2);
-
-  m_one->m_paramsT[id][0] = x0;
-  m_one->m_paramsT[id][1] = x1;
-  m_one->m_paramsT[id][2] = x2;
-
-  //???check debug abserr here how big are they
-  gsl_function func;
-  func.params = params;
-  
-  double result, abserr;
-  func.function = &my_f0;
-  gsl_deriv_central(&func, x0, h, &result, &abserr);
-  gsl_vector_set(df, 0, result);
-  
-  func.function = &my_f1;
-  gsl_deriv_central(&func, x1, h, &result, &abserr);
-  gsl_vector_set(df, 1, result);
-  
-  func.function = &my_f2;  
-  gsl_deriv_central(&func, x2, h, &result, &abserr);
-  
-  gsl_vector_set(df, 2, result);
-  }
+  const int id = *((int*)params);
+  const double xs[3] = {gsl_vector_get(v, 0),
+                        gsl_vector_get(v, 1),
+                        gsl_vector_get(v, 2)};
+  double grad[3];
+  m_one->computeINCCGrad(xs, grad, id);
+  gsl_vector_set(df, 0, grad[0]);
+  gsl_vector_set(df, 1, grad[1]);
+  gsl_vector_set(df, 2, grad[2]);
 }
      
 /* Compute both f and df together. */
 void Coptim::my_fdf(const gsl_vector *x, void *params, 
                     double *f, gsl_vector *df) {  
-  *f = my_f(x, params); 
-  my_df(x, params, df);
+  const int id = *((int*)params);
+  const double xs[3] = {gsl_vector_get(x, 0),
+                        gsl_vector_get(x, 1),
+                        gsl_vector_get(x, 2)};
+  double grad[3];
+  *f = m_one->computeINCCGrad(xs, grad, id);
+  gsl_vector_set(df, 0, grad[0]);
+  gsl_vector_set(df, 1, grad[1]);
+  gsl_vector_set(df, 2, grad[2]);
 }
 
-double Coptim::my_f0(double x, void* params) {
-  const int id = *((int*)params);
+//----------------------------------------------------------------------
+// Analytic gradient of my_f. A texture sample at grid position (x, y)
+// of image i is the bilinear interpolation of the image at
+//   q = left + x * dx + y * dy,
+// so its derivative with respect to a patch parameter is the image
+// gradient at q times dq/dparameter. Differentiating the normalized
+// cross correlation s = <t0, ti> / (3n) of the normalized textures
+// with respect to the raw texture Ti gives (t0 - s ti) / (3n sigma_i),
+// and symmetrically for the reference texture. The derivatives of the
+// sampling grid (left, dx, dy) only involve the patch geometry; they
+// are taken by central differences, which needs no image access.
+//----------------------------------------------------------------------
+double Coptim::computeINCCGrad(const double* xs, double* grad, const int id) {
+  grad[0] = grad[1] = grad[2] = 0.0;
+  
+  const float angle1 = xs[1] * m_ascalesT[id];
+  const float angle2 = xs[2] * m_ascalesT[id];
 
-  gsl_vector* v = gsl_vector_alloc (3);
-  gsl_vector_set(v, 0, x);
-  gsl_vector_set(v, 1, m_one->m_paramsT[id][1]);
-  gsl_vector_set(v, 2, m_one->m_paramsT[id][2]);
+  if (angle1 <= - M_PI / 2.0f || M_PI / 2.0f <= angle1 ||
+      angle2 <= - M_PI / 2.0f || M_PI / 2.0f <= angle2)
+    return 2.0f;      
 
-  const double score = my_f(v, params);
-  gsl_vector_free(v);
+  Vec4f coord, normal;
+  decode(coord, normal, xs, id);
   
-  return score;
-}
-
-double Coptim::my_f1(double x, void* params) {
-  const int id = *((int*)params);
+  const int index = m_indexesT[id][0];
+  Vec4f pxaxis, pyaxis;
+  getPAxes(index, coord, normal, pxaxis, pyaxis);
+  
+  const int size = min(m_fm.m_tau, (int)m_indexesT[id].size());
+  const int mininum = min(m_fm.m_minImageNumThreshold, size);
+  const int wsize = m_fm.m_wsize;
 
-  gsl_vector* v = gsl_vector_alloc (3);
-  gsl_vector_set(v, 0, m_one->m_paramsT[id][0]);
-  gsl_vector_set(v, 1, x);
-  gsl_vector_set(v, 2, m_one->m_paramsT[id][2]);
+  vector<Ctexture>& texs = m_texsT[id];
+  vector<SgradImage>& grads = m_gradsT[id];
+  for (int i = 0; i < size; ++i) {
+    SgradImage& gi = grads[i];
+    texs[i].clear();
+    if (grabFrame(coord, pxaxis, pyaxis, normal, m_indexesT[id][i], wsize,
+                  gi.m_frame[0], gi.m_frame[1], gi.m_frame[2], gi.m_level))
+      continue;
+    const Cimage& image = m_fm.m_pss.m_photos[m_indexesT[id][i]];
+    texs[i].sample(image, gi.m_level, gi.m_frame[0], gi.m_frame[1],
+                   gi.m_frame[2], wsize);
+    gi.m_sigma = texs[i].normalize();
+    Ctexture::sampleGradient(image, gi.m_level, gi.m_frame[0], gi.m_frame[1],
+                             gi.m_frame[2], wsize, gi.m_gx, gi.m_gy);
+  }
 
-  const double score = my_f(v, params);
-  gsl_vector_free(v);
+  if (texs[0].empty())
+    return 2.0f;
   
-  return score;
-}
+  double ans = 0.0f;
+  int denom = 0;
+  for (int i = 1; i < size; ++i) {
+    if (texs[i].empty())
+      continue;
+    grads[i].m_ncc = dot(texs[0], texs[i]);
+    ans += robustincc(1.0 - grads[i].m_ncc);
+    denom++;
+  }
+  if (denom < mininum - 1)
+    return 2.0f;
 
-double Coptim::my_f2(double x, void* params) {
-  const int id = *((int*)params);
+  //----------------------------------------------------------------------
+  // Derivatives of the sampling grids
+  const double step = 0.01;
+  for (int k = 0; k < 3; ++k) {
+    double xs0[3] = {xs[0], xs[1], xs[2]};
+    double xs1[3] = {xs[0], xs[1], xs[2]};
+    xs0[k] -= step;
+    xs1[k] += step;
+    Vec4f coord0, normal0, pxaxis0, pyaxis0;
+    Vec4f coord1, normal1, pxaxis1, pyaxis1;
+    decode(coord0, normal0, xs0, id);
+    decode(coord1, normal1, xs1, id);
+    getPAxes(index, coord0, normal0, pxaxis0, pyaxis0);
+    getPAxes(index, coord1, normal1, pxaxis1, pyaxis1);
+    
+    for (int i = 0; i < size; ++i) {
+      if (texs[i].empty())
+        continue;
+      SgradImage& gi = grads[i];
+      Vec3f frame0[3], frame1[3];
+      getFrame(coord0, pxaxis0, pyaxis0, m_indexesT[id][i], wsize, gi.m_level,
+               frame0[0], frame0[1], frame0[2]);
+      getFrame(coord1, pxaxis1, pyaxis1, m_indexesT[id][i], wsize, gi.m_level,
+               frame1[0], frame1[1], frame1[2]);
+      for (int f = 0; f < 3; ++f)
+        gi.m_dframe[k][f] = (frame1[f] - frame0[f]) / (2.0 * step);
+    }
+  }
 
-  gsl_vector* v = gsl_vector_alloc (3);
-  gsl_vector_set(v, 0, m_one->m_paramsT[id][0]);
-  gsl_vector_set(v, 1, m_one->m_paramsT[id][1]);
-  gsl_vector_set(v, 2, x);
-  
-  const double score = my_f(v, params);
-  gsl_vector_free(v);
+  //----------------------------------------------------------------------
+  // f = 1/denom sum_i robustincc(1 - s_i), d robustincc(r)/dr = 1/(1+3r)^2
+  Ctexture& gtex = m_gtexsT[id];
+  gtex.resize(texs[0].size());
+  for (int i = 1; i < size; ++i) {
+    if (texs[i].empty())
+      continue;
+    const float r = 1.0f - grads[i].m_ncc;
+    const double weight = 1.0 / ((1.0 + 3.0 * r) * (1.0 + 3.0 * r));
+    const double scale = - weight / (denom * 3.0 * texs[i].size() * grads[i].m_sigma);
+    addINCCGrad(i, texs[0], 1.0f, texs[i], - grads[i].m_ncc, scale, grad, id);
+
+    // Reference image: weight * (ti - s_i t0)
+    for (int c = 0; c < 3; ++c) {
+      float* gp = gtex.channel(c);
+      const float* t0 = texs[0].channel(c);
+      const float* ti = texs[i].channel(c);
+      for (int j = 0; j < texs[0].size(); ++j)
+        gp[j] += weight * (ti[j] - grads[i].m_ncc * t0[j]);
+    }
+  }
+  const double scale = - 1.0 / (denom * 3.0 * texs[0].size() * grads[0].m_sigma);
+  addINCCGrad(0, gtex, 1.0f, gtex, 0.0f, scale, grad, id);
   
-  return score;
+  return ans / denom;
+}
+
+// grad += scale * sum over samples and channels of
+//   (c0 * tex0 + c1 * tex1) * d(texture of image i)/dparameter
+void Coptim::addINCCGrad(const int i, const Ctexture& tex0, const float c0,
+                         const Ctexture& tex1, const float c1,
+                         const double scale, double* grad, const int id) const {
+  const SgradImage& gi = m_gradsT[id][i];
+  const int wsize = m_fm.m_wsize;
+  double sums[3] = {0.0, 0.0, 0.0};
+  int j = 0;
+  for (int y = 0; y < wsize; ++y) {
+    for (int x = 0; x < wsize; ++x, ++j) {
+      float ax = 0.0f, ay = 0.0f;
+      for (int c = 0; c < 3; ++c) {
+        const float a = c0 * tex0.channel(c)[j] + c1 * tex1.channel(c)[j];
+        ax += a * gi.m_gx.channel(c)[j];
+        ay += a * gi.m_gy.channel(c)[j];
+      }
+      for (int k = 0; k < 3; ++k) {
+        const Vec3f dq =
+          gi.m_dframe[k][0] + gi.m_dframe[k][1] * (float)x + gi.m_dframe[k][2] * (float)y;
+        sums[k] += ax * dq[0] + ay * dq[1];
+      }
+    }
+  }
+  for (int k = 0; k < 3; ++k)
+    grad[k] += scale * sums[k];
 }
 
 //----------------------------------------------------------------------
@@ -1039,6 +1091,28 @@ void Coptim::refinePatchBFGS(Cpatch& patch, const int id,
   
   double p[3];
   encode(patch.m_coord, patch.m_normal, p, id);
+
+  // NCC has an analytic gradient: use quasi-Newton
+  if (ncc) {
+    TBFGS<3> bfgs;
+    bfgs.m_maxIter = time;
+    CinccCost cost(*this, id);
+    double fx;
+    const int status = bfgs.minimize(cost, p, fx) == 0 ? GSL_SUCCESS : GSL_CONTINUE;
+
+    if (status == GSL_SUCCESS) {
+      decode(patch.m_coord, patch.m_normal, p, id);
+      
+      patch.m_ncc = 1.0 -
+        unrobustincc(computeINCC(patch.m_coord,
+                                 patch.m_normal, patch.m_images, id, 1));
+    }
+    else
+      patch.m_images.clear();
+    
+    ++m_status[status + 2];
+    return;
+  }
   
   gsl_vector* x = gsl_vector_alloc (3);
   gsl_vector_set(x, 0, p[0]);
@@ -1144,7 +1218,7 @@ void Coptim::setINCCs(const Patch::Cpatch& patch,
   Vec4f pxaxis, pyaxis;
   getPAxes(index, patch.m_coord, patch.m_normal, pxaxis, pyaxis);
   
-  vector<vector<float> >& texs = m_texsT[id];
+  vector<Ctexture>& texs = m_texsT[id];
   
   const int size = (int)indexes.size();
   for (int i = 0; i < size; ++i) {
@@ -1183,7 +1257,7 @@ void Coptim::setINCCs(const Patch::Cpatch& patch,
   Vec4f pxaxis, pyaxis;
   getPAxes(index, patch.m_coord, patch.m_normal, pxaxis, pyaxis);
   
-  vector<vector<float> >& texs = m_texsT[id];
+  vector<Ctexture>& texs = m_texsT[id];
 
   const int size = (int)indexes.size();
   for (int i = 0; i < size; ++i) {    
@@ -1241,9 +1315,22 @@ int Coptim::grabSafe(const int index, const int size, const Vec3f& center,
 
 int Coptim::grabTex(const Vec4f& coord, const Vec4f& pxaxis, const Vec4f& pyaxis,
 		    const Vec4f& pzaxis, const int index, const int size,
-                    std::vector<float>& tex) const {
+                    Ctexture& tex) const {
   tex.clear();
 
+  Vec3f left, dx, dy;
+  int level;
+  if (grabFrame(coord, pxaxis, pyaxis, pzaxis, index, size, left, dx, dy, level))
+    return 1;
+
+  tex.sample(m_fm.m_pss.m_photos[index], level, left, dx, dy, size);
+  
+  return 0;
+}
+
+int Coptim::grabFrame(const Vec4f& coord, const Vec4f& pxaxis, const Vec4f& pyaxis,
+                      const Vec4f& pzaxis, const int index, const int size,
+                      Vec3f& left, Vec3f& dx, Vec3f& dy, int& level) const {
   Vec4f ray = m_fm.m_pss.m_photos[index].m_center - coord;
   unitize(ray);
   const float weight = max(0.0f, ray * pzaxis);
@@ -1253,45 +1340,37 @@ int Coptim::grabTex(const Vec4f& coord, const Vec4f& pxaxis, const Vec4f& pyaxis
   if (weight < cos(m_fm.m_angleThreshold1))
     return 1;
 
-  const int margin = size / 2;
-
-  Vec3f center = m_fm.m_pss.project(index, coord, m_fm.m_level);  
-  Vec3f dx = m_fm.m_pss.project(index, coord + pxaxis, m_fm.m_level) - center;
-  Vec3f dy = m_fm.m_pss.project(index, coord + pyaxis, m_fm.m_level) - center;
+  const Vec3f center = m_fm.m_pss.project(index, coord, m_fm.m_level);  
+  const Vec3f dx0 = m_fm.m_pss.project(index, coord + pxaxis, m_fm.m_level) - center;
+  const Vec3f dy0 = m_fm.m_pss.project(index, coord + pyaxis, m_fm.m_level) - center;
   
-  const float ratio = (norm(dx) + norm(dy)) / 2.0f;
+  const float ratio = (norm(dx0) + norm(dy0)) / 2.0f;
   int leveldif = (int)floor(log(ratio) / log(2.0f) + 0.5f);
 
   // Upper limit is 2
   leveldif = max(-m_fm.m_level, min(2, leveldif));
+  level = m_fm.m_level + leveldif;
 
   const float scale = pow(2.0f, (float)leveldif);
-  const int newlevel = m_fm.m_level + leveldif;
-
-  center /= scale;  dx /= scale;  dy /= scale;
-  
-  if (grabSafe(index, size, center, dx, dy, newlevel) == 0)
+  if (grabSafe(index, size, center / scale, dx0 / scale, dy0 / scale, level) == 0)
     return 1;
-  
-  Vec3f left = center - dx * margin - dy * margin;
-
-  tex.resize(3 * size * size);
-  float* texp = &tex[0] - 1;
-  for (int y = 0; y < size; ++y) {
-    Vec3f vftmp = left;
-    left += dy;
-    for (int x = 0; x < size; ++x) {
-      Vec3f color = m_fm.m_pss.getColor(index, vftmp[0], vftmp[1], newlevel);
-      *(++texp) = color[0];
-      *(++texp) = color[1];
-      *(++texp) = color[2];
-      vftmp += dx;
-    }
-  }
-  
+
+  getFrame(coord, pxaxis, pyaxis, index, size, level, left, dx, dy);
   return 0;
 }
 
+void Coptim::getFrame(const Vec4f& coord, const Vec4f& pxaxis, const Vec4f& pyaxis,
+                      const int index, const int size, const int level,
+                      Vec3f& left, Vec3f& dx, Vec3f& dy) const {
+  const int margin = size / 2;
+  const float scale = pow(2.0f, (float)(level - m_fm.m_level));
+
+  const Vec3f center = m_fm.m_pss.project(index, coord, m_fm.m_level);
+  dx = (m_fm.m_pss.project(index, coord + pxaxis, m_fm.m_level) - center) / scale;
+  dy = (m_fm.m_pss.project(index, coord + pyaxis, m_fm.m_level) - center) / scale;
+  left = center / scale - dx * margin - dy * margin;
+}
+
 double Coptim::computeINCC(const Vec4f& coord, const Vec4f& normal,
 			   const std::vector<int>& indexes, const int id,
                            const int robust) {
@@ -1313,7 +1392,7 @@ double Coptim::computeINCC(const Vec4f& coord, const Vec4f& normal,
     return 2.0;
 
   const int size = min(m_fm.m_tau, (int)indexes.size());
-  vector<vector<float> >& texs = m_texsT[id];
+  vector<Ctexture>& texs = m_texsT[id];
 
   for (int i = 0; i < size; ++i) {
     int flag;
@@ -1412,7 +1491,7 @@ void Coptim::func(int m, int n, double* x, double* fvec, int* iflag, void* arg)
 }
 
 // Normalize only scale for each image
-void Coptim::normalize(std::vector<std::vector<float> >& texs,
+void Coptim::normalize(std::vector<Ctexture>& texs,
                        const int size) {
   // compute average rgb
   Vec3f ave;
@@ -1424,14 +1503,7 @@ void Coptim::normalize(std::vector<std::vector<float> >& texs,
     if (texs[i].empty())
       continue;
     
-    int count = 0;
-    while (count < (int)texs[i].size()) {
-      rgbs[i][0] += texs[i][count++];
-      rgbs[i][1] += texs[i][count++];
-      rgbs[i][2] += texs[i][count++];
-    }
-    rgbs[i] /= (int)texs[i].size() / 3;
-
+    rgbs[i] = texs[i].mean();
     ave += rgbs[i];
     ++denom;
   }
@@ -1446,110 +1518,49 @@ void Coptim::normalize(std::vector<std::vector<float> >& texs,
   for (int i = 0; i < size; ++i) {
     if (texs[i].empty())
       continue;
-    int count = 0;
     // compute scale
     Vec3f scale;
     for (int j = 0; j < 3; ++j)
       if (rgbs[i][j] != 0.0f)
         scale[j] = ave[j] / rgbs[i][j];
     
-    while (count < (int)texs[i].size()) {
-      texs[i][count++] *= scale[0];
-      texs[i][count++] *= scale[1];
-      texs[i][count++] *= scale[2];
-    }
+    texs[i].scale(scale);
   }
 }
 
-void Coptim::normalize(std::vector<float>& tex) {
-  const int size = (int)tex.size();
-  const int size3 = size / 3;
-  Vec3f ave;
-
-  float* texp = &tex[0] - 1;
-  for (int i = 0; i < size3; ++i) {
-    ave[0] += *(++texp);
-    ave[1] += *(++texp);
-    ave[2] += *(++texp);
-  }
-  
-  ave /= size3;
-
-  float ave2 = 0.0;
-  texp = &tex[0] - 1;
-  for (int i = 0; i < size3; ++i) {
-    const float f0 = ave[0] - *(++texp);
-    const float f1 = ave[1] - *(++texp);
-    const float f2 = ave[2] - *(++texp);
-    
-    ave2 += f0 * f0 + f1 * f1 + f2 * f2;
-  }
-  
-  ave2 = sqrt(ave2 / size);
-  
-  if (ave2 == 0.0f)
-    ave2 = 1.0f;
-  
-  texp = &tex[0] - 1;
-  for (int i = 0; i < size3; ++i) {
-    *(++texp) -= ave[0];    *texp /= ave2;
-    *(++texp) -= ave[1];    *texp /= ave2;
-    *(++texp) -= ave[2];    *texp /= ave2;
-  }
+void Coptim::normalize(Ctexture& tex) {
+  tex.normalize();
 }
 
-float Coptim::dot(const std::vector<float>& tex0,
-		  const std::vector<float>& tex1) const{
+float Coptim::dot(const Ctexture& tex0,
+		  const Ctexture& tex1) const{
 #ifndef PMVS_WNCC
-  const int size = (int)tex0.size();
-  vector<float>::const_iterator i0 = tex0.begin() - 1;
-  vector<float>::const_iterator i1 = tex1.begin() - 1;
-  float ans = 0.0f;
-  vector<float>::const_iterator end0 = tex0.end() - 1;
-  while (i0 != end0) {
-    ans += (*(++i0)) * (*(++i1));
-  }
-  
-  return ans / size;
+  return Ctexture::dot(tex0, tex1);
 #else
-  const int size = (int)tex0.size();
-  vector<float>::const_iterator i0 = tex0.begin();
-  vector<float>::const_iterator i1 = tex1.begin();
+  const int size = tex0.size();
   float ans = 0.0f;
-  for (int i = 0; i < size; ++i, ++i0, ++i1) {
-    ans += (*i0) * (*i1) * m_template[i];
-  }
+  for (int i = 0; i < size; ++i)
+    for (int c = 0; c < 3; ++c)
+      ans += tex0.channel(c)[i] * tex1.channel(c)[i] * m_template[3 * i + c];
   return ans;
 #endif
 }
 
-float Coptim::ssd(const std::vector<float>& tex0,
-		  const std::vector<float>& tex1) const{
+float Coptim::ssd(const Ctexture& tex0,
+		  const Ctexture& tex1) const{
   const float scale = 0.01;
 
 #ifndef PMVS_WNCC
-  const int size = (int)tex0.size();
-  vector<float>::const_iterator i0 = tex0.begin() - 1;
-  vector<float>::const_iterator i1 = tex1.begin() - 1;
-  float ans = 0.0f;
-  vector<float>::const_iterator end0 = tex0.end() - 1;
-  while (i0 != end0) {
-    const float ftmp = fabs((*(++i0)) - (*(++i1)));
-    //ans += (*(++i0)) * (*(++i1));
-    ans += ftmp;
-  }
-  
-  return scale * ans / size;
+  return scale * Ctexture::sad(tex0, tex1);
 #else
-  const int size = (int)tex0.size();
-  vector<float>::const_iterator i0 = tex0.begin();
-  vector<float>::const_iterator i1 = tex1.begin();
+  const int size = tex0.size();
   float ans = 0.0f;
-  for (int i = 0; i < size; ++i, ++i0, ++i1) {
-    const float ftmp = fabs((*i0) - (*i1));
-    //ans += (*i0) * (*i1) * m_template[i];
-    ans += ftmp * m_template[i];
-  }
+  for (int i = 0; i < size; ++i)
+    for (int c = 0; c < 3; ++c) {
+      const float ftmp = fabs(tex0.channel(c)[i] - tex1.channel(c)[i]);
+      //ans += (*i0) * (*i1) * m_template[i];
+      ans += ftmp * m_template[3 * i + c];
+    }
   return scale * ans;
 #endif
 }
@@ -3,6 +3,8 @@
 
 #include <vector>
 #include "patch.h"
+#include "../image/texture.h"
+#include "../numeric/bfgs.h"
 #include <gsl/gsl_multimin.h>
 
 namespace PMVS3 {
@@ -73,11 +75,27 @@ class Coptim {
   
   int grabTex(const Vec4f& coord, const Vec4f& pxaxis, const Vec4f& pyaxis,
               const Vec4f& pzaxis, const int index, const int size,
-              std::vector<float>& tex) const;
+              Image::Ctexture& tex) const;
   
   int grabSafe(const int index, const int size, const Vec3f& center,
                const Vec3f& dx, const Vec3f& dy, const int level) const;
 
+  // Sampling grid of grabTex: left + x * dx + y * dy at level.
+  // Returns 1 if the texture cannot be grabbed
+  int grabFrame(const Vec4f& coord, const Vec4f& pxaxis, const Vec4f& pyaxis,
+                const Vec4f& pzaxis, const int index, const int size,
+                Vec3f& left, Vec3f& dx, Vec3f& dy, int& level) const;
+  void getFrame(const Vec4f& coord, const Vec4f& pxaxis, const Vec4f& pyaxis,
+                const int index, const int size, const int level,
+                Vec3f& left, Vec3f& dx, Vec3f& dy) const;
+
+  // The cost of my_f and its analytic gradient with respect to the 3
+  // patch parameters
+  double computeINCCGrad(const double* xs, double* grad, const int id);
+  void addINCCGrad(const int i, const Image::Ctexture& tex0, const float c0,
+                   const Image::Ctexture& tex1, const float c1,
+                   const double scale, double* grad, const int id) const;
+
   double computeSSD(const Vec4f& coord, const Vec4f& normal,
                     const std::vector<int>& indexes, const int id);
 
@@ -95,11 +113,11 @@ class Coptim {
                      const int robust);
 
  public:
-  static void normalize(std::vector<float>& tex);
-  static void normalize(std::vector<std::vector<float> >& texs, const int size);
+  static void normalize(Image::Ctexture& tex);
+  static void normalize(std::vector<Image::Ctexture>& texs, const int size);
   
-  float dot(const std::vector<float>& tex0, const std::vector<float>& tex1) const;
-  float ssd(const std::vector<float>& tex0, const std::vector<float>& tex1) const;
+  float dot(const Image::Ctexture& tex0, const Image::Ctexture& tex1) const;
+  float ssd(const Image::Ctexture& tex0, const Image::Ctexture& tex1) const;
  protected:
   static void lfunc(double* p, double* hx, int m, int n, void* adata);
   void func(int m, int n, double* x, double* fvec, int* iflag, void* arg);
@@ -111,9 +129,6 @@ class Coptim {
   static void my_fdf(const gsl_vector *x, void *params, 
                      double *f, gsl_vector *df);
   // for derivative computation
-  static double my_f0(double x, void* params);
-  static double my_f1(double x, void* params);
-  static double my_f2(double x, void* params);
   //----------------------------------------------------------------------
   // For ssd
   static double my_f_ssd(const gsl_vector *v, void *params);
@@ -188,11 +203,41 @@ class Coptim {
   std::vector<Vec3f> m_paramsT;
   
   // Grabbed texture
-  std::vector<std::vector<std::vector<float> > > m_texsT;
+  std::vector<std::vector<Image::Ctexture> > m_texsT;
   // weights for refineDepthOrientationWeighed
   std::vector<std::vector<float> > m_weightsT;
   // Working array for levmar
   std::vector<std::vector<double> > m_worksT;
+
+  // Per image state for computeINCCGrad
+  struct SgradImage {
+    // Image gradients at the samples
+    Image::Ctexture m_gx, m_gy;
+    // left, dx, dy of the sampling grid
+    Vec3f m_frame[3];
+    // Derivatives of m_frame with respect to the 3 parameters
+    Vec3f m_dframe[3][3];
+    int m_level;
+    // Standard deviation of the texture before normalization
+    float m_sigma;
+    // Normalized cross correlation with the reference texture
+    float m_ncc;
+  };
+  std::vector<std::vector<SgradImage> > m_gradsT;
+  // Weighted sum of textures for the reference image gradient
+  std::vector<Image::Ctexture> m_gtexsT;
+
+  // Cost function for TBFGS
+  class CinccCost {
+  public:
+    CinccCost(Coptim& optim, const int id) : m_optim(optim), m_id(id) {}
+    double operator()(const double* xs, double* grad) {
+      return m_optim.computeINCCGrad(xs, grad, m_id);
+    }
+  protected:
+    Coptim& m_optim;
+    const int m_id;
+  };
   
 };
 };
@@ -14,6 +14,9 @@ Soption::Soption(void) {
   m_minImageNum = 3;    m_CPU = 4;
   m_setEdge = 0.0f;     m_useBound = 0;
   m_useVisData = 0;     m_sequence = -1;
+  m_tileCache = 0;
+  m_binary = 0;
+  m_mergeGroups = 0;
   m_tflag = -10;
   m_oflag = -10;
 
@@ -50,6 +53,9 @@ void Soption::init(const std::string prefix, const std::string option) {
     else if (name == "useBound")     ifstr >> m_useBound;
     else if (name == "useVisData")   ifstr >> m_useVisData;
     else if (name == "sequence")     ifstr >> m_sequence;
+    else if (name == "tileCache")    ifstr >> m_tileCache;
+    else if (name == "binary")       ifstr >> m_binary;
+    else if (name == "mergeGroups")  ifstr >> m_mergeGroups;
     else if (name == "timages") {
       ifstr >> m_tflag;
       if (m_tflag == -1) {
@@ -180,29 +186,22 @@ void Soption::initOimages(void) {
 
 // When do not use vis.dat
 void Soption::initVisdata(void) {
-  // Case classifications. Set m_visdata by using vis.dat or not.
+  // Case classifications. Set m_visdata2 by using vis.dat or not.
   if (m_useVisData == 0) {
     const int tnum = (int)m_timages.size();
     const int onum = (int)m_oimages.size();
     const int num = tnum + onum;
-    m_visdata.resize(num);
     m_visdata2.resize(num);
-    for (int y = 0; y < num; ++y) {
-      m_visdata[y].resize(num);
+    for (int y = 0; y < num; ++y)
       for (int x = 0; x < num; ++x)
-        if (x == y)
-          m_visdata[y][x] = 0;
-        else {
-          m_visdata[y][x] = 1;
+        if (x != y)
           m_visdata2[y].push_back(x);
-        }
-    }
   }
   else
     initVisdata2();
 }
 
-// Given m_timages and m_oimages, set m_visdata, m_visdata2
+// Given m_timages and m_oimages, set m_visdata2
 void Soption::initVisdata2(void) {
   string svisdata = m_prefix + string("vis.dat");
   
@@ -250,23 +249,11 @@ void Soption::initVisdata2(void) {
   }
   ifstr.close();
 
-  const int num = (int)images.size();
-  m_visdata.clear();  
-  m_visdata.resize(num);
-  for (int y = 0; y < num; ++y) {
-    m_visdata[y].resize(num);
-    fill(m_visdata[y].begin(), m_visdata[y].end(), 0);
-    for (int x = 0; x < (int)m_visdata2[y].size(); ++x)
-      m_visdata[y][m_visdata2[y][x]] = 1;
-  }
-
-  // check symmetry
-  for (int i = 0; i < (int)m_visdata.size(); ++i) {
-    for (int j = i+1; j < (int)m_visdata.size(); ++j) {
-      if (m_visdata[i][j] != m_visdata[j][i]) {
-        m_visdata[i][j] = m_visdata[j][i] = 1;
-      }
-    }
+  for (int y = 0; y < (int)m_visdata2.size(); ++y) {
+    vector<int>& indexes = m_visdata2[y];
+    sort(indexes.begin(), indexes.end());
+    indexes.erase(unique(indexes.begin(), indexes.end()), indexes.end());
+    indexes.erase(remove(indexes.begin(), indexes.end(), y), indexes.end());
   }
 }
                                              
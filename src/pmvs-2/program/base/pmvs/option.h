@@ -19,6 +19,15 @@ struct Soption{
   int m_useBound;
   int m_useVisData;
   int m_sequence;
+  // Memory budget (MB) of the tiled image cache. 0: no cache
+  int m_tileCache;
+  // Write .patch and .ply files in binary
+  int m_binary;
+  // Small group filter. 0: grow groups from each patch in turn, as
+  // the original serial search. 1: merge every pair of neighbors with
+  // a union-find, which also joins patches found from one side only,
+  // so groups are larger and fewer patches are removed
+  int m_mergeGroups;
   
   float m_maxAngleThreshold;
   float m_quadThreshold;
@@ -33,7 +42,8 @@ struct Soption{
   std::map<int, int> m_dict;
   
   std::vector<int> m_bindexes;
-  std::vector<std::vector<int> > m_visdata;
+  // For each image, the sorted indexes of the images it shares points
+  // with
   std::vector<std::vector<int> > m_visdata2;
   
   Soption(void);
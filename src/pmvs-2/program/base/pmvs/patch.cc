@@ -1,8 +1,65 @@
 #include <string>
+#include <cstdlib>
 #include "../numeric/vec4.h"
 #include "patch.h"
 
 using namespace std;
+using namespace Patch;
+
+CpatchPool Ppatch::m_pool;
+
+CpatchPool::CpatchPool(void) {
+  m_chunkNum = 0;
+  m_unused = 0;
+  pthread_mutex_init(&m_lock, NULL);
+}
+
+CpatchPool::~CpatchPool() {
+  for (int c = 0; c < m_chunkNum; ++c)
+    delete [] m_chunks[c];
+  pthread_mutex_destroy(&m_lock);
+}
+
+int CpatchPool::alloc(const Cpatch& patch) {
+  pthread_mutex_lock(&m_lock);
+  int handle;
+  if (!m_free.empty()) {
+    handle = m_free.back();
+    m_free.pop_back();
+  }
+  else {
+    if (m_unused == 0) {
+      if (m_chunkNum == MAXCHUNKS) {
+        cerr << "Too many patches" << endl;
+        exit (1);
+      }
+      m_chunks[m_chunkNum++] = new Cpatch[CHUNK];
+      m_unused = CHUNK;
+    }
+    handle = m_chunkNum * CHUNK - m_unused--;
+  }
+  pthread_mutex_unlock(&m_lock);
+
+  // Assignment reuses the memory of the vectors of the slot
+  (*this)[handle] = patch;
+  return handle;
+}
+
+void CpatchPool::release(const int handle) {
+  Cpatch& patch = (*this)[handle];
+  patch.m_images.clear();
+  patch.m_grids.clear();
+  patch.m_vimages.clear();
+  patch.m_vgrids.clear();
+  
+  pthread_mutex_lock(&m_lock);
+  m_free.push_back(handle);
+  pthread_mutex_unlock(&m_lock);
+}
+
+int CpatchPool::getSize(void) const {
+  return m_chunkNum * CHUNK - m_unused - (int)m_free.size();
+}
 
 std::istream& Patch::operator >>(std::istream& istr, Cpatch& rhs) {
   string header;
@@ -29,21 +86,21 @@ std::istream& Patch::operator >>(std::istream& istr, Cpatch& rhs) {
 }
 
 std::ostream& Patch::operator <<(std::ostream& ostr, const Cpatch& rhs) {
-  ostr << "PATCHS" << endl
-       << rhs.m_coord << endl
-       << rhs.m_normal << endl
+  ostr << "PATCHS" << '\n'
+       << rhs.m_coord << '\n'
+       << rhs.m_normal << '\n'
        << rhs.m_ncc << ' '
        << rhs.m_dscale << ' '
-       << rhs.m_ascale << endl
-       << (int)rhs.m_images.size() << endl;
+       << rhs.m_ascale << '\n'
+       << (int)rhs.m_images.size() << '\n';
   for (int i = 0; i < (int)rhs.m_images.size(); ++i)
     ostr << rhs.m_images[i] << ' ';
-  ostr << endl;
+  ostr << '\n';
   
-  ostr << (int)rhs.m_vimages.size() << endl;
+  ostr << (int)rhs.m_vimages.size() << '\n';
   for (int i = 0; i < (int)rhs.m_vimages.size(); ++i)
     ostr << rhs.m_vimages[i] << ' ';
-  ostr << endl;
+  ostr << '\n';
 
   return ostr;
 }
@@ -3,7 +3,7 @@
 
 #include <vector>
 #include <iostream>
-#include <boost/shared_ptr.hpp>
+#include <pthread.h>
 #include "../numeric/vec4.h"
 
 namespace Patch {
@@ -69,14 +69,80 @@ class Cpatch {
   float m_tmp;
 };
 
-typedef boost::shared_ptr<Cpatch> Ppatch;
+// CpatchPool stores all the patches. Patches are allocated in chunks
+// of CHUNK slots that never move, and are referred to by integer
+// handles. A released slot is recycled by the next allocation, and
+// its vectors keep their memory, so that creating and removing
+// millions of patches does not go through malloc/free every time.
+class CpatchPool {
+ public:
+  enum { LOG = 12, CHUNK = 1 << LOG, MAXCHUNKS = 1 << 16 };
+
+  CpatchPool(void);
+  virtual ~CpatchPool();
+
+  // Copy patch into a free slot and return its handle. Thread safe.
+  int alloc(const Cpatch& patch);
+  // Return a slot. No handle to it may be used afterwards.
+  void release(const int handle);
+
+  inline Cpatch& operator[](const int handle) const {
+    return m_chunks[handle >> LOG][handle & (CHUNK - 1)];
+  }
+
+  // number of patches in use
+  int getSize(void) const;
+
+ protected:
+  Cpatch* m_chunks[MAXCHUNKS];
+  int m_chunkNum;
+  // Slots not yet used in the last chunk
+  int m_unused;
+  std::vector<int> m_free;
+  pthread_mutex_t m_lock;
+};
+
+// Handle to a patch in the pool. Copying a handle does not copy the
+// patch, and a patch lives until it is explicitly released.
+class Ppatch {
+ public:
+  Ppatch(void) : m_handle(-1) {}
+  explicit Ppatch(const int handle) : m_handle(handle) {}
+
+  static inline Ppatch create(const Cpatch& patch) {
+    return Ppatch(m_pool.alloc(patch));
+  }
+  inline void release(void) {
+    m_pool.release(m_handle);
+    m_handle = -1;
+  }
+
+  inline Cpatch& operator*(void) const { return m_pool[m_handle]; }
+  inline Cpatch* operator->(void) const { return &m_pool[m_handle]; }
+  inline Cpatch* get(void) const {
+    return m_handle < 0 ? NULL : &m_pool[m_handle];
+  }
+  inline int getHandle(void) const { return m_handle; }
+
+  inline bool operator==(const Ppatch& rhs) const {
+    return m_handle == rhs.m_handle;
+  }
+  inline bool operator!=(const Ppatch& rhs) const {
+    return m_handle != rhs.m_handle;
+  }
+  inline bool operator<(const Ppatch& rhs) const {
+    return m_handle < rhs.m_handle;
+  }
+
+  static CpatchPool m_pool;
+
+ protected:
+  int m_handle;
+};
 
 struct Spatchcmp {
   bool operator()(const Ppatch& lhs, const Ppatch& rhs) {
-    if (lhs.get() < rhs.get())
-      return true;
-    else
-      return false;
+    return lhs < rhs;
   }
 };
  
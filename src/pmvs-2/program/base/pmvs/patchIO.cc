@@ -0,0 +1,295 @@
+#include <cstdlib>
+#include <sstream>
+#include "patchIO.h"
+
+using namespace std;
+using namespace Patch;
+
+namespace {
+const char magic[8] = {'P', 'A', 'T', 'C', 'H', 'E', 'S', 'B'};
+const int version = 1;
+// Flush buffers beyond this size
+const int blockSize = 1 << 20;
+
+void flush(ofstream& ofstr, vector<char>& buffer) {
+  if (!buffer.empty())
+    ofstr.write(&buffer[0], buffer.size());
+  buffer.clear();
+}
+};
+
+//----------------------------------------------------------------------
+void Patch::appendPatch(std::vector<char>& buffer, const Cpatch& patch) {
+  for (int i = 0; i < 3; ++i)
+    appendBinary(buffer, patch.m_coord[i]);
+  for (int i = 0; i < 3; ++i)
+    appendBinary(buffer, patch.m_normal[i]);
+  appendBinary(buffer, patch.m_ncc);
+  appendBinary(buffer, patch.m_dscale);
+  appendBinary(buffer, patch.m_ascale);
+  appendBinary(buffer, (int)patch.m_images.size());
+  appendBinary(buffer, (int)patch.m_vimages.size());
+  for (int i = 0; i < (int)patch.m_images.size(); ++i)
+    appendBinary(buffer, patch.m_images[i]);
+  for (int i = 0; i < (int)patch.m_vimages.size(); ++i)
+    appendBinary(buffer, patch.m_vimages[i]);
+}
+
+int Patch::extractPatch(std::istream& istr, Cpatch& patch) {
+  int inum = 0, vnum = 0;
+  for (int i = 0; i < 3; ++i)
+    extractBinary(istr, patch.m_coord[i]);
+  patch.m_coord[3] = 1.0f;
+  for (int i = 0; i < 3; ++i)
+    extractBinary(istr, patch.m_normal[i]);
+  patch.m_normal[3] = 0.0f;
+  extractBinary(istr, patch.m_ncc);
+  extractBinary(istr, patch.m_dscale);
+  extractBinary(istr, patch.m_ascale);
+  extractBinary(istr, inum);
+  extractBinary(istr, vnum);
+  if (!istr || inum < 0 || vnum < 0)
+    return 0;
+
+  patch.m_images.resize(inum);
+  for (int i = 0; i < inum; ++i)
+    extractBinary(istr, patch.m_images[i]);
+  patch.m_vimages.resize(vnum);
+  for (int i = 0; i < vnum; ++i)
+    extractBinary(istr, patch.m_vimages[i]);
+  return !istr.fail();
+}
+
+//----------------------------------------------------------------------
+CpatchWriter::CpatchWriter(void) {
+  m_binary = 0;
+}
+
+CpatchWriter::~CpatchWriter() {
+  close();
+}
+
+void CpatchWriter::open(const std::string file, const int num,
+                        const int binary) {
+  m_binary = binary;
+  m_ofstr.open(file.c_str(), ios::out | ios::binary);
+  if (!m_ofstr.is_open()) {
+    cerr << "Cannot write " << file << endl;
+    exit (1);
+  }
+
+  if (m_binary) {
+    m_buffer.reserve(blockSize + 1024);
+    m_buffer.insert(m_buffer.end(), magic, magic + 8);
+    appendBinary(m_buffer, version);
+    appendBinary(m_buffer, num);
+  }
+  else
+    m_ofstr << "PATCHES" << '\n' << num << '\n';
+}
+
+void CpatchWriter::write(const Cpatch& patch) {
+  if (!m_binary) {
+    m_ofstr << patch << '\n';
+    return;
+  }
+
+  appendPatch(m_buffer, patch);
+  if (blockSize <= (int)m_buffer.size())
+    flush(m_ofstr, m_buffer);
+}
+
+void CpatchWriter::close(void) {
+  if (!m_ofstr.is_open())
+    return;
+  flush(m_ofstr, m_buffer);
+  m_ofstr.close();
+}
+
+//----------------------------------------------------------------------
+CpatchReader::CpatchReader(void) {
+  m_binary = 0;
+  m_num = 0;
+  m_count = 0;
+}
+
+CpatchReader::~CpatchReader() {
+  close();
+}
+
+int CpatchReader::open(const std::string file) {
+  m_ifstr.open(file.c_str(), ios::in | ios::binary);
+  if (!m_ifstr.is_open())
+    return -1;
+
+  char header[8];
+  m_ifstr.read(header, 8);
+  m_binary = m_ifstr && memcmp(header, magic, 8) == 0;
+  m_count = 0;
+  m_num = 0;
+
+  if (m_binary) {
+    int itmp;
+    if (!extractBinary(m_ifstr, itmp) || itmp != version) {
+      cerr << "Unknown version of " << file << endl;
+      return 0;
+    }
+    extractBinary(m_ifstr, m_num);
+  }
+  else {
+    // ASCII: "PATCHES" and the number of patches
+    m_ifstr.clear();
+    m_ifstr.seekg(0);
+    string stmp;
+    m_ifstr >> stmp >> m_num;
+  }
+  if (!m_ifstr)
+    m_num = 0;
+  return m_num;
+}
+
+int CpatchReader::read(Cpatch& patch) {
+  if (m_num <= m_count)
+    return 0;
+
+  if (!m_binary) {
+    m_ifstr >> patch;
+    if (!m_ifstr)
+      return 0;
+    ++m_count;
+    return 1;
+  }
+
+  if (extractPatch(m_ifstr, patch) == 0)
+    return 0;
+
+  ++m_count;
+  return 1;
+}
+
+void CpatchReader::close(void) {
+  if (m_ifstr.is_open())
+    m_ifstr.close();
+}
+
+//----------------------------------------------------------------------
+CplyWriter::CplyWriter(void) {
+  m_binary = 0;
+}
+
+CplyWriter::~CplyWriter() {
+  close();
+}
+
+void CplyWriter::open(const std::string file, const int num,
+                      const int binary) {
+  m_binary = binary;
+  m_ofstr.open(file.c_str(), ios::out | ios::binary);
+  if (!m_ofstr.is_open()) {
+    cerr << "Cannot write " << file << endl;
+    exit (1);
+  }
+  m_buffer.reserve(blockSize + 1024);
+
+  m_ofstr << "ply" << '\n'
+          << (m_binary ? "format binary_little_endian 1.0" :
+              "format ascii 1.0") << '\n'
+          << "element vertex " << num << '\n'
+          << "property float x" << '\n'
+          << "property float y" << '\n'
+          << "property float z" << '\n'
+          << "property float nx" << '\n'
+          << "property float ny" << '\n'
+          << "property float nz" << '\n'
+          << "property uchar diffuse_red" << '\n'
+          << "property uchar diffuse_green" << '\n'
+          << "property uchar diffuse_blue" << '\n'
+          << "end_header" << '\n';
+}
+
+void CplyWriter::write(const Vec4f& coord, const Vec4f& normal,
+                       const Vec3i& color) {
+  if (!m_binary) {
+    m_ofstr << coord[0] << ' ' << coord[1] << ' ' << coord[2] << ' '
+            << normal[0] << ' ' << normal[1] << ' ' << normal[2] << ' '
+            << color[0] << ' ' << color[1] << ' ' << color[2] << '\n';
+    return;
+  }
+
+  for (int i = 0; i < 3; ++i)
+    appendBinary(m_buffer, coord[i]);
+  for (int i = 0; i < 3; ++i)
+    appendBinary(m_buffer, normal[i]);
+  for (int i = 0; i < 3; ++i)
+    m_buffer.push_back((char)max(0, min(255, color[i])));
+
+  if (blockSize <= (int)m_buffer.size())
+    flush(m_ofstr, m_buffer);
+}
+
+void CplyWriter::close(void) {
+  if (!m_ofstr.is_open())
+    return;
+  flush(m_ofstr, m_buffer);
+  m_ofstr.close();
+}
+
+//----------------------------------------------------------------------
+int Patch::readPLY(const std::string file, std::vector<Vec4f>& coords,
+                   std::vector<Vec4f>& normals, std::vector<Vec3i>& colors) {
+  ifstream ifstr;
+  ifstr.open(file.c_str(), ios::in | ios::binary);
+  if (!ifstr.is_open())
+    return 0;
+
+  // Only the layout written by CplyWriter is supported
+  int binary = -1;
+  int num = -1;
+  int properties = 0;
+  string line;
+  while (getline(ifstr, line)) {
+    istringstream isstr(line);
+    string key;
+    isstr >> key;
+    if (key == "format") {
+      string format;
+      isstr >> format;
+      if (format == "ascii")
+        binary = 0;
+      else if (format == "binary_little_endian")
+        binary = 1;
+    }
+    else if (key == "element") {
+      string name;
+      isstr >> name >> num;
+    }
+    else if (key == "property")
+      ++properties;
+    else if (key == "end_header")
+      break;
+  }
+  if (binary == -1 || num < 0 || properties != 9)
+    return 0;
+
+  coords.resize(num);
+  normals.resize(num);
+  colors.resize(num);
+  for (int p = 0; p < num; ++p) {
+    coords[p][3] = 1.0f;
+    normals[p][3] = 0.0f;
+    if (binary) {
+      for (int i = 0; i < 3; ++i)
+        extractBinary(ifstr, coords[p][i]);
+      for (int i = 0; i < 3; ++i)
+        extractBinary(ifstr, normals[p][i]);
+      unsigned char color[3];
+      ifstr.read((char*)color, 3);
+      colors[p] = Vec3i(color[0], color[1], color[2]);
+    }
+    else
+      ifstr >> coords[p][0] >> coords[p][1] >> coords[p][2]
+            >> normals[p][0] >> normals[p][1] >> normals[p][2]
+            >> colors[p][0] >> colors[p][1] >> colors[p][2];
+  }
+  return !ifstr.fail();
+}
@@ -0,0 +1,117 @@
+#ifndef PMVS3_PATCHIO_H
+#define PMVS3_PATCHIO_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include "patch.h"
+#include "../numeric/vec3.h"
+
+namespace Patch {
+
+// Readers and writers of .patch and .ply files.
+//
+// An ASCII .patch file is "PATCHES", the number of patches, and the
+// patches as written by operator <<. A binary .patch file starts with
+// a header of 16 bytes:
+//   char magic[8] = "PATCHESB", int version, int number of patches
+// followed by a record per patch:
+//   float coord[3], normal[3], ncc, dscale, ascale
+//   int number of images, number of visible images
+//   int images[], visible images[]
+// All the values are little endian. CpatchReader reads both formats.
+//
+// Writers collect records in a large buffer and write it out in
+// blocks, instead of one small write per value.
+
+// Binary values are stored little endian
+inline int isLittleEndian(void) {
+  const int one = 1;
+  return *(const char*)&one;
+}
+
+template<class T>
+inline void appendBinary(std::vector<char>& buffer, const T value) {
+  char bytes[sizeof(T)];
+  memcpy(bytes, &value, sizeof(T));
+  if (!isLittleEndian())
+    std::reverse(bytes, bytes + sizeof(T));
+  buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+template<class T>
+inline int extractBinary(std::istream& istr, T& value) {
+  char bytes[sizeof(T)];
+  if (!istr.read(bytes, sizeof(T)))
+    return 0;
+  if (!isLittleEndian())
+    std::reverse(bytes, bytes + sizeof(T));
+  memcpy(&value, bytes, sizeof(T));
+  return 1;
+}
+
+// A binary record of a patch. Returns 0 if the record is broken.
+void appendPatch(std::vector<char>& buffer, const Cpatch& patch);
+int extractPatch(std::istream& istr, Cpatch& patch);
+
+class CpatchWriter {
+ public:
+  CpatchWriter(void);
+  virtual ~CpatchWriter();
+
+  // Exits if the file cannot be opened
+  void open(const std::string file, const int num, const int binary);
+  void write(const Cpatch& patch);
+  void close(void);
+
+ protected:
+  std::ofstream m_ofstr;
+  int m_binary;
+  std::vector<char> m_buffer;
+};
+
+class CpatchReader {
+ public:
+  CpatchReader(void);
+  virtual ~CpatchReader();
+
+  // Returns the number of patches, or -1 if the file cannot be opened
+  int open(const std::string file);
+  // Returns 0 at the end of the file, or if the file is broken
+  int read(Cpatch& patch);
+  void close(void);
+
+ protected:
+  std::ifstream m_ifstr;
+  int m_binary;
+  int m_num;
+  int m_count;
+};
+
+// A PLY file of oriented points with colors. Binary files are
+// binary_little_endian.
+class CplyWriter {
+ public:
+  CplyWriter(void);
+  virtual ~CplyWriter();
+
+  void open(const std::string file, const int num, const int binary);
+  void write(const Vec4f& coord, const Vec4f& normal, const Vec3i& color);
+  void close(void);
+
+ protected:
+  std::ofstream m_ofstr;
+  int m_binary;
+  std::vector<char> m_buffer;
+};
+
+// Read the points of a PLY file written by CplyWriter (ASCII or
+// binary). Returns 0 on failure.
+int readPLY(const std::string file, std::vector<Vec4f>& coords,
+            std::vector<Vec4f>& normals, std::vector<Vec3i>& colors);
+
+};
+
+#endif // PMVS3_PATCHIO_H
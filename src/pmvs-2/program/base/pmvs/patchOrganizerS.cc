@@ -1,13 +1,14 @@
 #include <string>
 #include "patchOrganizerS.h"
 #include "findMatch.h"
+#include "patchIO.h"
 
 using namespace PMVS3;
 using namespace Patch;
 using namespace std;
 
-Ppatch CpatchOrganizerS::m_MAXDEPTH(new Cpatch());
-Ppatch CpatchOrganizerS::m_BACKGROUND(new Cpatch());
+Ppatch CpatchOrganizerS::m_MAXDEPTH(-2);
+Ppatch CpatchOrganizerS::m_BACKGROUND(-3);
 
 CpatchOrganizerS::CpatchOrganizerS(CfindMatch& findMatch) : m_fm(findMatch) {
 }
@@ -85,17 +86,14 @@ void CpatchOrganizerS::writePatches(void) {
     char buffer[1024];
     sprintf(buffer, "%smodels/%08d.patc%d", m_fm.m_prefix.c_str(), image, m_fm.m_level);
     
-    ofstream ofstr;
-    ofstr.open(buffer);
-    ofstr << "PATCHES" << endl
-          << (int)ppatches.size() << endl;
-
+    CpatchWriter writer;
+    writer.open(buffer, (int)ppatches.size(), m_fm.m_binary);
     for (int p = 0; p < (int)ppatches.size(); ++p) {
       Cpatch patch = *ppatches[p];
       index2image(patch);
-      ofstr << patch << endl;
+      writer.write(patch);
     }
-    ofstr.close();
+    writer.close();
     
     sprintf(buffer, "%smodels/%08d-%d.ply", m_fm.m_prefix.c_str(), image, m_fm.m_level);
     writePLY(ppatches, buffer);
@@ -119,13 +117,15 @@ void CpatchOrganizerS::writePatches2(const std::string prefix) {
   {
     char buffer[1024];
     sprintf(buffer, "%s.patch", prefix.c_str());
-    ofstream ofstr;
-    ofstr.open(buffer);
-    ofstr << "PATCHES" << endl
-          << (int)m_ppatches.size() << endl;
-    for (int p = 0; p < (int)m_ppatches.size(); ++p)
-      ofstr << *m_ppatches[p] << endl;
-    ofstr.close();
+    CpatchWriter writer;
+    writer.open(buffer, (int)m_ppatches.size(), m_fm.m_binary);
+    // Image ids, so that the outputs of clusters can be merged
+    for (int p = 0; p < (int)m_ppatches.size(); ++p) {
+      Cpatch patch = *m_ppatches[p];
+      index2image(patch);
+      writer.write(patch);
+    }
+    writer.close();
   }
 
   {
@@ -151,38 +151,37 @@ void CpatchOrganizerS::readPatches(void) {
     char buffer[1024];
     sprintf(buffer, "%smodels/%08d.patc%d",
             m_fm.m_prefix.c_str(), image, m_fm.m_level);
-    ifstream ifstr;
-    ifstr.open(buffer);
-    if (!ifstr.is_open())
+    CpatchReader reader;
+    const int pnum = reader.open(buffer);
+    if (pnum == -1)
       continue;
 
-    string header;    int pnum;
-    ifstr >> header >> pnum;
     cerr << image << ' ' << pnum << " patches" << endl;
     for (int p = 0; p < pnum; ++p) {
-      Ppatch ppatch(new Cpatch());
-      ifstr >> *ppatch;
-      ppatch->m_fix = 0;
-      ppatch->m_vimages.clear();
-
-      image2index(*ppatch);
-      if (ppatch->m_images.empty())
+      Cpatch patch;
+      if (reader.read(patch) == 0)
+        break;
+      patch.m_fix = 0;
+      patch.m_vimages.clear();
+
+      image2index(patch);
+      if (patch.m_images.empty())
         continue;
       
       // m_vimages must be targetting images
 #ifdef DEBUG
-      for (int j = 0; j < (int)ppatch->m_vimages.size(); ++j)
-        if (m_fm.m_tnum <= ppatch->m_vimages[j]) {
+      for (int j = 0; j < (int)patch.m_vimages.size(); ++j)
+        if (m_fm.m_tnum <= patch.m_vimages[j]) {
           cerr << "Impossible in readPatches. m_vimages must be targetting images" << endl
                << "for patches stored in targetting images, if visdata2 have been consistent" << endl;
           exit (1);
         }
 #endif
-      setGrids(*ppatch);
+      setGrids(patch);
+      Ppatch ppatch = Ppatch::create(patch);
       addPatch(ppatch);
     }
-    
-    ifstr.close();
+    reader.close();
   }
 
   // For patches in non-targetting images
@@ -190,33 +189,76 @@ void CpatchOrganizerS::readPatches(void) {
     const int image = m_fm.m_images[i];
     char buffer[1024];
     sprintf(buffer, "%smodels/%08d.patc%d", m_fm.m_prefix.c_str(), image, m_fm.m_level);
-    ifstream ifstr;
-    ifstr.open(buffer);
-    if (!ifstr.is_open())
+    CpatchReader reader;
+    const int pnum = reader.open(buffer);
+    if (pnum == -1)
       continue;
     
-    string header;    int pnum;
-    ifstr >> header >> pnum;
     cerr << image << ' ' << pnum << " patches" << endl;
-    
     for (int p = 0; p < pnum; ++p) {
-      Ppatch ppatch(new Cpatch());
-      ifstr >> *ppatch;      
-      ppatch->m_fix = 1;
-      ppatch->m_vimages.clear();
+      Cpatch patch;
+      if (reader.read(patch) == 0)
+        break;
+      patch.m_fix = 1;
+      patch.m_vimages.clear();
       
-      image2index(*ppatch);
-      if (ppatch->m_images.empty())
+      image2index(patch);
+      if (patch.m_images.empty())
         continue;
       
-      setGrids(*ppatch);
+      setGrids(patch);
+      Ppatch ppatch = Ppatch::create(patch);
       addPatch(ppatch);
     }
-    
-    ifstr.close();
+    reader.close();
   }
 }
 
+// m_images and m_vimages are stored as indexes. Grids are recomputed
+// when reading.
+void CpatchOrganizerS::writeCheckpoint(std::vector<char>& buffer) {
+  collectPatches();
+  appendBinary(buffer, (int)m_ppatches.size());
+  for (int p = 0; p < (int)m_ppatches.size(); ++p) {
+    const Cpatch& patch = *m_ppatches[p];
+    appendPatch(buffer, patch);
+    appendBinary(buffer, patch.m_timages);
+    appendBinary(buffer, patch.m_tmp);
+    appendBinary(buffer, patch.m_dflag);
+    appendBinary(buffer, patch.m_fix);
+  }
+}
+
+int CpatchOrganizerS::readCheckpoint(std::istream& istr) {
+  int pnum;
+  if (!extractBinary(istr, pnum))
+    return 0;
+
+  for (int p = 0; p < pnum; ++p) {
+    Cpatch patch;
+    if (!extractPatch(istr, patch))
+      return 0;
+    extractBinary(istr, patch.m_timages);
+    extractBinary(istr, patch.m_tmp);
+    extractBinary(istr, patch.m_dflag);
+    extractBinary(istr, patch.m_fix);
+    if (!istr)
+      return 0;
+
+    setGrids(patch);
+    for (int i = 0; i < (int)patch.m_vimages.size(); ++i) {
+      const int image = patch.m_vimages[i];
+      const Vec3f icoord =
+        m_fm.m_pss.project(image, patch.m_coord, m_fm.m_level);
+      patch.m_vgrids.push_back(TVec2<int>(((int)floor(icoord[0] + 0.5f)) / m_fm.m_csize,
+                                          ((int)floor(icoord[1] + 0.5f)) / m_fm.m_csize));
+    }
+    Ppatch ppatch = Ppatch::create(patch);
+    addPatch(ppatch);
+  }
+  return 1;
+}
+
 void CpatchOrganizerS::collectPatches(const int target) {
   m_ppatches.clear();
 
@@ -247,16 +289,14 @@ void CpatchOrganizerS::collectPatches(const int target) {
   }
 }
 
-void CpatchOrganizerS::collectPatches(std::priority_queue<Patch::Ppatch,
-                                      std::vector<Patch::Ppatch>,
-                                      P_compare>& pqpatches) {
+void CpatchOrganizerS::collectPatches(std::vector<Patch::Ppatch>& ppatches) {
   for (int index = 0; index < m_fm.m_tnum; ++index) {
     for (int i = 0; i < (int)m_pgrids[index].size(); ++i) {
       vector<Ppatch>::iterator begin = m_pgrids[index][i].begin();
       while (begin != m_pgrids[index][i].end()) {
         if ((*begin)->m_flag == 0) {
           (*begin)->m_flag = 1;
-          pqpatches.push(*begin);
+          ppatches.push_back(*begin);
         }
         ++begin;
       }
@@ -503,6 +543,15 @@ void CpatchOrganizerS::removePatch(const Ppatch& ppatch) {
                                          ppatch),
                                   m_vpgrids[image][index].end());
   }
+
+  // m_ppatches and m_dpgrids may still refer to the patch
+  m_removed.push_back(ppatch);
+}
+
+void CpatchOrganizerS::releasePatches(void) {
+  for (int p = 0; p < (int)m_removed.size(); ++p)
+    m_removed[p].release();
+  m_removed.clear();
 }
 
 int CpatchOrganizerS::isVisible0(const Cpatch& patch, const int image,
@@ -720,21 +769,8 @@ void CpatchOrganizerS::setScales(Patch::Cpatch& patch) const {
 // write out results
 void CpatchOrganizerS::writePLY(const std::vector<Ppatch>& patches,
                                 const std::string filename) {
-  ofstream ofstr;
-  ofstr.open(filename.c_str());
-  ofstr << "ply" << endl
-       << "format ascii 1.0" << endl
-       << "element vertex " << (int)patches.size() << endl
-       << "property float x" << endl
-       << "property float y" << endl
-       << "property float z" << endl
-       << "property float nx" << endl
-       << "property float ny" << endl
-       << "property float nz" << endl
-       << "property uchar diffuse_red" << endl
-       << "property uchar diffuse_green" << endl
-       << "property uchar diffuse_blue" << endl
-       << "end_header" << endl;
+  CplyWriter writer;
+  writer.open(filename, (int)patches.size(), m_fm.m_binary);
 
   vector<Ppatch>::const_iterator bpatch = patches.begin();
   vector<Ppatch>::const_iterator bend = patches.end();
@@ -795,51 +831,26 @@ void CpatchOrganizerS::writePLY(const std::vector<Ppatch>& patches,
       color[2] = (int)(b * 255.0f);
     }
     
-    ofstr << (*bpatch)->m_coord[0] << ' '
-          << (*bpatch)->m_coord[1] << ' '
-          << (*bpatch)->m_coord[2] << ' '
-          << (*bpatch)->m_normal[0] << ' '
-          << (*bpatch)->m_normal[1] << ' '
-          << (*bpatch)->m_normal[2] << ' '
-          << color[0] << ' ' << color[1] << ' ' << color[2] << endl;
-      ++bpatch;
-  }
-  ofstr.close();  
+    writer.write((*bpatch)->m_coord, (*bpatch)->m_normal, color);
+    ++bpatch;
+  }
+  writer.close();
 }
 
 void CpatchOrganizerS::writePLY(const std::vector<Ppatch>& patches,
                                 const std::string filename,
                                 const std::vector<Vec3i>& colors) {
-  ofstream ofstr;
-  ofstr.open(filename.c_str());
-  ofstr << "ply" << endl
-       << "format ascii 1.0" << endl
-       << "element vertex " << (int)patches.size() << endl
-       << "property float x" << endl
-       << "property float y" << endl
-       << "property float z" << endl
-       << "property float nx" << endl
-       << "property float ny" << endl
-       << "property float nz" << endl
-       << "property uchar diffuse_red" << endl
-       << "property uchar diffuse_green" << endl
-       << "property uchar diffuse_blue" << endl
-       << "end_header" << endl;
+  CplyWriter writer;
+  writer.open(filename, (int)patches.size(), m_fm.m_binary);
 
   vector<Ppatch>::const_iterator bpatch = patches.begin();
   vector<Ppatch>::const_iterator bend = patches.end();
   vector<Vec3i>::const_iterator colorb = colors.begin();
   
   while (bpatch != bend) {
-    ofstr << (*bpatch)->m_coord[0] << ' '
-          << (*bpatch)->m_coord[1] << ' '
-          << (*bpatch)->m_coord[2] << ' '
-          << (*bpatch)->m_normal[0] << ' '
-          << (*bpatch)->m_normal[1] << ' '
-          << (*bpatch)->m_normal[2] << ' '
-          << *colorb << endl;
+    writer.write((*bpatch)->m_coord, (*bpatch)->m_normal, *colorb);
     ++bpatch;
     ++colorb;
   }
-  ofstr.close();  
+  writer.close();
 }
@@ -21,8 +21,8 @@ class CpatchOrganizerS {
 
   void init(void);
   void collectPatches(const int target = 0);
-  void collectPatches(std::priority_queue<Patch::Ppatch, std::vector<Patch::Ppatch>,
-                      P_compare>& pqpatches);
+  // Collect patches not yet flagged, and flag them
+  void collectPatches(std::vector<Patch::Ppatch>& ppatches);
   
   void collectPatches(const int index,
                       std::priority_queue<Patch::Ppatch, std::vector<Patch::Ppatch>,
@@ -39,6 +39,12 @@ class CpatchOrganizerS {
                 const std::vector<Vec3i>& colors);
   
   void readPatches(void);
+
+  // Append all the patches, with the state expansion needs, to a
+  // checkpoint
+  void writeCheckpoint(std::vector<char>& buffer);
+  // Add the patches of a checkpoint. Returns 0 if it is broken.
+  int readCheckpoint(std::istream& istr);
   
   void clearCounts(void);
   void clearFlags(void);
@@ -46,7 +52,12 @@ class CpatchOrganizerS {
   void setGridsImages(Patch::Cpatch& patch,
                       const std::vector<int>& images) const;
   void addPatch(Patch::Ppatch& ppatch);
+  // Take a patch out of the grids. The patch is released by the
+  // next releasePatches.
   void removePatch(const Patch::Ppatch& ppatch);
+  // Return removed patches to the pool. Must be called only when
+  // m_ppatches and m_dpgrids no longer refer to them.
+  void releasePatches(void);
   void setGrids(Patch::Ppatch& ppatch) const;
   void setGrids(Patch::Cpatch& patch) const;
   void setVImagesVGrids(Patch::Ppatch& ppatch);
@@ -98,6 +109,9 @@ class CpatchOrganizerS {
   static Patch::Ppatch m_BACKGROUND;
   
  protected:
+  // Patches removed since the last releasePatches
+  std::vector<Patch::Ppatch> m_removed;
+
   CfindMatch& m_fm;
 };
 };
@@ -51,12 +51,17 @@ void Cseed::run(void) {
   fill(m_fcounts1.begin(), m_fcounts1.end(), 0);
   fill(m_pcounts.begin(), m_pcounts.end(), 0);
   
-  vector<int> vitmp;
-  for (int i = 0; i < m_fm.m_tnum; ++i)
-    vitmp.push_back(i);
+  m_order.clear();
+  vector<int> ranks;
+  for (int i = 0; i < m_fm.m_tnum; ++i) {
+    m_order.push_back(i);
+    ranks.push_back(i);
+  }
 
-  random_shuffle(vitmp.begin(), vitmp.end());
-  m_fm.m_jobs.insert(m_fm.m_jobs.end(), vitmp.begin(), vitmp.end());
+  random_shuffle(m_order.begin(), m_order.end());
+  // One image is already a large task
+  m_pool.m_batch = 1;
+  m_pool.init(m_fm.m_CPU, ranks);
 
   cerr << "adding seeds " << endl;
   
@@ -82,6 +87,7 @@ void Cseed::run(void) {
   cerr << "done" << endl;
   
   cerr << "---- Initial: " << tv.tv_sec - curtime << " secs ----" << endl;
+  m_pool.printStats(cerr);
 
   const int trial = accumulate(m_scounts.begin(), m_scounts.end(), 0);
   const int fail0 = accumulate(m_fcounts0.begin(), m_fcounts0.end(), 0);
@@ -103,18 +109,10 @@ void Cseed::initialMatchThread(void) {
   const int id = m_fm.m_count++;
   pthread_rwlock_unlock(&m_fm.m_lock);
 
-  while (1) {
-    int index = -1;
-    pthread_rwlock_wrlock(&m_fm.m_lock);
-    if (!m_fm.m_jobs.empty()) {
-      index = m_fm.m_jobs.front();
-      m_fm.m_jobs.pop_front();
-    }
-    pthread_rwlock_unlock(&m_fm.m_lock);
-    if (index == -1)
-      break;
-
-    initialMatch(index, id);
+  int rank;
+  while (m_pool.pop(id, rank)) {
+    initialMatch(m_order[rank], id);
+    m_pool.done(id);
   }
 }
 
@@ -190,7 +188,7 @@ void Cseed::initialMatch(const int index, const int id) {
 	  }
       	}
 	if (count != 0) {
-	  Ppatch ppatch(new Cpatch(bestpatch));
+	  Ppatch ppatch = Ppatch::create(bestpatch);
 	  m_fm.m_pos.addPatch(ppatch);
 	  ++totalcount;
           break;
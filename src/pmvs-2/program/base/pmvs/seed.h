@@ -3,8 +3,10 @@
 
 #include <boost/shared_ptr.hpp>
 #include <vector>
+#include <functional>
 #include "patch.h"
 #include "point.h"
+#include "taskPool.h"
 
 #include <pthread.h>
 
@@ -50,6 +52,11 @@ class Cseed {
   void initialMatchThread(void);
   static void* initialMatchThreadTmp(void* arg);
 
+  // Images in the (shuffled) order they are processed
+  std::vector<int> m_order;
+  // Ranks in m_order, lowest first
+  CtaskPool<int, std::greater<int> > m_pool;
+
   // Number of trials
   std::vector<int> m_scounts;
   // Number of failures in the prep
@@ -0,0 +1,250 @@
+#ifndef PMVS3_TASKPOOL_H
+#define PMVS3_TASKPOOL_H
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <pthread.h>
+#include <sys/time.h>
+
+namespace PMVS3 {
+
+//----------------------------------------------------------------------
+// Work-stealing task pool shared by the seed, expansion and filtering
+// threads. Every thread owns a heap of tasks ordered by Compare (the
+// same convention as std::priority_queue: the largest task comes
+// first), guarded by its own mutex. A thread pops its own best task;
+// when its heap is empty it steals a batch of the best tasks of
+// another thread. Tasks may be pushed while the pool runs (expansion
+// does this), so a thread only leaves once no task is queued or
+// running anywhere.
+//
+// Usage:
+//   pool.init(numThreads, tasks);   // before starting the threads
+//   while (pool.pop(id, task)) {    // in thread id
+//     ... pool.push(id, newTask) ...
+//     pool.done(id);
+//   }
+//   pool.printStats(std::cerr);     // after joining the threads
+//----------------------------------------------------------------------
+template<class T, class Compare>
+class CtaskPool {
+ public:
+  CtaskPool(void) : m_batch(16), m_queued(0), m_outstanding(0), m_sleepers(0) {
+    pthread_mutex_init(&m_waitLock, NULL);
+    pthread_cond_init(&m_waitCond, NULL);
+  }
+
+  ~CtaskPool() {
+    clear();
+    pthread_mutex_destroy(&m_waitLock);
+    pthread_cond_destroy(&m_waitCond);
+  }
+
+  // Set up numThreads workers and deal out the initial tasks. Tasks
+  // are sorted best first and handed out in batches of at most
+  // m_batch, round robin, so that every thread starts on high
+  // priority work.
+  void init(const int numThreads, std::vector<T>& tasks) {
+    clear();
+    m_workers.resize(numThreads);
+    for (int i = 0; i < numThreads; ++i) {
+      m_workers[i] = new Sworker;
+      pthread_mutex_init(&m_workers[i]->m_lock, NULL);
+    }
+
+    std::sort(tasks.begin(), tasks.end(), Better(m_compare));
+    const int size = (int)tasks.size();
+    const int batch =
+      std::max(1, std::min(m_batch, (size + numThreads - 1) / numThreads));
+    for (int t = 0; t < size; ++t) {
+      const int id = (t / batch) % numThreads;
+      m_workers[id]->m_heap.push_back(tasks[t]);
+    }
+    for (int i = 0; i < numThreads; ++i)
+      std::make_heap(m_workers[i]->m_heap.begin(), m_workers[i]->m_heap.end(),
+                     m_compare);
+
+    m_queued = size;
+    m_outstanding = size;
+    m_sleepers = 0;
+  }
+
+  // Add a task from thread id
+  void push(const int id, const T& task) {
+    Sworker& worker = *m_workers[id];
+    __sync_fetch_and_add(&m_outstanding, 1);
+    pthread_mutex_lock(&worker.m_lock);
+    worker.m_heap.push_back(task);
+    std::push_heap(worker.m_heap.begin(), worker.m_heap.end(), m_compare);
+    pthread_mutex_unlock(&worker.m_lock);
+    __sync_fetch_and_add(&m_queued, 1);
+
+    if (load(m_sleepers)) {
+      pthread_mutex_lock(&m_waitLock);
+      pthread_cond_broadcast(&m_waitCond);
+      pthread_mutex_unlock(&m_waitLock);
+    }
+  }
+
+  // Get the next task for thread id. Returns 0 when all the work is
+  // done. Every task obtained must be followed by a call to done().
+  int pop(const int id, T& task) {
+    if (popOwn(id, task))
+      return 1;
+
+    Sworker& worker = *m_workers[id];
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    int found = 0;
+    while (1) {
+      if (popOwn(id, task) || steal(id, task)) {
+        found = 1;
+        break;
+      }
+      if (load(m_outstanding) == 0)
+        break;
+
+      // Nothing to steal, but tasks are still running and may create
+      // more work. Sleep until a task is pushed or all are done.
+      pthread_mutex_lock(&m_waitLock);
+      __sync_fetch_and_add(&m_sleepers, 1);
+      while (load(m_queued) == 0 && load(m_outstanding) != 0)
+        pthread_cond_wait(&m_waitCond, &m_waitLock);
+      __sync_fetch_and_sub(&m_sleepers, 1);
+      pthread_mutex_unlock(&m_waitLock);
+    }
+    gettimeofday(&end, NULL);
+    worker.m_idle += (end.tv_sec - start.tv_sec) +
+      (end.tv_usec - start.tv_usec) / 1000000.0;
+    return found;
+  }
+
+  // Mark a task obtained by pop() as finished
+  void done(const int id) {
+    ++m_workers[id]->m_executed;
+    if (__sync_sub_and_fetch(&m_outstanding, 1) == 0) {
+      pthread_mutex_lock(&m_waitLock);
+      pthread_cond_broadcast(&m_waitCond);
+      pthread_mutex_unlock(&m_waitLock);
+    }
+  }
+
+  void printStats(std::ostream& ostr) const {
+    ostr << "Tasks per thread (executed stolen steals idle-secs):" << std::endl;
+    for (int i = 0; i < (int)m_workers.size(); ++i) {
+      const Sworker& worker = *m_workers[i];
+      ostr << "  " << i << ": " << worker.m_executed << ' '
+           << worker.m_stolen << ' ' << worker.m_steals << ' '
+           << std::setprecision(3) << worker.m_idle << std::endl;
+    }
+  }
+
+  void clear(void) {
+    for (int i = 0; i < (int)m_workers.size(); ++i) {
+      pthread_mutex_destroy(&m_workers[i]->m_lock);
+      delete m_workers[i];
+    }
+    m_workers.clear();
+  }
+
+  // Maximum number of tasks in an initial batch or a steal
+  int m_batch;
+
+ protected:
+  // Allocated separately, so that workers do not share cache lines
+  struct Sworker {
+    Sworker(void) : m_executed(0), m_stolen(0), m_steals(0), m_idle(0.0) {}
+    pthread_mutex_t m_lock;
+    std::vector<T> m_heap;
+    // statistics
+    int m_executed;
+    int m_stolen;
+    int m_steals;
+    double m_idle;
+    char m_pad[64];
+  };
+
+  // Orders tasks best first
+  class Better {
+  public:
+    Better(const Compare& compare) : m_compare(compare) {}
+    bool operator()(const T& lhs, const T& rhs) const {
+      return m_compare(rhs, lhs);
+    }
+    Compare m_compare;
+  };
+
+  static int load(volatile int& value) {
+    return __sync_fetch_and_add(&value, 0);
+  }
+
+  int popOwn(const int id, T& task) {
+    Sworker& worker = *m_workers[id];
+    int found = 0;
+    pthread_mutex_lock(&worker.m_lock);
+    if (!worker.m_heap.empty()) {
+      std::pop_heap(worker.m_heap.begin(), worker.m_heap.end(), m_compare);
+      task = worker.m_heap.back();
+      worker.m_heap.pop_back();
+      found = 1;
+    }
+    pthread_mutex_unlock(&worker.m_lock);
+    if (found)
+      __sync_fetch_and_sub(&m_queued, 1);
+    return found;
+  }
+
+  // Take the best half (at most m_batch) of another thread's tasks.
+  // Only one heap is locked at a time.
+  int steal(const int id, T& task) {
+    const int num = (int)m_workers.size();
+    std::vector<T> batch;
+    for (int i = 1; i < num && batch.empty(); ++i) {
+      Sworker& victim = *m_workers[(id + i) % num];
+      pthread_mutex_lock(&victim.m_lock);
+      const int size = (int)victim.m_heap.size();
+      const int count = std::min(m_batch, std::max(1, size / 2));
+      for (int c = 0; c < count && !victim.m_heap.empty(); ++c) {
+        std::pop_heap(victim.m_heap.begin(), victim.m_heap.end(), m_compare);
+        batch.push_back(victim.m_heap.back());
+        victim.m_heap.pop_back();
+      }
+      pthread_mutex_unlock(&victim.m_lock);
+    }
+    if (batch.empty())
+      return 0;
+
+    Sworker& worker = *m_workers[id];
+    ++worker.m_steals;
+    worker.m_stolen += (int)batch.size();
+
+    // Keep the best task, queue the rest locally
+    task = batch[0];
+    pthread_mutex_lock(&worker.m_lock);
+    for (int c = 1; c < (int)batch.size(); ++c) {
+      worker.m_heap.push_back(batch[c]);
+      std::push_heap(worker.m_heap.begin(), worker.m_heap.end(), m_compare);
+    }
+    pthread_mutex_unlock(&worker.m_lock);
+    __sync_fetch_and_sub(&m_queued, 1);
+    return 1;
+  }
+
+  Compare m_compare;
+  std::vector<Sworker*> m_workers;
+
+  // Tasks sitting in the heaps
+  volatile int m_queued;
+  // Tasks queued or running
+  volatile int m_outstanding;
+  // Threads waiting for work
+  volatile int m_sleepers;
+  pthread_mutex_t m_waitLock;
+  pthread_cond_t m_waitCond;
+};
+
+};
+
+#endif // PMVS3_TASKPOOL_H
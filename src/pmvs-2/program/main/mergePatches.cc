@@ -0,0 +1,223 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "../base/pmvs/patch.h"
+#include "../base/pmvs/option.h"
+#include "../base/pmvs/patchIO.h"
+
+using namespace PMVS3;
+using namespace Patch;
+using namespace std;
+
+// Merge the patches reconstructed for clusters of images (see
+// Bundle2PMVS). Every cluster owns its target images; a patch is kept
+// only from the cluster that owns its reference image. Near the
+// borders, two clusters may still reconstruct the same surface from
+// different reference images, so patches of different clusters that
+// lie within a grid cell of each other with similar normals are
+// merged, keeping the most photo-consistent one.
+
+struct Smerged {
+  Cpatch m_patch;
+  Vec3i m_color;
+  int m_cluster;
+  // Distance under which two patches are the same
+  float m_radius;
+};
+
+struct Sbetter {
+  Sbetter(const vector<Smerged>& patches) : m_patches(patches) {}
+  bool operator()(const int lhs, const int rhs) const {
+    return m_patches[rhs].m_patch.m_ncc < m_patches[lhs].m_patch.m_ncc;
+  }
+  const vector<Smerged>& m_patches;
+};
+
+static void readCluster(const string prefix, const string option,
+                        const int cluster, const map<int, int>& owners,
+                        const int csize, vector<Smerged>& patches) {
+  char buffer[1024];
+  sprintf(buffer, "%smodels/%s.patch", prefix.c_str(), option.c_str());
+  CpatchReader reader;
+  const int num = reader.open(buffer);
+  if (num == -1) {
+    cerr << "Cannot open " << buffer << endl;
+    exit (1);
+  }
+
+  sprintf(buffer, "%smodels/%s.ply", prefix.c_str(), option.c_str());
+  vector<Vec4f> coords, normals;
+  vector<Vec3i> colors;
+  if (!readPLY(buffer, coords, normals, colors) ||
+      (int)colors.size() != num) {
+    cerr << "Cannot read colors from " << buffer << endl;
+    exit (1);
+  }
+
+  int kept = 0;
+  for (int p = 0; p < num; ++p) {
+    Smerged merged;
+    if (reader.read(merged.m_patch) == 0) {
+      cerr << "Broken patch file for " << option << endl;
+      exit (1);
+    }
+    if (merged.m_patch.m_images.empty())
+      continue;
+    map<int, int>::const_iterator owner =
+      owners.find(merged.m_patch.m_images[0]);
+    if (owner == owners.end() || owner->second != cluster)
+      continue;
+
+    merged.m_color = colors[p];
+    merged.m_cluster = cluster;
+    merged.m_radius = csize * merged.m_patch.m_dscale;
+    patches.push_back(merged);
+    ++kept;
+  }
+  reader.close();
+  cerr << option << ": " << kept << " of " << num << " patches" << endl;
+}
+
+static long long cellKey(const int x, const int y, const int z) {
+  const long long mask = (1 << 21) - 1;
+  return ((x & mask) << 42) | ((y & mask) << 21) | (z & mask);
+}
+
+// Drop patches that duplicate a better patch of another cluster
+static void removeDuplicates(vector<Smerged>& patches) {
+  if (patches.empty())
+    return;
+
+  vector<float> radii;
+  for (int p = 0; p < (int)patches.size(); ++p)
+    radii.push_back(patches[p].m_radius);
+  nth_element(radii.begin(), radii.begin() + radii.size() / 2, radii.end());
+  const float unit = max(radii[radii.size() / 2], 1.0e-10f);
+
+  vector<int> order;
+  for (int p = 0; p < (int)patches.size(); ++p)
+    order.push_back(p);
+  sort(order.begin(), order.end(), Sbetter(patches));
+
+  map<long long, vector<int> > grid;
+  vector<int> keep(patches.size(), 0);
+  for (int i = 0; i < (int)order.size(); ++i) {
+    const Smerged& merged = patches[order[i]];
+    const Vec4f& coord = merged.m_patch.m_coord;
+    int cell[3];
+    for (int j = 0; j < 3; ++j)
+      cell[j] = (int)floor(coord[j] / unit);
+    const int margin = (int)ceil(merged.m_radius / unit);
+
+    int duplicate = 0;
+    for (int z = cell[2] - margin; z <= cell[2] + margin && !duplicate; ++z)
+      for (int y = cell[1] - margin; y <= cell[1] + margin && !duplicate; ++y)
+        for (int x = cell[0] - margin; x <= cell[0] + margin && !duplicate; ++x) {
+          map<long long, vector<int> >::const_iterator ite =
+            grid.find(cellKey(x, y, z));
+          if (ite == grid.end())
+            continue;
+          for (int k = 0; k < (int)ite->second.size(); ++k) {
+            const Smerged& other = patches[ite->second[k]];
+            if (other.m_cluster == merged.m_cluster)
+              continue;
+            Vec4f diff = other.m_patch.m_coord - coord;
+            diff[3] = 0.0f;
+            const float radius = max(merged.m_radius, other.m_radius);
+            if (norm(diff) < radius &&
+                0.5f < other.m_patch.m_normal * merged.m_patch.m_normal) {
+              duplicate = 1;
+              break;
+            }
+          }
+        }
+
+    if (duplicate)
+      continue;
+    keep[order[i]] = 1;
+    grid[cellKey(cell[0], cell[1], cell[2])].push_back(order[i]);
+  }
+
+  vector<Smerged> kept;
+  for (int p = 0; p < (int)patches.size(); ++p)
+    if (keep[p])
+      kept.push_back(patches[p]);
+  cerr << "Duplicates across clusters: "
+       << (int)patches.size() - (int)kept.size() << endl;
+  patches.swap(kept);
+}
+
+static void writePatches(const string prefix, const string output,
+                         const vector<Smerged>& patches, const int binary) {
+  char buffer[1024];
+  sprintf(buffer, "%smodels/%s.patch", prefix.c_str(), output.c_str());
+  CpatchWriter writer;
+  writer.open(buffer, (int)patches.size(), binary);
+  for (int p = 0; p < (int)patches.size(); ++p)
+    writer.write(patches[p].m_patch);
+  writer.close();
+
+  sprintf(buffer, "%smodels/%s.ply", prefix.c_str(), output.c_str());
+  CplyWriter plyWriter;
+  plyWriter.open(buffer, (int)patches.size(), binary);
+  for (int p = 0; p < (int)patches.size(); ++p)
+    plyWriter.write(patches[p].m_patch.m_coord, patches[p].m_patch.m_normal,
+                    patches[p].m_color);
+  plyWriter.close();
+
+  sprintf(buffer, "%smodels/%s.pset", prefix.c_str(), output.c_str());
+  ofstream ofstr;
+  ofstr.open(buffer);
+  for (int p = 0; p < (int)patches.size(); ++p) {
+    const Cpatch& patch = patches[p].m_patch;
+    ofstr << patch.m_coord[0] << ' ' << patch.m_coord[1] << ' '
+          << patch.m_coord[2] << ' ' << patch.m_normal[0] << ' '
+          << patch.m_normal[1] << ' ' << patch.m_normal[2] << endl;
+  }
+  ofstr.close();
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 4) {
+    cerr << "Usage: " << argv[0] << " prefix output option_file..." << endl
+         << "Merges models/<option_file>.patch (and .ply) of clusters" << endl
+         << "into models/<output>.patch, .ply and .pset" << endl
+         << "(binary if the option files say binary 1)" << endl;
+    exit (1);
+  }
+  const string prefix = argv[1];
+  const string output = argv[2];
+
+  // A target image belongs to the first cluster that lists it
+  vector<string> options;
+  vector<int> csizes;
+  // Binary output if any cluster wrote binary files
+  int binary = 0;
+  map<int, int> owners;
+  for (int i = 3; i < argc; ++i) {
+    Soption option;
+    option.init(prefix, argv[i]);
+    const int cluster = (int)options.size();
+    for (int t = 0; t < (int)option.m_timages.size(); ++t)
+      if (owners.find(option.m_timages[t]) == owners.end())
+        owners[option.m_timages[t]] = cluster;
+    options.push_back(argv[i]);
+    csizes.push_back(option.m_csize);
+    binary = max(binary, option.m_binary);
+  }
+
+  vector<Smerged> patches;
+  for (int c = 0; c < (int)options.size(); ++c)
+    readCluster(prefix, options[c], c, owners, csizes[c], patches);
+
+  removeDuplicates(patches);
+  writePatches(prefix, output, patches, binary);
+  cerr << (int)patches.size() << " patches in " << prefix << "models/"
+       << output << ".patch" << endl;
+}
@@ -8,7 +8,7 @@ using namespace std;
 
 int main(int argc, char* argv[]) {
   if (argc < 3) {
-    cerr << "Usage: " << argv[0] << " prefix option_file" << endl
+    cerr << "Usage: " << argv[0] << " prefix option_file [--resume]" << endl
          << endl
          << "--------------------------------------------------" << endl
          << "level       1    csize    2" << endl
@@ -16,6 +16,10 @@ int main(int argc, char* argv[]) {
          << "minImageNum 3    CPU      4" << endl
          << "useVisData  0    sequence -1" << endl
          << "quad        2.5  maxAngle 10.0" << endl
+         << "tileCache   0 (MB of memory for images, 0: all in memory)" << endl
+         << "binary      0 (1: binary .patch and .ply output)" << endl
+         << "mergeGroups 0 (1: group patches for the small group filter" << endl
+         << "               with a union-find of all neighbors)" << endl
          << "--------------------------------------------------" << endl
          << "2 ways to specify targetting images" << endl
          << "timages  5  1 3 5 7 9 (enumeration)" << endl
@@ -23,18 +27,27 @@ int main(int argc, char* argv[]) {
          << "--------------------------------------------------" << endl
          << "4 ways to specify other images" << endl
          << "oimages  5  0 2 4 6 8 (enumeration)" << endl
-         << "        -1  24 48 (range specification)" << endl;
+         << "        -1  24 48 (range specification)" << endl
+         << "--------------------------------------------------" << endl
+         << "--resume restarts from prefix/models/option_file.ckpt," << endl
+         << "saved after every phase of an interrupted run" << endl;
     exit (1);
   }
   
   PMVS3::Soption option;
   option.init(argv[1], argv[2]);  
   
+  // Continue an interrupted run from its checkpoint
+  const int resume = 4 <= argc && string(argv[3]) == "--resume";
+  
   PMVS3::CfindMatch findMatch;
   findMatch.init(option);
-  findMatch.run();
-  
+
   char buffer[1024];
   sprintf(buffer, "%smodels/%s", argv[1], argv[2]);
+  const string checkpoint = string(buffer) + ".ckpt";
+  findMatch.run(checkpoint, resume);
+  
   findMatch.write(buffer);
+  remove(checkpoint.c_str());
 }